@@ -0,0 +1,92 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * inetd::CoarseClock
+ * windows inetd service.
+ *
+ * Copyright (c) 2020 - 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <time.h>
+#include <atomic>
+
+namespace inetd {
+
+/*
+ *  Low cost clocks for the admission path.
+ *
+ *  The tick count is read from the shared user-data page; no system call, resolution
+ *  is that of the system timer (10-16ms), which is ample for second granularity limits.
+ */
+struct CoarseClock {
+	// Monotonic seconds, arbitrary epoch.
+	static time_t seconds()
+	{
+#if defined(_WIN32)
+		return (time_t)(::GetTickCount64() / 1000);
+#else
+		struct timespec ts;
+		(void) clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		return ts.tv_sec;
+#endif
+	}
+
+	// Monotonic milliseconds, arbitrary epoch.
+	static unsigned long long milliseconds()
+	{
+#if defined(_WIN32)
+		return ::GetTickCount64();
+#else
+		struct timespec ts;
+		(void) clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		return ((unsigned long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#endif
+	}
+
+	// Local minute of the day [0 .. 1439]; converted once per minute boundary.
+	static unsigned minuteofday()
+	{
+		static std::atomic<unsigned long long> cache(0);	// [expiry ms:48 | minute:16]
+		const unsigned long long now = milliseconds(),
+			t_cache = cache.load(std::memory_order_relaxed);
+
+		if (t_cache && now < (t_cache >> 16))
+			return (unsigned)(t_cache & 0xffff);
+
+		const time_t clock = ::time(nullptr);
+		struct tm tm = { 0 };
+#if defined(_WIN32)
+		localtime_s(&tm, &clock);
+#else
+		localtime_r(&clock, &tm);
+#endif
+		const unsigned minute = (tm.tm_hour * 60) + tm.tm_min,
+			remaining = (tm.tm_sec < 60 ? 60 - tm.tm_sec : 1);	// leap second
+
+		cache.store(((now + (remaining * 1000ULL)) << 16) | minute, std::memory_order_relaxed);
+		return minute;
+	}
+};
+
+}   //namespace inetd
+
+//end
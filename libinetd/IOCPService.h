@@ -53,7 +53,7 @@ public:
 		Listener& operator=(const Listener &) = delete;
 
 	public:
-		Listener() : fd_(0), acceptex_(nullptr), acceptexaddrs_(nullptr) {
+		Listener() : fd_(INVALID_SOCKET), acceptex_(nullptr), acceptexaddrs_(nullptr) {
 		}
 		bool is_open() {
 			return (fd_ != -1);
@@ -396,44 +396,72 @@ public:
 		}
 
 		if (fd != listener.fd_) {	// associate new listener.
-			GUID GUIDAcceptEx = WSAID_ACCEPTEX,
-			GUIDGetSockaddrs = WSAID_GETACCEPTEXSOCKADDRS;
-			DWORD dwBytes;
+			if (! Resolve(listener, fd)) {
+				return false;
+			}
 
-			listener.fd_ = -1;
-			listener.acceptex_ = 0;
-			listener.acceptexaddrs_ = 0;
-
-			// resolve async accept interface.
-			dwBytes = 0;
-			if (::WSAIoctl((SOCKET) fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
-				&GUIDAcceptEx, sizeof(GUIDAcceptEx), &listener.acceptex_, sizeof(listener.acceptex_),
-					&dwBytes, NULL, NULL) == SOCKET_ERROR) {
-				WSASyslogx(LOG_ERR, "WSAIoct(getacceptex)");
+			// associate the listener.
+			HANDLE t_iocp = ::CreateIoCompletionPort(reinterpret_cast<HANDLE>(fd), iocp,
+						reinterpret_cast<LONG_PTR>(&listener), numthreads_);
+			if (NULL == t_iocp || iocp != t_iocp) {
+				WSASyslogx(LOG_ERR, "AssociateIoCompletionPort");
 				return false;
 			}
 
-			dwBytes = 0;
-			if (::WSAIoctl((SOCKET) fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
-				&GUIDGetSockaddrs, sizeof(GUIDGetSockaddrs), &listener.acceptexaddrs_, sizeof(listener.acceptexaddrs_),
-					&dwBytes, NULL, NULL) == SOCKET_ERROR) {
-				WSASyslogx(LOG_ERR, "WSAIoct(getacceptexsockaddrs)");
+			listener.fd_ = fd;	// bound
+		}
+		return true;
+	}
+
+	// Adopt a listener handed from another process, see sethandoff(). The socket shares its
+	// file object with that of the original, which may already be associated with the original's
+	// completion port; the association is replaced (FileReplaceCompletionInformation, Windows 8.1+),
+	// otherwise made anew. The original must have no accepts outstanding, as their completions
+	// would otherwise be delivered here. Also reclaims a listener whose adoption failed.
+	bool Adopt(Listener &listener, int fd)
+	{
+		Socket::NtSetInformationFile_t SetInformationFile = Socket::getNtSetInformationFile();
+		HANDLE iocp;
+
+		if (INVALID_HANDLE_VALUE == (iocp = iocp_global_) ||
+				INVALID_SOCKET == fd) {
+			return false;		// preconditions.
+		}
+
+		if (fd != listener.fd_ && ! Resolve(listener, fd)) {
+			return false;
+		}
+
+		if (SetInformationFile) {	// replace any existing association.
+			HANDLE handle = reinterpret_cast<HANDLE>(fd);
+			ULONG_PTR iosb[2] = { 0, 0 };
+			void* info[2] = { iocp, &listener };	// FILE_COMPLETION_INFORMATION
+
+			const LONG status = SetInformationFile(handle, iosb, &info, sizeof(info), 61 /*FileReplaceCompletionInformation*/);
+			if (0 != status) {
+				syslog(LOG_ERR, "ReplaceCompletionInformation: 0x%lx", (unsigned long)status);
 				return false;
 			}
 
-			// associate the listener.
+		} else {			// unassociated only.
 			HANDLE t_iocp = ::CreateIoCompletionPort(reinterpret_cast<HANDLE>(fd), iocp,
 						reinterpret_cast<LONG_PTR>(&listener), numthreads_);
 			if (NULL == t_iocp || iocp != t_iocp) {
 				WSASyslogx(LOG_ERR, "AssociateIoCompletionPort");
 				return false;
 			}
-
-			listener.fd_ = fd;	// bound
 		}
+
+		listener.fd_ = fd;		// bound
 		return true;
 	}
 
+	// Whether an associated listener can be adopted by another process, see Adopt().
+	static bool Adoptable()
+	{
+		return (nullptr != Socket::getNtSetInformationFile());
+	}
+
 	bool Cancel(Listener &listener)
 	{
 		if (listener.fd_ != INVALID_SOCKET) {
@@ -443,6 +471,36 @@ public:
 		return false;
 	}
 
+	// Transfer an associated listener, without closing its socket. Outstanding accepts are
+	// cancelled and the completion key replaced (FileReplaceCompletionInformation, Windows 8.1+),
+	// so subsequent accepts complete against 'to'. 'from' retains the descriptor solely to
+	// conclude those accepts already queued; it must not be shutdown.
+	bool Transfer(Listener &to, Listener &from)
+	{
+		Socket::NtSetInformationFile_t SetInformationFile = Socket::getNtSetInformationFile();
+
+		if (INVALID_HANDLE_VALUE == iocp_global_ ||
+				INVALID_SOCKET == from.fd_ || nullptr == SetInformationFile) {
+			return false;		// preconditions.
+		}
+
+		HANDLE handle = reinterpret_cast<HANDLE>(from.fd_);
+		ULONG_PTR iosb[2] = { 0, 0 };
+		void* info[2] = { iocp_global_, &to };	// FILE_COMPLETION_INFORMATION
+
+		(void) ::CancelIoEx(handle, NULL);
+		const LONG status = SetInformationFile(handle, iosb, &info, sizeof(info), 61 /*FileReplaceCompletionInformation*/);
+		if (0 != status) {
+			syslog(LOG_ERR, "ReplaceCompletionInformation: 0x%lx", (unsigned long)status);
+			return false;
+		}
+
+		to.fd_ = from.fd_;		// bound
+		to.acceptex_ = from.acceptex_;
+		to.acceptexaddrs_ = from.acceptexaddrs_;
+		return true;
+	}
+
 	bool Shutdown(Listener &listener)
 	{
 		if (listener.fd_ != INVALID_SOCKET) {
@@ -520,6 +578,35 @@ public:
 	}
 
 private:
+	static bool Resolve(Listener &listener, int fd)
+	{
+		GUID GUIDAcceptEx = WSAID_ACCEPTEX,
+		GUIDGetSockaddrs = WSAID_GETACCEPTEXSOCKADDRS;
+		DWORD dwBytes;
+
+		listener.fd_ = -1;
+		listener.acceptex_ = 0;
+		listener.acceptexaddrs_ = 0;
+
+		// resolve async accept interface.
+		dwBytes = 0;
+		if (::WSAIoctl((SOCKET) fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&GUIDAcceptEx, sizeof(GUIDAcceptEx), &listener.acceptex_, sizeof(listener.acceptex_),
+				&dwBytes, NULL, NULL) == SOCKET_ERROR) {
+			WSASyslogx(LOG_ERR, "WSAIoct(getacceptex)");
+			return false;
+		}
+
+		dwBytes = 0;
+		if (::WSAIoctl((SOCKET) fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&GUIDGetSockaddrs, sizeof(GUIDGetSockaddrs), &listener.acceptexaddrs_, sizeof(listener.acceptexaddrs_),
+				&dwBytes, NULL, NULL) == SOCKET_ERROR) {
+			WSASyslogx(LOG_ERR, "WSAIoct(getacceptexsockaddrs)");
+			return false;
+		}
+		return true;
+	}
+
 	static unsigned __stdcall Worker(void *void_context)
 	{
 		HANDLE iocp = (HANDLE)void_context;
@@ -99,5 +99,60 @@ public:
 	CRITICAL_SECTION cs_;
 };
 
+
+class ReadWriteLock
+{
+	ReadWriteLock(const ReadWriteLock &) = delete;
+	ReadWriteLock& operator=(const ReadWriteLock &) = delete;
+
+public:
+	class Guard	// exclusive
+	{
+		Guard(const Guard &) = delete;
+		Guard& operator=(const Guard &) = delete;
+
+	public:
+		Guard(ReadWriteLock &lock) : lock_(lock)
+		{
+			::AcquireSRWLockExclusive(&lock.srw_);
+		}
+
+		~Guard()
+		{
+			::ReleaseSRWLockExclusive(&lock_.srw_);
+		}
+
+	private:
+		ReadWriteLock &lock_;
+	};
+
+	class SharedGuard
+	{
+		SharedGuard(const SharedGuard &) = delete;
+		SharedGuard& operator=(const SharedGuard &) = delete;
+
+	public:
+		SharedGuard(ReadWriteLock &lock) : lock_(lock)
+		{
+			::AcquireSRWLockShared(&lock.srw_);
+		}
+
+		~SharedGuard()
+		{
+			::ReleaseSRWLockShared(&lock_.srw_);
+		}
+
+	private:
+		ReadWriteLock &lock_;
+	};
+
+	ReadWriteLock()
+	{
+		::InitializeSRWLock(&srw_);
+	}
+
+	SRWLOCK srw_;
+};
+
 }   //namespace inetd
 
@@ -0,0 +1,115 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * inetd::SipHash
+ * windows inetd service.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  SipHash-2-4, Jean-Philippe Aumasson and Daniel J. Bernstein.
+ *
+ *  Keyed hash for tables indexed by remote supplied data (e.g. peer addresses), where
+ *  an unkeyed hash permits an attacker to force collisions; key with random().
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <random>
+
+namespace inetd {
+
+class SipHash {
+public:
+	SipHash(uint64_t k0, uint64_t k1) : k0_(k0), k1_(k1)
+	{
+	}
+
+	static SipHash random()
+	{
+		std::random_device rd;
+		return SipHash(((uint64_t)rd() << 32) | rd(), ((uint64_t)rd() << 32) | rd());
+	}
+
+	uint64_t operator()(const void *data, size_t len) const
+	{
+		const unsigned char *in = (const unsigned char *)data;
+		const unsigned char *end = in + (len & ~(size_t)7);
+		uint64_t v0 = 0x736f6d6570736575ULL ^ k0_;
+		uint64_t v1 = 0x646f72616e646f6dULL ^ k1_;
+		uint64_t v2 = 0x6c7967656e657261ULL ^ k0_;
+		uint64_t v3 = 0x7465646279746573ULL ^ k1_;
+		uint64_t m, b = ((uint64_t)len) << 56;
+
+		for (; in != end; in += 8) {
+			memcpy(&m, in, sizeof(m));		// note: little-endian hosts.
+			v3 ^= m;
+			round(v0, v1, v2, v3);
+			round(v0, v1, v2, v3);
+			v0 ^= m;
+		}
+
+		switch (len & 7) {
+		case 7: b |= ((uint64_t)in[6]) << 48;	/*FALLTHRU*/
+		case 6: b |= ((uint64_t)in[5]) << 40;	/*FALLTHRU*/
+		case 5: b |= ((uint64_t)in[4]) << 32;	/*FALLTHRU*/
+		case 4: b |= ((uint64_t)in[3]) << 24;	/*FALLTHRU*/
+		case 3: b |= ((uint64_t)in[2]) << 16;	/*FALLTHRU*/
+		case 2: b |= ((uint64_t)in[1]) << 8;	/*FALLTHRU*/
+		case 1: b |= ((uint64_t)in[0]);		/*FALLTHRU*/
+		case 0: break;
+		}
+
+		v3 ^= b;
+		round(v0, v1, v2, v3);
+		round(v0, v1, v2, v3);
+		v0 ^= b;
+		v2 ^= 0xff;
+		round(v0, v1, v2, v3);
+		round(v0, v1, v2, v3);
+		round(v0, v1, v2, v3);
+		round(v0, v1, v2, v3);
+		return v0 ^ v1 ^ v2 ^ v3;
+	}
+
+private:
+	static inline uint64_t rotl(uint64_t x, int b)
+	{
+		return (x << b) | (x >> (64 - b));
+	}
+
+	static inline void round(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3)
+	{
+		v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+		v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+		v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+		v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+	}
+
+private:
+	uint64_t k0_, k1_;
+};
+
+}   //namespace inetd
+
+//end
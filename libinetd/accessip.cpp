@@ -25,8 +25,13 @@
  */
 
 #include "inetd.h"
+#include <syslog.h>
+
+#include <algorithm>
+#include <unordered_map>
 
 #include "accessip.h"
+#include "../libiptable/rcu_radix.h"
 
 #define NETADDR_TO_PREFIX_X(na, pt, bits) \
 	do {						\
@@ -66,8 +71,161 @@ static bool acl_neg = false;
 static bool acl_pos = true;
 
 
-AccessIP::AccessIP(const netaddrs &netaddrs, int match_default)
-	: at_acl(nullptr)
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Table registry
+
+namespace {
+typedef std::unordered_map<std::string, AccessIP *> Registry;
+
+static inetd::CriticalSection registry_lock;
+static Registry registry;			// content key -> table; holds one reference.
+static unsigned long registry_acquired;		// total acquire() calls.
+static unsigned long registry_shared;		// acquire() calls satisfied by an existing table.
+}
+
+
+AccessIP::Ptr
+AccessIP::acquire(const netaddrs &netaddrs, int match_default)
+{
+	std::string key;
+	acl_key(netaddrs, match_default, key);
+
+	inetd::CriticalSection::Guard guard(registry_lock);
+	++registry_acquired;
+
+	Registry::iterator it(registry.find(key));
+	if (it != registry.end()) {
+		++registry_shared;
+		return Ptr(it->second);
+	}
+
+	AccessIP *table = new(std::nothrow) AccessIP(netaddrs, match_default, key);
+	if (nullptr == table)
+		return Ptr();
+	try {
+		registry.emplace(key, table);
+	} catch (...) {
+		delete table;
+		return Ptr();
+	}
+	intrusive_ptr_add_ref(table);		// registry reference.
+	return Ptr(table);
+}
+
+
+unsigned
+AccessIP::purge()
+{
+	unsigned count = 0;
+
+	inetd::CriticalSection::Guard guard(registry_lock);
+	for (Registry::iterator it(registry.begin()); it != registry.end();) {
+		AccessIP *table = it->second;
+		if (1 == intrusive_ptr_count(table)) {	// registry reference only.
+			it = registry.erase(it);
+			intrusive_ptr_release(table);
+			++count;
+		} else {
+			++it;
+		}
+	}
+	return count;
+}
+
+
+void
+AccessIP::sysdump()
+{
+	size_t bytes = 0, saved = 0;
+	unsigned references = 0;
+
+	inetd::CriticalSection::Guard guard(registry_lock);
+	for (const auto &entry : registry) {
+		const AccessIP *table = entry.second;
+		const unsigned users = intrusive_ptr_count(table) - 1;
+		const size_t footprint = table->footprint();
+
+		bytes += footprint;
+		if (users > 1)
+			saved += footprint * (users - 1);
+		references += users;
+	}
+
+	syslog(LOG_DEBUG, "acl: %u tables, %u references, %lu/%lu shared, %lu bytes, %lu bytes saved",
+		(unsigned)registry.size(), references, registry_shared, registry_acquired,
+		(unsigned long)bytes, (unsigned long)saved);
+}
+
+
+size_t
+AccessIP::footprint(unsigned &tables)
+{
+	size_t bytes = 0;
+
+	inetd::CriticalSection::Guard guard(registry_lock);
+	for (const auto &entry : registry)
+		bytes += entry.second->footprint();
+	tables = (unsigned)registry.size();
+	return bytes;
+}
+
+
+/*
+ *  Release, once no admission check can still reference the table; see netaddrs::allowed().
+ */
+void
+AccessIP::intrusive_deleter(AccessIP *table)
+{
+	rcu_retire(table, [](void *data) { delete static_cast<AccessIP *>(data); });
+}
+
+
+void
+AccessIP::acl_key(const netaddrs &netaddrs, int match_default, std::string &key)
+{
+	struct element {			// canonical rule image.
+		char op;
+		unsigned char family;
+		unsigned char masklen;
+		unsigned char address[16];
+	};
+
+	const netaddrs::Collection &addresses = netaddrs();
+	std::vector<struct element> elements;
+
+	elements.reserve(addresses.size());
+	for (const auto &netaddr : addresses) {
+		struct element e = {0};
+
+		e.op = netaddr.op;
+		e.family = (unsigned char)netaddr.addr.family;
+		e.masklen = (unsigned char)getmasklength(&netaddr.addr);
+		if (AF_INET6 == netaddr.addr.family) {
+			memcpy(e.address, &netaddr.addr.network.v6, sizeof(struct in6_addr));
+		} else if (AF_INET == netaddr.addr.family) {
+			memcpy(e.address, &netaddr.addr.network.v4, sizeof(struct in_addr));
+		}
+		elements.push_back(e);
+	}
+
+	// Rules are unique by prefix (see netaddrs::push), hence insertion order is not
+	// significant to the resulting tree; sort so equivalent lists share a key.
+	std::sort(elements.begin(), elements.end(), [](const element &a, const element &b) {
+			return memcmp(&a, &b, sizeof(element)) < 0;
+		});
+
+	key.reserve(sizeof(match_default) + (elements.size() * sizeof(element)));
+	key.assign((const char *)&match_default, sizeof(match_default));
+	if (elements.size())
+		key.append((const char *)elements.data(), elements.size() * sizeof(element));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Table
+
+AccessIP::AccessIP(const netaddrs &netaddrs, int match_default, const std::string &key)
+	: at_key(key), at_acl(nullptr), at_hits(nullptr)
 {
 	memset(&at_mct, 0, sizeof(at_mct));
 	if (! netaddrs.empty() || match_default) {
@@ -82,14 +240,44 @@ AccessIP::~AccessIP()
 }
 
 
+size_t
+AccessIP::footprint() const
+{
+	size_t bytes = sizeof(AccessIP) + at_key.capacity();
+	if (at_acl) {
+		bytes += sizeof(isc_radix_tree_t) +
+			(at_mct.mem_radix * sizeof(isc_radix_node_t)) +
+			(at_mct.mem_prefix * sizeof(isc_prefix_t));
+	}
+	if (at_hits) {
+		bytes += at_rules.size() * (sizeof(std::string) + sizeof(std::atomic<unsigned long>));
+	}
+	return bytes;
+}
+
+
+void
+AccessIP::dump() const
+{
+	if (nullptr == at_hits)
+		return;
+
+	for (unsigned num = 1; num < at_rules.size(); ++num) {
+		if (! at_rules[num].empty()) {
+			syslog(LOG_DEBUG, "acl: #%u %s, %lu hits",
+				num, at_rules[num].c_str(), at_hits[num].load(std::memory_order_relaxed));
+		}
+	}
+	syslog(LOG_DEBUG, "acl: unmatched, %lu hits", at_hits[0].load(std::memory_order_relaxed));
+}
+
+
 bool
 AccessIP::allowed(const netaddr &addr) const
 {
 	if (acl_active()) {
 		int match = 0;
-		if (acl_match(&addr, match)) {
-			return (match > 0);
-		}
+		return acl_hit(acl_match(&addr, match), match);
 	}
 	return true;
 }
@@ -100,9 +288,7 @@ AccessIP::allowed(const struct sockaddr_storage *addr) const
 {
 	if (acl_active()) {
 		int match = 0;
-		if (acl_match(addr, match)) {
-			return (match > 0);
-		}
+		return acl_hit(acl_match(addr, match), match);
 	}
 	return true;
 }
@@ -113,6 +299,7 @@ AccessIP::acl_create(const netaddrs &netaddrs, int match_default)
 {
 	bool ret;
 	isc_radix_create(&at_mct, &at_acl, RADIX_MAXBITS);
+	at_rules.reserve(netaddrs.size() + 2);
 	if (match_default) {
 		ret = acl_add((const netaddr *)NULL, (match_default > 0 ? true : false));
 		assert(ret);
@@ -121,6 +308,9 @@ AccessIP::acl_create(const netaddrs &netaddrs, int match_default)
 		ret = acl_add(&netaddr.addr, '+' == netaddr.op);
 		assert(ret);
 	}
+	at_rules.resize(at_acl->num_added_node + 1);
+	at_hits = new(std::nothrow) std::atomic<unsigned long>[at_rules.size()]();
+		// note: optional; on allocation failure rules are enforced yet not counted.
 }
 
 
@@ -136,14 +326,32 @@ AccessIP::acl_add(const netaddr *addr, bool pos)
 {
 	const int bitlen = (addr ? getmasklength(addr) : 0);
 	isc_prefix_t pfx = {0};
+	int num = 0;
 
 	NETADDR_TO_PREFIX_X(addr, pfx, bitlen);
-	return acl_add(&pfx, pos);
+	if (! acl_add(&pfx, pos, num))
+		return false;
+
+	if (num > 0) {				// rule image, for dump().
+		char t_rule[80] = {0};
+
+		t_rule[0] = (pos ? '+' : '-');
+		if (addr) {
+			inet_ntop(addr->family, (void *)&addr->network, t_rule + 1, sizeof(t_rule) - 8);
+			sprintf(t_rule + strlen(t_rule), "/%d", bitlen);
+		} else {
+			strcpy(t_rule + 1, "ALL");
+		}
+		if ((unsigned)num >= at_rules.size())
+			at_rules.resize(num + 1);
+		at_rules[num] = t_rule;
+	}
+	return true;
 }
 
 
 bool
-AccessIP::acl_add(isc_prefix_t *pfx, bool pos)
+AccessIP::acl_add(isc_prefix_t *pfx, bool pos, int &num)
 {
 	isc_radix_node_t *node = NULL;
 
@@ -175,6 +383,7 @@ AccessIP::acl_add(isc_prefix_t *pfx, bool pos)
 			    reinterpret_cast<void *>(pos ? &acl_pos : &acl_neg);
 		}
 	}
+	num = node->node_num[ISC_RADIX_FAMILY(pfx)];
 	return true;
 }
 
@@ -230,9 +439,24 @@ AccessIP::acl_match(const isc_prefix_t *pfx, int &match) const
 }
 
 
+bool
+AccessIP::acl_hit(bool matched, int match) const
+{
+	if (at_hits) {
+		const unsigned num = (matched ? (unsigned)(match < 0 ? -match : match) : 0);
+		if (num < at_rules.size())
+			at_hits[num].fetch_add(1, std::memory_order_relaxed);
+	}
+	return (matched ? match > 0 : true);
+}
+
+
 void
 AccessIP::acl_reset()
 {
+	delete[] at_hits;
+	at_hits = nullptr;
+	at_rules.clear();
 	if (nullptr == at_acl)
 		return;
 	isc_radix_destroy(at_acl, nullptr);
@@ -27,30 +27,66 @@
 
 #include "inetd.h"
 
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "IntrusivePtr.h"
+
 #include "../libiptable/isc_radix.h"
 #include "../libiptable/isc_netaddr.h"
 
-class AccessIP {
+/*
+ *  Compiled ACL table.
+ *
+ *  Tables are immutable once built and are hash-consed by content; services with
+ *  identical only_from/no_access rules share a single reference counted instance,
+ *  which is retained across reconfigurations until purge() finds it unreferenced;
+ *  release is then deferred until no admission check can reference it, see rcu_retire().
+ *
+ *  Each rule carries a relaxed hit counter, indexed by the radix node_num which
+ *  identifies the rule; slot 0 counts unmatched addresses. As tables are shared,
+ *  counts are the aggregate of all services referencing the table.
+ */
+class AccessIP : public inetd::intrusive::PtrMemberHook<AccessIP> {
+	AccessIP(const AccessIP &) = delete;
+	AccessIP& operator=(const AccessIP &) = delete;
+
 public:
-	AccessIP(const netaddrs &netaddrs, int match_default = 0 /*<0=none,>0=ALL*/);
-	~AccessIP();
+	typedef inetd::instrusive_ptr<AccessIP> Ptr;
+
+	static Ptr acquire(const netaddrs &netaddrs, int match_default = 0 /*<0=none,>0=ALL*/);
+	static unsigned purge();
+	static void sysdump();
+	static size_t footprint(unsigned &tables);
+	static void intrusive_deleter(AccessIP *table);
 
 	bool allowed(const netaddr &addr) const;
 	bool allowed(const struct sockaddr_storage *addr) const;
+	size_t footprint() const;
+	void dump() const;
 
 private:
+	AccessIP(const netaddrs &netaddrs, int match_default, const std::string &key);
+	~AccessIP();
+
+	static void acl_key(const netaddrs &netaddrs, int match_default, std::string &key);
 	void acl_create(const netaddrs &netaddrs, int match_default);
 	bool acl_active() const;
 	bool acl_add(const netaddr *addr, bool pos);
-	bool acl_add(isc_prefix_t *pfx, bool pos);
+	bool acl_add(isc_prefix_t *pfx, bool pos, int &num);
 	bool acl_match(const netaddr *addr, int &match) const;
 	bool acl_match(const struct sockaddr_storage *addr, int &match) const;
 	bool acl_match(const isc_prefix_t *pfx, int &match) const;
+	bool acl_hit(bool matched, int match) const;
 	void acl_reset();
 
 private:
+	const std::string at_key;
 	isc_mem_t at_mct;
 	isc_radix_tree_t *at_acl;
+	std::vector<std::string> at_rules;	// node_num -> rule image.
+	std::atomic<unsigned long> *at_hits;	// node_num -> hits; [0] unmatched.
 };
 
 //end
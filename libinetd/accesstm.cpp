@@ -30,6 +30,8 @@
 #include <time.h>
 #include <algorithm>
 
+#include "CoarseClock.h"
+
 
 //static
 unsigned
@@ -74,7 +76,7 @@ access_times::to_access_range(const char *arg, struct time &range)
 }
 
 
-access_times::access_times() : times_()
+access_times::access_times() : times_(), mask_()
 {
 }
 
@@ -87,6 +89,7 @@ access_times::push(const struct time &range)
 	for (struct time *ap = times_; ai < MAXACCESSV && ap->end; ++ap, ++ai) {
 		if (ap->start >= range.start && ap->end <= range.end) {
 			*ap = range;
+			compile();
 			return true;
 		} else if (range.start >= ap->start && range.end <= ap->end) {
 			return true;
@@ -94,24 +97,43 @@ access_times::push(const struct time &range)
 	}
 	if (ai < MAXACCESSV) {
 		times_[ai] = range;
+		compile();
 		return true;
 	}
 	return false;
 }
 
 
+/*
+ *  Compile the ranges into a minute of day bitmap, reducing allowed() to a single bit test.
+ */
+void
+access_times::compile()
+{
+	memset(mask_, 0, sizeof(mask_));
+	for (const struct time *ap = times_; ap < times_ + MAXACCESSV && ap->end; ++ap) {
+		for (unsigned minute = ap->start; minute < ap->end && minute < MINUTESPERDAY; ++minute) {
+			mask_[minute / 64] |= (uint64_t)1 << (minute % 64);
+		}
+	}
+}
+
+
 bool
-access_times::allowed(const unsigned now) const
+access_times::allowed(const unsigned minute) const
 {
 	if (empty())
 		return true;
+	if (minute >= MINUTESPERDAY)
+		return false;
+	return (0 != (mask_[minute / 64] & ((uint64_t)1 << (minute % 64))));
+}
 
-	for (const struct time *ap = times_; ap->end; ++ap) {
-		if (now >= ap->start && now < ap->end) {
-			return true;
-		}
-	}
-	return false;
+
+const struct access_times::time *
+access_times::times() const
+{
+	return times_;
 }
 
 
@@ -137,6 +159,7 @@ void
 access_times::clear()
 {
 	memset(times_, 0, sizeof(times_));
+	memset(mask_, 0, sizeof(mask_));
 }
 
 
@@ -158,11 +181,7 @@ accesstm(PeerInfo &remote)
 	const struct servtab *sep = remote.getserv();
 
 	if (! sep->se_access_times.empty()) {
-		const time_t now = remote.timestamp().tv_sec;
-		struct tm tm = { 0 };
-
-		localtime_s(&tm, &now);
-		if (! sep->se_access_times.allowed(access_times::to_time(tm.tm_hour, tm.tm_min))) {
+		if (! sep->se_access_times.allowed(inetd::CoarseClock::minuteofday())) {
 			return -1; // deny
 		}
 		return 1; // allowed
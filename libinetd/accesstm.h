@@ -25,6 +25,7 @@
  * ==
  */
 
+#include <stdint.h>
 #include <time.h>
 
 class access_times {
@@ -38,16 +39,22 @@ public:
 	static bool to_access_range(const char *arg, struct time &range);
 
 	access_times();
-	bool allowed(unsigned now) const;
+	bool allowed(unsigned minute) const;
 	bool push(const time &tm);
+	const struct time *times() const;
 	size_t size() const;
 	bool empty() const;
 	void clear();
 	void sysdump() const;
 
+private:
+	void compile();
+
 private:
 #define MAXACCESSV 10
+#define MINUTESPERDAY (24 * 60)
 	struct time times_[MAXACCESSV];
+	uint64_t mask_[(MINUTESPERDAY + 63) / 64]; // minute of day bitmap, compiled from times_.
 };
 
 //end
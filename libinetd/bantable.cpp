@@ -0,0 +1,603 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - dynamic ban table.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include "inetd.h"
+#include <syslog.h>
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bantable.h"
+
+#include "../libiptable/rcu_radix.h"
+
+#define BAN_MAXSTRIKES	1000			// policy limits; see to_policy().
+#define BAN_MAXWINDOW	(24 * 60 * 60)
+#define BAN_BASETTL	60			// default initial ban, seconds.
+#define BAN_MAXTTL	(24 * 60 * 60)		// default longest ban.
+#define BAN_LIMITTTL	(7 * 24 * 60 * 60)	// longest configurable ban.
+#if !defined(BAN_DECAY)
+#define BAN_DECAY	(24 * 60 * 60)		// quiet period, after which escalation resets.
+#endif
+#define BAN_SAVEGAP	60			// minimum interval between unforced saves.
+#define BAN_LIMIT	(256 * 1024)		// offenders tracked; thereafter new sources are not.
+#define BAN_SWEEP	4			// offenders examined for expiry per violation.
+
+namespace {
+struct Source {					// normalised source address.
+	unsigned char family;
+	unsigned char addr[16];
+
+	size_t length() const {
+		return 1 + (AF_INET6 == family ? 16 : 4);
+	}
+};
+
+struct Offender {
+	Source source;
+	unsigned strikes;			// violations within the current window.
+	time_t window;				// window start.
+	time_t until;				// ban expiry, otherwise 0.
+	unsigned level;				// escalation.
+};
+}; //namespace
+
+static rcu_radix_tree_t * const ban_published = rcu_radix_create(free); // source -> expiry.
+static std::atomic<long long> ban_horizon(0);	// latest published expiry.
+static std::atomic<unsigned long> ban_rejected(0);
+static std::atomic<bool> ban_enabled(false);	// ban_policy.strikes != 0.
+
+static inetd::CriticalSection ban_lock;		// guards the following.
+static bantable::policy ban_policy;		// disabled, unless configured.
+static std::unordered_map<std::string, Offender> ban_offenders;
+static std::deque<std::string> ban_sweep;	// offender keys, in sweep order.
+static std::string ban_filename;
+static void (*ban_saverequest)(void);
+static unsigned long ban_total;
+static unsigned long ban_untracked;		// violations by sources beyond BAN_LIMIT.
+static time_t ban_saved;
+static bool ban_dirty;
+static bool ban_requested;			// save requested, not yet performed.
+
+
+static bool
+normalise(const struct sockaddr_storage *ss, Source &source)
+{
+	memset(&source, 0, sizeof(source));
+	if (AF_INET == ss->ss_family) {
+		const struct in_addr *addr = &csatosin(ss)->sin_addr;
+		if (127 == (ntohl(addr->s_addr) >> 24))
+			return false;		// loopback, never banned.
+		source.family = AF_INET;
+		memcpy(source.addr, addr, 4);
+		return true;
+
+	} else if (AF_INET6 == ss->ss_family) {
+		const struct in6_addr *addr = &csatosin6(ss)->sin6_addr;
+		if (IN6_IS_ADDR_V4MAPPED(addr)) {
+			if (127 == addr->s6_addr[12])
+				return false;
+			source.family = AF_INET;
+			memcpy(source.addr, addr->s6_addr + 12, 4);
+			return true;
+		}
+		if (IN6_IS_ADDR_LOOPBACK(addr))
+			return false;
+		source.family = AF_INET6;
+		memcpy(source.addr, addr->s6_addr, 16);
+		return true;
+	}
+	return false;
+}
+
+
+static void
+to_prefix(const Source &source, isc_prefix_t &pfx)
+{
+	memset(&pfx, 0, sizeof(pfx));
+	pfx.family = source.family;
+	if (AF_INET6 == source.family) {
+		pfx.bitlen = 128;
+		memcpy(&pfx.add.sin6, source.addr, 16);
+	} else {
+		pfx.bitlen = 32;
+		memcpy(&pfx.add.sin, source.addr, 4);
+	}
+}
+
+
+/*
+ *  Publish the ban; lookups may run concurrently. Each expiry is immutable once published,
+ *  a renewal replacing it, with the prior reclaimed once no lookup can reference it.
+ */
+static bool
+publish(const Source &source, time_t until)
+{
+	long long *expiry;
+	isc_prefix_t pfx;
+
+	if (nullptr == ban_published ||
+			nullptr == (expiry = static_cast<long long *>(malloc(sizeof(long long)))))
+		return false;
+
+	*expiry = until;
+	to_prefix(source, pfx);
+	if (rcu_radix_insert(ban_published, &pfx, expiry) < 0) {
+		free(expiry);
+		return false;
+	}
+
+	long long horizon = ban_horizon.load();
+	while (until > horizon && ! ban_horizon.compare_exchange_weak(horizon, until))
+		;
+	return true;
+}
+
+
+/*
+ *  Retract the published ban of the offender, if any.
+ */
+static void
+retract(const Offender &o)
+{
+	isc_prefix_t pfx;
+
+	if (nullptr == ban_published || 0 == o.until)
+		return;
+	to_prefix(o.source, pfx);
+	(void) rcu_radix_remove(ban_published, &pfx);
+}
+
+
+/*
+ *  Offender by source, created on first reference; nullptr once BAN_LIMIT are tracked.
+ */
+static Offender *
+offender(const Source &source)
+{
+	std::string key((const char *)&source, source.length());
+	auto it = ban_offenders.find(key);
+
+	if (it != ban_offenders.end())
+		return &it->second;
+	if (ban_offenders.size() >= BAN_LIMIT)
+		return nullptr;
+
+	Offender &o = ban_offenders[key];
+	o.source = source;
+	ban_sweep.push_back(std::move(key));
+	return &o;
+}
+
+
+/*
+ *  Incremental expiry; examine the next few offenders, forgetting those outside their
+ *  window and decay period. Bounded per call, each is revisited once per table cycle.
+ */
+static void
+sweep(time_t now, const struct bantable::policy &policy)
+{
+	for (unsigned count = 0; count < BAN_SWEEP && ! ban_sweep.empty(); ++count) {
+		std::string key(std::move(ban_sweep.front()));
+		ban_sweep.pop_front();
+
+		auto it = ban_offenders.find(key);
+		if (it == ban_offenders.end())
+			continue;
+		const Offender &o = it->second;
+		if ((now - o.window) >= (time_t)policy.window && (o.until + BAN_DECAY) <= now) {
+			retract(o);
+			ban_offenders.erase(it);
+		} else {
+			ban_sweep.push_back(std::move(key));
+		}
+	}
+}
+
+
+/*
+ *  Withdraw all published bans.
+ */
+static void
+withdraw(void)
+{
+	ban_horizon.store(0);
+	for (const auto &it : ban_offenders)
+		retract(it.second);
+}
+
+
+/*
+ *  Policy from the defaults section,
+ *
+ *	ban_threshold = <violations> <seconds>
+ *	ban_duration = <seconds> [<maximum seconds>]
+ *
+ *  Without a threshold banning is disabled.
+ */
+//static
+bool
+bantable::to_policy(const char *threshold, const char *duration, struct policy &result)
+{
+	unsigned strikes = 0, window = 0, basettl = BAN_BASETTL, maxttl = BAN_MAXTTL;
+	char trailing;
+	int count;
+
+	memset(&result, 0, sizeof(result));
+	if (nullptr == threshold)
+		return true;			// disabled.
+
+	if (2 != sscanf(threshold, "%u %u %c", &strikes, &window, &trailing) ||
+			0 == strikes || strikes > BAN_MAXSTRIKES || 0 == window || window > BAN_MAXWINDOW)
+		return false;
+
+	if (duration) {
+		count = sscanf(duration, "%u %u %c", &basettl, &maxttl, &trailing);
+		if (1 == count) {
+			maxttl = (basettl > BAN_MAXTTL ? basettl : BAN_MAXTTL);
+		} else if (2 != count) {
+			return false;
+		}
+		if (0 == basettl || basettl > maxttl || maxttl > BAN_LIMITTTL)
+			return false;
+	}
+
+	result.strikes = strikes;
+	result.window = window;
+	result.basettl = basettl;
+	result.maxttl = maxttl;
+	return true;
+}
+
+
+/*
+ *  Apply the policy; disabling withdraws active bans and forgets offenders.
+ */
+//static
+void
+bantable::setpolicy(const struct policy &policy)
+{
+	inetd::CriticalSection::Guard guard(ban_lock);
+	const bool enabled = (0 != policy.strikes);
+
+	if (enabled) {
+		if (0 != memcmp(&ban_policy, &policy, sizeof(policy)))
+			syslog(LOG_INFO, "bans: %u violations within %us, ban %us up to %us",
+				policy.strikes, policy.window, policy.basettl, policy.maxttl);
+	} else if (ban_policy.strikes || ban_offenders.size()) {
+		if (ban_policy.strikes)
+			syslog(LOG_INFO, "bans: disabled");
+		withdraw();
+		ban_offenders.clear();
+		ban_sweep.clear();
+		ban_dirty = true;		// persist the empty set.
+	}
+	ban_policy = policy;
+	ban_enabled.store(enabled);
+}
+
+
+/*
+ *  Active ban against the source; lock free.
+ */
+//static
+bool
+bantable::banned(const struct sockaddr_storage *ss)
+{
+	const time_t now = ::time(nullptr);
+	Source source;
+
+	if (now >= ban_horizon.load(std::memory_order_acquire))
+		return false;			// none active.
+	if (! normalise(ss, source))
+		return false;
+
+	isc_prefix_t pfx;
+	void *data = nullptr;
+	long long until = 0;
+
+	if (nullptr == ban_published)
+		return false;
+	to_prefix(source, pfx);
+
+	const int token = rcu_read_enter();	// only host prefixes are published; matches are exact.
+	if (ISC_R_SUCCESS == rcu_radix_search(ban_published, &pfx, &data))
+		until = *static_cast<const long long *>(data);
+	rcu_read_exit(token);
+
+	if (until > now) {
+		ban_rejected.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+
+/*
+ *  Account a limit violation by the source, returning true when a new ban results.
+ */
+//static
+bool
+bantable::violation(const struct sockaddr_storage *ss, unsigned &ttl)
+{
+	const time_t now = ::time(nullptr);
+	Source source;
+	bool ret = false;
+
+	void (*request)(void) = nullptr;
+
+	ttl = 0;
+	if (! ban_enabled.load(std::memory_order_relaxed) || ! normalise(ss, source))
+		return false;
+
+	{	inetd::CriticalSection::Guard guard(ban_lock);
+		const struct policy &policy = ban_policy;
+
+		if (0 == policy.strikes)
+			return false;		// disabled, since.
+
+		sweep(now, policy);
+
+		Offender *t_o = offender(source);
+		if (nullptr == t_o) {
+			++ban_untracked;	// table full; admission continues to be limited.
+			return false;
+		}
+
+		Offender &o = *t_o;
+		if (o.until > now)
+			return false;		// already banned; connections in flight.
+
+		if ((now - o.window) >= (time_t)policy.window) {
+			o.window = now;
+			o.strikes = 0;
+		}
+		if (++o.strikes < policy.strikes)
+			return false;
+
+		if (o.until && (now - o.until) >= BAN_DECAY)
+			o.level = 0;		// well behaved since; restart escalation.
+		const unsigned long long t_ttl =
+			(unsigned long long)policy.basettl << (o.level < 12 ? o.level : 12);
+		ttl = (t_ttl > policy.maxttl ? policy.maxttl : (unsigned)t_ttl);
+		if (o.level < 31)
+			++o.level;
+		o.until = now + ttl;
+		o.strikes = 0;
+
+		if (! publish(source, o.until)) {
+			syslog(LOG_WARNING, "bans: publish failure, ban not enforced");
+		}
+		ban_dirty = true;
+		++ban_total;
+		ret = true;
+
+		if (ban_saverequest && ! ban_requested && (now - ban_saved) >= BAN_SAVEGAP) {
+			request = ban_saverequest;
+			ban_requested = true;
+		}
+	}
+
+	if (request)
+		request();			// see save(); never on this thread.
+	return ret;
+}
+
+
+/*
+ *  Load persisted bans, retaining those still active; the file is then used by save().
+ *  Once violations warrant a save, 'saverequest' is invoked; the owner should then
+ *  call save(false) from a context able to block on I/O.
+ *
+ *	<address> <expiry, epoch seconds> <level>
+ */
+//static
+bool
+bantable::load(const char *filename, void (*saverequest)(void))
+{
+	const time_t now = ::time(nullptr);
+	unsigned count = 0;
+	char line[256];
+	FILE *file;
+
+	{	inetd::CriticalSection::Guard guard(ban_lock);
+		ban_filename = (filename ? filename : "");
+		ban_saverequest = saverequest;
+	}
+
+	if (nullptr == filename || nullptr == (file = fopen(filename, "r")))
+		return false;
+
+	while (fgets(line, sizeof(line), file)) {
+		struct sockaddr_storage ss = {0};
+		char address[INET6_ADDRSTRLEN + 1];
+		long long until;
+		unsigned level;
+		Source source;
+
+		if ('#' == line[0] || 3 != sscanf(line, "%46s %lld %u", address, &until, &level))
+			continue;
+		if (until <= now)
+			continue;
+
+		if (1 == inet_pton(AF_INET, address, &((struct sockaddr_in *)&ss)->sin_addr)) {
+			ss.ss_family = AF_INET;
+		} else if (1 == inet_pton(AF_INET6, address, &((struct sockaddr_in6 *)&ss)->sin6_addr)) {
+			ss.ss_family = AF_INET6;
+		} else {
+			continue;
+		}
+		if (! normalise(&ss, source))
+			continue;
+
+		inetd::CriticalSection::Guard guard(ban_lock);
+		Offender *t_o = offender(source);
+		if (nullptr == t_o)
+			break;
+		Offender &o = *t_o;
+		o.until = (time_t)until;
+		o.level = (level < 31 ? level : 31);
+		if (publish(source, o.until))
+			++count;
+	}
+	fclose(file);
+
+	if (count)
+		syslog(LOG_INFO, "bans: %u active ban(s) restored from %s", count, filename);
+	return true;
+}
+
+
+/*
+ *  Persist active bans; unless forced, at most once per BAN_SAVEGAP seconds.
+ *
+ *  The active set is copied under the lock and written after its release, so admission
+ *  never waits on the file; saves are expected to be serialised by the caller. The file
+ *  is written aside and renamed over the original, so a failed save leaves it intact.
+ */
+//static
+bool
+bantable::save(bool force)
+{
+	struct Entry {
+		Source source;
+		time_t until;
+		unsigned level;
+	};
+	const time_t now = ::time(nullptr);
+	std::vector<Entry> entries;
+	std::string filename, t_filename;
+	FILE *file;
+
+	{	inetd::CriticalSection::Guard guard(ban_lock);
+
+		ban_requested = false;
+		if (! ban_dirty || ban_filename.empty())
+			return true;
+		if (! force && (now - ban_saved) < BAN_SAVEGAP)
+			return true;
+
+		for (const auto &it : ban_offenders) {
+			const Offender &o = it.second;
+			if (o.until > now)
+				entries.push_back(Entry{o.source, o.until, o.level});
+		}
+		filename = ban_filename;
+		ban_saved = now;
+		ban_dirty = false;		// restored on failure.
+	}
+
+	t_filename = filename + ".tmp";
+	if (nullptr == (file = fopen(t_filename.c_str(), "w"))) {
+		syslog(LOG_ERR, "bans: %s: %m", t_filename.c_str());
+		inetd::CriticalSection::Guard guard(ban_lock);
+		ban_dirty = true;
+		return false;
+	}
+
+	fprintf(file, "# inetd bans: <address> <expiry> <level>\n");
+	for (const auto &entry : entries) {
+		char address[INET6_ADDRSTRLEN + 1] = {0};
+
+		inet_ntop(entry.source.family, (void *)entry.source.addr, address, sizeof(address));
+		fprintf(file, "%s %lld %u\n", address, (long long)entry.until, entry.level);
+	}
+
+	const bool written = (0 == fflush(file) && 0 == ferror(file));
+	if (0 != fclose(file) || ! written) {
+		syslog(LOG_ERR, "bans: %s: %m", t_filename.c_str());
+		(void) unlink(t_filename.c_str());
+		inetd::CriticalSection::Guard guard(ban_lock);
+		ban_dirty = true;
+		return false;
+	}
+
+#if defined(_WIN32)
+	if (! ::MoveFileExA(t_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+#else
+	if (0 != ::rename(t_filename.c_str(), filename.c_str())) {
+#endif
+		syslog(LOG_ERR, "bans: %s: %m", filename.c_str());
+		(void) unlink(t_filename.c_str());
+		inetd::CriticalSection::Guard guard(ban_lock);
+		ban_dirty = true;
+		return false;
+	}
+	return true;
+}
+
+
+//static
+void
+bantable::sysdump()
+{
+	inetd::CriticalSection::Guard guard(ban_lock);
+	const time_t now = ::time(nullptr);
+	unsigned active = 0;
+
+	for (const auto &it : ban_offenders) {
+		if (it.second.until > now)
+			++active;
+	}
+	syslog(LOG_DEBUG, "bans: %u tracked, %u active, %lu issued, %lu rejected, %lu untracked",
+		(unsigned)ban_offenders.size(), active, ban_total, ban_rejected.load(std::memory_order_relaxed),
+		ban_untracked);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ban
+
+int
+banned(PeerInfo &remote)
+{
+	const struct sockaddr_storage *rss = remote.getaddr();
+
+	if (nullptr != rss && bantable::banned(rss)) {
+		if (debug)
+			syslog(LOG_DEBUG, "%s from %s banned", remote.getserv()->se_service, remote.getname());
+		return -1; // deny
+	}
+	return 0;
+}
+
+
+void
+banviolation(PeerInfo &remote, const char *reason)
+{
+	const struct sockaddr_storage *rss = remote.getaddr();
+	unsigned ttl;
+
+	if (nullptr != rss && bantable::violation(rss, ttl)) {
+		syslog(LOG_WARNING, "%s banned for %us, repeated %s violations",
+		    remote.getname(), ttl, reason);
+	}
+}
+
+//end
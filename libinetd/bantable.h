@@ -0,0 +1,63 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - dynamic ban table.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <time.h>
+
+/*
+ *  Global source address ban table.
+ *
+ *  When enabled by policy, see setpolicy(), sources repeatedly violating a cpm,
+ *  per-source or source rate limit are banned across all services, for a period
+ *  doubling with each successive ban. Admission consults the published bans, a radix
+ *  tree updated per source whilst being searched (rcu_radix), without locking; violations
+ *  and bookkeeping are serialised, being off the common path.
+ *
+ *  Active bans are persisted, see load() and save(); saves are requested of the caller
+ *  rather than performed by the violating connection.
+ */
+class bantable {
+	bantable() = delete;
+
+public:
+	struct policy {
+		unsigned strikes;		// violations within the window resulting in a ban; 0 disabled.
+		unsigned window;		// violation window, seconds.
+		unsigned basettl;		// initial ban, seconds; doubled per escalation.
+		unsigned maxttl;		// longest ban, seconds.
+	};
+
+	static bool to_policy(const char *threshold, const char *duration, struct policy &result);
+	static void setpolicy(const struct policy &policy);
+
+	static bool banned(const struct sockaddr_storage *ss);
+	static bool violation(const struct sockaddr_storage *ss, unsigned &ttl);
+	static bool load(const char *filename, void (*saverequest)(void) = nullptr);
+	static bool save(bool force = true);
+	static void sysdump();
+};
+
+//end
@@ -86,6 +86,7 @@
 #include "IntrusiveTree.h"
 #include "IntrusiveList.h"
 #include "ObjectPool.h"
+#include "CoarseClock.h"
 #include "inetd.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -93,8 +94,9 @@
 
 namespace {
 
-#define CHTGRAN		10
-#define CHTSIZE		6
+#define CHTGRAN		10			// bucket granularity, in seconds.
+#define CHTSIZE		6			// buckets, CHTSIZE * CHTGRAN = 60 seconds.
+#define CHSHARDS	32			// shard count; power of 2.
 
 typedef struct CTime {
 	unsigned long ct_ticks;
@@ -105,8 +107,7 @@ typedef struct CHost {
 	struct Compare {
 		int operator()(const CHost *a, const CHost *b) const
 		{
-			const int cmp = strcmp(a->ch_service, b->ch_service);
-			if (0 == cmp) {
+			if (a->ch_service == b->ch_service) {
 				if (a->ch_family == b->ch_family) {
 					if (AF_INET6 == a->ch_family) {
 						return memcmp(&a->ch_addrs.addr6, &b->ch_addrs.addr6, sizeof(a->ch_addrs.addr6));
@@ -116,7 +117,7 @@ typedef struct CHost {
 				}
 				return (a->ch_family < b->ch_family ? -1 : 1);
 			}
-			return cmp;
+			return ((uintptr_t)a->ch_service < (uintptr_t)b->ch_service ? -1 : 1);
 		}
 	};
 
@@ -143,6 +144,25 @@ typedef struct CHost {
 		ch_family = chash.ch_family;
 		ch_addrs = chash.ch_addrs;
 		(void) memset(ch_times, 0, sizeof(ch_times));
+		ch_ltime = ch_dtime = 0;
+	}
+
+	unsigned hash() const
+	{
+		const uint32_t *words = (const uint32_t *)&ch_addrs;
+		const uint64_t service = (uint64_t)(uintptr_t)ch_service;
+		uint32_t h = (uint32_t)(service ^ (service >> 32)) * 0x9e3779b1U;
+
+		h ^= words[0];
+		if (AF_INET6 == ch_family) {
+			h = (h * 0x85ebca6bU) ^ words[1];
+			h = (h * 0x85ebca6bU) ^ words[2];
+			h = (h * 0x85ebca6bU) ^ words[3];
+		}
+		h ^= h >> 16;
+		h *= 0x7feb352dU;
+		h ^= h >> 15;
+		return h;
 	}
 
 	inetd::Intrusive::TreeMemberHook<CHost> ch_rbnode;
@@ -153,33 +173,33 @@ typedef struct CHost {
 		struct in_addr addr4;
 		struct in6_addr addr6;
 	} ch_addrs;
-	const char *ch_service;			// service name.
+	const char *ch_service;			// service name; interned, compared by identity.
 	CTime ch_times[CHTSIZE];		// usage.
-	time_t ch_ltime;			// late update time.
+	time_t ch_ltime;			// last update time.
 	time_t ch_dtime;			// delay timestamp.
 } CHost;
 
 typedef inetd::intrusive_tree<CHost, CHost::Compare, inetd::Intrusive::TreeMemberHook<CHost>, &CHost::ch_rbnode> CHostTree_t;
 typedef inetd::intrusive_list<CHost, inetd::Intrusive::TailMemberHook<CHost>, &CHost::ch_listnode> CHostList_t;
 
-class HostCollection {
-	HostCollection(const HostCollection &) = delete;
-	HostCollection& operator=(const HostCollection &) = delete;
+//  Single shard; host tree plus least-recently-used list, under a spin lock.
+class HostShard {
+	HostShard(const HostShard &) = delete;
+	HostShard& operator=(const HostShard &) = delete;
 
 public:
-	HostCollection()
+	HostShard()
 	{
 	}
 
-	int check_limit(const struct sockaddr_storage &rss, const char *service, int maxcpm, int cpmwait)
+	int check_limit(const CHost &t_node, time_t now, int maxcpm, int cpmwait)
 	{
-		const time_t now = time(nullptr);
-		const unsigned int ticks = (unsigned int)(now / CHTGRAN);
-		inetd::CriticalSection::Guard guard(cs_);
+		const unsigned long ticks = (unsigned long)(now / CHTGRAN);
+		inetd::SpinLock::Guard guard(lock_);
 		CHost *node = nullptr;
 		int cnt = 0;
 
-		if (nullptr == (node = get_node(rss, service, now)))
+		if (nullptr == (node = get_node(t_node, now)))
 			return 0;		// node assignment error.
 
 		if (node->ch_dtime) {
@@ -215,19 +235,19 @@ public:
 	}
 
 private:
-	CHost *get_node(const struct sockaddr_storage &rss, const char *service, time_t now)
+	CHost *get_node(const CHost &t_node, time_t now)
 	{
-		CHost t_node(rss, service), *node = nullptr;
+		CHost *node = nullptr;
 
 		// lookup existing
 
 		if (nullptr != (node = tree_.find(t_node))) {
 			list_.remove(node);
 
-		// expire an existing, re-cycle node
+		// expire an existing, re-cycle node; once its usage window has elapsed
 
 		} else if (nullptr != (node = list_.front()) &&
-				(now + 60) > node->ch_ltime && now >= node->ch_dtime) {
+				now >= (node->ch_ltime + (CHTSIZE * CHTGRAN)) && now >= node->ch_dtime) {
 			list_.remove(node);
 			tree_.remove(node);
 
@@ -251,12 +271,34 @@ private:
 	}
 
 private:
-	inetd::CriticalSection cs_;
+	inetd::SpinLock lock_;
 	inetd::ObjectPool<CHost> pool_;
 	CHostTree_t tree_;
 	CHostList_t list_;
 };
 
+
+//  Host collection; sharded by (service, address) hash.
+class HostCollection {
+	HostCollection(const HostCollection &) = delete;
+	HostCollection& operator=(const HostCollection &) = delete;
+
+public:
+	HostCollection()
+	{
+	}
+
+	int check_limit(const struct sockaddr_storage &rss, const char *service, int maxcpm, int cpmwait)
+	{
+		const CHost t_node(rss, service);
+		HostShard &shard = shards_[t_node.hash() & (CHSHARDS - 1)];
+		return shard.check_limit(t_node, inetd::CoarseClock::seconds(), maxcpm, cpmwait);
+	}
+
+private:
+	HostShard shards_[CHSHARDS];
+};
+
 };  //namespace anon
 
 
@@ -286,6 +328,7 @@ cpmip(PeerInfo &remote)
 		if (clret) {
 			syslog(LOG_ERR, "%s from %s exceeded counts/min (limit %d/min)%s",
 			    sep->se_service, remote.getname(), maxcpm, (2 == clret ? " -- wait delay" : ""));
+			banviolation(remote, "cpm");
 			r = -1;
 		}
 	}
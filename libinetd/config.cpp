@@ -62,6 +62,7 @@
 
 #include "inetd.h"
 #include "config.h"
+#include "servdb.h"
 
 #if !defined(MAX)
 #define MIN(X,Y)	((X) < (Y) ? (X) : (Y))
@@ -390,14 +391,13 @@ more:
 #if defined(HAVE_AF_UNIX)
 		if (AF_UNIX != sep->se_family) {
 #endif
-			struct servent *sp;
-			sp = getservbyname(sep->se_service, sep->se_proto);
-			if (nullptr == sp) {
+			const int port = servdbport(sep->se_service, sep->se_proto);
+			if (-1 == port) {
 				syslog(LOG_ERR, "%s/%s: unknown service",
 					sep->se_service, sep->se_proto);
 				goto more;
 			}
-			sep->se_port = sp->s_port;
+			sep->se_port = port;
 #if defined(HAVE_AF_UNIX)
 		}
 #endif
@@ -602,9 +602,7 @@ more:
 static int
 matchservent(const char *name1, const char *name2, const char *proto)
 {
-	char **alias;
 	const char *p;
-	struct servent *se;
 
 	if (strcmp(proto, "unix") == 0) {
 		if ((p = strrchr(name1, '/')) != NULL)
@@ -614,14 +612,7 @@ matchservent(const char *name1, const char *name2, const char *proto)
 	}
 	if (strcmp(name1, name2) == 0)
 		return(1);
-	if ((se = getservbyname(name1, proto)) != NULL) {
-		if (strcmp(name2, se->s_name) == 0)
-			return(1);
-		for (alias = se->s_aliases; *alias; alias++)
-			if (strcmp(name2, *alias) == 0)
-				return(1);
-	}
-	return(0);
+	return servdbmatch(name1, name2, proto);
 }
 
 /*
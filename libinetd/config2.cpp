@@ -82,6 +82,16 @@ getconfigdef2(const char *key, char &op, unsigned idx)
 }
 
 
+const std::vector<std::string> *
+getconfigsources2(void)
+{
+	if (parser) {
+		return parser->sources();
+	}
+	return nullptr;
+}
+
+
 void
 endconfig2(void)
 {
@@ -27,6 +27,8 @@
  */
 
 #include <istream>
+#include <string>
+#include <vector>
 
 #include "config.h"
 
@@ -36,6 +38,7 @@ int setconfig2(const char *path);
 int setconfig2(std::istream &stream, const char *path);
 const char *setconfig2status(int *error_code);
 const char *getconfigdef2(const char *key, char &op, unsigned idx = 0);
+const std::vector<std::string> *getconfigsources2(void);
 struct servconfig *getconfigent2(const struct configparams *params, int *ret);
 void endconfig2(void);
 
@@ -0,0 +1,517 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - configuration watcher.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include "inetd.h"
+
+#include <syslog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32) && defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAVE_INOTIFY	1
+#endif
+
+#include "confwatch.h"
+
+namespace {
+struct Watch {
+	Watch(const std::string &t_directory) : directory(t_directory), any(false)
+#if defined(_WIN32)
+		, handle(INVALID_HANDLE_VALUE), overlapped()
+#elif defined(HAVE_INOTIFY)
+		, wd(-1)
+#endif
+	{
+	}
+
+	std::string directory;
+	std::vector<std::string> names;		// files of interest.
+	bool any;				// any modification; includedir.
+#if defined(_WIN32)
+	HANDLE handle;
+	OVERLAPPED overlapped;
+	DWORD buffer[4096];			// FILE_NOTIFY_INFORMATION, DWORD aligned.
+#elif defined(HAVE_INOTIFY)
+	int wd;
+#endif
+};
+
+
+class ConfWatch {
+	ConfWatch(const ConfWatch &) = delete;
+	ConfWatch& operator=(const ConfWatch &) = delete;
+
+public:
+	ConfWatch() : reload_(nullptr), lost_(false)
+#if defined(_WIN32)
+		, stop_(nullptr)
+#elif defined(HAVE_INOTIFY)
+		, fd_(-1)
+#endif
+	{
+#if defined(HAVE_INOTIFY)
+		stop_[0] = stop_[1] = -1;
+#endif
+	}
+
+	~ConfWatch()
+	{
+		stop();
+	}
+
+	bool start(const std::vector<std::string> &sources, void (*reload)(void));
+	void stop();
+
+	bool current(const std::vector<std::string> &sources) const
+	{
+		return (thread_.joinable() && ! lost_ && sources_ == sources);
+	}
+
+private:
+	void add(const std::string &source);
+	bool relevant(const Watch &watch, const char *name) const;
+	bool open();
+	void close();
+	int wait(int timeout);
+	void run();
+#if defined(_WIN32)
+	static bool arm(Watch &watch);
+#endif
+
+	std::vector<std::string> sources_;
+	std::vector<std::unique_ptr<Watch>> watches_; // stable addresses; overlapped i/o.
+	void (*reload_)(void);
+	std::atomic<bool> lost_;		// watch lost; re-establish on next load.
+	std::thread thread_;
+#if defined(_WIN32)
+	HANDLE stop_;
+#elif defined(HAVE_INOTIFY)
+	int fd_;
+	int stop_[2];
+#endif
+};
+
+
+/*
+ *  Watch 'source'; a file by its parent directory, otherwise an includedir (trailing '/').
+ */
+void
+ConfWatch::add(const std::string &source)
+{
+	const bool directory = (! source.empty() && ('/' == source.back() || '\\' == source.back()));
+	std::string path(source), name;
+
+	if (directory) {
+		path.pop_back();
+	} else {
+		const std::string::size_type slash = path.find_last_of("/\\");
+		if (std::string::npos == slash) {
+			name.swap(path);
+			path = ".";
+		} else {
+			name = path.substr(slash + 1);
+			path.erase(slash ? slash : 1);
+		}
+	}
+
+	for (auto &it : watches_) {
+		Watch &watch = *it;
+		if (watch.directory == path) {
+			if (directory) {
+				watch.any = true;
+				watch.names.clear();
+			} else if (! watch.any) {
+				watch.names.push_back(name);
+			}
+			return;
+		}
+	}
+
+	watches_.emplace_back(new Watch(path));
+	if (directory) {
+		watches_.back()->any = true;
+	} else {
+		watches_.back()->names.push_back(name);
+	}
+}
+
+
+bool
+ConfWatch::relevant(const Watch &watch, const char *name) const
+{
+	if (watch.any || nullptr == name || 0 == *name)
+		return true;			// includedir or unnamed event.
+	for (const auto &it : watch.names) {
+#if defined(_WIN32)
+		if (0 == _stricmp(it.c_str(), name))
+#else
+		if (0 == strcmp(it.c_str(), name))
+#endif
+			return true;
+	}
+	return false;
+}
+
+
+bool
+ConfWatch::start(const std::vector<std::string> &sources, void (*reload)(void))
+{
+	stop();
+
+	sources_ = sources;
+	reload_ = reload;
+	lost_ = false;
+	for (const auto &source : sources)
+		add(source);
+
+	if (! open()) {
+		close();
+		return false;
+	}
+	thread_ = std::thread(&ConfWatch::run, this);
+	return true;
+}
+
+
+void
+ConfWatch::stop()
+{
+	if (thread_.joinable()) {
+#if defined(_WIN32)
+		::SetEvent(stop_);
+#elif defined(HAVE_INOTIFY)
+		(void) ::write(stop_[1], "", 1);
+#endif
+		thread_.join();
+	}
+	close();
+}
+
+
+#if defined(_WIN32)
+//static
+bool
+ConfWatch::arm(Watch &watch)
+{
+	return (::ReadDirectoryChangesW(watch.handle, watch.buffer, sizeof(watch.buffer), FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME|FILE_NOTIFY_CHANGE_DIR_NAME|FILE_NOTIFY_CHANGE_SIZE|FILE_NOTIFY_CHANGE_LAST_WRITE,
+			nullptr, &watch.overlapped, nullptr) ? true : false);
+}
+
+
+bool
+ConfWatch::open()
+{
+	unsigned count = 0;
+
+	if (nullptr == (stop_ = ::CreateEventA(nullptr, TRUE, FALSE, nullptr)))
+		return false;
+
+	for (auto &it : watches_) {
+		Watch &watch = *it;
+
+		if (++count >= MAXIMUM_WAIT_OBJECTS) {
+			syslog(LOG_WARNING, "confwatch: %s: too many directories, not watched", watch.directory.c_str());
+			continue;
+		}
+
+		watch.handle = ::CreateFileA(watch.directory.c_str(), FILE_LIST_DIRECTORY,
+				FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+				FILE_FLAG_BACKUP_SEMANTICS|FILE_FLAG_OVERLAPPED, nullptr);
+		if (INVALID_HANDLE_VALUE == watch.handle) {
+			syslog(LOG_WARNING, "confwatch: %s: unable to watch (%u)", watch.directory.c_str(), (unsigned)::GetLastError());
+			continue;
+		}
+
+		if (nullptr == (watch.overlapped.hEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr)) || ! arm(watch)) {
+			syslog(LOG_WARNING, "confwatch: %s: unable to watch (%u)", watch.directory.c_str(), (unsigned)::GetLastError());
+			if (watch.overlapped.hEvent)
+				::CloseHandle(watch.overlapped.hEvent), watch.overlapped.hEvent = nullptr;
+			::CloseHandle(watch.handle), watch.handle = INVALID_HANDLE_VALUE;
+		}
+	}
+	return true;
+}
+
+
+void
+ConfWatch::close()
+{
+	for (auto &it : watches_) {
+		Watch &watch = *it;
+
+		if (INVALID_HANDLE_VALUE != watch.handle) {
+			DWORD bytes = 0;
+
+			::CancelIoEx(watch.handle, &watch.overlapped);
+			(void) ::GetOverlappedResult(watch.handle, &watch.overlapped, &bytes, TRUE);
+			::CloseHandle(watch.handle);
+		}
+		if (watch.overlapped.hEvent)
+			::CloseHandle(watch.overlapped.hEvent);
+	}
+	watches_.clear();
+	if (stop_) {
+		::CloseHandle(stop_);
+		stop_ = nullptr;
+	}
+}
+
+
+/*
+ *  Wait for a modification; 1 when relevant, 0 otherwise or upon timeout, -1 when stopped.
+ */
+int
+ConfWatch::wait(int timeout)
+{
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	Watch *active[MAXIMUM_WAIT_OBJECTS];
+	DWORD count = 0;
+
+	handles[count++] = stop_;
+	for (auto &it : watches_) {
+		if (INVALID_HANDLE_VALUE != it->handle && count < MAXIMUM_WAIT_OBJECTS) {
+			active[count] = it.get();
+			handles[count++] = it->overlapped.hEvent;
+		}
+	}
+
+	const DWORD rc = ::WaitForMultipleObjects(count, handles, FALSE, (timeout < 0 ? INFINITE : (DWORD)timeout));
+	if (WAIT_TIMEOUT == rc)
+		return 0;
+	if (WAIT_OBJECT_0 == rc || rc >= (WAIT_OBJECT_0 + count))
+		return -1;			// stop or error.
+
+	Watch &watch = *active[rc - WAIT_OBJECT_0];
+	DWORD bytes = 0;
+	bool changed = false;
+
+	if (! ::GetOverlappedResult(watch.handle, &watch.overlapped, &bytes, FALSE) || 0 == bytes) {
+		changed = true;			// buffer overflow; assume relevant.
+	} else {
+		const char *cursor = (const char *)watch.buffer;
+		for (;;) {
+			const FILE_NOTIFY_INFORMATION *info = (const FILE_NOTIFY_INFORMATION *)cursor;
+			char name[MAX_PATH * 2];
+			int len;
+
+			len = ::WideCharToMultiByte(CP_ACP, 0, info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)),
+					name, sizeof(name) - 1, nullptr, nullptr);
+			name[len > 0 ? len : 0] = 0;
+			if (relevant(watch, name))
+				changed = true;
+			if (0 == info->NextEntryOffset)
+				break;
+			cursor += info->NextEntryOffset;
+		}
+	}
+
+	::ResetEvent(watch.overlapped.hEvent);
+	if (! arm(watch)) {			// directory removed?
+		syslog(LOG_WARNING, "confwatch: %s: watch lost (%u)", watch.directory.c_str(), (unsigned)::GetLastError());
+		::CloseHandle(watch.handle), watch.handle = INVALID_HANDLE_VALUE;
+		lost_ = changed = true;
+	}
+	return (changed ? 1 : 0);
+}
+
+#elif defined(HAVE_INOTIFY)
+
+bool
+ConfWatch::open()
+{
+	if ((fd_ = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0 || pipe2(stop_, O_CLOEXEC) < 0) {
+		syslog(LOG_WARNING, "confwatch: inotify: %m");
+		return false;
+	}
+
+	for (auto &it : watches_) {
+		Watch &watch = *it;
+
+		watch.wd = inotify_add_watch(fd_, watch.directory.c_str(),
+				IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF);
+		if (watch.wd < 0)
+			syslog(LOG_WARNING, "confwatch: %s: unable to watch : %m", watch.directory.c_str());
+	}
+	return true;
+}
+
+
+void
+ConfWatch::close()
+{
+	watches_.clear();
+	if (fd_ >= 0)
+		::close(fd_), fd_ = -1;
+	if (stop_[0] >= 0)
+		::close(stop_[0]), ::close(stop_[1]), stop_[0] = stop_[1] = -1;
+}
+
+
+/*
+ *  Wait for a modification; 1 when relevant, 0 otherwise or upon timeout, -1 when stopped.
+ */
+int
+ConfWatch::wait(int timeout)
+{
+	struct pollfd fds[2] = {{fd_, POLLIN, 0}, {stop_[0], POLLIN, 0}};
+	alignas(struct inotify_event) char buffer[4096];
+	bool changed = false;
+	ssize_t len;
+	int rc;
+
+	if ((rc = poll(fds, 2, timeout)) <= 0)
+		return ((0 == rc || EINTR == errno) ? 0 : -1);
+	if (fds[1].revents)
+		return -1;			// stop.
+
+	while ((len = ::read(fd_, buffer, sizeof(buffer))) > 0) {
+		for (const char *cursor = buffer; cursor < buffer + len;) {
+			const struct inotify_event *event = (const struct inotify_event *)cursor;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				changed = true;
+			} else {
+				for (const auto &it : watches_) {
+					const Watch &watch = *it;
+					if (watch.wd != event->wd)
+						continue;
+					if (event->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED)) {
+						lost_ = changed = true;
+					} else if (relevant(watch, (event->len ? event->name : nullptr))) {
+						changed = true;
+					}
+				}
+			}
+			cursor += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return (changed ? 1 : 0);
+}
+
+#else	//unsupported
+
+bool
+ConfWatch::open()
+{
+	return false;
+}
+
+
+void
+ConfWatch::close()
+{
+	watches_.clear();
+}
+
+
+int
+ConfWatch::wait(int timeout)
+{
+	(void) timeout;
+	return -1;
+}
+
+#endif
+
+
+/*
+ *  Watcher thread; modifications are debounced, CONFWATCH_QUIET following the last
+ *  yet no later than CONFWATCH_DELAY following the first, into a single reload.
+ */
+void
+ConfWatch::run()
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point first, last;
+	bool pending = false;
+	int ret;
+
+	for (;;) {
+		int timeout = -1;		// infinite.
+
+		if (pending) {
+			const clock::time_point now = clock::now(),
+				deadline = std::min(last + std::chrono::milliseconds(CONFWATCH_QUIET),
+						first + std::chrono::milliseconds(CONFWATCH_DELAY));
+
+			if (now >= deadline) {
+				pending = false;
+				if (debug)
+					syslog(LOG_DEBUG, "confwatch: configuration modified, reloading");
+				reload_();
+				continue;
+			}
+			timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+		}
+
+		if ((ret = wait(timeout)) < 0)
+			break;
+		if (ret > 0) {
+			last = clock::now();
+			if (! pending) {
+				first = last;
+				pending = true;
+			}
+		}
+	}
+}
+
+
+static ConfWatch confwatch;
+}; //namespace
+
+
+/*
+ *  Watch the configuration 'sources', invoking 'reload' upon modification; sources are
+ *  reported by the configuration load, with includedir directories having a trailing '/'.
+ */
+int
+setconfwatch(const std::vector<std::string> &sources, void (*reload)(void))
+{
+	if (confwatch.current(sources))
+		return 1;			// unchanged.
+	return (confwatch.start(sources, reload) ? 1 : 0);
+}
+
+
+void
+endconfwatch(void)
+{
+	confwatch.stop();
+}
+
+//end
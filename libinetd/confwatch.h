@@ -0,0 +1,47 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - configuration watcher.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <string>
+#include <vector>
+
+/*
+ *  Configuration watcher.
+ *
+ *  The configuration sources, being the main configuration, include files and includedir
+ *  directories, are watched for modification; ReadDirectoryChangesW under Windows and
+ *  inotify under Linux. A burst of modifications is debounced into a single reload
+ *  request, raised once the sources have been quiet for CONFWATCH_QUIET milliseconds,
+ *  or at the latest CONFWATCH_DELAY milliseconds after the first.
+ */
+
+#define CONFWATCH_QUIET		500
+#define CONFWATCH_DELAY		5000
+
+int	setconfwatch(const std::vector<std::string> &sources, void (*reload)(void));
+void	endconfwatch(void);
+
+//end
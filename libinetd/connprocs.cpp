@@ -32,59 +32,48 @@
 #include "inetd.h"
 
 
-struct connprocs::Guard : public inetd::SpinLock::Guard
+/*
+ *  Per source child collection.
+ *
+ *  Children are linked through procinfo::pr_conn_link_, so no storage is reserved
+ *  per source address; the owning conntable lock serialises access.
+ */
+
+conninfo::conninfo(const struct sockaddr_storage *ss, int maxperip)
+	: co_table(nullptr), co_family(ss->ss_family), co_addr(), co_procs(maxperip)
 {
-	Guard(connprocs &cps) : inetd::SpinLock::Guard(cps.cp_lock)
-	{
+	if (AF_INET6 == co_family) {
+		co_addr.addr6 = ((const struct sockaddr_in6 *)ss)->sin6_addr;
+	} else {
+		co_addr.addr4 = ((const struct sockaddr_in *)ss)->sin_addr;
 	}
-};
+}
 
 
 connprocs::connprocs(int maxperip)
+	: cp_numchild(0), cp_maxchild(maxperip)
 {
-	cp_procs.reserve(maxperip);
-	cp_maxchild = maxperip;
+	LIST_INIT(&cp_procs);
 }
 
 
 bool
-connprocs::resize(int maxperip /*bool trim*/)
+connprocs::resize(int maxperip)
 {
-	Guard spin_guard(*this);
-
-	if (cp_maxchild == maxperip)
-		return true;
-
-//	const int numchild = procs.numchild();
-//	if (trim && maxperip < numchild) {
-//		for (int i = maxperip; i < numchild; ++i) {
-//			if (struct procinfo *proc = procs.cp_procs[i]) {
-//				assert(proc->pr_conn == conn);
-//				proc->pr_conn = nullptr;
-//				assert(nullptr != proc->pr_sep);
-//			}
-//		}
-//		cp_procs.resize(maxperip);
-//	}
-
-	try {
-		cp_procs.reserve(maxperip);
-		cp_maxchild = maxperip;
-		return true;
-	} catch(...) { /*memory-error*/ }
-	return false;
+	// note: existing children above the new limit are retained, until reaped.
+	cp_maxchild = maxperip;
+	return true;
 }
 
 
 struct procinfo *
 connprocs::newproc(struct conninfo *conn, int &maxchild)
 {
-	connprocs::Guard spin_guard(*this);
-
 	if ((maxchild = cp_maxchild) > 0) {
 		if (numchild() < maxchild) {
 			if (struct procinfo *proc = new(std::nothrow) procinfo) {
-				cp_procs.push_back(proc);
+				LIST_INSERT_HEAD(&cp_procs, proc, pr_conn_link_);
+				++cp_numchild;
 				proc->pr_conn = conn;
 				return proc;
 			}
@@ -99,37 +88,28 @@ connprocs::newproc(struct conninfo *conn, int &maxchild)
 bool
 connprocs::unlink(struct procinfo *proc)
 {
-	connprocs::Guard spin_guard(*this);
-
 	assert(proc->pr_conn != nullptr);
-	for (int it = 0, end = numchild(); it < end; ++it) {
-		if (cp_procs[it] == proc) {
-			// remove element by reorging last
-			if (end-- /*remove trail*/ && it != end) {
-				cp_procs[it] = cp_procs[end];
-			}
-			cp_procs.resize(end);
-			proc->pr_conn = nullptr;
-			return true;
-		}
-	}
-	assert(proc->pr_conn != nullptr);
-	return false;
+	if (nullptr == proc->pr_conn)
+		return false;
+
+	LIST_REMOVE(proc, pr_conn_link_);
+	--cp_numchild;
+	proc->pr_conn = nullptr;
+	return true;
 }
 
 
 void
 connprocs::clear(struct conninfo *conn)
 {
-	connprocs::Guard spin_guard(*this);
+	struct procinfo *proc;
 
-	for (int it = 0, end = numchild(); it < end; ++it) {
-		if (struct procinfo *proc = cp_procs[it]) {
-			assert(proc->pr_conn == conn);
-			proc->pr_conn = nullptr;
-		}
+	while (nullptr != (proc = LIST_FIRST(&cp_procs))) {
+		assert(proc->pr_conn == conn);
+		LIST_REMOVE(proc, pr_conn_link_);
+		proc->pr_conn = nullptr;
 	}
-	cp_procs.clear();
+	cp_numchild = 0;
 }
 
 //end
\ No newline at end of file
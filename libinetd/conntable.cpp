@@ -0,0 +1,326 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - per source connection table.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include "inetd.h"
+
+#include "conntable.h"
+#include "SipHash.h"
+
+#define CT_MINSIZE	16			// initial/minimum capacity; power of 2.
+#define CT_STRIPES	64			// lock stripes; power of 2.
+
+static const inetd::SipHash ct_siphash(inetd::SipHash::random());
+
+static struct Stripe {				// cache line per stripe.
+	inetd::SpinLock lock;
+	char pad[64 - sizeof(inetd::SpinLock)];
+} ct_stripes[CT_STRIPES];
+
+
+conntable::conntable()
+	: slots_(nullptr), capacity_(0), count_(0)
+{
+}
+
+
+conntable::~conntable()
+{
+	clear();
+}
+
+
+/*
+ *  Locate or create the source entry, and allocate a child slot against it.
+ */
+conntable::status
+conntable::acquire(const struct sockaddr_storage *ss, int maxperip,
+		struct conninfo *&conn, struct procinfo *&proc)
+{
+	const uint32_t hv = hash(ss);
+	inetd::SpinLock::Guard guard(lock());
+	int maxchild = 0;
+
+	conn = nullptr, proc = nullptr;
+	if (slot *sl = find(ss, hv)) {
+		conn = sl->conn;
+
+	} else {
+		if (nullptr == (conn = new(std::nothrow) conninfo(ss, maxperip)))
+			return CT_ERROR;
+		conn->co_table = this;
+		if (! insert(conn, hv)) {
+			delete conn;
+			conn = nullptr;
+			return CT_ERROR;
+		}
+	}
+
+	proc = conn->co_procs.newproc(conn, maxchild);
+	if (nullptr == proc || (struct procinfo *)-1 == proc) {
+		const status ret = (nullptr == proc && maxchild > 0 ? CT_LIMIT : CT_ERROR);
+
+		proc = nullptr;
+		if (conn->co_procs.numchild() <= 0) {
+			erase(find(ss, hv));	// new, yet unused.
+			delete conn;
+		}
+		conn = nullptr;
+		return ret;
+	}
+	proc->pr_table = this;
+	return CT_OK;
+}
+
+
+/*
+ *  Detach the child from its source entry, releasing the entry once no children remain.
+ *
+ *  The association is only read under the stripe lock; clear() may concurrently detach
+ *  and destroy the entry, see connections_resize().
+ */
+bool
+conntable::unlink(struct procinfo *proc)
+{
+	assert(proc->pr_table == this);
+
+	inetd::SpinLock::Guard guard(lock());
+	struct conninfo *conn = proc->pr_conn;
+
+	if (nullptr == conn)
+		return false;
+	assert(conn->co_table == this);
+	if (! conn->co_procs.unlink(proc))
+		return false;
+
+	if (conn->co_procs.numchild() <= 0) {
+		slot *sl = find(conn, hash(conn));
+		assert(sl && sl->conn == conn);
+		if (sl && sl->conn == conn) {
+			erase(sl);
+		}
+		delete conn;
+	}
+	return true;
+}
+
+
+bool
+conntable::resize(int maxperip)
+{
+	inetd::SpinLock::Guard guard(lock());
+
+	for (unsigned i = 0; i < capacity_; ++i) {
+		if (struct conninfo *conn = slots_[i].conn) {
+			if (! conn->co_procs.resize(maxperip))
+				return false;
+		}
+	}
+	return true;
+}
+
+
+void
+conntable::clear()
+{
+	inetd::SpinLock::Guard guard(lock());
+
+	for (unsigned i = 0; i < capacity_; ++i) {
+		if (struct conninfo *conn = slots_[i].conn) {
+			conn->co_procs.clear(conn);
+				// note: underlying procinfo's are not destroyed
+				//  these are assumed to be owned by the childlist.
+			delete conn;
+		}
+	}
+	free(slots_);
+	slots_ = nullptr;
+	capacity_ = count_ = 0;
+}
+
+
+size_t
+conntable::size() const
+{
+	return count_;
+}
+
+
+inetd::SpinLock &
+conntable::lock() const
+{
+	const uintptr_t key = (uintptr_t)this;
+	return ct_stripes[((key >> 6) ^ (key >> 12)) & (CT_STRIPES - 1)].lock;
+}
+
+
+//static
+uint32_t
+conntable::hash(int family, const void *addr)
+{
+	return (uint32_t) ct_siphash(addr, AF_INET6 == family ? sizeof(struct in6_addr) : sizeof(struct in_addr));
+}
+
+
+//static
+uint32_t
+conntable::hash(const struct sockaddr_storage *ss)
+{
+	if (AF_INET6 == ss->ss_family) {
+		return hash(AF_INET6, &((const struct sockaddr_in6 *)ss)->sin6_addr);
+	}
+	return hash(AF_INET, &((const struct sockaddr_in *)ss)->sin_addr);
+}
+
+
+//static
+uint32_t
+conntable::hash(const struct conninfo *conn)
+{
+	return hash(conn->co_family, &conn->co_addr);
+}
+
+
+//static
+bool
+conntable::equal(const struct conninfo *conn, const struct sockaddr_storage *ss)
+{
+	if (conn->co_family != ss->ss_family)
+		return false;
+	if (AF_INET6 == ss->ss_family) {
+		return (0 == memcmp(&conn->co_addr.addr6,
+				&((const struct sockaddr_in6 *)ss)->sin6_addr, sizeof(struct in6_addr)));
+	}
+	return (conn->co_addr.addr4.s_addr == ((const struct sockaddr_in *)ss)->sin_addr.s_addr);
+}
+
+
+conntable::slot *
+conntable::find(const struct sockaddr_storage *ss, uint32_t hv) const
+{
+	if (0 == count_)
+		return nullptr;
+
+	const unsigned mask = capacity_ - 1;
+	for (unsigned idx = hv & mask;; idx = (idx + 1) & mask) {
+		slot *sl = slots_ + idx;
+		if (nullptr == sl->conn)
+			return nullptr;
+		if (sl->hash == hv && equal(sl->conn, ss))
+			return sl;
+	}
+	/*NOTREACHED*/
+}
+
+
+conntable::slot *
+conntable::find(const struct conninfo *conn, uint32_t hv) const
+{
+	if (0 == count_)
+		return nullptr;
+
+	const unsigned mask = capacity_ - 1;
+	for (unsigned idx = hv & mask;; idx = (idx + 1) & mask) {
+		slot *sl = slots_ + idx;
+		if (nullptr == sl->conn || sl->conn == conn)
+			return (sl->conn ? sl : nullptr);
+	}
+	/*NOTREACHED*/
+}
+
+
+bool
+conntable::insert(struct conninfo *conn, uint32_t hv)
+{
+	if (((count_ + 1) * 10) > (capacity_ * 7)) {	// load factor 0.7
+		if (! rehash(capacity_ ? capacity_ * 2 : CT_MINSIZE))
+			return false;
+	}
+
+	const unsigned mask = capacity_ - 1;
+	unsigned idx = hv & mask;
+	while (slots_[idx].conn)
+		idx = (idx + 1) & mask;
+	slots_[idx].hash = hv;
+	slots_[idx].conn = conn;
+	++count_;
+	return true;
+}
+
+
+void
+conntable::erase(slot *sl)
+{
+	const unsigned mask = capacity_ - 1;
+	unsigned hole = (unsigned)(sl - slots_), idx = hole;
+
+	assert(sl && sl->conn);
+	for (;;) {				// backward shift.
+		idx = (idx + 1) & mask;
+		if (nullptr == slots_[idx].conn)
+			break;
+
+		const unsigned home = slots_[idx].hash & mask;
+		if (hole <= idx ? (hole < home && home <= idx) : (hole < home || home <= idx))
+			continue;		// already within its probe sequence.
+		slots_[hole] = slots_[idx];
+		hole = idx;
+	}
+	slots_[hole].conn = nullptr;
+
+	if (0 == --count_) {			// idle; release storage.
+		free(slots_);
+		slots_ = nullptr;
+		capacity_ = 0;
+
+	} else if (capacity_ > CT_MINSIZE && (count_ * 8) < capacity_) {
+		(void) rehash(capacity_ / 2);	// shrink; failure benign.
+	}
+}
+
+
+bool
+conntable::rehash(unsigned capacity)
+{
+	slot *nslots = (slot *)calloc(capacity, sizeof(slot));
+	if (nullptr == nslots)
+		return false;
+
+	const unsigned mask = capacity - 1;
+	for (unsigned i = 0; i < capacity_; ++i) {
+		if (slots_[i].conn) {
+			unsigned idx = slots_[i].hash & mask;
+			while (nslots[idx].conn)
+				idx = (idx + 1) & mask;
+			nslots[idx] = slots_[i];
+		}
+	}
+	free(slots_);
+	slots_ = nslots;
+	capacity_ = capacity;
+	return true;
+}
+
+//end
@@ -0,0 +1,82 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - per source connection table.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <stdint.h>
+
+#include "SimpleLock.h"
+
+struct conninfo;
+struct procinfo;
+
+/*
+ *  Open addressing (linear probe, backward shift deletion) table of source addresses,
+ *  keyed on the binary address using a keyed SipHash; grows and shrinks with load.
+ *
+ *  Storage is only allocated once a source is tracked (per_source > 0) and released
+ *  when the last source is; tables are guarded by a shared striped spin lock.
+ */
+class conntable {
+	conntable(const conntable &) = delete;
+	conntable& operator=(const conntable &) = delete;
+
+public:
+	enum status { CT_OK, CT_LIMIT, CT_ERROR };
+
+	conntable();
+	~conntable();
+
+	status acquire(const struct sockaddr_storage *ss, int maxperip,
+			struct conninfo *&conn, struct procinfo *&proc);
+	bool unlink(struct procinfo *proc);
+	bool resize(int maxperip);
+	void clear();
+	size_t size() const;
+
+private:
+	struct slot {
+		uint32_t hash;			// cached hash.
+		struct conninfo *conn;		// nullptr, when empty.
+	};
+
+	inetd::SpinLock &lock() const;
+	static uint32_t hash(int family, const void *addr);
+	static uint32_t hash(const struct sockaddr_storage *ss);
+	static uint32_t hash(const struct conninfo *conn);
+	static bool equal(const struct conninfo *conn, const struct sockaddr_storage *ss);
+	slot *find(const struct sockaddr_storage *ss, uint32_t hv) const;
+	slot *find(const struct conninfo *conn, uint32_t hv) const;
+	bool insert(struct conninfo *conn, uint32_t hv);
+	void erase(slot *sl);
+	bool rehash(unsigned capacity);
+
+private:
+	slot *slots_;
+	unsigned capacity_;			// power of 2; 0 until first use.
+	unsigned count_;
+};
+
+//end
@@ -167,6 +167,20 @@ environment::setenv()
 }
 
 
+const environment::Collection&
+environment::passenv() const
+{
+	return passenv_;
+}
+
+
+const environment::Collection&
+environment::setenv() const
+{
+	return setenv_;
+}
+
+
 const char **
 environment::get() const
 {
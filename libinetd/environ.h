@@ -43,6 +43,8 @@ public:
 	const char **get() const;
 	Collection& passenv();
 	Collection& setenv();
+	const Collection& passenv() const;
+	const Collection& setenv() const;
 	bool empty() const;
 	void clear();
 	void reset();
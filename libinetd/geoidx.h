@@ -0,0 +1,250 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * inetd::GeoIndex
+ * windows inetd service - native geoip range index.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Memory mappable country range index (.gidx), built from start,end,country CSV
+ *  range files by "mmdblookup --build".
+ *
+ *  Image layout, host (little-endian) byte order, each table 16 byte aligned:
+ *
+ *      header
+ *      v4 keys[1 + v4count]            uint32_t range start, Eytzinger order, [0] unused.
+ *      v4 ranks[1 + v4count]           uint32_t sorted index of each key.
+ *      v4 ends[v4count]                uint32_t range end, sorted order.
+ *      v4 codes[v4count]               char[4] country, sorted order.
+ *      v6 keys[1 + v6count]            key6 range start, Eytzinger order.
+ *      v6 ranks, ends, codes           as above.
+ *
+ *  The Eytzinger (breadth first) layout keeps the top levels of the search within a
+ *  few cache lines, and the descent is a fixed sequence of compares without a
+ *  data dependent branch.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace inetd {
+
+class GeoIndex {
+public:
+	enum { VERSION = 1, ALIGNMENT = 16 };
+
+	struct key6 {
+		uint64_t hi, lo;
+	};
+
+	struct header {
+		char magic[8];				// "GEOIDX\0\0"
+		uint32_t version;
+		uint32_t header_size;
+		uint32_t v4count;
+		uint32_t v6count;
+		uint64_t v4keys, v4ranks, v4ends, v4codes; // image offsets.
+		uint64_t v6keys, v6ranks, v6ends, v6codes;
+		uint64_t size;				// image size.
+	};
+
+	static const char *magic()
+	{
+		return "GEOIDX\0";
+	}
+
+	static key6 to_key6(const unsigned char addr[16])
+	{
+		key6 key = {0, 0};
+		for (unsigned i = 0; i < 8; ++i) {
+			key.hi = (key.hi << 8) | addr[i];
+			key.lo = (key.lo << 8) | addr[8 + i];
+		}
+		return key;
+	}
+
+	static uint32_t to_key4(const unsigned char addr[4])
+	{
+		return ((uint32_t)addr[0] << 24) | ((uint32_t)addr[1] << 16) | ((uint32_t)addr[2] << 8) | addr[3];
+	}
+
+	static size_t align(size_t offset)
+	{
+		return (offset + (ALIGNMENT - 1)) & ~(size_t)(ALIGNMENT - 1);
+	}
+
+	GeoIndex() : header_(nullptr)
+	{
+	}
+
+	// Validate and attach to an image.
+	bool attach(const void *base, size_t size)
+	{
+		const struct header *hdr = (const struct header *)base;
+
+		header_ = nullptr;
+		if (nullptr == base || size < sizeof(struct header) ||
+				0 != memcmp(hdr->magic, magic(), sizeof(hdr->magic)) ||
+				VERSION != hdr->version || sizeof(struct header) != hdr->header_size ||
+				hdr->size != size) {
+			return false;
+		}
+
+		const uint64_t v4count = hdr->v4count, v6count = hdr->v6count;
+			// 64-bit arithmetic; counts are 32-bit, no table length can overflow.
+
+		if (! within(hdr->v4keys, (v4count + 1) * sizeof(uint32_t), size) ||
+				! within(hdr->v4ranks, (v4count + 1) * sizeof(uint32_t), size) ||
+				! within(hdr->v4ends, v4count * sizeof(uint32_t), size) ||
+				! within(hdr->v4codes, v4count * 4, size) ||
+				! within(hdr->v6keys, (v6count + 1) * sizeof(key6), size) ||
+				! within(hdr->v6ranks, (v6count + 1) * sizeof(uint32_t), size) ||
+				! within(hdr->v6ends, v6count * sizeof(key6), size) ||
+				! within(hdr->v6codes, v6count * 4, size)) {
+			return false;
+		}
+
+		const char *image = (const char *)base;
+		if (! ranked((const uint32_t *)(image + hdr->v4ranks), hdr->v4count) ||
+				! ranked((const uint32_t *)(image + hdr->v6ranks), hdr->v6count)) {
+			return false;
+		}
+
+		v4keys_ = (const uint32_t *)(image + hdr->v4keys);
+		v4ranks_ = (const uint32_t *)(image + hdr->v4ranks);
+		v4ends_ = (const uint32_t *)(image + hdr->v4ends);
+		v4codes_ = image + hdr->v4codes;
+		v6keys_ = (const key6 *)(image + hdr->v6keys);
+		v6ranks_ = (const uint32_t *)(image + hdr->v6ranks);
+		v6ends_ = (const key6 *)(image + hdr->v6ends);
+		v6codes_ = image + hdr->v6codes;
+		header_ = hdr;
+		return true;
+	}
+
+	bool attached() const
+	{
+		return (nullptr != header_);
+	}
+
+	unsigned v4count() const
+	{
+		return header_ ? header_->v4count : 0;
+	}
+
+	unsigned v6count() const
+	{
+		return header_ ? header_->v6count : 0;
+	}
+
+	// Country of the range containing the address (host order), otherwise nullptr.
+	const char *lookup4(uint32_t addr) const
+	{
+		const size_t n = header_->v4count;
+		size_t k = 1;
+
+		while (k <= n)
+			k = (2 * k) + (v4keys_[k] <= addr);
+		k >>= ctz(~k) + 1;			// first key > addr, 0 if none.
+
+		const size_t successor = (k ? v4ranks_[k] : n);
+		if (0 == successor)
+			return nullptr;
+		const size_t idx = successor - 1;	// last key <= addr.
+		return (addr <= v4ends_[idx] ? v4codes_ + (idx * 4) : nullptr);
+	}
+
+	const char *lookup6(const key6 &addr) const
+	{
+		const size_t n = header_->v6count;
+		size_t k = 1;
+
+		while (k <= n)
+			k = (2 * k) + le(v6keys_[k], addr);
+		k >>= ctz(~k) + 1;
+
+		const size_t successor = (k ? v6ranks_[k] : n);
+		if (0 == successor)
+			return nullptr;
+		const size_t idx = successor - 1;
+		return (le(addr, v6ends_[idx]) ? v6codes_ + (idx * 4) : nullptr);
+	}
+
+private:
+	static bool within(uint64_t offset, uint64_t length, size_t size)
+	{
+		return (0 == (offset % ALIGNMENT) && offset <= size && length <= (size - offset));
+	}
+
+	// Each rank indexes the sorted ends and codes, see lookup4(); [0] unused.
+	static bool ranked(const uint32_t *ranks, uint32_t count)
+	{
+		for (uint64_t k = 1; k <= count; ++k) {
+			if (ranks[k] >= count)
+				return false;
+		}
+		return true;
+	}
+
+	static inline size_t le(const key6 &a, const key6 &b)
+	{
+		return (size_t)((a.hi < b.hi) | ((a.hi == b.hi) & (a.lo <= b.lo)));
+	}
+
+	static inline unsigned ctz(size_t value)
+	{
+#if defined(_MSC_VER)
+		unsigned long idx;
+#if defined(_WIN64)
+		_BitScanForward64(&idx, (unsigned __int64)value);
+#else
+		_BitScanForward(&idx, (unsigned long)value);
+#endif
+		return (unsigned)idx;
+#elif defined(__GNUC__)
+		return (unsigned)__builtin_ctzll((unsigned long long)value);
+#else
+		unsigned idx = 0;
+		while (0 == (value & 1))
+			value >>= 1, ++idx;
+		return idx;
+#endif
+	}
+
+private:
+	const struct header *header_;
+	const uint32_t *v4keys_, *v4ranks_, *v4ends_;
+	const char *v4codes_;
+	const key6 *v6keys_, *v6ends_;
+	const uint32_t *v6ranks_;
+	const char *v6codes_;
+};
+
+}   //namespace inetd
+
+//end
@@ -26,12 +26,24 @@
 
 #include "inetd.h"
 
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <process.h>
+#if defined(_WIN32)
+#include <io.h>
+#endif
+
 #include <map>
+#include <algorithm>
 #include <syslog.h>
 
 #include "geoips.h"
+#include "geoidx.h"
 #include "xinetd.h"
 
+#include "../libiptable/rcu_radix.h"
+
 
 /////////////////////////////////////////////////////////////////////////////////////////
 //  Geoipdb
@@ -52,6 +64,26 @@ struct Profile {
 }; //namespace
 
 
+// Touch each page of the mapping, optionally locking into memory;
+// avoids page-fault latency against the first lookups.
+static void
+prefault_mapping(const void *base, size_t size, const char *filename, bool lock)
+{
+	const volatile uint8_t *content = (const volatile uint8_t *)base;
+	unsigned sum = 0;
+
+	if (nullptr == base)
+		return;
+	for (size_t offset = 0; offset < size; offset += 4096)
+		sum += content[offset];
+	(void) sum;
+
+	if (lock && -1 == mlock(base, size)) {
+		syslog(LOG_WARNING, "geoip: mlock <%s> : %m", filename);
+	}
+}
+
+
 #if defined(HAVE_LIBMAXMINDDB)
 #if defined(ssize_t)
 #undef ssize_t
@@ -64,13 +96,13 @@ struct Profile {
 
 #include <maxminddb/maxminddb.h>
 
-class geoipdb {
+class geoipmmdb {
 public:
-	geoipdb() : mmdb_(), is_open_(false)
+	geoipmmdb() : mmdb_(), is_open_(false)
 	{
 	}
 
-	~geoipdb()
+	~geoipmmdb()
 	{
 		close();
 	}
@@ -121,6 +153,12 @@ public:
 		return is_open_;
 	}
 
+	void prefault(const char *filename, bool lock)
+	{
+		if (is_open_)
+			prefault_mapping(mmdb_.file_content, (size_t)mmdb_.file_size, filename, lock);
+	}
+
 	bool summary(const struct sockaddr *sa, std::string &country, std::string *city = nullptr)
 	{
 		if (!is_open_)
@@ -203,59 +241,405 @@ private:
 	bool is_open_;
 };
 
+#endif	//HAVE_LIBMAXMINDDB
 
-static inetd::CriticalSection geoip_lock;
-static std::map<std::string, geoipdb *> geoip_databases;
 
-static geoipdb *
-get_geoipdb(const inetd::String &database)
-{
-	inetd::CriticalSection::Guard guard(geoip_lock);
-	auto it = geoip_databases.find(database.c_str());
-	if (it != geoip_databases.end()) {
-		return it->second;
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Native range index (.gidx), see geoidx.h; country resolution only.
+//
+
+class geoipidx {
+public:
+	static bool is_index(const char *filename)
+	{
+		const char *ext = strrchr(filename, '.');
+		return (ext && 0 == _stricmp(ext, ".gidx"));
 	}
 
-	auto *geoip = new(std::nothrow) geoipdb;
-	if (geoip && geoip->open(database)) {
-		geoip_databases.emplace(database.c_str(), geoip);
-	} else {
-		delete geoip;
-		geoip = nullptr;
+	geoipidx() : base_(nullptr), size_(0)
+	{
 	}
-	return geoip;
-}
 
-#else	//HAVE_LIBMAXMINDDB
+	~geoipidx()
+	{
+		close();
+	}
+
+	bool open(const char *filename)
+	{
+		struct stat sb = {0};
+		int fd;
+
+		if (base_)
+			return false;
+#if defined(_WIN32)	// shared for delete; whilst mapped, the image may still be renamed aside.
+		HANDLE handle = ::CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_DELETE,
+					NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (INVALID_HANDLE_VALUE == handle) {
+			fd = -1;
+		} else if ((fd = _open_osfhandle((intptr_t)handle, _O_RDONLY|_O_BINARY)) < 0) {
+			::CloseHandle(handle);
+		}
+#else
+		fd = ::open(filename, O_RDONLY|O_BINARY);
+#endif
+		if (fd < 0 || -1 == fstat(fd, &sb) || sb.st_size <= 0) {
+			syslog(LOG_ERR, "geoip: cannot open <%s> : %m", filename);
+			if (fd >= 0) ::close(fd);
+			return false;
+		}
+
+		void *base = mmap(nullptr, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (MAP_FAILED == base) {
+			syslog(LOG_ERR, "geoip: cannot map <%s> : %m", filename);
+			return false;
+		}
+
+		if (! index_.attach(base, (size_t)sb.st_size)) {
+			syslog(LOG_ERR, "geoip: <%s> not a valid index", filename);
+			munmap(base, (size_t)sb.st_size);
+			return false;
+		}
+
+		base_ = base, size_ = (size_t)sb.st_size;
+		syslog(LOG_INFO, "geoip: <%s>, %u/%u ranges", filename, index_.v4count(), index_.v6count());
+		return true;
+	}
+
+	void close()
+	{
+		if (base_) {
+			munmap(base_, size_);
+			base_ = nullptr, size_ = 0;
+		}
+	}
+
+	bool is_open() const
+	{
+		return (nullptr != base_);
+	}
+
+	void prefault(const char *filename, bool lock)
+	{
+		prefault_mapping(base_, size_, filename, lock);
+	}
+
+	bool profile(const struct sockaddr *sa, Profile &profile)
+	{
+		const char *code = nullptr;
+
+		if (AF_INET == sa->sa_family) {
+			const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+			code = index_.lookup4(ntohl(sin->sin_addr.s_addr));
+
+		} else if (AF_INET6 == sa->sa_family) {
+			const struct in6_addr *addr = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+			if (IN6_IS_ADDR_V4MAPPED(addr))
+				code = index_.lookup4(inetd::GeoIndex::to_key4(addr->s6_addr + 12));
+			if (nullptr == code)
+				code = index_.lookup6(inetd::GeoIndex::to_key6(addr->s6_addr));
+		}
+
+		if (nullptr == code)
+			return false;
+		profile.country.assign(code, strnlen(code, 4));
+		return true;
+	}
+
+private:
+	inetd::GeoIndex index_;
+	void *base_;
+	size_t size_;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Database, either native index or MMDB by extension.
+//
 
 class geoipdb {
 public:
+	bool open(const char *filename)
+	{
+		if (geoipidx::is_index(filename))
+			return idx_.open(filename);
+#if defined(HAVE_LIBMAXMINDDB)
+		return mmdb_.open(filename);
+#else
+		syslog(LOG_ERR, "geoip: <%s> libmaxminddb support not available, native index (.gidx) expected", filename);
+		return false;
+#endif
+	}
+
+	void prefault(const char *filename, bool lock)
+	{
+		if (idx_.is_open()) {
+			idx_.prefault(filename, lock);
+			return;
+		}
+#if defined(HAVE_LIBMAXMINDDB)
+		mmdb_.prefault(filename, lock);
+#endif
+	}
+
 	bool profile(const struct sockaddr *sa, Profile &profile)
 	{
+		if (idx_.is_open())
+			return idx_.profile(sa, profile);
+#if defined(HAVE_LIBMAXMINDDB)
+		return mmdb_.profile(sa, profile);
+#else
 		return false;
+#endif
 	}
+
+private:
+	geoipidx idx_;
+#if defined(HAVE_LIBMAXMINDDB)
+	geoipmmdb mmdb_;
+#endif
 };
 
-geoipdb *
-get_geoipdb(const inetd::String &database)
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Geoip sources
+//
+//      Each database is opened once, at configuration time, and published as a shared
+//      instance; a watcher thread polls the underlying file and on change, once stable,
+//      opens the new image and swaps it in. Lookups hold their own reference, so those
+//      in flight complete against the previous mapping which is released on drain.
+//
+//      Sources are referenced by the geoips tables using them; those no longer referenced
+//      following a reconfiguration are released by purge(), unmapping and ceasing to poll.
+//
+//      Under Windows a mapped file cannot be replaced in place; an updater renames the
+//      current image aside, then the new image into place. Native indexes are opened
+//      shared for delete to permit this; MMDB images are mapped by libmaxminddb.
+//
+
+#if !defined(GEOIP_POLL)
+#define GEOIP_POLL	30			// watcher poll interval, seconds.
+#endif
+
+class geoipsource {
+	geoipsource(const geoipsource &) = delete;
+	geoipsource& operator=(const geoipsource &) = delete;
+
+public:
+	geoipsource(const char *filename, unsigned options)
+		: filename_(filename), options_(options), loaded_(), pending_()
+	{
+	}
+
+	std::shared_ptr<geoipdb> get() const
+	{
+		return std::atomic_load(&db_);
+	}
+
+	void options(unsigned options)
+	{
+		inetd::CriticalSection::Guard guard(lock_);
+		options_ |= options;
+	}
+
+	bool load()
+	{
+		inetd::CriticalSection::Guard guard(lock_);
+		struct stamp current;
+
+		stat(current);
+		return load(current);
+	}
+
+	void poll()
+	{
+		inetd::CriticalSection::Guard guard(lock_);
+		struct stamp current;
+
+		if (! stat(current) || current == loaded_) {
+			pending_ = stamp();
+		} else if (current == pending_) {	// stable over an interval; reload.
+			if (load(current))
+				syslog(LOG_INFO, "geoip: <%s> reloaded", filename_.c_str());
+			pending_ = stamp();
+		} else {
+			pending_ = current;		// changed; possibly still being written.
+		}
+	}
+
+private:
+	struct stamp {
+		stamp() : mtime(0), size(0) { }
+		bool operator==(const stamp &rhs) const {
+			return (mtime == rhs.mtime && size == rhs.size);
+		}
+		time_t mtime;
+		long long size;
+	};
+
+	bool stat(struct stamp &result) const
+	{
+		struct stat sb = {0};
+
+		if (-1 == ::stat(filename_.c_str(), &sb))
+			return false;
+		result.mtime = sb.st_mtime;
+		result.size = (long long)sb.st_size;
+		return true;
+	}
+
+	bool load(const struct stamp &current)
+	{
+		std::shared_ptr<geoipdb> db(new(std::nothrow) geoipdb);
+
+		if (! db || ! db->open(filename_.c_str()))
+			return false;
+		if (options_ & (geoips::GEOIP_PREFAULT|geoips::GEOIP_MLOCK))
+			db->prefault(filename_.c_str(), 0 != (options_ & geoips::GEOIP_MLOCK));
+		std::atomic_store(&db_, db);		// publish; previous released on drain.
+		loaded_ = current;
+		return true;
+	}
+
+private:
+	inetd::CriticalSection lock_;
+	const std::string filename_;
+	unsigned options_;
+	std::shared_ptr<geoipdb> db_;
+	struct stamp loaded_, pending_;
+};
+
+
+static inetd::CriticalSection geoip_lock;
+static std::map<std::string, std::shared_ptr<geoipsource>> &geoip_sources =
+	*new std::map<std::string, std::shared_ptr<geoipsource>>; // retained; the watcher outlives static destruction.
+static HANDLE geoip_watcher;
+
+
+static unsigned __stdcall
+geoip_watch(void *)
 {
-	return nullptr;
+	std::vector<std::shared_ptr<geoipsource>> sources;
+
+	for (;;) {
+		::Sleep(GEOIP_POLL * 1000);
+		{	inetd::CriticalSection::Guard guard(geoip_lock);
+			for (auto &it : geoip_sources)
+				sources.push_back(it.second);
+		}
+		for (auto &source : sources)
+			source->poll();
+		sources.clear();		// unreferenced whilst idle, see purge().
+	}
+	/*NOTREACHED*/
+	return 0;
 }
 
-#endif	//HAVE_LIBMAXMINDDB
+
+/*
+ *  Retrieve the source associated with the database, loading on first reference.
+ */
+static std::shared_ptr<geoipsource>
+geoip_source(const inetd::String &database, unsigned options)
+{
+	inetd::CriticalSection::Guard guard(geoip_lock);
+	auto it = geoip_sources.find(database.c_str());
+	if (it != geoip_sources.end()) {
+		it->second->options(options);
+		return it->second;
+	}
+
+	std::shared_ptr<geoipsource> source(new(std::nothrow) geoipsource(database.c_str(), options));
+	if (! source || ! source->load())
+		return nullptr;
+	geoip_sources.emplace(database.c_str(), source);
+
+	if (nullptr == geoip_watcher) {
+		geoip_watcher = (HANDLE)::_beginthreadex(NULL, 0, geoip_watch, NULL, 0, NULL);
+		if (nullptr == geoip_watcher)
+			syslog(LOG_ERR, "geoip: watcher: %m");
+	}
+	return source;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Rule hits
+//
+//  Counters are sized to the rule set they were built against, one per rule plus the
+//  default. A reconfiguration may replace them while an admission check still holds the
+//  previous set; checks are read sections, release is deferred until all those which
+//  could reference the set have exited, see rcu_retire().
+
+class geoips::Hits {
+	Hits(const Hits &) = delete;
+	Hits& operator=(const Hits &) = delete;
+
+public:
+	static Hits *create(size_t rules) {
+		Hits *hits = new(std::nothrow) Hits(rules);
+		if (hits && nullptr == hits->counters_) {
+			delete hits;
+			return nullptr;
+		}
+		return hits;
+	}
+
+	static void destroy(void *hits) {
+		delete static_cast<Hits *>(hits);
+	}
+
+	void hit(size_t idx) {			// idx >= rules, default.
+		counters_[idx < rules_ ? idx : rules_].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	unsigned long hits(size_t idx) const {
+		return counters_[idx < rules_ ? idx : rules_].load(std::memory_order_relaxed);
+	}
+
+private:
+	Hits(size_t rules) : rules_(rules), counters_(new(std::nothrow) std::atomic<unsigned long>[rules + 1]()) {
+	}
+
+	const size_t rules_;
+	std::unique_ptr<std::atomic<unsigned long>[]> counters_;
+};
+
+
+//static
+void
+geoips::purge()
+{
+	rcu_reclaim();				// retired rule hits.
+
+	std::vector<std::shared_ptr<geoipsource>> released;
+
+	{	inetd::CriticalSection::Guard guard(geoip_lock);
+		for (auto it = geoip_sources.begin(); it != geoip_sources.end();) {
+			if (1 == it->second.use_count()) {	// sole reference; no table nor lookup.
+				syslog(LOG_INFO, "geoip: <%s> released", it->first.c_str());
+				released.push_back(std::move(it->second));
+				it = geoip_sources.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+}
 
 
 /////////////////////////////////////////////////////////////////////////////////////////
 //  Geoip implementation
 
 geoips::geoips()
-	: match_default_(0), geoipdb_(nullptr)
+	: match_default_(0), options_(0), source_(), hits_(nullptr)
 {
 }
 
 
 geoips::geoips(const geoips &rhs)
-	: match_default_(0), geoipdb_(nullptr)
+	: match_default_(rhs.match_default_), database_(rhs.database_), options_(rhs.options_), source_(), hits_(nullptr)
 {
 	rules_ = rhs.rules_;
 }
@@ -265,6 +649,9 @@ geoips&
 geoips::operator=(geoips &&rhs)
 {
 	if (this != &rhs) {
+		match_default_ = rhs.match_default_;
+		database_ = rhs.database_;
+		options_ = rhs.options_;
 		rules_ = std::move(rhs.rules_);
 		rhs.reset();
 		reset();
@@ -289,9 +676,15 @@ geoips::operator()() const
 bool
 geoips::build()
 {
-	if (size() && nullptr == geoipdb_) {
-		if (nullptr == (geoipdb_ = get_geoipdb(database())))
+	if (size() && nullptr == hits_.load()) {	// optional; rules are enforced regardless.
+		hits_.store(Hits::create(size()));
+	}
+	if (size() && ! std::atomic_load(&source_)) {
+		std::shared_ptr<geoipsource> source(geoip_source(database(), options_));
+
+		if (! source)
 			return false;
+		std::atomic_store(&source_, source);
 	}
 	return true;
 }
@@ -322,32 +715,51 @@ geoips::allowed(const struct sockaddr *addr) const
 		return true;
 
 	if (size()) {
-		if (nullptr == geoipdb_)
-			geoipdb_ = get_geoipdb(database());
+		std::shared_ptr<geoipsource> source(std::atomic_load(&source_));
+		if (! source) {				// unavailable at build(); retried.
+			if ((source = geoip_source(database(), options_)))
+				std::atomic_store(&source_, source);
+		}
 
+		std::shared_ptr<geoipdb> db;		// reference held for the duration.
 		Profile profile;
-		if (geoipdb_ && geoipdb_->profile(addr, profile)) {
-			for (auto &rule : rules_) {
+		size_t matched = rules_.size();		// rule, otherwise the default.
+		if (source && (db = source->get()) && db->profile(addr, profile)) {
+			for (unsigned idx = 0; idx < rules_.size(); ++idx) {
+				const struct rule &rule = rules_[idx];
+				bool match = false;
+
 				switch (rule.type) {
 				case GEOIP_CITY:
-					if (rule.spec == profile.city)
-						return ('+' == rule.op);
+					match = (rule.spec == profile.city);
 					break;
 				case GEOIP_TIMEZONE:
-					if (rule.spec == profile.timezone)
-						return ('+' == rule.op);
+					match = (rule.spec == profile.timezone);
 					break;
 				case GEOIP_COUNTRY:
-					if (rule.spec == profile.country)
-						return ('+' == rule.op);
+					match = (rule.spec == profile.country);
 					break;
 				case GEOIP_CONTINENT:
-					if (rule.spec == profile.continent)
-						return ('+' == rule.op);
+					match = (rule.spec == profile.continent);
+					break;
+				default:
+					break;
+				}
+
+				if (match) {
+					matched = idx;
 					break;
 				}
 			}
 		}
+
+		const int token = rcu_read_enter();	// counters; see reset().
+		Hits *hits = hits_.load(std::memory_order_acquire);
+		if (hits)
+			hits->hit(matched);
+		rcu_read_exit(token);
+		if (matched < rules_.size())
+			return ('+' == rules_[matched].op);
 	}
 
 	return (match_default() >= 0);
@@ -381,16 +793,24 @@ geoips::database() const
 
 
 bool
-geoips::database(const char *database)
+geoips::database(const char *database, unsigned options)
 {
 	if (database && *database) {
 		database_ = database;
+		options_ = options;
 		return true;
 	}
 	return false;
 }
 
 
+unsigned
+geoips::options() const
+{
+	return options_;
+}
+
+
 // <city|timezone|country|continent> <values ...>
 bool
 geoips::push(const std::vector<std::string> &rules, char op)
@@ -433,6 +853,16 @@ geoips::push(const char *value, char op)
 }
 
 
+// replace the rule set; previously validated, see snapshot.
+void
+geoips::assign(Collection &&rules, int match_default)
+{
+	rules_ = std::move(rules);
+	match_default_ = match_default;
+	reset();
+}
+
+
 bool
 geoips::erase(const std::vector<std::string> &rules, char op)
 {
@@ -474,11 +904,32 @@ geoips::erase(const char *value, char op)
 }
 
 
+// same database and rule set; order significant.
+bool
+geoips::equal(const geoips &rhs) const
+{
+	return (match_default_ == rhs.match_default_ &&
+		options_ == rhs.options_ && database_ == rhs.database_ &&
+		rules_.size() == rhs.rules_.size() &&
+		std::equal(rules_.begin(), rules_.end(), rhs.rules_.begin(),
+			[](const rule &a, const rule &b) {
+				return a.op == b.op && a.type == b.type && a.spec == b.spec;
+			}));
+}
+
+
 void
 geoips::sysdump() const
 {
-	for (const auto &rule : rules_) {
-		syslog(LOG_DEBUG, "%c: %d/%s/%d (%s)", (int)rule.type, rule.op, rule.spec.c_str());
+	const Hits *hits = hits_.load(std::memory_order_acquire);
+
+	for (unsigned idx = 0; idx < rules_.size(); ++idx) {
+		const struct rule &rule = rules_[idx];
+		syslog(LOG_DEBUG, "%c: %d/%s, %lu hits", rule.op, (int)rule.type, rule.spec.c_str(),
+			(hits ? hits->hits(idx) : 0UL));
+	}
+	if (hits) {
+		syslog(LOG_DEBUG, "default: %lu hits", hits->hits(rules_.size()));
 	}
 }
 
@@ -497,6 +948,14 @@ geoips::empty() const
 }
 
 
+// rules or a default (geoip_allow/deny = ALL) to enforce.
+bool
+geoips::active() const
+{
+	return (! rules_.empty() || 0 != match_default_);
+}
+
+
 size_t
 geoips::clear(char op)
 {
@@ -519,7 +978,10 @@ geoips::clear()
 void
 geoips::reset()
 {
-	geoipdb_ = nullptr;
+	Hits *hits = hits_.exchange(nullptr);
+
+	std::atomic_store(&source_, std::shared_ptr<geoipsource>());
+	rcu_retire(hits, Hits::destroy);	// may be in use; released once unreferenced.
 }
 
 
@@ -529,14 +991,15 @@ geoips::reset()
 int
 geoip(PeerInfo &remote)
 {
-#if defined(HAVE_GEOIP)
 	const struct servtab *sep = remote.getserv();
-	return sep->se_geoip.allowed(remote.getaddr());
-
-#else
-	return 0;
 
-#endif
+	if (sep->se_geoips.active()) {
+		if (! sep->se_geoips.allowed((const struct sockaddr *)remote.getaddr())) {
+			return -1; // deny
+		}
+		return 1; // allowed
+	}
+	return 0; // unlimited
 }
 
 //end
@@ -28,16 +28,19 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
 
 #include "SimpleString.h"
 
-class geoipdb;
+class geoipsource;
 
 class geoips {
 	geoips operator=(const geoips &) = delete;
 
 public:
 	enum geoip_type { GEOIP_NONE, GEOIP_CONTINENT, GEOIP_COUNTRY, GEOIP_TIMEZONE, GEOIP_CITY };
+	enum geoip_options { GEOIP_PREFAULT = 0x01, GEOIP_MLOCK = 0x02 };
 
 	struct rule {
 		std::string spec;
@@ -58,23 +61,34 @@ public:
 	int match_default() const;
 	bool match_default(int status);
 	const inetd::String& database() const;
-	bool database(const char *database);
+	bool database(const char *database, unsigned options = 0);
+	unsigned options() const;
 	bool push(const std::vector<std::string> &rules, char op);
 	bool push(const char *value, char op);
 	bool erase(const std::vector<std::string> &rules, char op);
 	bool erase(const char *value, char op);
+	void assign(Collection &&rules, int match_default);
+	bool equal(const geoips &rhs) const;
 	void sysdump() const;
 	size_t size() const;
 	bool empty() const;
+	bool active() const;
 	size_t clear(char op);
 	void clear();
 	void reset();
 
+	static void purge();
+
+private:
+	class Hits;
+
 private:
 	int match_default_;
 	inetd::String database_;
+	unsigned options_;
 	Collection rules_;
-	mutable geoipdb *geoipdb_;
+	mutable std::shared_ptr<geoipsource> source_;	// referenced; see purge().
+	std::atomic<Hits *> hits_;		// rule hits; allocated by build(), retired by reset().
 };
 
 //end
@@ -0,0 +1,563 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - listener handoff.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Handoff table layout, host byte order:
+ *
+ *      header
+ *      listener[count]         u32 key length, WSAPROTOCOL_INFOW, key.
+ *
+ *  The table is written by the original process beside the configuration, named to the
+ *  replacement by the HANDOFF_ENV environment variable, and removed once read.
+ */
+
+#include "inetd.h"
+
+#include <syslog.h>
+#include <sysexits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "handoff.h"
+#if defined(_WIN32)
+#include "SocketShare.h"
+#endif
+
+#define HANDOFF_VERSION 	1
+
+#if defined(_WIN32)
+namespace {
+struct Header {
+	char magic[8];				// "INETDHOF"
+	uint32_t version;
+	uint32_t count;				// listeners.
+	uint32_t parent;			// originating process.
+	char ready[MAX_PATH];			// readiness event; replacement loaded.
+};
+
+static const char handoff_magic[8] = {'I','N','E','T','D','H','O','F'};
+
+static std::mutex handoff_lock;
+static std::unordered_map<std::string, SOCKET> handoff_listeners;
+static std::string handoff_ready;
+static unsigned handoff_count;
+
+static inetd::ScopedProcessId spawn_child;	// replacement pending its load.
+static inetd::ScopedHandle spawn_ready;
+static std::string spawn_path;
+static ULONGLONG spawn_started;
+static unsigned spawn_count;
+
+static HANDLE watch_event = nullptr;
+static HANDLE watch_wait = nullptr;
+static void (*watch_upgrade)(void) = nullptr;
+
+
+/*
+ *  Upgrade request event, by process; global when permitted, otherwise session local.
+ */
+static void
+upgrade_event(char *name, size_t namelen, bool global, unsigned pid)
+{
+	sprintf_s(name, namelen, "%s\\inetd-upgrade-%u", (global ? "Global" : "Local"), pid);
+}
+
+
+/*
+ *  Environment of the replacement; that of the current process plus the handoff table.
+ */
+static void
+upgrade_environment(std::vector<char> &environment, const char *path)
+{
+	const size_t namelen = sizeof(HANDOFF_ENV) - 1;
+	char *strings = ::GetEnvironmentStringsA();
+
+	if (strings) {
+		for (const char *cursor = strings; *cursor; ) {
+			const size_t length = strlen(cursor) + 1;
+
+			if (0 != _strnicmp(cursor, HANDOFF_ENV "=", namelen + 1))
+				environment.insert(environment.end(), cursor, cursor + length);
+			cursor += length;
+		}
+		::FreeEnvironmentStringsA(strings);
+	}
+
+	const std::string variable(std::string(HANDOFF_ENV "=") + path);
+	environment.insert(environment.end(), variable.c_str(), variable.c_str() + variable.length() + 1);
+	environment.push_back(0);
+}
+
+
+static VOID CALLBACK
+upgrade_requested(PVOID lpParam, BOOLEAN TimerOrWaitFired)
+{
+	(void) lpParam, (void) TimerOrWaitFired;
+	if (watch_upgrade)
+		watch_upgrade();
+}
+
+};  //namespace
+
+
+/*
+ *  Start the replacement, passing each listener; returns 0 once the replacement is running,
+ *  its load then being awaited by handoffready(), otherwise -1, in which case the listeners
+ *  remain solely with the caller.
+ */
+int
+handoffspawn(const char *path, const std::vector<struct handofflistener> &listeners)
+{
+	char progname[MAX_PATH] = {0}, basename[MAX_PATH] = {0};
+	std::string cmdline(::GetCommandLineA());
+	std::vector<char> environment;
+	STARTUPINFOA si = {0};
+	inetd::ScopedProcessId &child = spawn_child;
+	inetd::ScopedHandle &ready = spawn_ready;
+	Header header;
+	FILE *file = nullptr;
+	bool written = false;
+	unsigned count = 0;
+
+	if (child.IsValid())
+		return -1;			// pending.
+
+	if (0 == ::GetModuleFileNameA(NULL, progname, sizeof(progname))) {
+		syslog(LOG_ERR, "upgrade: module name: %M");
+		return -1;
+	}
+
+	inetd::SocketShare::GenerateUniqueName(basename, sizeof(basename));
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, handoff_magic, sizeof(header.magic));
+	header.version = HANDOFF_VERSION;
+	header.parent = (uint32_t)::GetCurrentProcessId();
+	sprintf_s(header.ready, sizeof(header.ready), "Local\\%s-ready", basename);
+
+	ready.Set(::CreateEventA(NULL, TRUE, FALSE, header.ready));
+	if (! ready.IsValid()) {
+		syslog(LOG_ERR, "upgrade: CreateEvent(%s): %M", header.ready);
+		ready.Close();
+		return -1;
+	}
+
+	// Replacement; held suspended until its table is complete.
+
+	upgrade_environment(environment, path);
+	si.cb = sizeof(si);
+	if (! ::CreateProcessA(progname, &cmdline[0], NULL, NULL, FALSE /*no inheritance*/,
+			CREATE_SUSPENDED, environment.data(), NULL, &si, child)) {
+		syslog(LOG_ERR, "upgrade: CreateProcess(%s): %M", progname);
+		child.Close();
+		ready.Close();
+		return -1;
+	}
+
+	// Listeners, duplicated for the replacement.
+
+	if (nullptr == (file = fopen(path, "wb"))) {
+		syslog(LOG_ERR, "upgrade: %s: %m", path);
+
+	} else {
+		bool success = (1 == fwrite(&header, sizeof(header), 1, file));
+
+		for (const auto &listener : listeners) {
+			WSAPROTOCOL_INFOW info = {0};
+			const uint32_t keylen = (uint32_t)listener.key.length();
+
+			if (! success)
+				break;
+			if (SOCKET_ERROR == ::WSADuplicateSocketW((SOCKET)listener.fd, child.process_id(), &info)) {
+				syslog(LOG_WARNING, "upgrade: WSADuplicateSocket(%d): %M", listener.fd);
+				continue;		// replacement binds its own.
+			}
+			success = (1 == fwrite(&keylen, sizeof(keylen), 1, file) &&
+					1 == fwrite(&info, sizeof(info), 1, file) &&
+					(0 == keylen || 1 == fwrite(listener.key.data(), keylen, 1, file)));
+			++count;
+		}
+
+		header.count = count;
+		if (success) {
+			success = (0 == fseek(file, 0, SEEK_SET) &&
+					1 == fwrite(&header, sizeof(header), 1, file));
+		}
+		if (0 != fclose(file) || ! success) {
+			syslog(LOG_ERR, "upgrade: %s: write error", path);
+		} else {
+			written = true;
+		}
+	}
+
+	// Release the replacement; its load is awaited by handoffready().
+
+	if (! written || (DWORD)-1 == ::ResumeThread(child.process_thread())) {
+		::TerminateProcess(child.process_handle(), EX_SOFTWARE);
+		(void) unlink(path);
+		child.Close();
+		ready.Close();
+		return -1;
+	}
+
+	spawn_path = path;
+	spawn_started = ::GetTickCount64();
+	spawn_count = count;
+	return 0;
+}
+
+
+/*
+ *  Poll the replacement started by handoffspawn(), without blocking; returns 1 once it has
+ *  signalled its load as complete, 0 whilst pending, otherwise -1 should it have exited or
+ *  not be ready within HANDOFF_TIMEOUT, in which case it is terminated and the listeners
+ *  remain solely with the caller.
+ */
+int
+handoffready(void)
+{
+	inetd::ScopedProcessId &child = spawn_child;
+	int ret = -1;
+
+	if (! child.IsValid())
+		return -1;
+
+	const HANDLE handles[2] = { spawn_ready.Get(), child.process_handle() };
+	const DWORD wait = ::WaitForMultipleObjects(2, handles, FALSE, 0);
+
+	if (WAIT_OBJECT_0 == wait) {
+		syslog(LOG_INFO, "upgrade: %u listeners handed to pid %d", spawn_count, child.pid());
+		ret = 1;
+
+	} else if (WAIT_OBJECT_0 + 1 == wait) {
+		DWORD status = 0;
+
+		::GetExitCodeProcess(child.process_handle(), &status);
+		syslog(LOG_ERR, "upgrade: replacement pid %d exited, status %u", child.pid(), (unsigned)status);
+
+	} else if (WAIT_TIMEOUT == wait &&
+			(::GetTickCount64() - spawn_started) < HANDOFF_TIMEOUT) {
+		return 0;			// pending.
+
+	} else {
+		syslog(LOG_ERR, "upgrade: replacement pid %d not ready, terminated", child.pid());
+		::TerminateProcess(child.process_handle(), EX_SOFTWARE);
+	}
+
+	if (ret < 0)
+		(void) unlink(spawn_path.c_str());
+	child.Close();
+	spawn_ready.Close();
+	return ret;
+}
+
+
+/*
+ *  Abandon any replacement pending its load; see handoffready().
+ */
+void
+handoffcancel(void)
+{
+	inetd::ScopedProcessId &child = spawn_child;
+
+	if (! child.IsValid())
+		return;
+
+	syslog(LOG_INFO, "upgrade: replacement pid %d cancelled", child.pid());
+	::TerminateProcess(child.process_handle(), EX_SOFTWARE);
+	::WaitForSingleObject(child.process_handle(), HANDOFF_TIMEOUT);
+	(void) unlink(spawn_path.c_str());
+	child.Close();
+	spawn_ready.Close();
+}
+
+
+/*
+ *  Load any listeners handed to this process; returns their count, otherwise -1 on error.
+ */
+int
+sethandoff(void)
+{
+	const char *env = getenv(HANDOFF_ENV);
+	Header header;
+	FILE *file = nullptr;
+	std::string path;
+	int ret = -1;
+
+	if (nullptr == env || 0 == *env)
+		return 0;
+	path = env;
+	::SetEnvironmentVariableA(HANDOFF_ENV, NULL);	// not for our children.
+	memset(&header, 0, sizeof(header));
+
+	if (nullptr == (file = fopen(path.c_str(), "rb"))) {
+		syslog(LOG_ERR, "handoff: %s: %m", path.c_str());
+		return -1;
+	}
+
+	if (1 != fread(&header, sizeof(header), 1, file) ||
+			0 != memcmp(header.magic, handoff_magic, sizeof(header.magic)) ||
+			HANDOFF_VERSION != header.version) {
+		syslog(LOG_ERR, "handoff: %s: invalid table", path.c_str());
+
+	} else {
+		std::lock_guard<std::mutex> guard(handoff_lock);
+
+		header.ready[sizeof(header.ready) - 1] = 0;
+		handoff_ready = header.ready;
+		ret = 0;
+
+		for (uint32_t idx = 0; idx < header.count; ++idx) {
+			WSAPROTOCOL_INFOW info = {0};
+			uint32_t keylen = 0;
+			std::string key;
+			SOCKET fd;
+
+			if (1 != fread(&keylen, sizeof(keylen), 1, file) || keylen > 1024 ||
+					1 != fread(&info, sizeof(info), 1, file)) {
+				syslog(LOG_ERR, "handoff: %s: truncated table", path.c_str());
+				break;
+			}
+			key.resize(keylen);
+			if (keylen && 1 != fread(&key[0], keylen, 1, file)) {
+				syslog(LOG_ERR, "handoff: %s: truncated table", path.c_str());
+				break;
+			}
+
+			if (INVALID_SOCKET == (fd = ::WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO,
+					FROM_PROTOCOL_INFO, &info, 0, WSA_FLAG_OVERLAPPED))) {
+				syslog(LOG_WARNING, "handoff: WSASocket(%u): %M", (unsigned)idx);
+				continue;		// bound afresh.
+			}
+			::SetHandleInformation((HANDLE) fd, HANDLE_FLAG_INHERIT, 0);
+			if (! handoff_listeners.emplace(key, fd).second) {
+				syslog(LOG_WARNING, "handoff: %s duplicate, closed", key.c_str());
+				::closesocket(fd);
+			}
+		}
+		handoff_count = (unsigned)handoff_listeners.size();
+		ret = (int)handoff_count;
+
+		if (debug)
+			syslog(LOG_DEBUG, "handoff: %u listeners from pid %u", handoff_count, (unsigned)header.parent);
+	}
+
+	fclose(file);
+	(void) unlink(path.c_str());
+	return ret;
+}
+
+
+/*
+ *  Adopt the inherited listener of the service 'key'; returns the descriptor, otherwise -1.
+ */
+int
+gethandoff(const std::string &key)
+{
+	std::lock_guard<std::mutex> guard(handoff_lock);
+
+	if (! handoff_listeners.empty()) {
+		auto it = handoff_listeners.find(key);
+
+		if (it != handoff_listeners.end()) {
+			const SOCKET fd = it->second;
+
+			handoff_listeners.erase(it);
+			return (int)fd;
+		}
+	}
+	return -1;
+}
+
+
+/*
+ *  Complete the handoff; release those listeners not adopted and signal the original process.
+ */
+void
+endhandoff(void)
+{
+	std::lock_guard<std::mutex> guard(handoff_lock);
+
+	if (handoff_ready.empty())
+		return;
+
+	for (auto &listener : handoff_listeners) {	// service withdrawn or altered by the new configuration.
+		syslog(LOG_WARNING, "handoff: %s not adopted, closed", listener.first.c_str());
+		::closesocket(listener.second);
+	}
+	syslog(LOG_INFO, "handoff: %u of %u listeners adopted",
+		handoff_count - (unsigned)handoff_listeners.size(), handoff_count);
+	handoff_listeners.clear();
+
+	inetd::ScopedHandle ready(::OpenEventA(EVENT_MODIFY_STATE, FALSE, handoff_ready.c_str()));
+	if (! ready.IsValid() || ! ::SetEvent(ready)) {
+		syslog(LOG_ERR, "handoff: SetEvent(%s): %M", handoff_ready.c_str());
+	}
+	handoff_ready.clear();
+}
+
+
+/*
+ *  Watch for upgrade requests, see handoffsignal().
+ */
+int
+sethandoffwatch(void (*upgrade)(void))
+{
+	const unsigned pid = (unsigned)::GetCurrentProcessId();
+	char name[MAX_PATH];
+
+	if (watch_event)
+		return 0;
+
+	upgrade_event(name, sizeof(name), true, pid);
+	if (nullptr == (watch_event = ::CreateEventA(NULL, FALSE /*auto*/, FALSE, name))) {
+		upgrade_event(name, sizeof(name), false, pid);
+		watch_event = ::CreateEventA(NULL, FALSE /*auto*/, FALSE, name);
+	}
+
+	if (nullptr == watch_event) {
+		syslog(LOG_WARNING, "upgrade: CreateEvent(%s): %M", name);
+		return -1;
+	}
+
+	watch_upgrade = upgrade;
+	if (! ::RegisterWaitForSingleObject(&watch_wait, watch_event, upgrade_requested, nullptr, INFINITE, WT_EXECUTEDEFAULT)) {
+		syslog(LOG_WARNING, "upgrade: RegisterWait: %M");
+		::CloseHandle(watch_event);
+		watch_event = nullptr;
+		return -1;
+	}
+
+	if (debug)
+		syslog(LOG_DEBUG, "upgrade: watching %s", name);
+	return 0;
+}
+
+
+void
+endhandoffwatch(void)
+{
+	if (watch_wait) {
+		::UnregisterWaitEx(watch_wait, INVALID_HANDLE_VALUE);
+		watch_wait = nullptr;
+	}
+	if (watch_event) {
+		::CloseHandle(watch_event);
+		watch_event = nullptr;
+	}
+	watch_upgrade = nullptr;
+}
+
+
+/*
+ *  Request the upgrade of the inetd instance 'pid'.
+ */
+int
+handoffsignal(int pid)
+{
+	char name[MAX_PATH];
+	HANDLE event;
+
+	upgrade_event(name, sizeof(name), true, (unsigned)pid);
+	if (nullptr == (event = ::OpenEventA(EVENT_MODIFY_STATE, FALSE, name))) {
+		upgrade_event(name, sizeof(name), false, (unsigned)pid);
+		event = ::OpenEventA(EVENT_MODIFY_STATE, FALSE, name);
+	}
+
+	if (nullptr == event) {
+		syslog(LOG_ERR, "upgrade: pid %d: not accepting requests: %M", pid);
+		return -1;
+	}
+
+	const BOOL ret = ::SetEvent(event);
+	::CloseHandle(event);
+	return (ret ? 0 : -1);
+}
+
+#else	//!_WIN32
+
+int
+handoffspawn(const char *path, const std::vector<struct handofflistener> &listeners)
+{
+	(void) path, (void) listeners;
+	return -1;
+}
+
+int
+handoffready(void)
+{
+	return -1;
+}
+
+void
+handoffcancel(void)
+{
+}
+
+int
+sethandoff(void)
+{
+	return 0;
+}
+
+int
+gethandoff(const std::string &key)
+{
+	(void) key;
+	return -1;
+}
+
+void
+endhandoff(void)
+{
+}
+
+int
+sethandoffwatch(void (*upgrade)(void))
+{
+	(void) upgrade;
+	return -1;
+}
+
+void
+endhandoffwatch(void)
+{
+}
+
+int
+handoffsignal(int pid)
+{
+	(void) pid;
+	return -1;
+}
+
+#endif	//_WIN32
+
+//end
@@ -0,0 +1,65 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - listener handoff.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+
+#include <string>
+#include <vector>
+
+/*
+ *  Listener handoff; hot upgrade.
+ *
+ *  On request, see sethandoffwatch() and handoffsignal(), the running inetd starts its
+ *  image anew and passes each of its listening sockets to the replacement, together with
+ *  a table identifying the service each serves. Sockets are duplicated for the new process
+ *  (WSADuplicateSocket, as SocketShare), so its listeners are never closed; connections
+ *  arriving during the exchange queue on the listen backlog. The replacement adopts the
+ *  inherited listeners in place of binding its own, see gethandoff(), and on completing
+ *  its load signals the original, see handoffready(), which then stops accepting, drains
+ *  and exits.
+ */
+
+#define HANDOFF_ENV		"INETD_HANDOFF"
+#define HANDOFF_TIMEOUT		(30 * 1000)	// replacement start-up, milliseconds.
+
+struct handofflistener {
+	std::string key;			// service identity.
+	int fd;
+};
+
+int	handoffspawn(const char *path, const std::vector<struct handofflistener> &listeners);
+int	handoffready(void);
+void	handoffcancel(void);
+
+int	sethandoff(void);
+int	gethandoff(const std::string &key);
+void	endhandoff(void);
+
+int	sethandoffwatch(void (*upgrade)(void));
+void	endhandoffwatch(void);
+int	handoffsignal(int pid);
+
+//end
@@ -148,6 +148,14 @@
 #include "ObjectPool.h"
 #include "CPULoadInfo.h"
 
+#include <unordered_map>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include <limits.h>
 #include <ctype.h>
 #include <fcntl.h>
@@ -181,6 +189,13 @@
 #include "inetd.h"
 #include "config.h"
 #include "config2.h"
+#include "confwatch.h"
+#include "handoff.h"
+#include "servdb.h"
+#include "snapshot.h"
+#include "accessip.h"
+#include "bantable.h"
+#include "proctable.h"
 #include "pathnames.h"
 
 #ifdef IPSEC
@@ -244,7 +259,9 @@ static void	close_sep(struct servtab *, bool end = false);
 static void	sigchld(void);
 static void	sigterm(void);
 static void	flag_signal(int);
+static void	bans_request(void);
 static void	config(void);
+static int	check(void);
 
 static void	addchild(struct servtab *sep, pid_t pid, struct procinfo *proc);
 static void	reapchildren(void);
@@ -253,7 +270,15 @@ static const char *reapchild(pid_t pid);
 static void	enable(struct servtab *sep);
 static void	disable(struct servtab *, bool closing = false);
 static void	retry(void);
-static void	setup(struct servtab *);
+static void	setup(const std::vector<struct servtab *> &pending);
+static void	transfer(std::vector<struct servtab *> &pending);
+static void	upgrade(void);
+static bool	upgrade_continue(void);
+static void	upgrade_cancel(void);
+static bool	upgrade_defer(int signo);
+static void	upgrade_request(void);
+static bool	upgrade_drained(void);
+static bool	iocp_listener(const struct servtab *sep);
 #ifdef IPSEC
 static void	ipsecsetup(struct servtab *);
 #endif
@@ -261,18 +286,10 @@ static void	ipsecsetup(struct servtab *);
 static void	unregisterrpc(register struct servtab *sep);
 #endif
 
-static struct conninfo *search_connections(PeerInfo &remote);
-static bool	new_connection(const struct servtab *sep, struct conninfo *conn, struct procinfo *&proc);
+static struct conninfo *search_connections(PeerInfo &remote, struct procinfo *&proc);
 static void	connections_resize(struct servtab *sep, int maxperip);
 static void	connections_free(struct servtab *sep);
 
-static struct procinfo *connprocs_new(struct conninfo *conn, int &maxchild);
-static void	connprocs_clear(struct conninfo *conn);
-
-static void	free_conn(struct conninfo *conn);
-
-static struct procinfo *search_proc(pid_t pid, struct procinfo *add = nullptr);
-static int	hashval(const char *p, int len);
 static void	free_proc(struct procinfo *proc);
 
 static void	print_service(const char *, const struct servconfig *);
@@ -287,6 +304,10 @@ int		debug = 0;
 static int	wrap_ex = 0;
 static int	wrap_bi = 0;
 static int	dolog = 0;
+static bool	upgrading = false;		/* listeners handed to a replacement; draining */
+static bool	inherited = false;		/* listeners handed from an original; loading */
+static std::atomic<unsigned> accepting(0);	/* asynchronous accepts in-flight */
+static std::atomic<unsigned> armed(0);		/* asynchronous accepts outstanding */
 static fd_set	allsock;
 
 static char	*hostname = nullptr;
@@ -314,7 +335,7 @@ static char	servicesprog[MAX_PATH];
 static struct netconfig *udpconf, *tcpconf, *udp6conf, *tcp6conf;
 #endif
 
-static ProcInfoList proctable[PERIPSIZE];
+static proctable processes;
 
 static int
 getvalue(const char *arg, int *value, const char *whine, int limit = 0)
@@ -360,6 +381,8 @@ inetd_main(int argc, char * const *argv)
 			ret = body(argc, argv);
 		}
 		process_group.close();
+		if (! upgrading)		/* replacement owns the ban table */
+			bantable::save();
 	} catch (int exit_code) {
 		ret = exit_code;
 	} catch (std::exception &msg) {
@@ -396,11 +419,11 @@ body(int argc, char * const *argv)
 #endif
 	struct addrinfo hints, *res;
 	const char *servname;
-	int error;
+	int error, doupgrade = 0, docheck = 0;
 
 	getservicesprog(servicesprog, sizeof(servicesprog));
 	openlog("inetd", LOG_PID | LOG_NOWAIT | (getlogoption() & LOG_NOHEADER), LOG_DAEMON);
-	while ((ch = getopt(argc, argv, "dlwWR:a:c:C:p:s:t:")) != -1)
+	while ((ch = getopt(argc, argv, "dlnwUWR:a:c:C:p:s:t:")) != -1)
 		switch(ch) {
 		case 'd':
 			debug = 1;
@@ -409,6 +432,9 @@ body(int argc, char * const *argv)
 		case 'l':
 			dolog = 1;
 			break;
+		case 'n':
+			docheck = 1;
+			break;
 		case 'R':
 			getvalue(optarg, &params.toomany,
 				"-R %s: bad value for service invocation rate");
@@ -431,6 +457,9 @@ body(int argc, char * const *argv)
 			getvalue(optarg, &params.maxperip,
 				"-s %s: bad value for maximum children per source address");
 			break;
+		case 'U':
+			doupgrade = 1;
+			break;
 		case 'w':
 			wrap_ex++;
 			break;
@@ -451,11 +480,28 @@ body(int argc, char * const *argv)
 		case '?':
 		default:
 			syslog(LOG_ERR,
-				"usage: inetd [-dlwW] [-a address] [-R rate]"
+				"usage: inetd [-dlnUwW] [-a address] [-R rate]"
 				" [-c maximum] [-C rate] [-t threads] [-p pidfile] [conf-file]");
 			terminate(EX_USAGE);
 		}
 
+	/*
+	 * Upgrade request; signal the running instance, see upgrade().
+	 */
+	if (doupgrade) {
+		FILE *file;
+		int pid = 0;
+
+		if (nullptr == (file = fopen(pid_file, "r")) || 1 != fscanf(file, "%d", &pid) || pid <= 0) {
+			syslog(LOG_ERR, "%s: unable to determine running instance", pid_file);
+			if (file)
+				fclose(file);
+			return EX_UNAVAILABLE;
+		}
+		fclose(file);
+		return (handoffsignal(pid) < 0 ? EX_UNAVAILABLE : 0);
+	}
+
 	/*
 	 * Initialize Bind Addrs.
 	 *   When hostname is NULL, wild card bind addrs are obtained from getaddrinfo().
@@ -532,6 +578,9 @@ body(int argc, char * const *argv)
 	if (access(SERVICES, R_OK) < 0)
 		syslog(LOG_ERR, "Accessing %s: %m, continuing anyway.", SERVICES);
 
+	if (docheck)
+		return check();			// dry-run; nothing bound.
+
 	if (0 == debug) {
 		pid_t otherpid;
 
@@ -579,8 +628,6 @@ body(int argc, char * const *argv)
 		terminate(EX_OSERR);
 	}
 
-	config();
-
 #if !defined(O_CLOEXEC)
 #define O_CLOEXEC	0
 #endif
@@ -594,10 +641,24 @@ body(int argc, char * const *argv)
 	nsock++;
 #endif
 
+	bantable::load(_PATH_INETDBANS, bans_request);
+	inherited = (sethandoff() > 0);		// upgrade; listeners of the original.
+	config();				// signalpipe available; see setconfwatch()
+	endhandoff();
+	inherited = false;
+	sethandoffwatch(upgrade_request);
+
 	for (;;) {
+		struct timeval drain = {1, 0}, step = {0, 50 * 1000};
+		bool pending;
 		int n;
 		fd_set readable;
 
+		if (upgrading && upgrade_drained()) {
+			return 0;
+		}
+		pending = upgrade_continue();	// upgrade in progress; polled.
+
 #ifdef SANITY_CHECK
 		if (nsock == 0) {
 			syslog(LOG_ERR, "%s: nsock=0", __func__);
@@ -607,7 +668,8 @@ body(int argc, char * const *argv)
 
 		/* WIN32: limit 64 sockets and HANDLE's should be reorged reducing starved objects */
 		readable = allsock;
-		if ((n = select(FD_SETSIZE /*dummy*/, &readable, (fd_set *)0, (fd_set *)0, (struct timeval *)0)) <= 0) {
+		if ((n = select(FD_SETSIZE /*dummy*/, &readable, (fd_set *)0, (fd_set *)0,
+				(pending ? &step : (upgrading ? &drain : (struct timeval *)0)))) <= 0) {
 			if (n < 0 && errno != EINTR) {
 				syslog(LOG_WARNING, "select: %m");
 				sleep(1);
@@ -617,6 +679,8 @@ body(int argc, char * const *argv)
 
 #define SIGALRM 	1001
 #define SIGHUP		1002
+#define SIGUPGRADE	1003
+#define SIGBANS 	1004
 
 		/* handle any queued signal flags */
 		if (FD_ISSET(signalpipe[0], &readable)) {
@@ -640,15 +704,26 @@ body(int argc, char * const *argv)
 					syslog(LOG_DEBUG, "handling signal flag %d", signo);
 				switch (signo) {
 				case SIGALRM:
-					retry();
+					if (! upgrading && ! upgrade_defer(signo))
+						retry();
 					break;
 				case SIGCHLD:
 					reapchildren();
 					break;
 				case SIGHUP:
-					config();
+					if (! upgrading && ! upgrade_defer(signo))
+						config();
+					break;
+				case SIGUPGRADE:
+					upgrade();
+					break;
+				case SIGBANS:
+					bantable::save(false);
 					break;
 				case SIGTERM:
+					upgrade_cancel();
+					endconfwatch();
+					endhandoffwatch();
 					return 0;
 				}
 			}
@@ -691,7 +766,9 @@ body(int argc, char * const *argv)
 						syslog(LOG_ERR, "ioctl3 (FIONBIO, 0): %m");
 
 					PeerInfo remote(ctrl, sep);
-					if (accessip(remote) < 0 || geoip(remote) < 0 || cpmip(remote) < 0) {
+					if (banned(remote) < 0 ||
+							accessip(remote) < 0 || geoip(remote) < 0 || cpmip(remote) < 0 ||
+							ratelimit(remote) < 0) {
 						sockclose(ctrl);
 						continue;
 					}
@@ -712,25 +789,39 @@ static void async_accept(inetd::instrusive_ptr<struct servtab> &service,
 		std::shared_ptr<inetd::IOCPService::Socket> &cxt, bool success)
 {
 	struct servtab *sep(service.get());
+	inetd::instrusive_ptr<struct servtab> successor;
 
+	++accepting;
+	--armed;
 	{	std::shared_ptr<inetd::IOCPService::Socket>
 			acceptor = std::make_shared<inetd::IOCPService::Socket>();
 		inetd::IOCPService::AcceptCallback callback(std::bind(&async_accept, service, acceptor, std::placeholders::_1));
 
 		inetd::CriticalSection::Guard guard(sep->se_state.lock);
 		if (sep->se_state.running) {	// rearm acceptor.
-			iocp.Accept(sep->se_listener, *acceptor.get(), std::move(callback));
+			++armed;
+			if (! iocp.Accept(sep->se_listener, *acceptor.get(), std::move(callback)))
+				--armed;
+		} else if (success && sep->se_successor) {
+			successor = sep->se_successor;	// listener transferred, see transfer().
 		} else {
 			success = false;
 		}
 	}
 
+	if (successor) {
+		sep = successor.get();
+	}
+
 	if (success) {				// connection made and running.
 		PeerInfo remote(cxt->fd(), sep);
-		if (accessip(remote) >= 0 && geoip(remote) >= 0 && cpmip(remote) >= 0) {
+		if (banned(remote) >= 0 &&
+				accessip(remote) >= 0 && geoip(remote) >= 0 && cpmip(remote) >= 0 &&
+				ratelimit(remote) >= 0) {
 			do_accept(remote);
 		}
 	}
+	--accepting;
 }
 
 static int
@@ -749,14 +840,9 @@ do_accept(PeerInfo &remote)
 	}
 
 	if (sep->se_accept && sep->se_socktype == SOCK_STREAM) {
-		if (dofork && (conn = search_connections(remote)) != nullptr) {
+		if (dofork && (conn = search_connections(remote, proc)) != nullptr) {
 			if (conn == (conninfo *)-1)
 				return 0;
-			if (! new_connection(sep, conn, proc)) {
-				assert(proc == nullptr);
-				free_conn(conn);
-				return 0;
-			}
 		}
 	}
 
@@ -782,7 +868,6 @@ do_accept(PeerInfo &remote)
 				syslog(LOG_ERR, "%s/%s server failing (looping), service terminated",
 					sep->se_service, sep->se_proto);
 				free_proc(proc);
-				free_conn(conn);
 				close_sep(sep);
 				setalarm(RETRYTIME);
 				return -1;	// shutdown.
@@ -794,7 +879,6 @@ do_accept(PeerInfo &remote)
 		if (-1 == pid) {		// fork error.
 			syslog(LOG_ERR, "fork: %m");
 			free_proc(proc);
-			free_conn(conn);
 			sleep(1);
 			return 0;
 		}
@@ -1076,6 +1160,18 @@ inetd_signal_stop(void)
 	flag_signal(SIGTERM);
 }
 
+extern "C" void
+inetd_signal_upgrade(void)
+{
+	flag_signal(SIGUPGRADE);
+}
+
+static void
+bans_request(void)
+{
+	flag_signal(SIGBANS);
+}
+
 static void
 sigchld()
 {
@@ -1098,6 +1194,8 @@ flag_signal(int signo)
 		switch (signo) {
 		case SIGHUP: name = "HUP"; break;
 		case SIGTERM: name = "TERM"; break;
+		case SIGUPGRADE: name = "UPGRADE"; break;
+		case SIGBANS: name = "BANS"; break;
 		case SIGCHLD: name = "CHLD"; break;
 		default:
 			break;
@@ -1141,10 +1239,17 @@ addchild(struct servtab *sep, pid_t pid, struct procinfo *proc)
 		}
 	}
 
-	if (search_proc(pid, proc) != nullptr) {
+	switch (processes.insert(pid, proc)) {
+	case proctable::PT_OK:
+		break;
+	case proctable::PT_EXISTS:
 		syslog(LOG_ERR, "addchild: child already on process list");
 		terminate(EX_OSERR);
 		return;
+	default:
+		syslog(LOG_ERR, "addchild: process list: %m");
+		terminate(EX_OSERR);
+		return;
 	}
 
 	inetd::CriticalSection::Guard guard(sep->se_state.lock);
@@ -1187,13 +1292,12 @@ reapchild(pid_t pid)
 {
 	const char *ret = nullptr;
 	struct procinfo *proc;
-	struct conninfo *conn;
 
 	assert(pid != -1);
 	if (pid == -1)
 		return nullptr;
 
-	if ((proc = search_proc(pid)) == nullptr) {
+	if ((proc = processes.find(pid)) == nullptr) {
 		if (debug) {
 			syslog(LOG_DEBUG, "reapchild %d : not found", pid);
 		}
@@ -1207,15 +1311,13 @@ reapchild(pid_t pid)
 	if (servtab *sep = proc->pr_sep) {
 		inetd::CriticalSection::Guard guard(sep->se_state.lock);
 		const int count = (int)sep->se_children.remove(proc);
-		if (! SERVTAB_EXCEEDS_LIMITX(sep, count))
+		if (! upgrading && ! SERVTAB_EXCEEDS_LIMITX(sep, count))
 			enable(sep);
 		proc->pr_sep = nullptr;
 		ret = sep->se_server;
 	}
 
-	conn = proc->pr_conn;
 	free_proc(proc);
-	free_conn(conn);
 
 	return ret;
 }
@@ -1230,57 +1332,242 @@ services()
 	return services_;
 }
 
-static struct servtab *
-config_match(Services &services, struct servconfig *cfg)
+/*
+ *  Service identity; (name, proto, socktype, family, rpc).
+ */
+typedef std::unordered_map<std::string, struct servtab *> ServiceIndex;
+
+static const std::string &
+config_key(const struct servconfig *cfg, std::string &key)
 {
-	for (auto sit : *services) {
-		struct servtab *sep = sit.get();
-		if (strcmp(sep->se_service, cfg->se_service) == 0 &&
-		    strcmp(sep->se_proto, cfg->se_proto) == 0 &&
+	char t_key[64];
+	int rpc = 0;
+
 #if defined(RPC)
-		    sep->se_rpc == cfg->se_rpc &&
+	rpc = cfg->se_rpc;
+#endif
+	key.assign((const char *)&cfg->se_service, sizeof(cfg->se_service)); // interned, by identity
+	key.append(cfg->se_proto.c_str());
+	key.append(t_key, snprintf(t_key, sizeof(t_key), "%c%d/%d/%d", 0, cfg->se_socktype, cfg->se_family, rpc));
+	return key;
+}
+
+static struct servtab *
+config_match(const ServiceIndex &index, const std::string &key)
+{
+	ServiceIndex::const_iterator it(index.find(key));
+	return (it != index.end() ? it->second : nullptr);
+}
+
+/*
+ *  Listener endpoint; (socktype, family, nomapped, bind address and port).
+ */
+static const std::string &
+config_endpoint(const struct servtab *sep, std::string &key)
+{
+	char host[NI_MAXHOST], port[NI_MAXSERV], t_key[64];
+
+	key.assign(t_key, snprintf(t_key, sizeof(t_key), "%d/%d/%d", sep->se_socktype, sep->se_family, sep->se_nomapped));
+	switch (sep->se_family) {
+	case AF_INET:
+#ifdef INET6
+	case AF_INET6:
+#endif
+		if (0 == getnameinfo((const struct sockaddr *)&sep->se_ctrladdr, sep->se_ctrladdr_size,
+				host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV)) {
+			key.append("@").append(host).append(":").append(port);
+		}
+		break;
+#if defined(HAVE_AF_UNIX)
+	case AF_UNIX:
+		key.append("@").append(sep->se_ctrladdr_un.sun_path);
+		break;
+#endif
+	}
+	return key;
+}
+
+/*
+ *  Whether the bind address of the definitions agree; the port is resolved separately.
+ */
+static bool
+config_bindequal(const struct servconfig *a, const struct servconfig *b)
+{
+	switch (a->se_family) {
+	case AF_INET:
+		return (0 == memcmp(&a->se_ctrladdr4.sin_addr, &b->se_ctrladdr4.sin_addr, sizeof(struct in_addr)));
+#ifdef INET6
+	case AF_INET6:
+		return (0 == memcmp(&a->se_ctrladdr6.sin6_addr, &b->se_ctrladdr6.sin6_addr, sizeof(struct in6_addr)) &&
+			    a->se_ctrladdr6.sin6_scope_id == b->se_ctrladdr6.sin6_scope_id);
 #endif
-		    sep->se_socktype == cfg->se_socktype &&
-		    sep->se_family == cfg->se_family) {
-			return sep;
+	}
+	return true;
+}
+
+/*
+ *  Listener identity across processes, see upgrade(); service identity by value plus the
+ *  endpoint, so listeners are only adopted by an unchanged definition.
+ */
+static const std::string &
+handoff_key(const struct servtab *sep, std::string &key)
+{
+	std::string endpoint;
+	char t_key[32];
+	int rpc = 0;
+
+#if defined(RPC)
+	rpc = sep->se_rpc;
+#endif
+	key.assign(sep->se_service);
+	key.append("/");
+	key.append(sep->se_proto.c_str());
+	key.append(t_key, snprintf(t_key, sizeof(t_key), "/%d/", rpc));
+	key.append(config_endpoint(sep, endpoint));
+	return key;
+}
+
+typedef struct servconfig *(*configent_t)(const struct configparams *params, int *ret);
+
+/*
+ *  Open the configuration, returning its iterator; nullptr on error.
+ */
+static configent_t
+config_open(void)
+{
+	const char *dot;
+
+	if (nullptr != (dot = strrchr(SERVICES, '.')) && 0 == strcmp(dot, ".xconf")) {
+		if (! setconfig2(SERVICES)) {
+			syslog(LOG_ERR, "%s", setconfig2status(nullptr));
+			return nullptr;
 		}
+		return getconfigent2;
+	}
+	if (! setconfig(SERVICES)) {
+		syslog(LOG_ERR, "%s: %m", SERVICES);
+		return nullptr;
+	}
+	return getconfigent;
+}
+
+/*
+ *  Global default, from the defaults section or the replayed snapshot; nullptr when unset.
+ */
+static const char *
+config_default(const char *key, bool replay)
+{
+	const char *value;
+	char op = '=';
+
+	if (replay)
+		return getsnapshotdef(key);
+	value = getconfigdef2(key, op);
+	snapshotdefault(key, value);		// replayed on a later cold start.
+	return value;
+}
+
+/*
+ *  Ban policy, see bantable; ban_threshold and ban_duration defaults.
+ */
+static bool
+config_bans(bool replay, bantable::policy &policy)
+{
+	const char *threshold = config_default("ban_threshold", replay),
+		*duration = config_default("ban_duration", replay);
+
+	if (! bantable::to_policy(threshold, duration, policy)) {
+		syslog(LOG_ERR, "%s: invalid ban_threshold <%s> and/or ban_duration <%s>", SERVICES,
+			(threshold ? threshold : ""), (duration ? duration : ""));
+		return false;
 	}
-	return nullptr;
+	return true;
+}
+
+/*
+ *  Configuration modification, see setconfwatch(); reload as per SIGHUP.
+ */
+static void
+config_modified(void)
+{
+	flag_signal(SIGHUP);
 }
 
 static void
 config(void)
 {
-	const char *dot;
-	struct servconfig *(*configent)(const struct configparams *params, int *ret);
+	configent_t configent;
 	struct servconfig *cfg;
 	int cfgerr = 0;
 #ifdef LOGIN_CAP
 	login_cap_t *lc = nullptr;
 #endif
-
-	if (nullptr != (dot = strrchr(SERVICES, '.')) && 0 == strcmp(dot, ".xconf")) {
-		if (! setconfig2(SERVICES)) {
-			syslog(LOG_ERR, "%s", setconfig2status(nullptr));
-			return;
-		}
-		configent = getconfigent2;
+	static bool coldstart = true;
+	const bool initial = coldstart;
+	const std::string snapshot(std::string(SERVICES) + ".snapshot");
+	std::vector<std::unique_ptr<struct servconfig>> configs;
+	std::vector<std::string> sources;
+	bantable::policy banpolicy;
+	bool replay = false;
+
+	servconfig::newgeneration();		// names interned by this load
+	if (coldstart && setsnapshot(snapshot.c_str(), &params)) {
+		configent = getsnapshotent;	// sources unchanged since the last load.
+		replay = true;
 	} else {
-		if (! setconfig(SERVICES)) {
-			syslog(LOG_ERR, "%s: %m", SERVICES);
-			return;
+		setservdb();
+		if (nullptr == (configent = config_open()))
+			return;			// rejected; running services retained.
+		snapshotbegin();
+	}
+	coldstart = false;
+
+	/*
+	 * Parse the configuration as a whole before applying; a reload is rejected on
+	 * error, leaving the running services untouched. The sources are read once, so
+	 * what is verified is what is applied.
+	 */
+	while ((cfg = configent(&params, &cfgerr))) {
+		if (! replay)
+			snapshotrecord(cfg);
+		configs.emplace_back(new(std::nothrow) servconfig(*cfg));
+		if (nullptr == configs.back().get()) {
+			syslog(LOG_ERR, "new: %m");
+			terminate(EX_OSERR);
 		}
-		configent = getconfigent;
 	}
 
-	for (auto sit : *services_)
+	if (0 == cfgerr && ! config_bans(replay, banpolicy))
+		cfgerr = EX_CONFIG;
+
+	if (cfgerr) {
+		if (replay)
+			endsnapshot();
+		endconfig();
+		endconfig2();
+		if (initial)
+			terminate(cfgerr);
+		syslog(LOG_ERR, "%s: configuration error, reload rejected", SERVICES);
+		return;
+	}
+
+	ServiceIndex current, pending;
+	std::vector<struct servtab *> setups;
+	std::string key;
+
+	current.reserve(services_->size());
+	for (auto sit : *services_) {
 		sit->se_checked = 0;
+		current.emplace(config_key(sit.get(), key), sit.get());
+	}
 
 	Services t_services(std::make_shared<ServiceCollection>());
 
 	t_services->reserve(services_->size() > 64 ? services_->size() + 8 : 64);
+	pending.reserve(t_services->capacity());
 
-	while ((cfg = configent(&params, &cfgerr))) {
+	for (const auto &t_cfg : configs) {
+		cfg = t_cfg.get();
 #if !defined(_WIN32)
 		if (getpwnam(cfg->se_user) == nullptr) {
 			syslog(LOG_ERR, "%s/%s: no such user '%s', service ignored",
@@ -1304,14 +1591,15 @@ config(void)
 #endif
 
 
-		if (config_match(t_services, cfg)) {
+		config_key(cfg, key);
+		if (config_match(pending, key)) {
 			syslog(LOG_ERR, "%s/%s: service duplicated, secondary ignored",
 				cfg->se_service, cfg->se_proto);
 			continue;
 		}
 
 		const int new_nomapped = cfg->se_nomapped;
-		struct servtab *sep = config_match(services_, cfg);
+		struct servtab *sep = config_match(current, key);
 
 		if (sep != nullptr) {
 			int i;
@@ -1333,6 +1621,13 @@ config(void)
 			if (debug)
 				syslog(LOG_DEBUG, "recreating %s", cfg->se_service);
 
+			/* bind address; a change of endpoint, the port is resolved below */
+			if (! config_bindequal(sep, cfg)) {
+				sep->se_ctrladdr_size = cfg->se_ctrladdr_size;
+				memcpy(&sep->se_ctrladdr, &cfg->se_ctrladdr, cfg->se_ctrladdr_size);
+				sep->se_reset = 1;
+			}
+
 			sep->se_maxchild = cfg->se_maxchild;
 			sep->se_cpmmax = cfg->se_cpmmax;
 			sep->se_cpmwait = cfg->se_cpmwait;
@@ -1350,6 +1645,7 @@ config(void)
 				}
 			}
 			sep->se_accept = cfg->se_accept;
+			sep->se_names = servconfig::names();
 
 			sep->se_user = std::move(cfg->se_user);
 			sep->se_group = std::move(cfg->se_group);
@@ -1367,7 +1663,15 @@ config(void)
 				SWAP(const char *, sep->se_argv[i], cfg->se_argv[i]);
 			sep->se_environ = std::move(cfg->se_environ);
 			sep->se_access_times = std::move(cfg->se_access_times);
-			sep->se_addresses = std::move(cfg->se_addresses);
+
+			/* compiled tables; retained, with their state, unless the rules differ */
+			if (! sep->se_addresses.equal(cfg->se_addresses))
+				sep->se_addresses = std::move(cfg->se_addresses);
+			if (! sep->se_shadow_addresses.equal(cfg->se_shadow_addresses))
+				sep->se_shadow_addresses = std::move(cfg->se_shadow_addresses);
+			if (! sep->se_geoips.equal(cfg->se_geoips))
+				sep->se_geoips = std::move(cfg->se_geoips);
+			sep->se_ratelimits = std::move(cfg->se_ratelimits);
 #ifdef IPSEC
 			sep->se_policy = std::move(cfg->se_policy);
 			ipsecsetup(sep);
@@ -1386,6 +1690,25 @@ config(void)
 			print_service("ADD ", sep);
 		}
 		t_services->push_back(sep);
+		pending.emplace(key, sep);
+
+		/* compile acl; identical rule sets share a single table */
+		if (! sep->se_addresses.build()) {
+			syslog(LOG_ERR, "%s/%s: unable to build acl: %m",
+				sep->se_service, sep->se_proto);
+		}
+		if (sep->se_shadow_addresses.active() && ! sep->se_shadow_addresses.build()) {
+			syslog(LOG_ERR, "%s/%s: unable to build shadow acl: %m",
+				sep->se_service, sep->se_proto);
+		}
+		if (! sep->se_ratelimits.build()) {
+			syslog(LOG_ERR, "%s/%s: unable to build rate limits: %m",
+				sep->se_service, sep->se_proto);
+		}
+		if (! sep->se_geoips.build()) {		/* preload; avoid first connection cost */
+			syslog(LOG_ERR, "%s/%s: unable to load geoip database <%s>",
+				sep->se_service, sep->se_proto, sep->se_geoips.database().c_str());
+		}
 
 		sep->se_checked = 1;
 		if (ISMUX(sep)) {
@@ -1457,16 +1780,28 @@ config(void)
 		inetd::CriticalSection::Guard guard(sep->se_state.lock);
 		if (sep->se_state.enabled) {
 			if (sep->se_fd == -1) {
-				setup(sep);
+				setups.push_back(sep);
 			} else if (! SERVTAB_EXCEEDS_LIMIT(sep)) {
 				enable(sep);
 			}
 		}
 	}
 
-	if (cfgerr) terminate(cfgerr);
+	transfer(setups);
+	setup(setups);
+	if (replay) {
+		sources = getsnapshotsources();
+		endsnapshot();
+	} else {
+		const std::vector<std::string> *t_sources = getconfigsources2();
+		sources = (t_sources ? *t_sources : std::vector<std::string>{SERVICES});
+		if (servdbsource())
+			sources.push_back(servdbsource());	// port resolution
+		snapshotcommit(snapshot.c_str(), &params, sources);
+	}
 	endconfig();
 	endconfig2();
+	setconfwatch(sources, config_modified);
 
 	/*
 	 * Swap resources and purge anything not looked at above.
@@ -1481,6 +1816,162 @@ config(void)
 			close_sep(sep, true);
 		}
 	}
+
+	/*
+	 * Release acl tables no longer referenced by any service; retired limiter and geoip state.
+	 */
+	AccessIP::purge();
+	ratelimits::purge();
+	geoips::purge();
+	bantable::setpolicy(banpolicy);
+	bantable::save();
+	if (debug) {
+		AccessIP::sysdump();
+		processes.sysdump();
+		bantable::sysdump();
+	}
+}
+
+/*
+ *  Approximate service memory footprint; the instance, its strings, the spawn environment
+ *  and rule tables. Compiled acl tables are shared, see AccessIP, so are counted by each user.
+ */
+static size_t
+check_footprint(const struct servtab *sep)
+{
+	size_t bytes = sizeof(struct servtab);
+	const char **env;
+
+	bytes += sep->se_proto.length() + sep->se_user.length() + sep->se_group.length() +
+		    sep->se_banner.length() + sep->se_banner_success.length() + sep->se_banner_fail.length() +
+		    sep->se_server.length() + sep->se_working_directory.length() + sep->se_arguments.length() +
+		    sep->se_remote_name.length();
+	for (const auto &value : sep->se_environ.passenv())
+		bytes += sizeof(value) + value.length();
+	for (const auto &value : sep->se_environ.setenv())
+		bytes += sizeof(value) + value.length();
+	if (nullptr != (env = sep->se_environ.get())) {
+		for (; *env; ++env)
+			bytes += sizeof(const char *) + strlen(*env) + 1;
+		bytes += sizeof(const char *);
+	}
+	bytes += sep->se_addresses.footprint() + sep->se_shadow_addresses.footprint();
+	for (const auto &rule : sep->se_geoips())
+		bytes += sizeof(rule) + rule.spec.capacity();
+	bytes += sep->se_ratelimits.size() * sizeof(ratelimits::rule);
+	return bytes;
+}
+
+/*
+ *  Configuration check, see -n; parse with the production parsers and build each service's
+ *  acl, geoip, rate-limit and spawn structures as per config(), without binding. The cost of
+ *  each service plus load totals are reported on stdout, parse errors to syslog.
+ */
+static int
+check(void)
+{
+	typedef std::chrono::steady_clock checkclock;
+	auto elapsed = [](checkclock::time_point &start) {
+			const checkclock::time_point now = checkclock::now();
+			const double t_elapsed = std::chrono::duration<double, std::milli>(now - start).count();
+			start = now;
+			return t_elapsed;
+		};
+	configent_t configent;
+	struct servconfig *cfg;
+	ServiceCollection services;
+	ServiceIndex index;
+	std::string key;
+	double parse = 0, build = 0;
+	size_t bytes = 0, acl;
+	unsigned tables = 0;
+	int cfgerr = 0;
+
+	servconfig::newgeneration();
+	setservdb();
+
+	checkclock::time_point start = checkclock::now();
+	if (nullptr == (configent = config_open()))
+		return EX_CONFIG;
+	parse += elapsed(start);
+
+	printf("%-24s %-8s %6s %6s %6s %6s %6s %10s %10s\n",
+		"service", "proto", "acl", "shadow", "geoip", "rates", "times", "bytes", "build-ms");
+	while (true) {
+		cfg = configent(&params, &cfgerr);
+		parse += elapsed(start);
+		if (nullptr == cfg)
+			break;
+
+		config_key(cfg, key);
+		if (config_match(index, key)) {
+			syslog(LOG_ERR, "%s/%s: service duplicated, secondary ignored",
+				cfg->se_service, cfg->se_proto);
+			continue;
+		}
+
+		struct servtab *sep = new(std::nothrow) servtab(*cfg);	// owning copy; cfg reset on advance.
+		if (sep == nullptr) {
+			syslog(LOG_ERR, "new: %m");
+			terminate(EX_OSERR);
+		}
+		sep->se_state.enabled = false;	// never enabled.
+		services.push_back(sep);
+		index.emplace(key, sep);
+
+		if (! sep->se_addresses.build()) {
+			syslog(LOG_ERR, "%s/%s: unable to build acl: %m",
+				sep->se_service, sep->se_proto);
+		}
+		if (sep->se_shadow_addresses.active() && ! sep->se_shadow_addresses.build()) {
+			syslog(LOG_ERR, "%s/%s: unable to build shadow acl: %m",
+				sep->se_service, sep->se_proto);
+		}
+		if (! sep->se_ratelimits.build()) {
+			syslog(LOG_ERR, "%s/%s: unable to build rate limits: %m",
+				sep->se_service, sep->se_proto);
+		}
+		if (! sep->se_geoips.build()) {
+			syslog(LOG_ERR, "%s/%s: unable to load geoip database <%s>",
+				sep->se_service, sep->se_proto, sep->se_geoips.database().c_str());
+		}
+		(void) sep->se_environ.get();	// spawn environment; otherwise built on first use.
+
+		const double t_build = elapsed(start);
+		const size_t t_bytes = check_footprint(sep);
+
+		printf("%-24s %-8s %6u %6u %6u %6u %6u %10lu %10.3f\n",
+			sep->se_service, sep->se_proto.c_str(), (unsigned)sep->se_addresses.size(),
+			(unsigned)sep->se_shadow_addresses.size(), (unsigned)sep->se_geoips.size(),
+			(unsigned)sep->se_ratelimits.size(), (unsigned)sep->se_access_times.size(),
+			(unsigned long)t_bytes, t_build);
+		build += t_build;
+		bytes += t_bytes;
+		start = checkclock::now();	// exclude reporting.
+	}
+
+	bantable::policy banpolicy;
+	if (! config_bans(false, banpolicy)) {
+		cfgerr = EX_CONFIG;
+	} else if (banpolicy.strikes) {
+		printf("bans: %u violations within %us, ban %us up to %us\n",
+			banpolicy.strikes, banpolicy.window, banpolicy.basettl, banpolicy.maxttl);
+	} else {
+		printf("bans: disabled\n");
+	}
+	endconfig();
+	endconfig2();
+
+	acl = AccessIP::footprint(tables);
+	printf("%s: %u services, %lu bytes; %u acl tables, %lu bytes; parse %.3f ms, build %.3f ms%s\n",
+		SERVICES, (unsigned)services.size(), (unsigned long)bytes, tables, (unsigned long)acl,
+		parse, build, (cfgerr ? "; configuration error" : ""));
+
+	services.clear();
+	AccessIP::purge();
+	ratelimits::purge();
+	geoips::purge();
+	return cfgerr;
 }
 
 #if defined(RPC)
@@ -1540,21 +2031,64 @@ static void
 retry(void)
 {
 	Services current_services(services());
+	std::vector<struct servtab *> pending;
+
 	for (auto sit : *current_services) {
 		struct servtab *sep = sit.get();
 
 		inetd::CriticalSection::Guard guard(sep->se_state.lock);
 		if (sep->se_state.enabled) {
 			if (sep->se_fd == -1 && !ISMUX(sep)) {
-				setup(sep);
+				pending.push_back(sep);
 			}
 		}
 	}
+	setup(pending);
 }
 
-static void
-setup(struct servtab *sep)
+/*
+ *  Listener setup.
+ *
+ *  Listeners are prepared, that is created, configured, bound and listening, in parallel
+ *  on a transient worker pool; the calling thread registers each batch of SETUP_BATCH
+ *  with the i/o engine, in order, as it completes. Bind failures are retried following
+ *  RETRYTIME, as before.
+ */
+#define SETUP_BATCH	64			// listeners per batch.
+#define SETUP_MAXWORKERS 16
+
+enum { SETUP_OK, SETUP_FAILED, SETUP_RETRY };
+
+struct setuptimes {				// phase timings, in milliseconds.
+	setuptimes() : socket(0), bind(0), serial(0), enable(0), total(0)
+	{
+	}
+	double socket;				// socket creation and options, accumulated.
+	double bind;				// bind and listen, accumulated.
+	double serial;				// serialised preparation; AF_UNIX.
+	double enable;				// registration.
+	double total;				// elapsed.
+};
+
+typedef std::chrono::steady_clock setupclock;
+
+static double
+setup_elapsed(setupclock::time_point &start)
+{
+	const setupclock::time_point now = setupclock::now();
+	const double elapsed = std::chrono::duration<double, std::milli>(now - start).count();
+
+	start = now;
+	return elapsed;
+}
+
+/*
+ *  Prepare the service listener; called with se_state.lock held, see setup().
+ */
+static int
+setup_socket(struct servtab *sep, struct setuptimes &times)
 {
+	setupclock::time_point start = setupclock::now();
 	int on = 1;
 
 	/* Set all listening sockets to close-on-exec. */
@@ -1564,11 +2098,27 @@ setup(struct servtab *sep)
 
 	assert(sep->se_state.enabled);
 
+	sep->se_inherited = 0;
+	if (inherited) {			// upgrade; adopt the original listener.
+		std::string key;
+
+		if ((sep->se_fd = gethandoff(handoff_key(sep, key))) >= 0) {
+			if (sep->se_accept && sep->se_socktype == SOCK_STREAM && iocp.Enabled() &&
+					! iocp.Adopt(sep->se_listener, sep->se_fd)) {
+				syslog(LOG_WARNING, "%s/%s: inherited listener not adopted, selecting",
+				    sep->se_service, sep->se_proto);
+				sep->se_inherited = 1;
+			}
+			times.socket += setup_elapsed(start);
+			return SETUP_OK;
+		}
+	}
+
 	if ((sep->se_fd = socket(sep->se_family, sep->se_socktype | SOCK_CLOEXEC, 0)) < 0) {
 		// Note: the socket function creates a socket that supports overlapped I/O operations as the default behavior.
 		syslog(LOG_ERR, "%s/%s: socket: %m",
 		    sep->se_service, sep->se_proto);
-		return;
+		return SETUP_FAILED;
 	}
 
 #define turnon(fd, opt) \
@@ -1613,17 +2163,18 @@ setup(struct servtab *sep)
 		umask(0777); /* Make socket with conservative permissions */
 	}
 #endif //HAVE_AF_UNIX
+	times.socket += setup_elapsed(start);
 
 	if (bind(sep->se_fd, (struct sockaddr *)&sep->se_ctrladdr, sep->se_ctrladdr_size) < 0) {
 		syslog(LOG_ERR, "%s/%s: bind: %m", sep->se_service, sep->se_proto);
 		(void) sockclose(sep->se_fd);
 		sep->se_fd = -1;
-		setalarm(RETRYTIME);
 #if defined(HAVE_AF_UNIX)
 		if (sep->se_family == AF_UNIX)
 			umask(mask);
 #endif //HAVE_AF_UNIX
-		return;
+		times.bind += setup_elapsed(start);
+		return SETUP_RETRY;
 	}
 
 #if defined(HAVE_AF_UNIX)
@@ -1637,6 +2188,18 @@ setup(struct servtab *sep)
 	}
 #endif //HAVE_AF_UNIX
 
+	if (sep->se_socktype == SOCK_STREAM)
+		listen(sep->se_fd, -1);
+	times.bind += setup_elapsed(start);
+	return SETUP_OK;
+}
+
+/*
+ *  Register a prepared listener; rpc binding and i/o engine.
+ */
+static void
+setup_register(struct servtab *sep)
+{
 #if defined(RPC)
 	if (sep->se_rpc) {
 		u_int i;
@@ -1675,7 +2238,7 @@ setup(struct servtab *sep)
 		else {
 			syslog(LOG_ERR, "%s/%s: inetd compiled without inet6 support\n",
 			    sep->se_service, sep->se_proto);
-			(void) close(sep->se_fd);
+			(void) sockclose(sep->se_fd);
 			sep->se_fd = -1;
 			return;
 		}
@@ -1692,8 +2255,6 @@ setup(struct servtab *sep)
 	}
 #endif //RPC
 
-	if (sep->se_socktype == SOCK_STREAM)
-		listen(sep->se_fd, -1);
 	enable(sep);
 	if (debug) {
 		syslog(LOG_DEBUG, "registered %s on %d",
@@ -1701,6 +2262,449 @@ setup(struct servtab *sep)
 	}
 }
 
+/*
+ *  Whether preparation is to be serialised; umask() is process wide.
+ */
+static bool
+setup_serial(const struct servtab *sep)
+{
+#if defined(HAVE_AF_UNIX)
+	return (AF_UNIX == sep->se_family);
+#else
+	(void) sep;
+	return false;
+#endif
+}
+
+static void
+setup(const std::vector<struct servtab *> &pending)
+{
+	const size_t count = pending.size(), batches = (count + SETUP_BATCH - 1) / SETUP_BATCH;
+	setupclock::time_point start = setupclock::now(), phase = start;
+	std::vector<int> results(count, SETUP_FAILED);
+	std::vector<unsigned char> completed(batches, 0);
+	std::vector<struct setuptimes> times;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> next(0);
+	std::condition_variable cond;
+	std::mutex lock;
+	unsigned workers = std::thread::hardware_concurrency(), failed = 0, retries = 0;
+	bool retry = false;
+
+	if (0 == count)
+		return;
+
+	if (workers > SETUP_MAXWORKERS)
+		workers = SETUP_MAXWORKERS;
+	if (workers > batches)
+		workers = (unsigned)batches;
+	times.resize(workers > 1 ? workers + 1 : 1);
+
+	/*
+	 * Preparation holds the service lock; until registered the service remains
+	 * reachable by in-flight accept completions, see disable().
+	 */
+	auto prepare = [&](size_t idx, struct setuptimes &t_times) {
+		struct servtab *sep = pending[idx];
+
+		inetd::CriticalSection::Guard guard(sep->se_state.lock);
+		results[idx] = setup_socket(sep, t_times);
+	};
+
+	for (size_t idx = 0; idx < count; ++idx) {
+		if (setup_serial(pending[idx]))
+			prepare(idx, times[0]);
+	}
+	times[0].serial = setup_elapsed(phase);
+
+	auto worker = [&](struct setuptimes &t_times) {
+		size_t batch;
+
+		while ((batch = next++) < batches) {
+			const size_t end = std::min(count, (batch + 1) * SETUP_BATCH);
+
+			for (size_t idx = batch * SETUP_BATCH; idx < end; ++idx) {
+				if (! setup_serial(pending[idx]))
+					prepare(idx, t_times);
+			}
+			{	std::lock_guard<std::mutex> guard(lock);
+				completed[batch] = 1;
+			}
+			cond.notify_one();
+		}
+	};
+
+	if (workers > 1) {
+		try {
+			for (unsigned w = 1; w <= workers; ++w)
+				threads.emplace_back(worker, std::ref(times[w]));
+		} catch (const std::system_error &) {
+			// thread resources; those started complete the set.
+		}
+	}
+	if (threads.empty())
+		worker(times[0]);
+
+	for (size_t batch = 0; batch < batches; ++batch) {
+		const size_t end = std::min(count, (batch + 1) * SETUP_BATCH);
+
+		if (! threads.empty()) {
+			std::unique_lock<std::mutex> guard(lock);
+			cond.wait(guard, [&]() { return 0 != completed[batch]; });
+		}
+		phase = setupclock::now();
+
+		for (size_t idx = batch * SETUP_BATCH; idx < end; ++idx) {
+			struct servtab *sep = pending[idx];
+
+			inetd::CriticalSection::Guard guard(sep->se_state.lock);
+			if (SETUP_OK == results[idx]) {
+				if (sep->se_state.enabled) {
+					setup_register(sep);
+				} else {
+					(void) sockclose(sep->se_fd);
+					sep->se_fd = -1;
+				}
+			} else {
+				if (SETUP_RETRY == results[idx]) {
+					retry = true;
+					++retries;
+				}
+				++failed;
+			}
+		}
+		times[0].enable += setup_elapsed(phase);
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	if (retry)
+		setalarm(RETRYTIME);
+
+	struct setuptimes &total = times[0];
+	for (size_t w = 1; w < times.size(); ++w) {
+		total.socket += times[w].socket;
+		total.bind += times[w].bind;
+	}
+	total.total = setup_elapsed(start);
+	if (debug) {
+		syslog(LOG_DEBUG, "setup: %u listeners, %u workers, %u failed (%u retry); "
+			"socket %.1fms, bind %.1fms (accumulated); serial %.1fms, enable %.1fms, total %.1fms",
+			(unsigned)count, (unsigned)(threads.empty() ? 1 : threads.size()), failed, retries,
+			total.socket, total.bind, total.serial, total.enable, total.total);
+	}
+}
+
+/*
+ *  Listener transfer.
+ *
+ *  A service withdrawn by a reload whose endpoint is unchanged within a service introduced
+ *  by the same reload, for example when renamed, hands over its listener rather than it
+ *  being closed and bound anew; connections queued on the listen backlog are retained.
+ *  Accepts outstanding against the original are cancelled, those already completed being
+ *  served by its successor, see async_accept().
+ */
+static void
+transfer(std::vector<struct servtab *> &pending)
+{
+	std::unordered_map<std::string, struct servtab *> withdrawn;
+	std::string key;
+	unsigned transferred = 0;
+
+	for (auto sit : *services_) {
+		struct servtab *sep = sit.get();
+
+		if (sep->se_checked || sep->se_fd < 0)
+			continue;
+#if defined(RPC)
+		if (sep->se_rpc)
+			continue;		// registration bound to the descriptor.
+#endif
+		withdrawn.emplace(config_endpoint(sep, key), sep);
+	}
+
+	if (withdrawn.empty())
+		return;
+
+	for (auto it = pending.begin(); it != pending.end();) {
+		struct servtab *sep = *it, *osep;
+		auto wit = withdrawn.find(config_endpoint(sep, key));
+
+		if (wit == withdrawn.end()
+#if defined(RPC)
+				|| sep->se_rpc
+#endif
+				) {
+			++it;
+			continue;
+		}
+		osep = wit->second;
+		withdrawn.erase(wit);
+
+		{	inetd::CriticalSection::Guard guard(osep->se_state.lock);
+			const bool associated = (iocp_listener(osep) && osep->se_listener.is_open());
+
+			disable(osep);		// stop accepting.
+			if (associated && (! iocp_listener(sep) ||
+					! iocp.Transfer(sep->se_listener, osep->se_listener))) {
+				disable(osep, true);	// release the endpoint; bound anew.
+				++it;
+				continue;
+			}
+			sep->se_fd = osep->se_fd;
+			osep->se_fd = -1;
+			osep->se_successor = sep->shared_from_this();
+		}
+
+		{	inetd::CriticalSection::Guard guard(sep->se_state.lock);
+			if (debug)
+				syslog(LOG_DEBUG, "transferring %s listener to %s, fd %d",
+					osep->se_service, sep->se_service, sep->se_fd);
+			if (sep->se_state.enabled && ! SERVTAB_EXCEEDS_LIMIT(sep))
+				enable(sep);
+		}
+		it = pending.erase(it);
+		++transferred;
+	}
+
+	if (debug && transferred)
+		syslog(LOG_DEBUG, "transfer: %u listeners", transferred);
+}
+
+/*
+ *  Hot upgrade.
+ *
+ *  The listeners are handed to a replacement image, see handoffspawn(), which adopts them
+ *  in place of binding its own; once it has loaded, this instance stops accepting, lets
+ *  in-flight accepts and tracked children drain, at most UPGRADE_DRAIN seconds, then exits.
+ *  Should the replacement fail to load, service continues here unaffected.
+ *
+ *  The replacement moves each completion port listener onto its own port, see IOCPService::Adopt(),
+ *  hence accepts here are first paused, at most UPGRADE_PAUSE milliseconds, until none remain
+ *  outstanding; connections arriving meanwhile queue on the listen backlog. Without the means
+ *  to adopt, the replacement selects such listeners, which select() bounds to FD_SETSIZE.
+ *
+ *  Each phase is polled from the event loop, see upgrade_continue(), so children are reaped
+ *  and SIGTERM honoured throughout; reloads and retries are deferred until its outcome.
+ */
+#define UPGRADE_DRAIN	(60*5)			/* drain limit, seconds */
+#define UPGRADE_PAUSE	(5*1000)		/* accept pause limit, milliseconds */
+
+enum { UPGRADE_IDLE, UPGRADE_PAUSING, UPGRADE_SPAWNED };
+
+static int upgrade_phase = UPGRADE_IDLE;
+static std::chrono::steady_clock::time_point upgrade_paused;
+static std::vector<inetd::instrusive_ptr<struct servtab>> upgrade_held;
+static std::vector<struct handofflistener> upgrade_listeners;
+static bool upgrade_reload, upgrade_retry;	/* deferred signals */
+static time_t upgrade_deadline;
+
+static void
+upgrade_resume(void)
+{
+	std::vector<struct servtab *> rebind;
+
+	for (auto &held : upgrade_held) {
+		struct servtab *sep = held.get();
+
+		inetd::CriticalSection::Guard guard(sep->se_state.lock);
+		if (! sep->se_state.enabled || sep->se_fd < 0)
+			continue;
+		if (inetd::IOCPService::Adoptable() &&
+				! iocp.Adopt(sep->se_listener, sep->se_fd)) {
+			syslog(LOG_WARNING, "upgrade: %s: listener not reclaimed, rebinding", sep->se_service);
+			disable(sep, true);	// replacement may have adopted; bound anew.
+			rebind.push_back(sep);
+			continue;
+		}
+		if (! SERVTAB_EXCEEDS_LIMIT(sep))
+			enable(sep);
+	}
+	setup(rebind);
+	upgrade_held.clear();
+	upgrade_listeners.clear();
+	upgrade_phase = UPGRADE_IDLE;
+
+	if (upgrade_reload)
+		flag_signal(SIGHUP);
+	else if (upgrade_retry)
+		flag_signal(SIGALRM);
+	upgrade_reload = upgrade_retry = false;
+}
+
+static void
+upgrade_failed(void)
+{
+	syslog(LOG_ERR, "upgrade failed, service continuing");
+	if (0 == debug && nullptr == pfh && (pfh = pidfile_open(pid_file, 0600, nullptr)) != nullptr)
+		(void) pidfile_write(pfh);
+	upgrade_resume();
+}
+
+static void
+upgrade(void)
+{
+	Services current_services(services());
+	unsigned selected = 1 /*signalpipe*/;
+	std::string key;
+
+	if (upgrading || UPGRADE_IDLE != upgrade_phase)
+		return;
+
+	upgrade_listeners.clear();
+	for (auto sit : *current_services) {
+		struct servtab *sep = sit.get();
+
+		inetd::CriticalSection::Guard guard(sep->se_state.lock);
+		if (sep->se_state.enabled && sep->se_fd >= 0) {
+			upgrade_listeners.push_back({handoff_key(sep, key), sep->se_fd});
+			if (! iocp_listener(sep) || ! inetd::IOCPService::Adoptable())
+				++selected;
+		}
+	}
+
+	if (selected > FD_SETSIZE) {
+		syslog(LOG_ERR, "upgrade: %u listeners exceed select limit of %u, service continuing",
+			selected, (unsigned)FD_SETSIZE);
+		upgrade_listeners.clear();
+		return;
+	}
+
+	for (auto sit : *current_services) {	// pause accepts, see IOCPService::Adopt().
+		struct servtab *sep = sit.get();
+
+		inetd::CriticalSection::Guard guard(sep->se_state.lock);
+		if (sep->se_state.enabled && sep->se_fd >= 0 && iocp_listener(sep)) {
+			disable(sep);
+			upgrade_held.push_back(sep->shared_from_this());
+		}
+	}
+
+	upgrade_phase = UPGRADE_PAUSING;
+	upgrade_paused = std::chrono::steady_clock::now();
+	(void) upgrade_continue();
+}
+
+/*
+ *  Advance an upgrade in progress, without blocking; returns whether one remains pending.
+ */
+static bool
+upgrade_continue(void)
+{
+	const std::string path(std::string(SERVICES) + ".handoff");
+
+	switch (upgrade_phase) {
+	case UPGRADE_PAUSING:
+		if (armed) {
+			if (std::chrono::steady_clock::now() - upgrade_paused <
+					std::chrono::milliseconds(UPGRADE_PAUSE))
+				return true;
+			syslog(LOG_ERR, "upgrade: %u accepts outstanding, service continuing", (unsigned)armed);
+			upgrade_resume();
+			return false;
+		}
+
+		bantable::save();		// replacement state.
+		if (pfh != nullptr) {		// released to the replacement.
+			pidfile_close(pfh);
+			pfh = nullptr;
+		}
+		if (handoffspawn(path.c_str(), upgrade_listeners) < 0) {
+			upgrade_failed();
+			return false;
+		}
+		upgrade_phase = UPGRADE_SPAWNED;
+		return true;
+
+	case UPGRADE_SPAWNED: {
+			const int ready = handoffready();
+
+			if (0 == ready)
+				return true;
+			if (ready < 0) {
+				upgrade_failed();
+				return false;
+			}
+		}
+		break;
+
+	default:
+		return false;
+	}
+
+	upgrading = true;
+	endconfwatch();
+	endhandoffwatch();
+
+	Services current_services(services());
+	for (auto sit : *current_services) {	// stop accepting.
+		struct servtab *sep = sit.get();
+
+		inetd::CriticalSection::Guard guard(sep->se_state.lock);
+		if (sep->se_state.enabled && sep->se_fd >= 0)
+			disable(sep, true);
+	}
+	upgrade_held.clear();
+	upgrade_listeners.clear();
+	upgrade_phase = UPGRADE_IDLE;
+	upgrade_deadline = time(nullptr) + UPGRADE_DRAIN;
+	return false;
+}
+
+/*
+ *  Termination; abandon any replacement yet to load.
+ */
+static void
+upgrade_cancel(void)
+{
+	if (UPGRADE_SPAWNED == upgrade_phase)
+		handoffcancel();
+	upgrade_held.clear();
+	upgrade_listeners.clear();
+	upgrade_phase = UPGRADE_IDLE;
+}
+
+/*
+ *  Whilst an upgrade is in progress, reload and retry are deferred until its outcome;
+ *  neither then applies on success, the replacement having loaded.
+ */
+static bool
+upgrade_defer(int signo)
+{
+	if (UPGRADE_IDLE == upgrade_phase)
+		return false;
+	if (SIGHUP == signo)
+		upgrade_reload = true;
+	else
+		upgrade_retry = true;
+	return true;
+}
+
+/*
+ *  Upgrade request, see sethandoffwatch(); as per SIGUPGRADE.
+ */
+static void
+upgrade_request(void)
+{
+	flag_signal(SIGUPGRADE);
+}
+
+static bool
+upgrade_drained(void)
+{
+	const size_t children = processes.size();
+
+	if (0 == accepting && 0 == children) {
+		syslog(LOG_INFO, "upgrade: drained, exiting");
+		return true;
+	}
+	if (time(nullptr) >= upgrade_deadline) {
+		syslog(LOG_WARNING, "upgrade: drain limit, exiting with %u children", (unsigned)children);
+		return true;
+	}
+	return false;
+}
+
 #ifdef IPSEC
 static void
 ipsecsetup(struct servtab *sep)
@@ -1794,6 +2798,12 @@ close_sep(struct servtab *sep, bool end /*=false*/)
 	sep->se_count = 0;			// reset usage
 }
 
+unsigned servtab::newid()
+{
+	static std::atomic<unsigned> sequence(0);
+	return ++sequence;
+}
+
 void servtab::intrusive_deleter(struct servtab *sep)
 {
 	assert(! sep->se_state.enabled);
@@ -1813,6 +2823,16 @@ void servtab::intrusive_deleter(struct servtab *sep)
  *  Service control
  */
 
+/*
+ *  Whether the listener is serviced by the i/o engine; inherited listeners, see upgrade(),
+ *  are adopted by its completion port, only those which could not be are selected.
+ */
+static bool
+iocp_listener(const struct servtab *sep)
+{
+	return (sep->se_accept && sep->se_socktype == SOCK_STREAM && iocp.Enabled() && ! sep->se_inherited);
+}
+
 static void
 enable(struct servtab *sep)
 {
@@ -1820,7 +2840,7 @@ enable(struct servtab *sep)
 	if (sep->se_state.running) {
 #ifdef SANITY_CHECK
 		assert(sep->se_fd >= 0);
-		if (sep->se_accept && sep->se_socktype == SOCK_STREAM && iocp.Enabled()) {
+		if (iocp_listener(sep)) {
 			assert(sep->se_listener.is_open());
 		} else {
 			assert(FD_ISSET(sep->se_fd, &allsock));
@@ -1850,7 +2870,7 @@ enable(struct servtab *sep)
 	}
 #endif
 
-	if (sep->se_accept && sep->se_socktype == SOCK_STREAM && iocp.Enabled()) {
+	if (iocp_listener(sep)) {
 		if (! iocp.Listen(sep->se_listener, sep->se_fd)) {
 			terminate(EX_SOFTWARE);
 			return;
@@ -1859,8 +2879,10 @@ enable(struct servtab *sep)
 		std::shared_ptr<inetd::IOCPService::Socket>
 			acceptor = std::make_shared<inetd::IOCPService::Socket>();
 
+		++armed;
 		if (! iocp.Accept(sep->se_listener, *acceptor.get(),
 			    std::bind(&async_accept, sep->shared_from_this(), acceptor, std::placeholders::_1))) {
+			--armed;
 			terminate(EX_SOFTWARE);
 			return;
 		}
@@ -1900,7 +2922,7 @@ disable(struct servtab *sep, bool closing /*=false*/)
 		}
 #endif
 
-		if (sep->se_accept && sep->se_socktype == SOCK_STREAM && iocp.Enabled()) {
+		if (iocp_listener(sep)) {
 			if (! closing && ! iocp.Cancel(sep->se_listener)) {
 				terminate(EX_SOFTWARE);
 			}
@@ -1914,7 +2936,7 @@ disable(struct servtab *sep, bool closing /*=false*/)
 	}
 
 	if (closing && sep->se_fd >= 0) {
-		if (sep->se_accept && sep->se_socktype == SOCK_STREAM && iocp.Enabled()) {
+		if (iocp_listener(sep)) {
 			iocp.Shutdown(sep->se_listener);
 		}
 		sockclose(sep->se_fd);
@@ -1984,12 +3006,12 @@ print_service(const char *action, const struct servconfig *sep)
 
 
 static struct conninfo *
-search_connections(PeerInfo &remote)
+search_connections(PeerInfo &remote, struct procinfo *&proc)
 {
 	struct servtab *sep = remote.getserv();
 	struct conninfo *conn = nullptr;
-	int hv;
 
+	proc = nullptr;
 	if (sep->se_maxperip <= 0)
 		return nullptr;
 
@@ -1999,13 +3021,10 @@ search_connections(PeerInfo &remote)
 
 	switch (ss->ss_family) {
 	case AF_INET:
-		hv = hashval((char *)&((struct sockaddr_in *)ss)->sin_addr, sizeof(struct in_addr));
-		break;
 #ifdef INET6
 	case AF_INET6:
-		hv = hashval((char *)&((struct sockaddr_in6 *)ss)->sin6_addr, sizeof(struct in6_addr));
-		break;
 #endif
+		break;
 	default:
 		/*
 		 * Since we only support AF_INET and AF_INET6, just
@@ -2014,69 +3033,24 @@ search_connections(PeerInfo &remote)
 		return nullptr;
 	}
 
-	const char *pname = remote.getname();
-	if (nullptr == pname) {
-		return nullptr;
-	}
-
-	sep->se_conn[hv].foreach_term_r([hv, ss, &sep, pname, &conn](struct conninfo *ci) {
-		if (ci) {
-			char pname2[NI_MAXHOST];
-
-			if (getnameinfo((const struct sockaddr *)&ci->co_addr,
-				    SOCKLEN_SOCKADDR_STORAGE(ci->co_addr), pname2, sizeof(pname2), nullptr, 0, NI_NUMERICHOST) == 0) {
-				if (strcmp(pname, pname2) == 0) {
-					conn = ci;
-					return true; //match
-				}
-			} else {
-				syslog(LOG_ERR, "%s getnameinfo error : %M", sep->se_service);
-			}
-			return false; //next
-		}
-
-		if ((ci = new(std::nothrow) conninfo(sep->se_maxperip)) == nullptr) {
-			syslog(LOG_ERR, "new: %m");
-			terminate(EX_OSERR);
-			conn = (conninfo *)-1;
-			return false; //done
-		}
-
-		static_assert(sizeof(ci->co_addr) == sizeof(*ss), "address structures");
-		memcpy(&ci->co_addr, &ss, sizeof(ci->co_addr));
-		sep->se_conn[hv].push_front_r(*ci);
-		conn = ci;
-		return true; //done
-	});
-
 	/*
 	 * Since a child process is not invoked yet, we cannot determine a pid of a child.
-	 * So, co_proc and co_numchild should be filled leter.
+	 * So, the returned procinfo pr_pid should be filled later.
 	 */
-
-	return conn;
-}
-
-static bool
-new_connection(const struct servtab *sep, struct conninfo *conn, struct procinfo *&proc)
-{
-	char pname[NI_MAXHOST] = "unknown";
-	int maxchild = 0;
-
-	proc = nullptr;
-	if (nullptr == (proc = connprocs_new(conn, maxchild))) {
-		if (maxchild > 0) { // limit imposed
-			if (getnameinfo((struct sockaddr *)&conn->co_addr,
-				    SOCKLEN_SOCKADDR_STORAGE(conn->co_addr),
-				    pname, sizeof(pname), nullptr, 0, NI_NUMERICHOST)) {
-				syslog(LOG_ERR, "%s getnameinfo error : %M", sep->se_service);
-			}
-			syslog(LOG_ERR, "%s from %s exceeded count (limit %d)",
-				sep->se_service, pname, maxchild);
-			return false;
-		}
+	switch (sep->se_conn.acquire(ss, sep->se_maxperip, conn, proc)) {
+	case conntable::CT_OK:
+		return conn;
+	case conntable::CT_LIMIT:
+		syslog(LOG_ERR, "%s from %s exceeded count (limit %d)",
+			sep->se_service, remote.getname(), sep->se_maxperip);
+		banviolation(remote, "per-source");
+		break;
+	default:
+		syslog(LOG_ERR, "new: %m");
+		terminate(EX_OSERR);
+		break;
 	}
-	return true;
+	return (conninfo *)-1;
 }
 
 static void
@@ -2086,105 +3060,31 @@ connections_resize(struct servtab *sep, int maxperip)
 		connections_free(sep);
 		return;
 	}
-	for (unsigned i = 0; i < PERIPSIZE; ++i) {
-		sep->se_conn[i].foreach_r([maxperip](auto conn) {
-			if (! conn->co_procs.resize(maxperip)) {
-				terminate(EX_OSERR);
-			}
-			return false; //next
-		});
+	if (! sep->se_conn.resize(maxperip)) {
+		terminate(EX_OSERR);
 	}
 }
 
 static void
 connections_free(struct servtab *sep)
 {
-	for (unsigned i = 0; i < PERIPSIZE; ++i) {
-		sep->se_conn[i].foreach_safe_r([](auto conn) {
-			connprocs_clear(conn);
-			free_conn(conn);
-			return false; //next
-		});
-	}
+	sep->se_conn.clear();
 	assert(0 == sep->se_children.count());
 }
 
-static void
-free_conn(struct conninfo *conn)
-{
-	if (nullptr == conn)
-		return;
-	if (conn->co_procs.numchild() <= 0) {
-		ConnInfoList::remove_self_r(conn);
-		delete conn;
-	}
-}
-
-
-/////////////////////////////////////////////////////////////////////////////////////////
-//	connprocs
-
-static struct procinfo *
-connprocs_new(struct conninfo *conn, int &maxchild)
-{
-	if (struct procinfo *proc = conn->co_procs.newproc(conn, maxchild)) {
-		if (proc == (struct procinfo *) -1) {
-			syslog(LOG_ERR, "new: %m");
-			terminate(EX_OSERR);
-			proc = nullptr;
-		}
-		return proc;
-	}
-	return nullptr;
-}
-
-static void
-connprocs_clear(struct conninfo *conn)
-{
-	conn->co_procs.clear(conn);
-		// note: underlying procinfo's are not destroyed
-		//  these are assumed to be owned by the childlist.
-}
-
-
 /////////////////////////////////////////////////////////////////////////////////////////
 //	procinfo
 
-static struct procinfo *
-search_proc(pid_t pid, struct procinfo *add)
-{
-	struct procinfo *proc = nullptr;
-	int hv;
-
-	assert(nullptr == add || -1 == add->pr_pid);
-
-	hv = hashval((const char *)&pid, sizeof(pid));
-	proctable[hv].foreach_term_r([hv, pid, add, &proc](struct procinfo *pi) {
-		if (pi) {
-			if (pi->pr_pid == pid) {
-				proc = pi;
-				return true;
-			}
-
-		} else if (proc == nullptr /*nomatch*/ && add) {
-			proctable[hv].push_back(*add);
-			add->pr_pid = pid;
-			return true;
-		}
-		return false; //next
-	});
-	return proc;
-}
-
 static void
 free_proc(struct procinfo *proc)
 {
 	if (nullptr == proc)
 		return;
 
-	if (struct conninfo *conn = proc->pr_conn) {
-		conn->co_procs.unlink(proc);
-		proc->pr_conn = nullptr;
+	if (class conntable *table = proc->pr_table) {
+		table->unlink(proc);		// pr_conn read under the table lock.
+		proc->pr_table = nullptr;
+		assert(nullptr == proc->pr_conn);
 	}
 
 	if (-1 != proc->pr_pid) {
@@ -2192,27 +3092,14 @@ free_proc(struct procinfo *proc)
 			sep->se_children.remove_r(proc);
 			proc->pr_sep = nullptr;
 		}
-		ProcInfoList::remove_self_r(proc);
+		processes.remove(proc->pr_pid);
 		proc->pr_pid = -1;
 	}
 
 	assert(! proc->pr_child_link_.is_hooked());
-	assert(! proc->pr_procinfo_link_.is_hooked());
 	assert(nullptr == proc->pr_conn);
 	assert(nullptr == proc->pr_sep);
 	delete proc;
 }
 
-static int
-hashval(const char *p, int len)
-{
-	unsigned int hv = 0xABC3D20F;
-	int i;
-
-	for (i = 0; i < len; ++i, ++p)
-		hv = (hv << 5) ^ (hv >> 23) ^ *p;
-	hv = (hv ^ (hv >> 16)) & (PERIPSIZE - 1);
-	return hv;
-}
-
 //end
@@ -81,6 +81,8 @@
 #include "netaddrs.h"
 #include "accesstm.h"
 #include "geoips.h"
+#include "ratelimit.h"
+#include "conntable.h"
 #include "environ.h"
 #include "peerinfo.h"
 
@@ -125,20 +127,20 @@ struct procinfo {
 	procinfo(const procinfo &) = delete;
 	procinfo operator=(const procinfo &) = delete;
 
-	procinfo() : pr_pid(-1), pr_conn(nullptr), pr_sep(nullptr) {
+	procinfo() : pr_pid(-1), pr_table(nullptr), pr_conn(nullptr), pr_sep(nullptr) {
 	}
 
-	inetd::Intrusive::TailMemberHook<procinfo> pr_procinfo_link_;
 	inetd::Intrusive::ListMemberHook<procinfo> pr_child_link_;
+	LIST_ENTRY(procinfo) pr_conn_link_; /* connprocs linkage */
 	pid_t pr_pid; 			/* child pid & linked, otherwise -1 */
-	struct conninfo *pr_conn;	/* associated host connection */
+	class conntable *pr_table;	/* owning connection table; fixed at allocation */
+	struct conninfo *pr_conn;	/* associated host connection; guarded by pr_table */
 	struct servtab *pr_sep; 	/* associated service */
 };
 
-typedef inetd::intrusive_list<procinfo, inetd::Intrusive::TailMemberHook<procinfo>, &procinfo::pr_procinfo_link_> ProcInfoList;
 typedef inetd::intrusive_list<procinfo, inetd::Intrusive::ListMemberHook<procinfo>, &procinfo::pr_child_link_> ChildList;
 
-// host connection collection
+// host connection collection; guarded by the owning conntable.
 struct connprocs {
 	connprocs(const connprocs &) = delete;
 	connprocs operator=(const connprocs &) = delete;
@@ -149,13 +151,12 @@ struct connprocs {
 	bool unlink(struct procinfo *proc);
 	void clear(struct conninfo *conn);
 	int numchild() const {
-		return (int)cp_procs.size();
+		return cp_numchild;
 	}
 
 private:
-	struct Guard;
-	inetd::SpinLock cp_lock;	/* spin lock */
-	std::vector<struct procinfo *> cp_procs; /* child proc entries */
+	LIST_HEAD(, procinfo) cp_procs;	/* child proc entries */
+	int cp_numchild;		/* number of children */
 	int cp_maxchild;		/* max number of children */
 };
 
@@ -164,17 +165,18 @@ struct conninfo {
 	conninfo(const conninfo &) = delete;
 	conninfo operator=(const conninfo &) = delete;
 
-	conninfo(int maxperip) : co_procs(maxperip) {
-	}
+	conninfo(const struct sockaddr_storage *ss, int maxperip);
 
-	inetd::Intrusive::ListMemberHook<conninfo> co_link_;
-	struct sockaddr_storage co_addr;/* source address */
-	connprocs co_procs;		/* array of child proc entry, from same host/addr */
+	class conntable *co_table;	/* owning table */
+	int co_family;			/* source address family */
+	union { 			/* source address */
+		struct in_addr addr4;
+		struct in6_addr addr6;
+	} co_addr;
+	connprocs co_procs;		/* child proc entries, from same host/addr */
 };
 
-typedef inetd::intrusive_list<conninfo, inetd::Intrusive::ListMemberHook<conninfo>, &conninfo::co_link_> ConnInfoList;
-
-#define PERIPSIZE	256		/* procinfo hash table size */
+struct servnames;
 
 // service configuration
 struct servconfig {
@@ -182,8 +184,12 @@ struct servconfig {
 
 	static const char *newname(const char *name);
 	static const char *newarg(const char *arg);
+	static std::shared_ptr<servnames> names();
+	static void newgeneration();
 
 	servconfig();
+	servconfig(const servconfig &rhs);	/* owning; argv duplicated */
+	~servconfig();
 
 	const char *se_service;		/* name of service */
 	const struct biltin *se_bi;	/* if built-in, description */
@@ -217,7 +223,9 @@ struct servconfig {
 	environment se_environ;		/* application environment */
 	access_times se_access_times;	/* access time ranges */
 	netaddrs se_addresses;		/* only_from/no_access addresses */
+	netaddrs se_shadow_addresses;	/* shadow_only_from/shadow_no_access; evaluated, not enforced */
 	geoips se_geoips;		/* geoip rules */
+	ratelimits se_ratelimits;	/* token bucket rate limits */
 	union { 			/* bound address */
 		struct sockaddr se_un_ctrladdr;
 		struct sockaddr_in se_un_ctrladdr4;
@@ -255,6 +263,7 @@ struct servconfig {
 	u_int	se_rpc_lowvers; 	/* RPC low version */
 	u_int	se_rpc_highvers;	/* RPC high version */
 #endif
+	std::shared_ptr<servnames> se_names; /* interned name generation; see newname() */
 };
 
 // service instance
@@ -264,18 +273,21 @@ struct servtab : public servconfig,
 	servtab(const servtab &) = delete;
 	servtab operator=(const servtab &) = delete;
 
-	servtab() : servconfig(),
+	servtab() : servconfig(), se_id(newid()),
 			se_fd(-1), se_count(0), se_time() {
 		se_state.enabled = false;
 		se_state.running = false;
 	}
 
-	servtab(const servconfig &cfg) : servconfig(cfg),
+	servtab(const servconfig &cfg) : servconfig(cfg), se_id(newid()),
 			se_fd(-1), se_count(0), se_time() {
+		se_names = names();
 		se_state.enabled = true;
 		se_state.running = false;
 	}
 
+	static unsigned newid();
+
 	static void intrusive_deleter(struct servtab *sep);
 
 	struct {
@@ -286,18 +298,22 @@ struct servtab : public servconfig,
 	struct se_flags {
 		u_int se_checked : 1;	/* looked at during configuration merge */
 		u_int se_reset : 1;	/* channel reset required */
+		u_int se_inherited : 1;	/* inherited listener not adopted, selected; see sethandoff() */
 	} se_flags;
+	const unsigned se_id;		/* unique service identifier; stable across reconfiguration */
 	int	se_fd;			/* open descriptor */
 	inetd::IOCPService::Listener se_listener; /* iocp listener */
+	inetd::instrusive_ptr<servtab> se_successor; /* listener transferred to; see transfer() */
 	int	se_count;		/* number started since se_time */
 	struct	timespec se_time;	/* start of se_count */
 
-	ConnInfoList se_conn[PERIPSIZE];/* per host connection management */
+	conntable se_conn;		/* per host connection management */
 	ChildList se_children;		/* active child processes */
 };
 
 #define se_reset	se_flags.se_reset
 #define se_checked	se_flags.se_checked
+#define se_inherited	se_flags.se_inherited
 
 #define SERVTAB_EXCEEDS_LIMIT(sep)	\
 	((sep)->se_maxchild > 0 && (sep)->se_children.count() >= (sep)->se_maxchild)
@@ -322,10 +338,13 @@ extern int debug;
 
 Services services();
 
+int	banned(PeerInfo &remote);
+void	banviolation(PeerInfo &remote, const char *reason);
 int	accessip(PeerInfo &remote);
 int	geoip(PeerInfo &remote);
 int	accesstm(PeerInfo &remote);
 int	cpmip(PeerInfo &remote);
+int	ratelimit(PeerInfo &remote);
 
 int	banner(PeerInfo &remote);
 int	banner_success(PeerInfo &remote);
@@ -33,6 +33,7 @@ __BEGIN_DECLS
 extern int  inetd_main(int argc, char * const *argv);
 extern void inetd_signal_reconfig(int verbose);
 extern void inetd_signal_stop(int verbose);
+extern void inetd_signal_upgrade(void);
 
 __END_DECLS
 
@@ -102,6 +102,12 @@
 #include <algorithm>
 
 #include "accessip.h"
+#include "CoarseClock.h"
+
+#include "../libiptable/rcu_radix.h"
+
+#define SHADOW_LOGMAX		10		// divergence reports,
+#define SHADOW_LOGPERIOD	60		//  per period (seconds).
 
 /////////////////////////////////////////////////////////////////////////////////////////
 //  netaddr's
@@ -110,15 +116,14 @@ static inetd::CriticalSection netaddr_lock;
 
 
 netaddrs::netaddrs()
-	: match_default_(0), table_(nullptr)
+	: match_default_(0), shadowed_()
 {
 }
 
 
 netaddrs::netaddrs(const netaddrs &rhs)
-	: match_default_(0), table_(nullptr)
+	: match_default_(rhs.match_default_), addresses_(rhs.addresses_), shadowed_()
 {
-	addresses_ = rhs.addresses_;
 }
 
 
@@ -127,6 +132,9 @@ netaddrs::operator=(netaddrs &&rhs)
 {
 	if (this != &rhs) {
 		addresses_ = std::move(rhs.addresses_);
+		match_default_ = rhs.match_default_;
+		for (auto &counter : shadowed_)
+			counter.store(0, std::memory_order_relaxed);
 		rhs.reset();
 		reset();
 	}
@@ -151,8 +159,9 @@ bool
 netaddrs::build()
 {
 	inetd::CriticalSection::Guard guard(netaddr_lock);
-	if (nullptr == table_) {
-		if (nullptr == (table_ = new(std::nothrow) AccessIP(*this, match_default())))
+	if (nullptr == table_.get()) {
+		table_ = AccessIP::acquire(*this, match_default());
+		if (nullptr == table_.get())
 			return false;
 	}
 	return true;
@@ -165,13 +174,20 @@ netaddrs::allowed(const struct netaddr &addr) const
 	if (0 == addr.family)
 		return true;
 
-	if (nullptr == table_) {
+	if (nullptr == table_.get()) {
 		inetd::CriticalSection::Guard guard(netaddr_lock);
-		if (nullptr == table_) {
-			table_ = new AccessIP(*this, match_default());
+		if (nullptr == table_.get()) {
+			table_ = AccessIP::acquire(*this, match_default());
+			if (nullptr == table_.get())
+				return false;	// resource error; deny
 		}
 	}
-	return table_->allowed(addr);
+
+	const int token = rcu_read_enter();	// table retained until exit, see AccessIP::intrusive_deleter().
+	const AccessIP *table = table_.get();
+	const bool allowed = (table ? table->allowed(addr) : false);
+	rcu_read_exit(token);
+	return allowed;
 }
 
 
@@ -181,13 +197,37 @@ netaddrs::allowed(const struct sockaddr_storage *addr) const
 	if (nullptr == addr)
 		return true;
 
-	if (nullptr == table_) {
+	if (nullptr == table_.get()) {
 		inetd::CriticalSection::Guard guard(netaddr_lock);
-		if (nullptr == table_) {
-			table_ = new AccessIP(*this, match_default());
+		if (nullptr == table_.get()) {
+			table_ = AccessIP::acquire(*this, match_default());
+			if (nullptr == table_.get())
+				return false;	// resource error; deny
 		}
 	}
-	return table_->allowed(addr);
+
+	const int token = rcu_read_enter();	// table retained until exit, see AccessIP::intrusive_deleter().
+	const AccessIP *table = table_.get();
+	const bool allowed = (table ? table->allowed(addr) : false);
+	rcu_read_exit(token);
+	return allowed;
+}
+
+
+/*
+ *  Shadow evaluation; the result is counted against the live verdict, never enforced.
+ *  Returns true when the verdicts diverge.
+ */
+bool
+netaddrs::shadow(const struct sockaddr_storage *addr, bool live) const
+{
+	const bool result = allowed(addr);
+
+	shadowed_[0].fetch_add(1, std::memory_order_relaxed);
+	if (result == live)
+		return false;
+	shadowed_[result ? 1 : 2].fetch_add(1, std::memory_order_relaxed);
+	return true;
 }
 
 
@@ -231,6 +271,16 @@ netaddrs::push(const netaddr &addr, char op)
 }
 
 
+// replace the rule set; previously validated, see snapshot.
+void
+netaddrs::assign(Collection &&addresses, int match_default)
+{
+	addresses_ = std::move(addresses);
+	match_default_ = match_default;
+	reset();
+}
+
+
 bool
 netaddrs::erase(const netaddr &addr, char op)
 {
@@ -243,6 +293,19 @@ netaddrs::erase(const netaddr &addr, char op)
 }
 
 
+// same rule set; order significant.
+bool
+netaddrs::equal(const netaddrs &rhs) const
+{
+	return (match_default_ == rhs.match_default_ &&
+		addresses_.size() == rhs.addresses_.size() &&
+		std::equal(addresses_.begin(), addresses_.end(), rhs.addresses_.begin(),
+			[](const netaddress &a, const netaddress &b) {
+				return a.op == b.op && 0 == netaddrcmp(&a.addr, &b.addr);
+			}));
+}
+
+
 void
 netaddrs::sysdump() const
 {
@@ -254,6 +317,13 @@ netaddrs::sysdump() const
 		inet_ntop(address.addr.family, (void *)&address.addr.mask, t_mask, sizeof(t_mask));
 		syslog(LOG_DEBUG, "%c: %s/%d (%s)", address.op, t_addr, masklen, t_mask);
 	}
+	if (table_.get()) {
+		table_->dump();
+	}
+	if (const unsigned long evaluated = shadowed_[0].load(std::memory_order_relaxed)) {
+		syslog(LOG_DEBUG, "shadow: %lu evaluated, %lu would allow, %lu would deny", evaluated,
+			shadowed_[1].load(std::memory_order_relaxed), shadowed_[2].load(std::memory_order_relaxed));
+	}
 }
 
 
@@ -264,6 +334,14 @@ netaddrs::size() const
 }
 
 
+size_t
+netaddrs::footprint() const
+{
+	return (addresses_.capacity() * sizeof(struct netaddress)) +
+		(table_.get() ? table_->footprint() : 0);
+}
+
+
 bool
 netaddrs::empty() const
 {
@@ -271,6 +349,14 @@ netaddrs::empty() const
 }
 
 
+// rules or a default (only_from/no_access = ALL) to enforce.
+bool
+netaddrs::active() const
+{
+	return (! addresses_.empty() || 0 != match_default_);
+}
+
+
 size_t
 netaddrs::clear(char op)
 {
@@ -294,19 +380,51 @@ netaddrs::clear()
 void
 netaddrs::reset()
 {
-	delete table_;
-	table_ = nullptr;
+	table_.reset();
 }
 
 
 /////////////////////////////////////////////////////////////////////////////////////////
 //  netaddr's
 
+// bounded divergence reporting; process wide.
+static bool
+shadow_report()
+{
+	static std::atomic<unsigned long long> window(0);	// [period:32 | count:32]
+	const unsigned long long period = (unsigned long long)(inetd::CoarseClock::seconds() / SHADOW_LOGPERIOD) & 0xffffffff;
+	unsigned long long t_window = window.load(std::memory_order_relaxed), next;
+
+	do {
+		if ((t_window >> 32) != period) {
+			next = (period << 32) | 1;
+		} else if ((t_window & 0xffffffff) >= SHADOW_LOGMAX) {
+			return false;
+		} else {
+			next = t_window + 1;
+		}
+	} while (! window.compare_exchange_weak(t_window, next, std::memory_order_relaxed));
+	return true;
+}
+
+
 int
 accessip(PeerInfo &remote)
 {
 	const struct servtab *sep = remote.getserv();
-	return sep->se_addresses.allowed(remote.getaddr());
+	int ret = 0; // unlimited
+
+	if (sep->se_addresses.active()) {
+		ret = (sep->se_addresses.allowed(remote.getaddr()) ? 1 /*allowed*/ : -1 /*deny*/);
+	}
+
+	if (sep->se_shadow_addresses.active()) {
+		if (sep->se_shadow_addresses.shadow(remote.getaddr(), ret >= 0) && shadow_report()) {
+			syslog(LOG_NOTICE, "%s/%s: shadow acl would %s %s",
+			    sep->se_service, sep->se_proto.c_str(), (ret >= 0 ? "deny" : "allow"), remote.getname());
+		}
+	}
+	return ret;
 }
 
 //end
@@ -27,6 +27,9 @@
  */
 
 #include <vector>
+#include <atomic>
+
+#include "IntrusivePtr.h"
 
 #include "../libiptable/netaddr.h"
 
@@ -51,14 +54,19 @@ public:
 	bool build();
 	bool allowed(const struct netaddr &addr) const;
 	bool allowed(const struct sockaddr_storage *addr) const;
+	bool shadow(const struct sockaddr_storage *addr, bool live) const;
 	int match_default() const;
 	bool match_default(int status);
 	bool has_unspec(char op) const;
 	bool push(const netaddr &addr, char op);
 	bool erase(const netaddr &addr, char op);
+	void assign(Collection &&addresses, int match_default);
+	bool equal(const netaddrs &rhs) const;
 	void sysdump() const;
 	size_t size() const;
+	size_t footprint() const;
 	bool empty() const;
+	bool active() const;
 	size_t clear(char op);
 	void clear();
 	void reset();
@@ -66,7 +74,8 @@ public:
 private:
 	int match_default_;
 	Collection addresses_;
-	mutable AccessIP *table_;
+	mutable inetd::instrusive_ptr<AccessIP> table_;
+	mutable std::atomic<unsigned long> shadowed_[3];	// evaluated, would allow, would deny.
 };
 
 //end
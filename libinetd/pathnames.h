@@ -38,5 +38,6 @@
 #endif
 #define _PATH_INETDCONF	"/etc/inetd.conf"
 #define _PATH_INETDPID	_PATH_VARRUN "inetd.pid"
+#define _PATH_INETDBANS	_PATH_VARRUN "inetd.bans"
 
 //end
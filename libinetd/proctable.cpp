@@ -0,0 +1,225 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - pid indexed process table.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include "inetd.h"
+#include <syslog.h>
+
+#include "proctable.h"
+
+#define PT_MINSIZE	64			// initial/minimum capacity; power of 2.
+#define PT_MINSHIFT	(32 - 6)		// 32 - log2(PT_MINSIZE).
+
+
+proctable::proctable()
+	: slots_(nullptr), capacity_(0), shift_(PT_MINSHIFT), count_(0),
+		lookups_(0), probes_(0), maxprobe_(0)
+{
+}
+
+
+proctable::~proctable()
+{
+	free(slots_);
+}
+
+
+/*
+ *  Associate the process with the given pid.
+ */
+proctable::status
+proctable::insert(pid_t pid, struct procinfo *proc)
+{
+	inetd::ReadWriteLock::Guard guard(lock_);
+	unsigned probes = 0, idx;
+
+	assert(-1 != pid && proc && -1 == proc->pr_pid);
+	if (((count_ + 1) * 10) > (capacity_ * 7)) {	// load factor 0.7
+		if (! rehash(capacity_ ? capacity_ * 2 : PT_MINSIZE))
+			return PT_ERROR;
+	}
+
+	idx = locate(pid, probes);
+	probed(probes);
+	if (slots_[idx].pid == pid)
+		return PT_EXISTS;
+	slots_[idx].pid = pid;
+	slots_[idx].proc = proc;
+	proc->pr_pid = pid;
+	++count_;
+	return PT_OK;
+}
+
+
+/*
+ *  Lookup the process associated with the given pid; callable concurrently.
+ */
+struct procinfo *
+proctable::find(pid_t pid) const
+{
+	inetd::ReadWriteLock::SharedGuard guard(lock_);
+	unsigned probes = 0, idx;
+
+	if (0 == count_)
+		return nullptr;
+	idx = locate(pid, probes);
+	probed(probes);
+	return (slots_[idx].pid == pid ? slots_[idx].proc : nullptr);
+}
+
+
+/*
+ *  Disassociate the process with the given pid, returning the process reference.
+ */
+struct procinfo *
+proctable::remove(pid_t pid)
+{
+	inetd::ReadWriteLock::Guard guard(lock_);
+	unsigned probes = 0, hole, idx;
+	struct procinfo *proc;
+
+	if (0 == count_)
+		return nullptr;
+	hole = locate(pid, probes);
+	if (slots_[hole].pid != pid)
+		return nullptr;
+	proc = slots_[hole].proc;
+
+	const unsigned mask = capacity_ - 1;
+	for (idx = hole;;) {			// backward shift.
+		idx = (idx + 1) & mask;
+		if (-1 == slots_[idx].pid)
+			break;
+
+		const unsigned base = home(slots_[idx].pid);
+		if (hole <= idx ? (hole < base && base <= idx) : (hole < base || base <= idx))
+			continue;		// already within its probe sequence.
+		slots_[hole] = slots_[idx];
+		hole = idx;
+	}
+	slots_[hole].pid = -1;
+	slots_[hole].proc = nullptr;
+
+	--count_;
+	if (capacity_ > PT_MINSIZE && (count_ * 8) < capacity_) {
+		(void) rehash(capacity_ / 2);	// shrink; failure benign.
+	}
+	return proc;
+}
+
+
+void
+proctable::sysdump() const
+{
+	inetd::ReadWriteLock::SharedGuard guard(lock_);
+	const unsigned long long lookups = lookups_.load(std::memory_order_relaxed),
+		probes = probes_.load(std::memory_order_relaxed);
+
+	syslog(LOG_DEBUG, "proctable: %u entries, %u capacity, %llu lookups, %.2f average probe, %u max probe",
+		count_, capacity_, lookups, (lookups ? (double)probes / lookups : 0.0),
+		maxprobe_.load(std::memory_order_relaxed));
+}
+
+
+size_t
+proctable::size() const
+{
+	inetd::ReadWriteLock::SharedGuard guard(lock_);
+	return count_;
+}
+
+
+/*
+ *  Fibonacci hashing; disperses the sequential/4-aligned pid's well.
+ */
+unsigned
+proctable::home(pid_t pid) const
+{
+	return (unsigned)(((uint32_t)pid * UINT32_C(2654435769)) >> shift_);
+}
+
+
+/*
+ *  Slot holding the pid, otherwise the empty slot terminating its probe sequence.
+ */
+unsigned
+proctable::locate(pid_t pid, unsigned &probes) const
+{
+	const unsigned mask = capacity_ - 1;
+	unsigned idx = home(pid);
+
+	for (probes = 1;; ++probes, idx = (idx + 1) & mask) {
+		const pid_t t_pid = slots_[idx].pid;
+		if (t_pid == pid || -1 == t_pid)
+			return idx;
+	}
+	/*NOTREACHED*/
+}
+
+
+void
+proctable::probed(unsigned probes) const
+{
+	lookups_.fetch_add(1, std::memory_order_relaxed);
+	probes_.fetch_add(probes, std::memory_order_relaxed);
+
+	unsigned t_max = maxprobe_.load(std::memory_order_relaxed);
+	while (probes > t_max &&
+		    ! maxprobe_.compare_exchange_weak(t_max, probes, std::memory_order_relaxed))
+		;
+}
+
+
+bool
+proctable::rehash(unsigned capacity)
+{
+	slot *nslots = (slot *)malloc(capacity * sizeof(slot));
+	unsigned shift = 32;
+
+	if (nullptr == nslots)
+		return false;
+	for (unsigned i = 0; i < capacity; ++i) {
+		nslots[i].pid = -1;
+		nslots[i].proc = nullptr;
+	}
+	for (unsigned c = capacity; c > 1; c >>= 1)
+		--shift;
+
+	slot *oslots = slots_;
+	const unsigned ocapacity = capacity_;
+
+	slots_ = nslots, capacity_ = capacity, shift_ = shift;
+	for (unsigned i = 0; i < ocapacity; ++i) {
+		if (-1 != oslots[i].pid) {
+			unsigned probes;
+			const unsigned idx = locate(oslots[i].pid, probes);
+			slots_[idx] = oslots[i];
+		}
+	}
+	free(oslots);
+	return true;
+}
+
+//end
@@ -0,0 +1,80 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - pid indexed process table.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <stdint.h>
+#include <atomic>
+
+#include "SimpleLock.h"
+
+struct procinfo;
+
+/*
+ *  Open addressing (linear probe, backward shift deletion) table of child processes,
+ *  the pid held inline alongside the procinfo reference; grows and shrinks with load.
+ *
+ *  Lookups run concurrently under a shared lock, insert/remove are exclusive.
+ *  Probe lengths are accumulated for diagnostics, see sysdump().
+ */
+class proctable {
+	proctable(const proctable &) = delete;
+	proctable& operator=(const proctable &) = delete;
+
+public:
+	enum status { PT_OK, PT_EXISTS, PT_ERROR };
+
+	proctable();
+	~proctable();
+
+	status insert(pid_t pid, struct procinfo *proc);
+	struct procinfo *find(pid_t pid) const;
+	struct procinfo *remove(pid_t pid);
+	void sysdump() const;
+	size_t size() const;
+
+private:
+	struct slot {
+		pid_t pid;			// -1, when empty.
+		struct procinfo *proc;
+	};
+
+	unsigned home(pid_t pid) const;
+	unsigned locate(pid_t pid, unsigned &probes) const;
+	void probed(unsigned probes) const;
+	bool rehash(unsigned capacity);
+
+private:
+	mutable inetd::ReadWriteLock lock_;
+	slot *slots_;
+	unsigned capacity_;			// power of 2.
+	unsigned shift_;			// 32 - log2(capacity_).
+	unsigned count_;
+	mutable std::atomic<uint64_t> lookups_;
+	mutable std::atomic<uint64_t> probes_;
+	mutable std::atomic<unsigned> maxprobe_;
+};
+
+//end
@@ -0,0 +1,676 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - token bucket rate limits.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  rate_limit = <scope> <rate>[/<seconds>] [<burst>]
+ *
+ *      scope   source          Exact source address.
+ *              subnet          IPv4 /24 and IPv6 /64 source network.
+ *              subnet48        IPv4 /24 and IPv6 /48 source network.
+ *              service         All sources, service wide.
+ *
+ *  Each rule is a token bucket of depth <burst> (default <rate>), refilled at
+ *  <rate> tokens every <seconds> (default 1); a connection consumes one token
+ *  from every bucket along its path, and is refused when any bucket is empty.
+ *
+ *  Per-address scopes use a fixed, set associative table of buckets keyed on the exact
+ *  (masked) source address; a seeded hash selects the set, each guarded by its own spin
+ *  lock. Each bucket is a single 64-bit word, holding a millisecond timestamp and a
+ *  milli-token count; the service scope is a lone bucket updated by compare-and-swap.
+ *  No allocation and constant time per connection.
+ *
+ *  Sources never share a bucket, so a source limited is the source at fault, as assumed
+ *  by the ban table. Once a set is full an idle bucket, one refilled to capacity, is
+ *  recycled, otherwise the least recently used; its source restarts with a full bucket.
+ */
+
+#include "inetd.h"
+#include <syslog.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+
+#include "ratelimit.h"
+#include "CoarseClock.h"
+#include "SimpleLock.h"
+
+#define RL_SLOTS	4096			// buckets per address scope; power of 2.
+#define RL_WAYS		8			// buckets per set.
+#define RL_TOKEN	1000			// milli-tokens per token.
+#define RL_MAXRATE	1000000
+#define RL_MAXPERIOD	86400
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Bucket tables
+
+class ratelimits::Buckets {
+	Buckets(const Buckets &) = delete;
+	Buckets& operator=(const Buckets &) = delete;
+
+	struct Source {				// masked source address; family 0, unused.
+		unsigned char family;
+		unsigned char addr[16];
+	};
+
+	struct Bucket {
+		uint64_t state;			// [timestamp:32|milli-tokens:32]
+		Source source;
+	};
+
+	struct Set {
+		inetd::SpinLock lock;
+		Bucket buckets[RL_WAYS];
+	};
+
+	struct Table {
+		const struct rule *rule;	// associated rule.
+		uint32_t capacity;		// bucket depth, milli-tokens.
+		unsigned mask;			// set mask.
+		std::atomic<uint64_t> *slot;	// service scope.
+		Set *sets;			// address scopes.
+	};
+
+	struct Taken {
+		const Table *table;
+		Set *set;
+		Source source;
+	};
+
+public:
+	static Buckets *create(const Collection &rules);
+
+	const struct rule *take(const struct sockaddr_storage *addr) const;
+
+private:
+	Buckets(size_t tables, size_t slots, size_t sets);
+	static uint64_t key(const struct sockaddr_storage *addr, scope type, Source &source);
+	static bool take(uint64_t &state, uint32_t now, const Table &table);
+	static bool take(std::atomic<uint64_t> &slot, uint32_t now, const Table &table);
+	static void give(uint64_t &state, const Table &table);
+	static void give(std::atomic<uint64_t> &slot, const Table &table);
+	static Bucket &bucket(Set &set, const Source &source, uint32_t now, const Table &table);
+	static void give(Set &set, const Source &source, const Table &table);
+
+private:
+	static const uint64_t seed_;
+	std::vector<Table> tables_;
+	std::vector<std::atomic<uint64_t>> slots_;
+	std::unique_ptr<Set[]> sets_;
+};
+
+
+static uint64_t
+rl_seed()
+{
+	std::random_device rd;
+	return ((uint64_t)rd() << 32) ^ rd() ^ inetd::CoarseClock::milliseconds();
+}
+
+const uint64_t ratelimits::Buckets::seed_ = rl_seed();
+
+
+static inline uint64_t
+rl_mix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+
+ratelimits::Buckets::Buckets(size_t tables, size_t slots, size_t sets)
+	: slots_(slots), sets_(new Set[sets]())
+{
+	tables_.reserve(tables);
+}
+
+
+ratelimits::Buckets *
+ratelimits::Buckets::create(const Collection &rules)
+{
+	size_t slots = 0, sets = 0;
+
+	for (const auto &rule : rules) {
+		if (RL_SERVICE == rule.type) {
+			++slots;
+		} else {
+			sets += RL_SLOTS / RL_WAYS;
+		}
+	}
+
+	Buckets *buckets = nullptr;
+	try {
+		buckets = new Buckets(rules.size(), slots, sets);
+	} catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+
+	std::atomic<uint64_t> *slot = buckets->slots_.data();
+	Set *set = buckets->sets_.get();
+	for (const auto &rule : rules) {
+		Table table = {0};
+
+		table.rule = &rule;
+		table.capacity = rule.burst * RL_TOKEN;
+		if (RL_SERVICE == rule.type) {
+			table.slot = slot++;
+			table.slot->store(table.capacity, std::memory_order_relaxed); // full
+		} else {
+			table.mask = (RL_SLOTS / RL_WAYS) - 1;
+			table.sets = set;	// unused buckets; filled on first use.
+			set += RL_SLOTS / RL_WAYS;
+		}
+		buckets->tables_.push_back(table);
+	}
+	return buckets;
+}
+
+
+/*
+ *  Masked source address and its seeded hash.
+ */
+uint64_t
+ratelimits::Buckets::key(const struct sockaddr_storage *addr, scope type, Source &source)
+{
+	uint64_t h = seed_ ^ addr->ss_family;
+
+	memset(&source, 0, sizeof(source));
+	source.family = (unsigned char)addr->ss_family;
+	if (AF_INET6 == addr->ss_family) {
+		const struct in6_addr &in6 = ((const struct sockaddr_in6 *)addr)->sin6_addr;
+		uint64_t hi, lo;
+
+		memcpy(&hi, in6.s6_addr, sizeof(hi));
+		memcpy(&lo, in6.s6_addr + 8, sizeof(lo));
+		if (RL_SUBNET == type) {		// /64
+			lo = 0;
+		} else if (RL_SUBNET48 == type) {	// /48
+			lo = 0;
+			memset((unsigned char *)&hi + 6, 0, 2);
+		}
+		memcpy(source.addr, &hi, sizeof(hi));
+		memcpy(source.addr + 8, &lo, sizeof(lo));
+		h = rl_mix(h ^ hi);
+		h = rl_mix(h ^ lo);
+
+	} else {
+		uint32_t in4 = ((const struct sockaddr_in *)addr)->sin_addr.s_addr;
+
+		if (RL_SOURCE != type) {		// /24
+			in4 &= htonl(0xffffff00);
+		}
+		memcpy(source.addr, &in4, sizeof(in4));
+		h = rl_mix(h ^ in4);
+	}
+	return h;
+}
+
+
+bool
+ratelimits::Buckets::take(uint64_t &state, uint32_t now, const Table &table)
+{
+	const struct rule *rule = table.rule;
+	uint32_t stamp = (uint32_t)(state >> 32);
+	uint64_t tokens = (uint32_t)state;
+	const uint32_t elapsed = now - stamp;
+
+	if (elapsed) {				// refill; rate/period milli-tokens per millisecond.
+		const uint64_t refill = ((uint64_t)elapsed * rule->rate) / rule->period;
+
+		if (tokens + refill >= table.capacity) {
+			tokens = table.capacity;
+			stamp = now;
+		} else if (refill) {		// consume only the time accounted for.
+			tokens += refill;
+			stamp += (uint32_t)(((refill * rule->period) + rule->rate - 1) / rule->rate);
+		}
+	}
+
+	if (tokens < RL_TOKEN)
+		return false;			// empty.
+	tokens -= RL_TOKEN;
+	state = ((uint64_t)stamp << 32) | tokens;
+	return true;
+}
+
+
+bool
+ratelimits::Buckets::take(std::atomic<uint64_t> &slot, uint32_t now, const Table &table)
+{
+	uint64_t ov = slot.load(std::memory_order_relaxed);
+
+	for (;;) {
+		uint64_t nv = ov;
+
+		if (! take(nv, now, table))
+			return false;
+		if (slot.compare_exchange_weak(ov, nv, std::memory_order_relaxed))
+			return true;
+	}
+}
+
+
+void
+ratelimits::Buckets::give(uint64_t &state, const Table &table)
+{
+	uint64_t tokens = (uint32_t)state + RL_TOKEN;
+
+	if (tokens > table.capacity)
+		tokens = table.capacity;
+	state = (state & 0xffffffff00000000ULL) | tokens;
+}
+
+
+void
+ratelimits::Buckets::give(std::atomic<uint64_t> &slot, const Table &table)
+{
+	uint64_t ov = slot.load(std::memory_order_relaxed);
+
+	for (;;) {
+		uint64_t nv = ov;
+
+		give(nv, table);
+		if (slot.compare_exchange_weak(ov, nv, std::memory_order_relaxed))
+			return;
+	}
+}
+
+
+/*
+ *  Bucket of the source within its set, recycling one when absent; set lock held.
+ */
+ratelimits::Buckets::Bucket &
+ratelimits::Buckets::bucket(Set &set, const Source &source, uint32_t now, const Table &table)
+{
+	Bucket *victim = nullptr;
+	uint32_t oldest = 0;
+
+	for (Bucket &b : set.buckets) {
+		if (0 == memcmp(&b.source, &source, sizeof(source)))
+			return b;
+	}
+
+	for (Bucket &b : set.buckets) {
+		if (0 == b.source.family) {
+			victim = &b;		// unused.
+			break;
+		}
+
+		const uint32_t age = now - (uint32_t)(b.state >> 32);
+		const uint64_t refill = ((uint64_t)age * table.rule->rate) / table.rule->period;
+		if ((uint32_t)b.state + refill >= table.capacity) {
+			victim = &b;		// idle; indistinguishable from a new bucket.
+			break;
+		}
+		if (nullptr == victim || age > oldest) {
+			victim = &b;		// least recently used, thus far.
+			oldest = age;
+		}
+	}
+
+	victim->source = source;
+	victim->state = ((uint64_t)now << 32) | table.capacity; // full
+	return *victim;
+}
+
+
+void
+ratelimits::Buckets::give(Set &set, const Source &source, const Table &table)
+{
+	inetd::SpinLock::Guard guard(set.lock);
+
+	for (Bucket &b : set.buckets) {
+		if (0 == memcmp(&b.source, &source, sizeof(source))) {
+			give(b.state, table);
+			return;
+		}
+	}					// recycled since; nothing to return.
+}
+
+
+const struct ratelimits::rule *
+ratelimits::Buckets::take(const struct sockaddr_storage *addr) const
+{
+	const uint32_t now = (uint32_t)inetd::CoarseClock::milliseconds();
+	Taken taken[RL_SCOPES];
+	unsigned count = 0;
+
+	for (const auto &table : tables_) {
+		Taken &t = taken[count];
+		bool success;
+
+		t.table = &table;
+		t.set = nullptr;
+		if (RL_SERVICE == table.rule->type) {
+			success = take(*table.slot, now, table);
+
+		} else {
+			if (nullptr == addr ||
+				(AF_INET != addr->ss_family && AF_INET6 != addr->ss_family))
+				continue;	// unknown source, service scope only.
+
+			t.set = table.sets + (key(addr, table.rule->type, t.source) & table.mask);
+			inetd::SpinLock::Guard guard(t.set->lock);
+			success = take(bucket(*t.set, t.source, now, table).state, now, table);
+		}
+
+		if (! success) {
+			while (count--) {	// return tokens taken by earlier scopes.
+				const Taken &r = taken[count];
+				if (r.set) {
+					give(*r.set, r.source, *r.table);
+				} else {
+					give(*r.table->slot, *r.table);
+				}
+			}
+			return table.rule;
+		}
+
+		assert(count < RL_SCOPES);	// one rule per scope; see push().
+		++count;
+	}
+	return nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Retired tables
+//
+//  Tables replaced during reconfiguration may still be referenced by an in-flight
+//  admission check; release is deferred until the following reconfiguration.
+
+namespace {
+static inetd::CriticalSection retired_lock;
+static std::vector<void *> retired_pending, retired_expired;
+};
+
+
+void
+ratelimits::purge()
+{
+	std::vector<void *> expired;
+
+	{	inetd::CriticalSection::Guard guard(retired_lock);
+		expired.swap(retired_expired);
+		retired_expired.swap(retired_pending);
+	}
+
+	for (void *buckets : expired) {
+		delete static_cast<Buckets *>(buckets);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  Rules
+
+//static
+bool
+ratelimits::to_rule(const char *scope, const char *rate, const char *burst, struct rule &result)
+{
+	unsigned long count, period = 1, depth;
+	char *end = nullptr;
+
+	if (0 == _stricmp(scope, "source")) {
+		result.type = RL_SOURCE;
+	} else if (0 == _stricmp(scope, "subnet")) {
+		result.type = RL_SUBNET;
+	} else if (0 == _stricmp(scope, "subnet48")) {
+		result.type = RL_SUBNET48;
+	} else if (0 == _stricmp(scope, "service")) {
+		result.type = RL_SERVICE;
+	} else {
+		return false;
+	}
+
+	count = strtoul(rate, &end, 10);		// <rate>[/<seconds>]
+	if (end == rate || 0 == count || count > RL_MAXRATE)
+		return false;
+	if ('/' == *end) {
+		const char *cursor = end + 1;
+
+		period = strtoul(cursor, &end, 10);
+		if (end == cursor || 0 == period || period > RL_MAXPERIOD)
+			return false;
+	}
+	if (*end)
+		return false;
+
+	depth = count;					// [<burst>]
+	if (burst) {
+		depth = strtoul(burst, &end, 10);
+		if (end == burst || *end || 0 == depth || depth > RL_MAXRATE)
+			return false;
+	}
+
+	result.rate = (unsigned)count;
+	result.period = (unsigned)period;
+	result.burst = (unsigned)depth;
+	return true;
+}
+
+
+//static
+const char *
+ratelimits::to_name(scope type)
+{
+	switch (type) {
+	case RL_SOURCE:   return "source";
+	case RL_SUBNET:   return "subnet";
+	case RL_SUBNET48: return "subnet48";
+	case RL_SERVICE:  return "service";
+	default:
+		break;
+	}
+	return "unknown";
+}
+
+
+ratelimits::ratelimits() : buckets_(nullptr)
+{
+}
+
+
+ratelimits::ratelimits(const ratelimits &rhs)
+	: rules_(rhs.rules_), buckets_(nullptr)
+{
+}
+
+
+ratelimits&
+ratelimits::operator=(ratelimits &&rhs)
+{
+	if (this != &rhs) {
+		const bool same = equal(rhs);
+
+		rhs.reset();
+		if (! same) {			// retain bucket state when unchanged.
+			reset();
+			rules_ = std::move(rhs.rules_);
+		}
+		rhs.rules_.clear();
+	}
+	return *this;
+}
+
+
+bool
+ratelimits::equal(const ratelimits &rhs) const
+{
+	return (rules_.size() == rhs.rules_.size() &&
+		std::equal(rules_.begin(), rules_.end(), rhs.rules_.begin(),
+			[](const rule &a, const rule &b) {
+				return a.type == b.type && a.rate == b.rate &&
+					a.period == b.period && a.burst == b.burst;
+			}));
+}
+
+
+ratelimits::~ratelimits()
+{
+	delete buckets_.load();
+}
+
+
+const ratelimits::Collection&
+ratelimits::operator()() const
+{
+	return rules_;
+}
+
+
+ratelimits::Buckets *
+ratelimits::buckets() const
+{
+	Buckets *buckets = buckets_.load(std::memory_order_acquire);
+
+	if (nullptr == buckets && rules_.size()) {
+		Buckets *expected = nullptr;
+
+		if (nullptr == (buckets = Buckets::create(rules_)))
+			return nullptr;
+		if (! buckets_.compare_exchange_strong(expected, buckets,
+				std::memory_order_acq_rel, std::memory_order_acquire)) {
+			delete buckets;		// lost race.
+			buckets = expected;
+		}
+	}
+	return buckets;
+}
+
+
+bool
+ratelimits::build()
+{
+	return (rules_.empty() || nullptr != buckets());
+}
+
+
+const struct ratelimits::rule *
+ratelimits::allowed(const struct sockaddr_storage *addr) const
+{
+	if (rules_.empty())
+		return nullptr;
+
+	const Buckets *buckets = this->buckets();
+	if (nullptr == buckets)
+		return nullptr;			// resource error
+
+	return buckets->take(addr);
+}
+
+
+bool
+ratelimits::push(const struct rule &rule)
+{
+	if (buckets_.load())
+		return false;			// active.
+
+	for (auto &existing : rules_) {
+		if (existing.type == rule.type) {
+			existing = rule;	// replace.
+			return true;
+		}
+	}
+	rules_.push_back(rule);
+	return true;
+}
+
+
+void
+ratelimits::sysdump() const
+{
+	for (const auto &rule : rules_) {
+		syslog(LOG_DEBUG, "rate_limit: %s %u/%us burst %u",
+			to_name(rule.type), rule.rate, rule.period, rule.burst);
+	}
+}
+
+
+size_t
+ratelimits::size() const
+{
+	return rules_.size();
+}
+
+
+bool
+ratelimits::empty() const
+{
+	return rules_.empty();
+}
+
+
+void
+ratelimits::clear()
+{
+	rules_.clear();
+	reset();
+}
+
+
+void
+ratelimits::reset()
+{
+	Buckets *buckets = buckets_.exchange(nullptr);
+
+	if (buckets) {
+		inetd::CriticalSection::Guard guard(retired_lock);
+		retired_pending.push_back(buckets);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  rate limits
+
+int
+ratelimit(PeerInfo &remote)
+{
+	const struct servtab *sep = remote.getserv();
+
+	if (! sep->se_ratelimits.empty()) {
+		const struct ratelimits::rule *rule;
+
+		if (nullptr != (rule = sep->se_ratelimits.allowed(remote.getaddr()))) {
+			syslog(LOG_ERR, "%s from %s exceeded %s rate limit (%u/%us, burst %u)",
+			    sep->se_service, remote.getname(), ratelimits::to_name(rule->type),
+			    rule->rate, rule->period, rule->burst);
+			if (ratelimits::RL_SOURCE == rule->type)
+				banviolation(remote, "rate limit");
+			return -1; // deny
+		}
+		return 1; // allowed
+	}
+	return 0; // unlimited
+}
+
+//end
@@ -0,0 +1,80 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - token bucket rate limits.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <vector>
+#include <atomic>
+
+class ratelimits {
+	ratelimits operator=(const ratelimits &) = delete;
+
+public:
+	enum scope {
+		RL_SOURCE,			// exact address.
+		RL_SUBNET,			// ipv4 /24, ipv6 /64.
+		RL_SUBNET48,			// ipv4 /24, ipv6 /48.
+		RL_SERVICE,			// whole service.
+		RL_SCOPES
+	};
+
+	struct rule {
+		scope type;
+		unsigned rate;			// tokens per period.
+		unsigned period;		// period, in seconds.
+		unsigned burst;			// bucket depth.
+	};
+	typedef std::vector<struct rule> Collection;
+
+	static bool to_rule(const char *scope, const char *rate, const char *burst, struct rule &result);
+	static const char *to_name(scope type);
+	static void purge();
+
+	ratelimits();
+	ratelimits(const ratelimits &rhs);
+	ratelimits& operator=(ratelimits &&rhs);
+	~ratelimits();
+
+	const Collection& operator()() const;
+	bool build();
+	const struct rule *allowed(const struct sockaddr_storage *addr) const;
+	bool push(const struct rule &rule);
+	bool equal(const ratelimits &rhs) const;
+	void sysdump() const;
+	size_t size() const;
+	bool empty() const;
+	void clear();
+	void reset();
+
+private:
+	class Buckets;
+	Buckets *buckets() const;
+
+private:
+	Collection rules_;
+	mutable std::atomic<Buckets *> buckets_;
+};
+
+//end
@@ -28,6 +28,7 @@
 
 #include <algorithm>
 #include <climits>
+#include <unordered_map>
 
 #include <sysexits.h>
 #include <syslog.h>
@@ -35,12 +36,122 @@
 #include "config.h"
 
 
-struct snode { /* name string cache */
-	LIST_ENTRY(snode) node_;
-	char name_[1]; // implied nul
+/*
+ *  Interned names.
+ *
+ *  Names are interned into the current generation; a name already held by a live
+ *  generation is returned as is, so interned names are unique and compare by identity.
+ *  Each servtab references the generation current when it was created or reconfigured,
+ *  and a generation references the older generations it returned names from; storage
+ *  is released in bulk once no servtab can reference any of its names.
+ */
+struct servnames {
+	servnames(const servnames &) = delete;
+	servnames& operator=(const servnames &) = delete;
+
+	enum { BLOCKSIZE = 4 * 1024 };
+
+	servnames() : used_(BLOCKSIZE)
+	{
+	}
+
+	~servnames();
+
+	const char *push(const char *name)
+	{
+		const size_t length = strlen(name) + 1 /*nul*/;
+		char *result;
+
+		if (length > BLOCKSIZE / 4) {		// dedicated
+			blocks_.emplace_back(new char[length]);
+			result = blocks_.back().get();
+			if (blocks_.size() > 1)		// partial block remains trailing
+				std::swap(blocks_.back(), blocks_[blocks_.size() - 2]);
+		} else {
+			if (used_ + length > BLOCKSIZE) {
+				blocks_.emplace_back(new char[BLOCKSIZE]);
+				used_ = 0;
+			}
+			result = blocks_.back().get() + used_;
+			used_ += length;
+		}
+		(void) memcpy(result, name, length);
+		names_.push_back(result);
+		return result;
+	}
+
+	void depend(std::shared_ptr<servnames> &&generation)
+	{
+		for (const auto &it : depends_)
+			if (it == generation)
+				return;
+		depends_.push_back(std::move(generation));
+	}
+
+	std::weak_ptr<servnames> self_;
+	std::vector<std::shared_ptr<servnames>> depends_;
+	std::vector<std::unique_ptr<char[]>> blocks_;
+	std::vector<const char *> names_;
+	size_t used_;				// within the trailing block.
+};
+
+namespace {
+struct NameHash {
+	size_t operator()(const char *name) const
+	{
+		size_t hash = (size_t)2166136261U;	// FNV-1a
+		while (*name)
+			hash = (hash ^ (unsigned char)*name++) * (size_t)16777619U;
+		return hash;
+	}
+};
+
+struct NameEqual {
+	bool operator()(const char *a, const char *b) const
+	{
+		return (a == b || 0 == strcmp(a, b));
+	}
 };
+}; //namespace
+
+typedef std::unordered_map<const char *, servnames *, NameHash, NameEqual> NameIndex;
+
+static inetd::CriticalSection names_lock;
+static NameIndex names_index;			// live names, all generations.
+static std::shared_ptr<servnames> names_current;
+
+
+servnames::~servnames()
+{
+	inetd::CriticalSection::Guard guard(names_lock);
+	for (const char *name : names_)	{	// unless since re-interned
+		NameIndex::iterator it(names_index.find(name));
+		if (it != names_index.end() && it->first == name)
+			names_index.erase(it);
+	}
+}
 
-static LIST_HEAD(snodes, snode) string_collection;
+
+static servnames *
+names_generation()
+{
+	if (! names_current) {
+		names_current = std::make_shared<servnames>();
+		names_current->self_ = names_current;
+	}
+	return names_current.get();
+}
+
+
+#if !defined(NDEBUG)
+static bool
+names_interned(const char *name)
+{
+	inetd::CriticalSection::Guard guard(names_lock);
+	NameIndex::const_iterator it(names_index.find(name));
+	return (it != names_index.end() && it->first == name);
+}
+#endif
 
 
 servconfig::servconfig()
@@ -51,33 +162,112 @@ servconfig::servconfig()
 }
 
 
+// Copy, owning its arguments; parser entries are reset on advance, see freeconfig().
+servconfig::servconfig(const servconfig &rhs)
+	: se_service(rhs.se_service), se_bi(rhs.se_bi),
+	  se_socktype(rhs.se_socktype), se_family(rhs.se_family), se_port(rhs.se_port),
+	  se_proto(rhs.se_proto),
+	  se_sndbuf(rhs.se_sndbuf), se_rcvbuf(rhs.se_rcvbuf),
+	  se_maxchild(rhs.se_maxchild), se_cpmmax(rhs.se_cpmmax), se_cpmwait(rhs.se_cpmwait),
+	  se_maxperip(rhs.se_maxperip),
+	  se_user(rhs.se_user), se_group(rhs.se_group),
+	  se_banner(rhs.se_banner), se_banner_success(rhs.se_banner_success), se_banner_fail(rhs.se_banner_fail),
+#ifdef LOGIN_CAP
+	  se_class(rhs.se_class),
+#endif
+#ifdef IPSEC
+	  se_policy(rhs.se_policy),
+#endif
+	  se_server(rhs.se_server), se_server_name(nullptr),
+	  se_working_directory(rhs.se_working_directory),
+	  se_arguments(rhs.se_arguments),
+	  se_environ(rhs.se_environ),
+	  se_access_times(rhs.se_access_times),
+	  se_addresses(rhs.se_addresses),
+	  se_shadow_addresses(rhs.se_shadow_addresses),
+	  se_geoips(rhs.se_geoips),
+	  se_ratelimits(rhs.se_ratelimits),
+	  se_un(rhs.se_un), se_ctrladdr_size(rhs.se_ctrladdr_size),
+	  se_remote_family(rhs.se_remote_family), se_remote_port(rhs.se_remote_port),
+	  se_remote_name(rhs.se_remote_name),
+	  se_un_remote(rhs.se_un_remote), se_remoteaddr_size(rhs.se_remoteaddr_size),
+	  se_sockuid(rhs.se_sockuid), se_sockgid(rhs.se_sockgid), se_sockmode(rhs.se_sockmode),
+	  se_type(rhs.se_type), se_accept(rhs.se_accept), se_nomapped(rhs.se_nomapped),
+#if defined(RPC)
+	  se_rpc(rhs.se_rpc), se_rpc_prog(rhs.se_rpc_prog),
+	  se_rpc_lowvers(rhs.se_rpc_lowvers), se_rpc_highvers(rhs.se_rpc_highvers),
+#endif
+	  se_names(rhs.se_names)
+{
+	const char *server = rhs.se_server.data();
+
+	if (rhs.se_server_name) {		// either within se_server or interned.
+		if (server && rhs.se_server_name >= server &&
+				rhs.se_server_name <= server + rhs.se_server.length()) {
+			se_server_name = se_server.data() + (rhs.se_server_name - server);
+		} else {
+			se_server_name = rhs.se_server_name;
+		}
+	}
+
+	memset(se_argv, 0, sizeof(se_argv));
+	for (unsigned av = 0; av < MAXARGV && rhs.se_argv[av]; ++av)
+		se_argv[av] = servconfig::newarg(rhs.se_argv[av]);
+}
+
+
+servconfig::~servconfig()
+{
+	for (unsigned av = 0; av < MAXARGV; ++av)
+		free((char *)se_argv[av]);
+}
+
+
 //static
 const char *
 servconfig::newname(const char *name)
 {
-	static bool initialised = false;
-	snode *node;
+	inetd::CriticalSection::Guard guard(names_lock);
+	servnames *current = names_generation();
+	NameIndex::iterator it(names_index.find(name));
 
-	if (! initialised) {
-		LIST_INIT(&string_collection);
-		initialised = true;
-	}
+	if (it != names_index.end()) {
+		if (it->second == current)
+			return it->first;
 
-	LIST_FOREACH(node, &string_collection, node_) {
-		if (0 == strcmp(node->name_, name)) {
-			return node->name_;
+		std::shared_ptr<servnames> owner(it->second->self_.lock());
+		if (owner) {			// retain the owner whilst this generation lives
+			current->depend(std::move(owner));
+			return it->first;
 		}
+		names_index.erase(it);		// owner expiring
 	}
 
-	const size_t slen = strlen(name);
-	if (nullptr == (node = (snode *)::malloc(sizeof(snode) + slen))) {
-		throw std::bad_alloc();
-		/*NOREACHED*/
-	}
+	const char *result = current->push(name);
+	names_index.emplace(result, current);
+	return result;
+}
+
+
+//static
+std::shared_ptr<servnames>
+servconfig::names()
+{
+	inetd::CriticalSection::Guard guard(names_lock);
+	names_generation();
+	return names_current;
+}
+
+
+//static
+void
+servconfig::newgeneration()
+{
+	std::shared_ptr<servnames> previous;	// released outside the lock.
+	inetd::CriticalSection::Guard guard(names_lock);
 
-	(void) memcpy(node->name_, name, slen + 1 /*nul*/);
-	LIST_INSERT_HEAD(&string_collection, node, node_);
-	return node->name_;
+	previous.swap(names_current);
+	names_generation();
 }
 
 
@@ -146,13 +336,15 @@ syslogconfig(const char *label, const struct servconfig *sep)
 	sep->se_access_times.sysdump();
 	sep->se_geoips.sysdump();
 	sep->se_addresses.sysdump();
+	sep->se_shadow_addresses.sysdump();
+	sep->se_ratelimits.sysdump();
 }
 
 
 void
 freeconfig(struct servconfig *sep)
 {
-	assert(nullptr == sep->se_service || (sep->se_service == servconfig::newname(sep->se_service)));
+	assert(nullptr == sep->se_service || names_interned(sep->se_service));
 	sep->se_service = nullptr;	/* name of service */
 	sep->se_bi = nullptr;		/* if built-in, description */
 	sep->se_socktype = 0;		/* type of socket to use */
@@ -184,7 +376,9 @@ freeconfig(struct servconfig *sep)
 	memset(sep->se_argv, 0, sizeof(sep->se_argv));
 	sep->se_access_times.clear();	/* access times */
 	sep->se_addresses.clear();	/* access control */
+	sep->se_shadow_addresses.clear(); /* shadow access control */
 	sep->se_geoips.clear();		/* geoip rules */
+	sep->se_ratelimits.clear();	/* rate limits */
 	sep->se_environ.clear();	/* environment */
 	memset(&sep->se_un, 0, sizeof(sep->se_un)); /* bound address */
 	sep->se_ctrladdr_size = 0;
@@ -206,6 +400,7 @@ freeconfig(struct servconfig *sep)
 	sep->se_rpc_highvers = 0;	/* RPC high version */
 #endif
 	sep->se_maxperip;		/* max number of children per src */
+	sep->se_names.reset();		/* name generation */
 }
 
 //end
\ No newline at end of file
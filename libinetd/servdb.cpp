@@ -0,0 +1,287 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - services database.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  services(5)
+ *
+ *      <name> <port>/<protocol> [<alias> ...] [# comment]
+ */
+
+#include "inetd.h"
+
+#include <sys/stat.h>
+#include <syslog.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "servdb.h"
+
+namespace {
+struct Entry {
+	int port;				// network order.
+	unsigned names;				// first name, within names_.
+	unsigned count;				// name and aliases.
+};
+
+#define ENTRY_UNKNOWN	0xffffffffU		// cached getservbyname() failure.
+
+class ServicesDB {
+	ServicesDB(const ServicesDB &) = delete;
+	ServicesDB& operator=(const ServicesDB &) = delete;
+
+public:
+	ServicesDB() : loaded_(false), direct_(false), mtime_(0), size_(0)
+	{
+	}
+
+	int load();
+	const Entry *lookup(const char *name, const char *proto);
+	bool match(const Entry *entry, const char *name) const;
+	const char *source() const;
+
+private:
+	static std::string path();
+	bool parse(FILE *file);
+	void push(const char *proto, int port, const std::vector<const char *> &names);
+	void clear();
+
+	typedef std::unordered_map<std::string, unsigned> Index;
+
+	std::string source_;
+	bool loaded_;
+	bool direct_;				// database read; otherwise getservbyname() cache.
+	time_t mtime_;
+	off_t size_;
+	std::vector<Entry> entries_;
+	std::vector<std::string> names_;
+	Index index_;				// "name/proto" to entry.
+	std::string key_;
+};
+
+
+//static
+std::string
+ServicesDB::path()
+{
+#if defined(_WIN32)
+	char t_path[MAX_PATH] = {0};
+	const UINT len = ::GetSystemDirectoryA(t_path, sizeof(t_path));
+	if (len && len < sizeof(t_path))
+		return std::string(t_path, len) + "\\drivers\\etc\\services";
+#endif
+	return "/etc/services";
+}
+
+
+void
+ServicesDB::clear()
+{
+	entries_.clear();
+	names_.clear();
+	index_.clear();
+}
+
+
+int
+ServicesDB::load()
+{
+	const std::string t_path(path());
+	struct stat sb = {0};
+	FILE *file;
+
+	if (0 == stat(t_path.c_str(), &sb)) {
+		if (loaded_ && direct_ && sb.st_mtime == mtime_ && sb.st_size == size_)
+			return 1;		// unchanged
+
+		if (nullptr != (file = fopen(t_path.c_str(), "r"))) {
+			clear();
+			direct_ = parse(file);
+			fclose(file);
+			if (direct_) {
+				source_ = t_path;
+				loaded_ = true;
+				mtime_ = sb.st_mtime, size_ = sb.st_size;
+				if (debug)
+					syslog(LOG_DEBUG, "services: %s, %u entries", t_path.c_str(), (unsigned)entries_.size());
+				return 1;
+			}
+		}
+	}
+
+	clear();				// getservbyname() fallback; cache per load.
+	loaded_ = true, direct_ = false;
+	return 0;
+}
+
+
+bool
+ServicesDB::parse(FILE *file)
+{
+	std::vector<const char *> names;
+	char line[1024];
+
+	while (fgets(line, sizeof(line), file)) {
+		char *cursor = line, *name, *port, *proto;
+
+		if (nullptr != (name = strchr(cursor, '#')))
+			*name = 0;		// comment
+
+		names.clear();
+		while (nullptr != (name = strtok(cursor, " \t\r\n"))) {
+			names.push_back(name);
+			cursor = nullptr;
+		}
+		if (names.size() < 2)
+			continue;
+
+		port = (char *)names[1];	// <port>/<protocol>
+		if (nullptr == (proto = strchr(port, '/')) || !proto[1])
+			continue;
+		*proto++ = 0;
+
+		char *end = nullptr;
+		const unsigned long value = strtoul(port, &end, 10);
+		if (end == port || *end || value > 0xffff)
+			continue;
+
+		names.erase(names.begin() + 1);
+		push(proto, (int)htons((u_short)value), names);
+	}
+	return (0 == ferror(file));
+}
+
+
+void
+ServicesDB::push(const char *proto, int port, const std::vector<const char *> &names)
+{
+	const unsigned entry = (unsigned)entries_.size();
+
+	entries_.push_back(Entry{port, (unsigned)names_.size(), (unsigned)names.size()});
+	for (const char *name : names) {
+		names_.emplace_back(name);
+		key_.assign(name).append(1, '/').append(proto);
+		index_.emplace(key_, entry);	// first definition prevails
+	}
+}
+
+
+const Entry *
+ServicesDB::lookup(const char *name, const char *proto)
+{
+	if (! loaded_)
+		load();
+
+	key_.assign(name).append(1, '/').append(proto);
+	Index::const_iterator it(index_.find(key_));
+	if (it != index_.end())
+		return (ENTRY_UNKNOWN == it->second ? nullptr : &entries_[it->second]);
+	if (direct_)
+		return nullptr;
+
+	const struct servent *sp = getservbyname(name, proto);
+	if (nullptr == sp) {
+		index_.emplace(key_, ENTRY_UNKNOWN);
+		return nullptr;
+	}
+
+	std::vector<const char *> names;
+	names.push_back(sp->s_name);
+	for (char **alias = sp->s_aliases; alias && *alias; ++alias)
+		names.push_back(*alias);
+
+	const unsigned entry = (unsigned)entries_.size();
+	push(proto, sp->s_port, names);
+	key_.assign(name).append(1, '/').append(proto);
+	index_[key_] = entry;			// queried name, when not canonical
+	return &entries_[entry];
+}
+
+
+const char *
+ServicesDB::source() const
+{
+	return (direct_ ? source_.c_str() : nullptr);
+}
+
+
+bool
+ServicesDB::match(const Entry *entry, const char *name) const
+{
+	for (unsigned idx = 0; idx < entry->count; ++idx)
+		if (0 == strcmp(name, names_[entry->names + idx].c_str()))
+			return true;
+	return false;
+}
+
+
+static ServicesDB servicesdb;
+}; //namespace
+
+
+/*
+ *  Load the services database; re-read only when modified since the previous load.
+ */
+int
+setservdb(void)
+{
+	return servicesdb.load();
+}
+
+
+/*
+ *  Resolve the port, in network order, of service 'name' under 'proto'; -1 if unknown.
+ */
+int
+servdbport(const char *name, const char *proto)
+{
+	const Entry *entry = servicesdb.lookup(name, proto);
+	return (entry ? entry->port : -1);
+}
+
+
+/*
+ *  Whether 'name2' is the service 'name1' under 'proto', or one of its aliases.
+ */
+int
+servdbmatch(const char *name1, const char *name2, const char *proto)
+{
+	const Entry *entry = servicesdb.lookup(name1, proto);
+	return (entry && servicesdb.match(entry, name2) ? 1 : 0);
+}
+
+
+/*
+ *  Database path, when read directly; see setservdb().
+ */
+const char *
+servdbsource(void)
+{
+	return servicesdb.source();
+}
+
+//end
@@ -0,0 +1,42 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - services database.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Services database.
+ *
+ *  The services database is loaded once per configuration load into a hash index of
+ *  (name or alias, protocol) to entry, against which service names are matched and
+ *  resolved; the database is only re-read when modified. Where the database cannot be
+ *  read directly, getservbyname() results are cached instead.
+ */
+
+int	setservdb(void);
+int	servdbport(const char *name, const char *proto);
+int	servdbmatch(const char *name1, const char *name2, const char *proto);
+const char *servdbsource(void);
+
+//end
@@ -0,0 +1,887 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - configuration snapshot.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Image layout, host byte order:
+ *
+ *      header
+ *      source[sources]         u8 type, u64 size, i64 mtime, u64 hash, string path.
+ *      default[defaults]       string key, string value; global defaults.
+ *      service[services]       u32 length, record; see record() and replay().
+ *
+ *  Strings are a u32 length followed by the characters, without terminator; a length
+ *  of ~0 denotes a null string. The checksum covers the image following the header.
+ */
+
+#include "inetd.h"
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <sysexits.h>
+#include <syslog.h>
+
+#include "config.h"
+#include "snapshot.h"
+#include "SipHash.h"
+
+#include <buildinfo.h>
+
+#define SNAPSHOT_VERSION	2
+#define SNAPSHOT_FORMAT 	1		// record semantics; bump with parser or servconfig changes.
+#define SNAPSHOT_NULL		0xffffffffU	// null string.
+
+namespace {
+struct Header {
+	char magic[8];				// "INETDSNP"
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t build;				// record layout signature.
+	uint64_t params;			// global parameters signature.
+	uint32_t sources;			// source stamps.
+	uint32_t services;			// service records.
+	uint32_t defaults;			// global defaults.
+	uint64_t size;				// image size.
+	uint64_t checksum;			// image hash, following the header.
+};
+
+enum SourceType { SOURCE_FILE = 1, SOURCE_DIRECTORY = 2 };
+
+struct Stamp {
+	uint8_t type;
+	uint64_t size;
+	int64_t mtime;
+	uint64_t hash;
+};
+
+static const char snapshot_magic[8] = { 'I', 'N', 'E', 'T', 'D', 'S', 'N', 'P' };
+
+// fixed key; integrity of local content, not remote supplied data.
+static const inetd::SipHash snapshot_hash(0x736e617073686f74ULL, 0x696e657464636667ULL);
+
+
+class Writer {
+public:
+	template <typename T>
+	void value(const T &value)
+	{
+		buffer_.append((const char *)&value, sizeof(T));
+	}
+
+	void bytes(const void *data, size_t size)
+	{
+		buffer_.append((const char *)data, size);
+	}
+
+	void string(const char *value, size_t length)
+	{
+		if (nullptr == value) {
+			this->value<uint32_t>(SNAPSHOT_NULL);
+		} else {
+			this->value<uint32_t>((uint32_t)length);
+			buffer_.append(value, length);
+		}
+	}
+
+	void string(const char *value)
+	{
+		string(value, value ? strlen(value) : 0);
+	}
+
+	void string(const inetd::String &value)
+	{
+		string(value.data(), value.length());
+	}
+
+	void string(const std::string &value)
+	{
+		string(value.data(), value.length());
+	}
+
+	std::string &buffer()
+	{
+		return buffer_;
+	}
+
+private:
+	std::string buffer_;
+};
+
+
+class Reader {
+public:
+	Reader(const char *cursor, const char *end) : cursor_(cursor), end_(end)
+	{
+	}
+
+	template <typename T>
+	bool value(T &value)
+	{
+		return bytes(&value, sizeof(T));
+	}
+
+	bool bytes(void *data, size_t size)
+	{
+		if ((size_t)(end_ - cursor_) < size)
+			return false;
+		(void) memcpy(data, cursor_, size);
+		cursor_ += size;
+		return true;
+	}
+
+	bool string(const char *&data, uint32_t &length)
+	{
+		if (! value(length))
+			return false;
+		if (SNAPSHOT_NULL == length) {
+			data = nullptr, length = 0;
+			return true;
+		}
+		if ((size_t)(end_ - cursor_) < length)
+			return false;
+		data = cursor_;
+		cursor_ += length;
+		return true;
+	}
+
+	bool string(inetd::String &value)
+	{
+		const char *data;
+		uint32_t length;
+		if (! string(data, length))
+			return false;
+		value.assign(data, length);
+		return true;
+	}
+
+	bool string(std::string &value)
+	{
+		const char *data;
+		uint32_t length;
+		if (! string(data, length))
+			return false;
+		value.assign(data ? data : "", length);
+		return true;
+	}
+
+	const char *cursor() const
+	{
+		return cursor_;
+	}
+
+	size_t remaining() const
+	{
+		return (size_t)(end_ - cursor_);
+	}
+
+private:
+	const char *cursor_;
+	const char *end_;
+};
+}; //namespace
+
+
+static Writer	snapshot_writer;		// pending image, see snapshotbegin().
+static uint32_t	snapshot_count;
+static std::vector<std::pair<std::string, std::string>> snapshot_defaults; // recorded, see snapshotdefault().
+static time_t	snapshot_started;
+static bool	snapshot_active;
+
+static void	*snapshot_base;			// mapped image, see setsnapshot().
+static size_t	snapshot_size;
+static Reader	snapshot_reader(nullptr, nullptr);
+static uint32_t	snapshot_remaining;
+static std::vector<std::string> snapshot_sources;
+static std::vector<std::pair<std::string, std::string>> snapshot_replaydefs;
+static struct servconfig snapshot_ent;
+
+
+/*
+ *  Signatures; an image is only replayed by an identical build, against identical parameters.
+ *
+ *  The build is identified by the package version and build number, see buildinfo.h, so
+ *  changes outside this module invalidate images; SNAPSHOT_FORMAT covers those which alter
+ *  the meaning of a record without its layout, for example a parser default.
+ */
+static uint64_t
+build_signature()
+{
+	char signature[256];
+	unsigned biltin_count = 0;
+
+	for (const struct biltin *bi = biltins; bi->bi_service; ++bi)
+		++biltin_count;
+	snprintf(signature, sizeof(signature), "%u %s-%s %s %s %s/%u/%u/%u/%u/%u/%u/%u",
+		(unsigned)SNAPSHOT_FORMAT, WININETD_VERSION, WININETD_BUILD_NUMBER, WININETD_BUILD_DATE,
+		__DATE__, __TIME__, biltin_count, (unsigned)sizeof(struct netaddrs::netaddress),
+		(unsigned)sizeof(struct ratelimits::rule), (unsigned)sizeof(struct access_times::time),
+		(unsigned)sizeof(((struct servconfig *)0)->se_un), (unsigned)sizeof(((struct servconfig *)0)->se_un_remote),
+		(unsigned)MAXARGV);
+	return snapshot_hash(signature, strlen(signature));
+}
+
+
+static uint64_t
+params_signature(const struct configparams *params)
+{
+	Writer w;
+
+	w.value(params->euid);
+	w.value(params->egid);
+	w.value(params->sockopts);
+	w.value(params->toomany);
+	w.value(params->maxperip);
+	w.value(params->maxcpm);
+	w.value(params->maxchild);
+	w.value(params->v4bind_ok);
+	w.value(params->v6bind_ok);
+	if (params->bind_sa4)
+		w.bytes(&params->bind_sa4->sin_addr, sizeof(params->bind_sa4->sin_addr));
+	if (params->bind_sa6)
+		w.bytes(&params->bind_sa6->sin6_addr, sizeof(params->bind_sa6->sin6_addr));
+	return snapshot_hash(w.buffer().data(), w.buffer().size());
+}
+
+
+/*
+ *  Source stamp; file content or directory listing, size and modification time.
+ */
+static bool
+source_stamp(const std::string &source, struct Stamp &stamp)
+{
+	const bool directory = (! source.empty() && '/' == source.back());
+	const std::string path(source, 0, directory ? source.length() - 1 : source.length());
+	struct stat sb = {0};
+
+	if (0 != stat(path.c_str(), &sb))
+		return false;
+
+	stamp.mtime = (int64_t)sb.st_mtime;
+	if (directory) {
+		DIR *dir = opendir(path.c_str());
+		std::string names;
+		struct dirent *entry;
+
+		if (nullptr == dir)
+			return false;
+		stamp.type = SOURCE_DIRECTORY;
+		stamp.size = 0;
+		while (nullptr != (entry = readdir(dir))) {
+			names.append(entry->d_name);
+			names.push_back('/');
+			++stamp.size;
+		}
+		closedir(dir);
+		stamp.hash = snapshot_hash(names.data(), names.size());
+
+	} else {
+		const size_t size = (size_t)sb.st_size;
+		int fd;
+
+		stamp.type = SOURCE_FILE;
+		stamp.size = (uint64_t)sb.st_size;
+		stamp.hash = snapshot_hash("", 0);
+		if (size) {
+			std::string content(size, 0);
+			ssize_t cnt = -1;
+
+			if ((fd = open(path.c_str(), O_RDONLY|O_BINARY)) < 0)
+				return false;
+			cnt = read(fd, &content[0], (unsigned)size);
+			close(fd);
+			if (cnt < 0 || (size_t)cnt != size)
+				return false;
+			stamp.hash = snapshot_hash(content.data(), content.size());
+		}
+	}
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  record
+
+template <typename Rules>
+static void
+record_rules(Writer &w, const Rules &rules)
+{
+	w.value((uint32_t)rules.size());
+	if (rules.size())
+		w.bytes(rules.data(), rules.size() * sizeof(rules[0]));
+}
+
+
+static void
+record(Writer &w, const struct servconfig *sep)
+{
+	int32_t bi_index = -1;
+
+	if (sep->se_bi)
+		bi_index = (int32_t)(sep->se_bi - biltins);
+
+	w.string(sep->se_service);
+	w.value(bi_index);
+	w.value(sep->se_socktype);
+	w.value(sep->se_family);
+	w.value(sep->se_port);
+	w.string(sep->se_proto);
+	w.value(sep->se_sndbuf);
+	w.value(sep->se_rcvbuf);
+	w.value(sep->se_maxchild);
+	w.value(sep->se_cpmmax);
+	w.value(sep->se_cpmwait);
+	w.value(sep->se_maxperip);
+	w.string(sep->se_user);
+	w.string(sep->se_group);
+	w.string(sep->se_banner);
+	w.string(sep->se_banner_success);
+	w.string(sep->se_banner_fail);
+#ifdef LOGIN_CAP
+	w.string(sep->se_class);
+#endif
+#ifdef IPSEC
+	w.string(sep->se_policy);
+#endif
+	w.string(sep->se_server);
+
+	// server name; either a reference within se_server or an independent value.
+	const char *server = sep->se_server.data(), *name = sep->se_server_name;
+	if (nullptr == name) {
+		w.value((uint8_t)0);
+	} else if (server && name >= server && name <= server + strlen(server)) {
+		w.value((uint8_t)1);
+		w.value((uint32_t)(name - server));
+	} else {
+		w.value((uint8_t)2);
+		w.string(name);
+	}
+
+	w.string(sep->se_working_directory);
+	w.string(sep->se_arguments);
+	uint32_t argc = 0;
+	while (argc < MAXARGV && sep->se_argv[argc])
+		++argc;
+	w.value(argc);
+	for (uint32_t av = 0; av < argc; ++av)
+		w.string(sep->se_argv[av]);
+
+	const environment::Collection &passenv = sep->se_environ.passenv(), &setenv = sep->se_environ.setenv();
+	w.value((uint32_t)passenv.size());
+	for (const auto &value : passenv)
+		w.string(value);
+	w.value((uint32_t)setenv.size());
+	for (const auto &value : setenv)
+		w.string(value);
+
+	const uint32_t times = (uint32_t)sep->se_access_times.size();
+	w.value(times);
+	w.bytes(sep->se_access_times.times(), times * sizeof(struct access_times::time));
+
+	w.value(sep->se_addresses.match_default());
+	record_rules(w, sep->se_addresses());
+	w.value(sep->se_shadow_addresses.match_default());
+	record_rules(w, sep->se_shadow_addresses());
+
+	const geoips::Collection &geoip_rules = sep->se_geoips();
+	w.string(sep->se_geoips.database());
+	w.value(sep->se_geoips.options());
+	w.value(sep->se_geoips.match_default());
+	w.value((uint32_t)geoip_rules.size());
+	for (const auto &rule : geoip_rules) {
+		w.string(rule.spec);
+		w.value((int32_t)rule.type);
+		w.value(rule.op);
+	}
+
+	record_rules(w, sep->se_ratelimits());
+
+	w.bytes(&sep->se_un, sizeof(sep->se_un));
+	w.value(sep->se_ctrladdr_size);
+	w.value(sep->se_remote_family);
+	w.value(sep->se_remote_port);
+	w.string(sep->se_remote_name);
+	w.bytes(&sep->se_un_remote, sizeof(sep->se_un_remote));
+	w.value(sep->se_remoteaddr_size);
+	w.value(sep->se_sockuid);
+	w.value(sep->se_sockgid);
+	w.value(sep->se_sockmode);
+	w.value(sep->se_type);
+	w.value(sep->se_accept);
+	w.value(sep->se_nomapped);
+#if defined(RPC)
+	w.value(sep->se_rpc);
+	w.value(sep->se_rpc_prog);
+	w.value(sep->se_rpc_lowvers);
+	w.value(sep->se_rpc_highvers);
+#endif
+}
+
+
+template <typename Rules>
+static bool
+replay_rules(Reader &r, Rules &rules)
+{
+	uint32_t count;
+
+	if (! r.value(count))
+		return false;
+	rules.resize(count);
+	return (0 == count || r.bytes(&rules[0], count * sizeof(rules[0])));
+}
+
+
+static bool
+replay(Reader &r, struct servconfig *sep)
+{
+	const char *data;
+	uint32_t length, count;
+	int32_t bi_index;
+	uint8_t server_name;
+	std::string name;
+
+	if (! r.string(name) || name.empty())
+		return false;
+	sep->se_service = servconfig::newname(name.c_str());
+	if (! r.value(bi_index))
+		return false;
+	if (bi_index >= 0) {
+		for (int32_t bi = 0; bi <= bi_index; ++bi)
+			if (nullptr == biltins[bi].bi_service)
+				return false;
+		sep->se_bi = biltins + bi_index;
+	}
+	if (! r.value(sep->se_socktype) ||
+			! r.value(sep->se_family) ||
+			! r.value(sep->se_port) ||
+			! r.string(sep->se_proto) ||
+			! r.value(sep->se_sndbuf) ||
+			! r.value(sep->se_rcvbuf) ||
+			! r.value(sep->se_maxchild) ||
+			! r.value(sep->se_cpmmax) ||
+			! r.value(sep->se_cpmwait) ||
+			! r.value(sep->se_maxperip) ||
+			! r.string(sep->se_user) ||
+			! r.string(sep->se_group) ||
+			! r.string(sep->se_banner) ||
+			! r.string(sep->se_banner_success) ||
+			! r.string(sep->se_banner_fail) ||
+#ifdef LOGIN_CAP
+			! r.string(sep->se_class) ||
+#endif
+#ifdef IPSEC
+			! r.string(sep->se_policy) ||
+#endif
+			! r.string(sep->se_server) ||
+			! r.value(server_name)) {
+		return false;
+	}
+
+	if (1 == server_name) {
+		uint32_t offset;
+		if (! r.value(offset) || offset > sep->se_server.length())
+			return false;
+		sep->se_server_name = sep->se_server.c_str() + offset;
+	} else if (2 == server_name) {
+		if (! r.string(name))
+			return false;
+		sep->se_server_name = servconfig::newname(name.c_str());
+	}
+
+	if (! r.string(sep->se_working_directory) ||
+			! r.string(sep->se_arguments) ||
+			! r.value(count) || count > MAXARGV)
+		return false;
+	for (uint32_t av = 0; av < count; ++av) {
+		if (! r.string(name))
+			return false;
+		sep->se_argv[av] = servconfig::newarg(name.c_str());
+	}
+
+	environment::Collection &passenv = sep->se_environ.passenv(), &setenv = sep->se_environ.setenv();
+	if (! r.value(count))
+		return false;
+	while (count--) {
+		if (! r.string(data, length))
+			return false;
+		passenv.emplace_back(data, length);
+	}
+	if (! r.value(count))
+		return false;
+	while (count--) {
+		if (! r.string(data, length))
+			return false;
+		setenv.emplace_back(data, length);
+	}
+
+	if (! r.value(count) || count > MAXACCESSV)
+		return false;
+	while (count--) {
+		struct access_times::time range;
+		if (! r.value(range) || ! sep->se_access_times.push(range))
+			return false;
+	}
+
+	netaddrs::Collection addresses;
+	int match_default;
+	if (! r.value(match_default) || ! replay_rules(r, addresses))
+		return false;
+	sep->se_addresses.assign(std::move(addresses), match_default);
+	if (! r.value(match_default) || ! replay_rules(r, addresses))
+		return false;
+	sep->se_shadow_addresses.assign(std::move(addresses), match_default);
+
+	geoips::Collection geoip_rules;
+	inetd::String database;
+	unsigned options;
+	if (! r.string(database) || ! r.value(options) || ! r.value(match_default) || ! r.value(count))
+		return false;
+	while (count--) {
+		geoips::rule rule;
+		int32_t type;
+		if (! r.string(rule.spec) || ! r.value(type) || ! r.value(rule.op))
+			return false;
+		rule.type = (geoips::geoip_type)type;
+		geoip_rules.push_back(std::move(rule));
+	}
+	if (! database.empty())
+		sep->se_geoips.database(database.c_str(), options);
+	sep->se_geoips.assign(std::move(geoip_rules), match_default);
+
+	ratelimits::Collection limits;
+	if (! replay_rules(r, limits))
+		return false;
+	for (const auto &limit : limits)
+		sep->se_ratelimits.push(limit);
+
+	return (r.bytes(&sep->se_un, sizeof(sep->se_un)) &&
+		r.value(sep->se_ctrladdr_size) &&
+		r.value(sep->se_remote_family) &&
+		r.value(sep->se_remote_port) &&
+		r.string(sep->se_remote_name) &&
+		r.bytes(&sep->se_un_remote, sizeof(sep->se_un_remote)) &&
+		r.value(sep->se_remoteaddr_size) &&
+		r.value(sep->se_sockuid) &&
+		r.value(sep->se_sockgid) &&
+		r.value(sep->se_sockmode) &&
+		r.value(sep->se_type) &&
+		r.value(sep->se_accept) &&
+		r.value(sep->se_nomapped)
+#if defined(RPC)
+		&& r.value(sep->se_rpc) &&
+		r.value(sep->se_rpc_prog) &&
+		r.value(sep->se_rpc_lowvers) &&
+		r.value(sep->se_rpc_highvers)
+#endif
+		);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  writer
+
+/*
+ *  Start recording; configurations subsequently delivered are recorded by snapshotrecord().
+ */
+void
+snapshotbegin(void)
+{
+	snapshot_writer.buffer().clear();
+	snapshot_writer.buffer().append(sizeof(struct Header), 0);
+	snapshot_count = 0;
+	snapshot_defaults.clear();
+	snapshot_started = time(nullptr);
+	snapshot_active = true;
+}
+
+
+void
+snapshotrecord(const struct servconfig *cfg)
+{
+	if (! snapshot_active)
+		return;
+
+	std::string &buffer = snapshot_writer.buffer();
+	const size_t offset = buffer.size();
+
+	snapshot_writer.value((uint32_t)0);	// length, see below.
+	record(snapshot_writer, cfg);
+
+	const uint32_t length = (uint32_t)(buffer.size() - offset - sizeof(uint32_t));
+	(void) memcpy(&buffer[offset], &length, sizeof(length));
+	++snapshot_count;
+}
+
+
+/*
+ *  Record a global default consulted by the load, see getsnapshotdef(); unset values
+ *  are not recorded.
+ */
+void
+snapshotdefault(const char *key, const char *value)
+{
+	if (! snapshot_active || nullptr == value)
+		return;
+	snapshot_defaults.emplace_back(key, value);
+}
+
+
+/*
+ *  Write the recorded image, stamped against the given sources; the sources are
+ *  expected to be unmodified since snapshotbegin(), otherwise the image is abandoned.
+ */
+int
+snapshotcommit(const char *path, const struct configparams *params, const std::vector<std::string> &sources)
+{
+	if (! snapshot_active)
+		return 0;
+	snapshot_active = false;
+
+	std::string body, &image = snapshot_writer.buffer();
+	Writer stamps;
+
+	for (const auto &source : sources) {
+		struct Stamp stamp;
+		if (! source_stamp(source, stamp) || stamp.mtime >= (int64_t)snapshot_started) {
+			if (debug)
+				syslog(LOG_DEBUG, "snapshot: source <%s> changed, not written", source.c_str());
+			image.clear();
+			return 0;
+		}
+		stamps.value(stamp.type);
+		stamps.value(stamp.size);
+		stamps.value(stamp.mtime);
+		stamps.value(stamp.hash);
+		stamps.string(source);
+	}
+	for (const auto &def : snapshot_defaults) {
+		stamps.string(def.first);
+		stamps.string(def.second);
+	}
+	image.insert(sizeof(struct Header), stamps.buffer());
+
+	struct Header hdr = {{0}};
+	(void) memcpy(hdr.magic, snapshot_magic, sizeof(hdr.magic));
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.header_size = sizeof(struct Header);
+	hdr.build = build_signature();
+	hdr.params = params_signature(params);
+	hdr.sources = (uint32_t)sources.size();
+	hdr.services = snapshot_count;
+	hdr.defaults = (uint32_t)snapshot_defaults.size();
+	hdr.size = image.size();
+	hdr.checksum = snapshot_hash(image.data() + sizeof(hdr), image.size() - sizeof(hdr));
+	(void) memcpy(&image[0], &hdr, sizeof(hdr));
+
+	const std::string t_path = std::string(path) + ".tmp";
+	FILE *file;
+
+	if (nullptr == (file = fopen(t_path.c_str(), "wb"))) {
+		syslog(LOG_WARNING, "snapshot: %s: %m", t_path.c_str());
+		image.clear();
+		return 0;
+	}
+
+	const bool written = (image.size() == fwrite(image.data(), 1, image.size(), file));
+	if (0 != fclose(file) || ! written) {
+		syslog(LOG_WARNING, "snapshot: %s: %m", t_path.c_str());
+		(void) unlink(t_path.c_str());
+		image.clear();
+		return 0;
+	}
+	image.clear();
+
+#if defined(_WIN32)
+	if (! ::MoveFileExA(t_path.c_str(), path, MOVEFILE_REPLACE_EXISTING)) {
+#else
+	if (0 != ::rename(t_path.c_str(), path)) {
+#endif
+		syslog(LOG_WARNING, "snapshot: %s: %m", path);
+		(void) unlink(t_path.c_str());
+		return 0;
+	}
+
+	if (debug)
+		syslog(LOG_DEBUG, "snapshot: %s, %u services, %u sources", path, snapshot_count, (unsigned)sources.size());
+	return 1;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//  reader
+
+/*
+ *  Map the image at 'path', returning 1 when valid against the current build, parameters
+ *  and sources; services are then retrieved using getsnapshotent().
+ */
+int
+setsnapshot(const char *path, const struct configparams *params)
+{
+	struct stat sb = {0};
+	int fd;
+
+	endsnapshot();
+	if ((fd = open(path, O_RDONLY|O_BINARY)) < 0)
+		return 0;
+	if (-1 == fstat(fd, &sb) || sb.st_size < (off_t)sizeof(struct Header)) {
+		close(fd);
+		return 0;
+	}
+
+	void *base = mmap(nullptr, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == base) {
+		syslog(LOG_WARNING, "snapshot: cannot map <%s> : %m", path);
+		return 0;
+	}
+	snapshot_base = base, snapshot_size = (size_t)sb.st_size;
+
+	const char *image = (const char *)base, *end = image + snapshot_size;
+	const struct Header *hdr = (const struct Header *)base;
+	const char *reason = nullptr;
+
+	if (0 != memcmp(hdr->magic, snapshot_magic, sizeof(hdr->magic)) ||
+			SNAPSHOT_VERSION != hdr->version || sizeof(struct Header) != hdr->header_size ||
+			hdr->size != snapshot_size) {
+		reason = "format";
+	} else if (hdr->build != build_signature()) {
+		reason = "build";
+	} else if (hdr->params != params_signature(params)) {
+		reason = "options";
+	} else if (hdr->checksum != snapshot_hash(image + sizeof(*hdr), snapshot_size - sizeof(*hdr))) {
+		reason = "checksum";
+	}
+
+	Reader r(image + sizeof(*hdr), end);
+	snapshot_sources.clear();
+	for (uint32_t source = 0; nullptr == reason && source < hdr->sources; ++source) {
+		struct Stamp stored, current;
+		std::string name;
+
+		if (! r.value(stored.type) || ! r.value(stored.size) || ! r.value(stored.mtime) ||
+				! r.value(stored.hash) || ! r.string(name)) {
+			reason = "format";
+		} else if (! source_stamp(name, current) || current.type != stored.type ||
+				current.size != stored.size || current.mtime != stored.mtime || current.hash != stored.hash) {
+			reason = "sources";
+		}
+		snapshot_sources.push_back(std::move(name));
+	}
+
+	snapshot_replaydefs.clear();
+	for (uint32_t def = 0; nullptr == reason && def < hdr->defaults; ++def) {
+		std::string key, value;
+
+		if (! r.string(key) || ! r.string(value)) {
+			reason = "format";
+		} else {
+			snapshot_replaydefs.emplace_back(std::move(key), std::move(value));
+		}
+	}
+
+	if (reason) {
+		if (debug)
+			syslog(LOG_DEBUG, "snapshot: %s, ignored (%s)", path, reason);
+		endsnapshot();
+		return 0;
+	}
+
+	snapshot_reader = r;
+	snapshot_remaining = hdr->services;
+	if (debug)
+		syslog(LOG_DEBUG, "snapshot: %s, %u services", path, snapshot_remaining);
+	return 1;
+}
+
+
+struct servconfig *
+getsnapshotent(const struct configparams *params, int *ret)
+{
+	struct servconfig *sep = &snapshot_ent;
+	uint32_t length;
+
+	(void) params;
+	if (ret) *ret = 0;
+	freeconfig(sep);
+	if (nullptr == snapshot_base || 0 == snapshot_remaining)
+		return nullptr;
+
+	--snapshot_remaining;
+	if (snapshot_reader.value(length)) {
+		const char *record = snapshot_reader.cursor();
+		Reader r(record, record + length);
+
+		if (length <= snapshot_reader.remaining() && replay(r, sep) && r.cursor() == record + length) {
+			snapshot_reader = Reader(record + length, (const char *)snapshot_base + snapshot_size);
+			return sep;
+		}
+	}
+
+	syslog(LOG_ERR, "snapshot: corrupt service record");
+	freeconfig(sep);
+	if (ret) *ret = EX_SOFTWARE;
+	return nullptr;
+}
+
+
+/*
+ *  Global default recorded with the mapped image, see snapshotdefault(); nullptr when unset.
+ */
+const char *
+getsnapshotdef(const char *key)
+{
+	for (const auto &def : snapshot_replaydefs) {
+		if (def.first == key)
+			return def.second.c_str();
+	}
+	return nullptr;
+}
+
+
+/*
+ *  Sources the mapped image was stamped against; see setsnapshot().
+ */
+const std::vector<std::string> &
+getsnapshotsources(void)
+{
+	return snapshot_sources;
+}
+
+
+void
+endsnapshot(void)
+{
+	if (snapshot_base) {
+		munmap(snapshot_base, snapshot_size);
+		snapshot_base = nullptr, snapshot_size = 0;
+	}
+	snapshot_reader = Reader(nullptr, nullptr);
+	snapshot_remaining = 0;
+	snapshot_replaydefs.clear();
+}
+
+//end
@@ -0,0 +1,59 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - configuration snapshot.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <string>
+#include <vector>
+
+/*
+ *  Binary configuration snapshot.
+ *
+ *  Each service configuration delivered by a successful load, fully resolved (service
+ *  ports, bind and redirect addresses, built-ins, access rules and spawn arguments), is
+ *  recorded into a versioned image written beside the configuration. At the next start,
+ *  when the global parameters and every source consulted (size, modification time and
+ *  content hash) are unchanged, the image is memory mapped and replayed in place of the
+ *  text parser; see setsnapshot() and getsnapshotent().
+ *
+ *  Rule tables are stored in their parsed form and compiled on replay, as on any load;
+ *  global defaults consulted by the load (see getconfigdef2()) are recorded alongside.
+ */
+
+struct servconfig;
+struct configparams;
+
+int	setsnapshot(const char *path, const struct configparams *params);
+struct servconfig *getsnapshotent(const struct configparams *params, int *ret);
+const char *getsnapshotdef(const char *key);
+const std::vector<std::string> &getsnapshotsources(void);
+void	endsnapshot(void);
+
+void	snapshotbegin(void);
+void	snapshotrecord(const struct servconfig *cfg);
+void	snapshotdefault(const char *key, const char *value);
+int	snapshotcommit(const char *path, const struct configparams *params, const std::vector<std::string> &sources);
+
+//end
@@ -0,0 +1,545 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - ban table test.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Dynamic bans, see bantable.cpp:
+ *
+ *	o policy; ban_threshold and ban_duration parsing, defaults and limits.
+ *	o threshold; a ban follows the <strikes>th violation and not before, affects only
+ *	  the violating source, is shared by its v4-mapped form, and never applies to
+ *	  loopback. Violations whilst banned are not counted.
+ *	o window; strikes are forgotten once the violation window passes.
+ *	o escalation; each successive ban doubles, up to the maximum, and escalation
+ *	  restarts once the source has been quiet for the decay period.
+ *	o concurrency; whilst violations are recorded, readers never observe a ban short
+ *	  of the threshold, nor one released.
+ *	o persistence; active bans are saved and restored with their escalation, expired and
+ *	  malformed entries ignored, and unforced saves are requested and rate limited.
+ *
+ *	bantable_test [sources [violations [readers]]]
+ *
+ *  Linked with bantable.cpp built with -DBAN_DECAY=2, escalation decaying after two
+ *  seconds rather than a day; escalation takes some seconds to run.
+ */
+
+#include "../inetd.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../bantable.h"
+#include "unittest.h"
+
+#define STRIKES		3
+#define TIMEOUT		10			// expiry timeout, seconds.
+
+static const char *filename = "bantable_test.bans";
+
+static std::atomic<unsigned long> errors;	// failures, any thread.
+static unsigned saverequests;
+
+
+static void
+failed(const char *test, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "bantable_test: %s, ", test);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	++errors;
+}
+
+
+static struct sockaddr_storage
+address(const char *text)
+{
+	struct sockaddr_storage ss = {0};
+
+	if (1 == inet_pton(AF_INET, text, &((struct sockaddr_in *)&ss)->sin_addr)) {
+		ss.ss_family = AF_INET;
+	} else if (1 == inet_pton(AF_INET6, text, &((struct sockaddr_in6 *)&ss)->sin6_addr)) {
+		ss.ss_family = AF_INET6;
+	}
+	return ss;
+}
+
+
+static bool
+banned(const char *text)
+{
+	const struct sockaddr_storage ss = address(text);
+	return bantable::banned(&ss);
+}
+
+
+/*
+ *  Record a violation; returns the ban duration, 0 when none resulted.
+ */
+static unsigned
+violation(const char *text)
+{
+	const struct sockaddr_storage ss = address(text);
+	unsigned ttl = ~0U;
+
+	if (bantable::violation(&ss, ttl) != (0 != ttl))
+		failed("violation", "%s, result inconsistent with duration %u", text, ttl);
+	return ttl;
+}
+
+
+/*
+ *  Withdraw all bans and offenders, then apply the policy.
+ */
+static void
+reset(const char *threshold, const char *duration)
+{
+	struct bantable::policy policy, disabled;
+
+	if (! bantable::to_policy(threshold, duration, policy) ||
+			! bantable::to_policy(nullptr, nullptr, disabled)) {
+		failed("reset", "policy <%s> <%s> rejected", threshold, duration);
+		return;
+	}
+	bantable::setpolicy(disabled);
+	bantable::setpolicy(policy);
+}
+
+
+static bool
+expire(const char *text)
+{
+	const double timeout = now() + TIMEOUT;
+
+	while (banned(text)) {
+		if (now() > timeout)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	return true;
+}
+
+
+static void
+test_policy()
+{
+	static const struct {
+		const char *threshold, *duration;
+		bool valid;
+		unsigned strikes, window, basettl, maxttl;
+	} policies[] = {
+		{nullptr, nullptr,	true, 0, 0, 0, 0},		// disabled.
+		{nullptr, "60",		true, 0, 0, 0, 0},
+		{"3 600", nullptr,	true, 3, 600, 60, 86400},	// defaults.
+		{"3 600", "120",	true, 3, 600, 120, 86400},
+		{"3 600", "172800",	true, 3, 600, 172800, 172800},	// beyond the default maximum.
+		{"3 600", "30 300",	true, 3, 600, 30, 300},
+		{"1000 86400", "604800 604800", true, 1000, 86400, 604800, 604800},
+		{"0 60", nullptr,	false, 0, 0, 0, 0},
+		{"1001 60", nullptr,	false, 0, 0, 0, 0},
+		{"3 0", nullptr,	false, 0, 0, 0, 0},
+		{"3 86401", nullptr,	false, 0, 0, 0, 0},
+		{"3", nullptr,		false, 0, 0, 0, 0},
+		{"3 60 x", nullptr,	false, 0, 0, 0, 0},
+		{"3 60", "0",		false, 0, 0, 0, 0},
+		{"3 60", "120 60",	false, 0, 0, 0, 0},
+		{"3 60", "60 604801",	false, 0, 0, 0, 0},
+		{"3 60", "60 120 x",	false, 0, 0, 0, 0},
+		};
+
+	for (const auto &t : policies) {
+		struct bantable::policy policy;
+		const bool valid = bantable::to_policy(t.threshold, t.duration, policy);
+
+		if (valid != t.valid) {
+			failed("policy", "<%s> <%s>, %s", (t.threshold ? t.threshold : "none"),
+				(t.duration ? t.duration : "none"), (valid ? "accepted" : "rejected"));
+		} else if (valid && (policy.strikes != t.strikes || policy.window != t.window ||
+				policy.basettl != t.basettl || policy.maxttl != t.maxttl)) {
+			failed("policy", "<%s> <%s>, %u %u %u %u", (t.threshold ? t.threshold : "none"),
+				(t.duration ? t.duration : "none"),
+				policy.strikes, policy.window, policy.basettl, policy.maxttl);
+		}
+	}
+}
+
+
+static void
+test_threshold()
+{
+	static const char *loopback[] = {"127.0.0.1", "127.1.2.3", "::1", "::ffff:127.0.0.1"};
+
+	reset("3 600", "3600");
+
+	for (unsigned strike = 1; strike <= STRIKES; ++strike) {
+		const unsigned ttl = violation("10.0.0.1");
+
+		if (ttl != (strike == STRIKES ? 3600U : 0U) || banned("10.0.0.1") != (strike == STRIKES))
+			failed("threshold", "strike %u, ban %u", strike, ttl);
+	}
+	if (! banned("::ffff:10.0.0.1") || banned("10.0.0.2") || banned("::ffff:10.0.0.2"))
+		failed("threshold", "ban not confined to the source");
+	if (0 != violation("10.0.0.1") || 0 != violation("::ffff:10.0.0.1"))
+		failed("threshold", "violation whilst banned, reissued");
+
+	violation("10.0.0.3"), violation("::ffff:10.0.0.3");	// the v4-mapped form is counted together.
+	if (banned("10.0.0.3") || 3600 != violation("::ffff:10.0.0.3") || ! banned("10.0.0.3"))
+		failed("threshold", "v4-mapped source not shared");
+
+	violation("2001:db8::1"), violation("2001:db8::2"), violation("2001:db8::1"), violation("2001:db8::2");
+	if (banned("2001:db8::1") || banned("2001:db8::2"))
+		failed("threshold", "interleaved sources aggregated");
+	if (3600 != violation("2001:db8::1") || ! banned("2001:db8::1") || banned("2001:db8::2"))
+		failed("threshold", "ipv6 source");
+
+	for (const char *source : loopback) {
+		for (unsigned strike = 0; strike < (STRIKES * 2); ++strike) {
+			if (violation(source))
+				failed("threshold", "loopback %s banned", source);
+		}
+		if (banned(source))
+			failed("threshold", "loopback %s banned", source);
+	}
+}
+
+
+/*
+ *  The source is first banned briefly, so it is retained by the sweep whilst its window
+ *  passes (see BAN_DECAY); its strikes are restarted in place rather than forgotten.
+ */
+static void
+test_window()
+{
+	const char *source = "10.0.1.1";
+
+	reset("2 1", "1 1");
+
+	if (violation(source) || 1 != violation(source))
+		failed("window", "ban at threshold");
+	if (! expire(source)) {
+		failed("window", "ban not expired");
+		return;
+	}
+
+	if (violation(source))
+		failed("window", "ban before threshold");
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	if (violation(source) || banned(source))	// window passed; strikes restart.
+		failed("window", "strikes retained beyond the window");
+	if (1 != violation(source))
+		failed("window", "ban within the window");
+}
+
+
+/*
+ *  Bans of one second doubling to two, the maximum; once quiet for the decay period, the
+ *  next ban is again one second.
+ */
+static void
+test_escalation()
+{
+	static const unsigned expected[] = {1, 2, 2};
+	const char *source = "10.0.2.1";
+
+	reset("1 600", "1 2");
+
+	for (unsigned ban = 0; ban < (sizeof(expected) / sizeof(expected[0])); ++ban) {
+		const unsigned ttl = violation(source);
+
+		if (ttl != expected[ban])
+			failed("escalation", "ban %u, %us expected %us", ban + 1, ttl, expected[ban]);
+		if (0 != violation(source))
+			failed("escalation", "ban %u, violation whilst banned", ban + 1);
+		if (! expire(source)) {
+			failed("escalation", "ban %u, not expired", ban + 1);
+			return;
+		}
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+	if (1 != violation(source))
+		failed("escalation", "escalation retained beyond the decay period");
+}
+
+
+struct source {
+	struct sockaddr_storage ss;
+	std::string key;			// reference identity, empty when never banned.
+	unsigned canon;				// first source sharing the identity.
+};
+
+
+static void
+random_source(struct source &src, const std::vector<struct source> &sources)
+{
+	const unsigned kind = random32() % 8;
+
+	memset(&src.ss, 0, sizeof(src.ss));
+	if (kind < 4) {				// v4
+		struct sockaddr_in *sin = (struct sockaddr_in *)&src.ss;
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(0x0b000000 | (random32() & 0xffff));
+		src.key.assign("4");
+		src.key.append((const char *)&sin->sin_addr, 4);
+
+	} else if (kind < 6) {			// v6
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&src.ss;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr.s6_addr[0] = 0x20;
+		sin6->sin6_addr.s6_addr[1] = 0x01;
+		for (unsigned i = 12; i < 16; ++i)
+			sin6->sin6_addr.s6_addr[i] = (unsigned char)(random32() & (i == 12 ? 0x01 : 0xff));
+		src.key.assign("6");
+		src.key.append((const char *)&sin6->sin6_addr, 16);
+
+	} else if (kind < 7 && ! sources.empty() &&
+			AF_INET == sources.back().ss.ss_family) {	// v4-mapped alias of the previous.
+		const struct sockaddr_in *sin = (const struct sockaddr_in *)&sources.back().ss;
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&src.ss;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr.s6_addr[10] = 0xff;
+		sin6->sin6_addr.s6_addr[11] = 0xff;
+		memcpy(sin6->sin6_addr.s6_addr + 12, &sin->sin_addr, 4);
+		src.key = sources.back().key;
+
+	} else {				// loopback
+		struct sockaddr_in *sin = (struct sockaddr_in *)&src.ss;
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(0x7f000001 + (random32() & 0xff));
+		src.key.clear();
+	}
+}
+
+
+/*
+ *  Random violations over a population of sources, against a reference counting
+ *  violations per identity; the run completes well within the window and the ban.
+ */
+static void
+test_concurrent(unsigned nsources, unsigned nviolations, unsigned nreaders)
+{
+	std::vector<struct source> sources;
+	std::map<std::string, unsigned> strikes, identities;	// reference.
+	std::vector<std::atomic<unsigned>> violations(nsources);
+	std::vector<std::thread> readers;
+	std::atomic<unsigned long> lookups(0);
+	std::atomic<bool> stop(false);
+	unsigned i;
+
+	reset("3 600", "3600");
+
+	for (i = 0; i < nsources; ++i) {
+		struct source src;
+		random_source(src, sources);
+		src.canon = (src.key.empty() ? i : identities.emplace(src.key, i).first->second);
+		sources.push_back(src);
+	}
+
+	for (i = 0; i < nreaders; ++i) {
+		readers.emplace_back([&, i]() {
+			uint64_t state = 0x2545f4914f6cdd1dULL * (i + 1);
+			std::vector<unsigned char> seen(nsources);
+			unsigned long t_lookups = 0;
+
+			while (! stop.load(std::memory_order_relaxed)) {
+				const unsigned idx = random32r(&state) % nsources;
+				const struct source &src = sources[idx];
+
+				if (bantable::banned(&src.ss)) {	// violations are counted before being issued.
+					if (src.key.empty() || violations[src.canon].load() < STRIKES)
+						failed("concurrent", "source %u banned early", idx);
+					seen[idx] = 1;
+				} else if (seen[idx]) {
+					failed("concurrent", "source %u released", idx);
+				}
+				++t_lookups;
+			}
+			lookups += t_lookups;
+		});
+	}
+
+	for (i = 0; i < nviolations; ++i) {
+		const struct source &src = sources[random32() % nsources];
+		bool reference = false;
+		unsigned ttl = 0;
+
+		violations[src.canon].fetch_add(1);
+		const bool issued = bantable::violation(&src.ss, ttl);
+		if (! src.key.empty())
+			reference = (++strikes[src.key] == STRIKES);
+		if (issued != reference || (issued && 3600 != ttl))
+			failed("concurrent", "violation %u, ban %d expected %d", i, issued, reference);
+	}
+
+	stop = true;
+	for (auto &reader : readers)
+		reader.join();
+
+	for (const auto &src : sources) {		// quiescent; exact agreement.
+		const auto it = (src.key.empty() ? strikes.end() : strikes.find(src.key));
+		const bool reference = (it != strikes.end() && it->second >= STRIKES);
+
+		if (bantable::banned(&src.ss) != reference)
+			failed("concurrent", "quiescent, ban %d expected %d", ! reference, reference);
+	}
+	printf("bantable_test: %u sources, %u violations, %u readers, %lu lookups\n",
+		nsources, nviolations, nreaders, lookups.load());
+}
+
+
+static void
+saverequest(void)
+{
+	++saverequests;
+}
+
+
+static bool
+saved(const char *text, unsigned *level = nullptr)
+{
+	char line[256], address[INET6_ADDRSTRLEN + 1];
+	bool found = false;
+	long long until;
+	unsigned t_level;
+	FILE *file;
+
+	if (nullptr == (file = fopen(filename, "r")))
+		return false;
+	while (! found && fgets(line, sizeof(line), file)) {
+		if (3 == sscanf(line, "%46s %lld %u", address, &until, &t_level) && 0 == strcmp(address, text)) {
+			if (level)
+				*level = t_level;
+			found = true;
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+
+static void
+test_persistence()
+{
+	static const char *restored[] = {"10.0.3.1", "2001:db8::3", "10.0.3.5", "10.0.3.6", "10.0.3.7"};
+	const long long t_now = (long long)time(nullptr);
+	unsigned level = 0;
+	FILE *file;
+
+	reset("1 600", "3600 86400");
+	(void) remove(filename);
+	if (bantable::load(filename, saverequest))
+		failed("persistence", "missing file loaded");
+
+	if (nullptr == (file = fopen(filename, "w"))) {
+		failed("persistence", "unable to create %s", filename);
+		return;
+	}
+	fprintf(file, "# inetd bans: <address> <expiry> <level>\n");
+	fprintf(file, "10.0.3.1 %lld 3\n", t_now + 3600);
+	fprintf(file, "10.0.3.2 %lld 1\n", t_now - 10);		// expired.
+	fprintf(file, "2001:db8::3 %lld 0\n", t_now + 3600);
+	fprintf(file, "127.0.0.1 %lld 0\n", t_now + 3600);	// loopback.
+	fprintf(file, "10.0.3.4 x 0\nnonsense\n");
+	fclose(file);
+
+	if (! bantable::load(filename, saverequest))
+		failed("persistence", "load failed");
+	if (! banned("10.0.3.1") || ! banned("2001:db8::3") || banned("10.0.3.2") ||
+			banned("127.0.0.1") || banned("10.0.3.4"))
+		failed("persistence", "restored bans");
+
+	if (3600 != violation("10.0.3.5") || 1 != saverequests)	// save requested ...
+		failed("persistence", "save not requested, %u", saverequests);
+	if (3600 != violation("10.0.3.6") || 1 != saverequests)	// ... once, until performed.
+		failed("persistence", "save requested whilst pending, %u", saverequests);
+	if (! bantable::save(false) || ! saved("10.0.3.1", &level) || 3 != level ||
+			! saved("2001:db8::3") || ! saved("10.0.3.5") || ! saved("10.0.3.6") || saved("10.0.3.2"))
+		failed("persistence", "saved bans");
+
+	(void) remove(filename);
+	if (3600 != violation("10.0.3.7") || 1 != saverequests)	// within the save interval.
+		failed("persistence", "save requested within the interval, %u", saverequests);
+	if (! bantable::save(false) || nullptr != (file = fopen(filename, "r")))
+		failed("persistence", "unforced save within the interval");
+	if (file)
+		fclose(file);
+	if (! bantable::save(true) || ! saved("10.0.3.7") || ! saved("10.0.3.1"))
+		failed("persistence", "forced save");
+
+	reset("1 600", "3600 86400");			// withdrawn, then restored.
+	for (const char *source : restored) {
+		if (banned(source))
+			failed("persistence", "%s, not withdrawn", source);
+	}
+	if (! bantable::load(filename, saverequest))
+		failed("persistence", "reload failed");
+	for (const char *source : restored) {
+		if (! banned(source))
+			failed("persistence", "%s, not restored", source);
+	}
+	(void) remove(filename);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned nsources = (argc > 1 ? (unsigned)atoi(argv[1]) : 4000);
+	const unsigned nviolations = (argc > 2 ? (unsigned)atoi(argv[2]) : 20000);
+	const unsigned nreaders = (argc > 3 ? (unsigned)atoi(argv[3]) : 2);
+
+	if (0 == nsources || 0 == nviolations || argc > 4) {
+		fprintf(stderr, "usage: bantable_test [sources [violations [readers]]]\n");
+		return 1;
+	}
+
+	test_policy();
+	test_threshold();
+	test_window();
+	test_escalation();
+	test_concurrent(nsources, nviolations, nreaders);
+	test_persistence();
+
+	if (errors) {
+		fprintf(stderr, "bantable_test: %lu failures\n", errors.load());
+		return 1;
+	}
+	printf("bantable_test: passed\n");
+	return 0;
+}
+
+//end
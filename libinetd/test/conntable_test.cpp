@@ -0,0 +1,392 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - connection table test.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+
+/*
+ *  Per source child limits of conntable::acquire(), see conntable.cpp:
+ *
+ *	o limit; a source is admitted exactly 'maxperip' children, then refused without
+ *	  allocation, and admitted again once a child exits.
+ *	o identity; children of a source share its entry, which holds the binary address;
+ *	  ipv4 and ipv6 sources sharing low order bytes are distinct.
+ *	o untracked; a zero limit is an error, and leaves no entry behind.
+ *	o resize; a raised limit admits further children, a lowered one retains the
+ *	  existing until they exit.
+ *	o growth; thousands of sources each held to the limit, then drained to idle.
+ *	o clear; detaches every child.
+ *	o concurrency; threads admitting the same sources never exceed the limit.
+ *
+ *	conntable_test [sources [threads]]
+ */
+
+#include "../inetd.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "../conntable.h"
+#include "unittest.h"
+
+#define MAXPERIP	3
+
+static std::atomic<unsigned long> errors;	// failures, any thread.
+
+
+static void
+failed(const char *test, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "conntable_test: %s, ", test);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	++errors;
+}
+
+
+static struct sockaddr_storage
+inet4(uint32_t addr)
+{
+	struct sockaddr_storage ss = {0};
+	struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(addr);
+	return ss;
+}
+
+
+static struct sockaddr_storage
+inet6(uint32_t low)
+{
+	struct sockaddr_storage ss = {0};
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+	const uint32_t nlow = htonl(low);
+
+	sin6->sin6_family = AF_INET6;
+	sin6->sin6_addr.s6_addr[0] = 0x20;
+	sin6->sin6_addr.s6_addr[1] = 0x01;
+	memcpy(sin6->sin6_addr.s6_addr + 12, &nlow, 4);
+	return ss;
+}
+
+
+static struct sockaddr_storage
+source(unsigned id)
+{
+	return (id % 3 ? inet4(0x0a000000 + id) : inet6(0x0a000000 + id));
+}
+
+
+static bool
+same(const struct conninfo *conn, const struct sockaddr_storage &ss)
+{
+	if (conn->co_family != ss.ss_family)
+		return false;
+	if (AF_INET6 == ss.ss_family)
+		return (0 == memcmp(&conn->co_addr.addr6, &((const struct sockaddr_in6 *)&ss)->sin6_addr, 16));
+	return (conn->co_addr.addr4.s_addr == ((const struct sockaddr_in *)&ss)->sin_addr.s_addr);
+}
+
+
+/*
+ *  Admit children until refused, bounded; returns the refusing status.
+ */
+static conntable::status
+fill(conntable &table, const struct sockaddr_storage &ss, int maxperip,
+		std::vector<struct procinfo *> &children, unsigned limit = 100)
+{
+	for (unsigned i = 0; i < limit; ++i) {
+		struct conninfo *conn = nullptr;
+		struct procinfo *proc = nullptr;
+		const conntable::status status = table.acquire(&ss, maxperip, conn, proc);
+
+		if (conntable::CT_OK != status) {
+			if (conn || proc)
+				failed("acquire", "refusal returned an entry");
+			return status;
+		}
+		if (nullptr == conn || nullptr == proc || proc->pr_conn != conn ||
+				proc->pr_table != &table || conn->co_table != &table || ! same(conn, ss)) {
+			failed("acquire", "malformed child");
+		} else if (children.size() && children[0]->pr_conn != conn) {
+			failed("acquire", "children of a source on distinct entries");
+		}
+		children.push_back(proc);
+	}
+	return conntable::CT_OK;
+}
+
+
+static void
+release(conntable &table, std::vector<struct procinfo *> &children)
+{
+	for (struct procinfo *proc : children) {
+		if (! table.unlink(proc) || nullptr != proc->pr_conn)
+			failed("unlink", "child not detached");
+		delete proc;
+	}
+	children.clear();
+}
+
+
+static void
+test_limit()
+{
+	const struct sockaddr_storage ss = inet4(0x0a000001);
+	std::vector<struct procinfo *> children;
+	conntable table;
+
+	if (conntable::CT_LIMIT != fill(table, ss, MAXPERIP, children) || MAXPERIP != children.size())
+		failed("limit", "admitted %u of %u", (unsigned)children.size(), MAXPERIP);
+	if (1 != table.size())
+		failed("limit", "%u entries", (unsigned)table.size());
+
+	struct procinfo *exited = children.back();	// exit, then readmit.
+	children.pop_back();
+	if (! table.unlink(exited) || 1 != table.size())
+		failed("limit", "exit released the entry");
+	delete exited;
+	if (conntable::CT_LIMIT != fill(table, ss, MAXPERIP, children) || MAXPERIP != children.size())
+		failed("limit", "readmitted %u of %u", (unsigned)children.size(), MAXPERIP);
+
+	release(table, children);
+	if (0 != table.size())
+		failed("limit", "%u entries once idle", (unsigned)table.size());
+
+	struct conninfo *conn = nullptr;		// untracked.
+	struct procinfo *proc = nullptr;
+	if (conntable::CT_ERROR != table.acquire(&ss, 0, conn, proc) || conn || proc || 0 != table.size())
+		failed("limit", "zero limit admitted");
+}
+
+
+static void
+test_identity()
+{
+	const uint32_t low = 0x0a000102;
+	const struct sockaddr_storage v4 = inet4(low), v6 = inet6(low);
+	std::vector<struct procinfo *> children4, children6;
+	conntable table;
+
+	fill(table, v4, MAXPERIP, children4);
+	if (conntable::CT_LIMIT != fill(table, v6, MAXPERIP, children6) || MAXPERIP != children6.size())
+		failed("identity", "ipv6 admitted %u of %u", (unsigned)children6.size(), MAXPERIP);
+	if (2 != table.size() || children4[0]->pr_conn == children6[0]->pr_conn)
+		failed("identity", "ipv4 and ipv6 sources merged");
+
+	struct sockaddr_storage port = v4;		// port is not part of the key.
+	((struct sockaddr_in *)&port)->sin_port = htons(4321);
+	if (conntable::CT_LIMIT != fill(table, port, MAXPERIP, children4) || MAXPERIP != children4.size())
+		failed("identity", "port distinguished the source");
+
+	release(table, children4);
+	release(table, children6);
+}
+
+
+static void
+test_resize()
+{
+	const struct sockaddr_storage ss = inet4(0x0a000003);
+	std::vector<struct procinfo *> children;
+	conntable table;
+
+	fill(table, ss, MAXPERIP, children);
+	if (! table.resize(MAXPERIP + 2) ||
+			conntable::CT_LIMIT != fill(table, ss, MAXPERIP + 2, children) || MAXPERIP + 2 != children.size())
+		failed("resize", "raised, admitted %u of %u", (unsigned)children.size(), MAXPERIP + 2);
+
+	if (! table.resize(1) ||			// lowered; existing retained.
+			conntable::CT_LIMIT != fill(table, ss, 1, children) || MAXPERIP + 2 != children.size())
+		failed("resize", "lowered, holding %u of %u", (unsigned)children.size(), MAXPERIP + 2);
+	while (children.size() > 1) {
+		struct procinfo *proc = children.back();
+		children.pop_back();
+		table.unlink(proc);
+		delete proc;
+	}
+	if (conntable::CT_LIMIT != fill(table, ss, 1, children) || 1 != children.size())
+		failed("resize", "lowered, admitted beyond the limit");
+	release(table, children);
+}
+
+
+/*
+ *  Grow through the rehash points, each source held at its limit, then drain.
+ */
+static void
+test_growth(unsigned nsources)
+{
+	std::vector<std::vector<struct procinfo *>> children(nsources);
+	conntable table;
+
+	for (unsigned round = 0; round < 2; ++round) {	// second, reuse once idle.
+		for (unsigned id = 0; id < nsources; ++id) {
+			const struct sockaddr_storage ss = source(id);
+
+			if (conntable::CT_LIMIT != fill(table, ss, MAXPERIP, children[id]) ||
+					MAXPERIP != children[id].size())
+				failed("growth", "source %u admitted %u of %u", id, (unsigned)children[id].size(), MAXPERIP);
+		}
+		if (nsources != table.size())
+			failed("growth", "%u entries of %u", (unsigned)table.size(), nsources);
+
+		for (unsigned id = 0; id < nsources; ++id) {	// random exits.
+			std::vector<struct procinfo *> &c = children[id];
+			const size_t idx = random32() % c.size();
+			struct procinfo *proc = c[idx];
+
+			c[idx] = c.back(), c.pop_back();
+			table.unlink(proc);
+			delete proc;
+		}
+		for (unsigned id = 0; id < nsources; ++id) {
+			const struct sockaddr_storage ss = source(id);
+
+			if (conntable::CT_LIMIT != fill(table, ss, MAXPERIP, children[id]) ||
+					MAXPERIP != children[id].size())
+				failed("growth", "source %u readmitted %u of %u", id, (unsigned)children[id].size(), MAXPERIP);
+		}
+
+		for (auto &c : children)
+			release(table, c);
+		if (0 != table.size())
+			failed("growth", "%u entries once idle", (unsigned)table.size());
+	}
+}
+
+
+static void
+test_clear()
+{
+	std::vector<std::vector<struct procinfo *>> children(100);
+	conntable table;
+
+	for (unsigned id = 0; id < children.size(); ++id)
+		fill(table, source(id), MAXPERIP, children[id]);
+	table.clear();
+	if (0 != table.size())
+		failed("clear", "%u entries", (unsigned)table.size());
+	for (auto &c : children) {
+		for (struct procinfo *proc : c) {
+			if (nullptr != proc->pr_conn || table.unlink(proc))
+				failed("clear", "child remains attached");
+			delete proc;
+		}
+	}
+}
+
+
+/*
+ *  Threads admitting and exiting children of a shared set of sources; admissions per
+ *  source never exceed the limit.
+ */
+static void
+test_concurrent(unsigned nthreads)
+{
+	const unsigned nsources = 64, operations = 50000;
+	std::vector<std::atomic<int>> active(nsources);
+	std::vector<std::thread> threads;
+	conntable table;
+
+	for (unsigned t = 0; t < nthreads; ++t) {
+		threads.emplace_back([&, t]() {
+			uint64_t state = 0x2545f4914f6cdd1dULL * (t + 1);
+			std::vector<std::pair<unsigned, struct procinfo *>> held;
+
+			for (unsigned op = 0; op < operations; ++op) {
+				if (held.size() < 8 && (random32r(&state) % 2)) {
+					const unsigned id = random32r(&state) % nsources;
+					const struct sockaddr_storage ss = source(id);
+					struct conninfo *conn = nullptr;
+					struct procinfo *proc = nullptr;
+
+					if (conntable::CT_OK == table.acquire(&ss, MAXPERIP, conn, proc)) {
+						if (++active[id] > MAXPERIP)
+							failed("concurrent", "source %u above the limit", id);
+						held.emplace_back(id, proc);
+					}
+				} else if (held.size()) {
+					const size_t idx = random32r(&state) % held.size();
+					auto h = held[idx];
+
+					held[idx] = held.back(), held.pop_back();
+					--active[h.first];	// before the slot is released.
+					table.unlink(h.second);
+					delete h.second;
+				}
+			}
+			for (auto &h : held) {
+				--active[h.first];
+				table.unlink(h.second);
+				delete h.second;
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	if (0 != table.size())
+		failed("concurrent", "%u entries once idle", (unsigned)table.size());
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned nsources = (argc > 1 ? (unsigned)atoi(argv[1]) : 5000);
+	const unsigned nthreads = (argc > 2 ? (unsigned)atoi(argv[2]) : 4);
+
+	if (0 == nsources || 0 == nthreads || argc > 3) {
+		fprintf(stderr, "usage: conntable_test [sources [threads]]\n");
+		return 1;
+	}
+
+	test_limit();
+	test_identity();
+	test_resize();
+	test_growth(nsources);
+	test_clear();
+	test_concurrent(nthreads);
+
+	if (errors) {
+		fprintf(stderr, "conntable_test: %lu failures\n", errors.load());
+		return 1;
+	}
+	printf("conntable_test: passed\n");
+	return 0;
+}
+
+//end
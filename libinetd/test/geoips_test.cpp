@@ -0,0 +1,350 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - geoip source test.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+
+/*
+ *  Geoip rules against a native .gidx database, see geoips.cpp:
+ *
+ *	o rules; allow and deny country lists, the match default, v4-mapped sources and
+ *	  an unavailable database.
+ *	o swap; whilst readers look up, the database is replaced by successive generations.
+ *	  Each is reloaded by the watcher and swapped in; a reader never steps back to an
+ *	  earlier generation, nor sees one not yet published, nor a released image.
+ *	o release; purge() keeps a source whilst any table references it, and releases it
+ *	  once none do, so the next table loads the current image.
+ *
+ *  Each generation holds fixed country ranges, a marker range (10/8) coded "G<n>" and
+ *  16n padding ranges; successive images differ in size, as the watcher compares only
+ *  size and modification time, the latter to the second.
+ *
+ *	geoips_test [generations [readers]]
+ *
+ *  Linked with geoips.cpp built with -DGEOIP_POLL=1, a reload each second or two, and the
+ *  builder, ../mmdblookup/geoidx.cpp.
+ */
+
+#include "../inetd.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../geoips.h"
+#include "../../mmdblookup/geoidx.h"
+#include "unittest.h"
+
+#define RELOAD		20			// reload timeout, seconds.
+
+static const char *source = "geoips_test.txt";
+static const char *staging = "geoips_test.tmp";
+static const char *database = "geoips_test.gidx";
+
+static std::atomic<unsigned long> errors;	// failures, any thread.
+
+
+static void
+failed(const char *test, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "geoips_test: %s, ", test);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	++errors;
+}
+
+
+static struct sockaddr_storage
+address(const char *text)
+{
+	struct sockaddr_storage ss = {0};
+
+	if (1 == inet_pton(AF_INET, text, &((struct sockaddr_in *)&ss)->sin_addr)) {
+		ss.ss_family = AF_INET;
+	} else if (1 == inet_pton(AF_INET6, text, &((struct sockaddr_in6 *)&ss)->sin6_addr)) {
+		ss.ss_family = AF_INET6;
+	}
+	return ss;
+}
+
+
+static bool
+allowed(const geoips &table, const char *text)
+{
+	const struct sockaddr_storage ss = address(text);
+	return table.allowed((const struct sockaddr *)&ss);
+}
+
+
+/*
+ *  Build generation 'g' into staging and replace the database.
+ */
+static bool
+publish(unsigned g)
+{
+	const std::vector<const char *> sources = {source};
+	FILE *file;
+
+	if (nullptr == (file = fopen(source, "w")))
+		return false;
+	fprintf(file,
+		"1.0.0.0,1.0.0.255,AU\n"
+		"1.0.1.0,1.0.1.255,NZ\n"
+		"3.0.0.0,3.255.255.255,US\n"
+		"5.0.0.0,5.0.255.255,GB\n"
+		"10.0.0.0,10.255.255.255,G%u\n"
+		"2001:db8::,2001:db8:ffff:ffff:ffff:ffff:ffff:ffff,JP\n", g);
+	for (unsigned pad = 0; pad < (g * 16); ++pad)		// disjoint, so not coalesced.
+		fprintf(file, "20.%u.%u.0,20.%u.%u.255,FR\n", pad >> 7, (pad & 0x7f) * 2, pad >> 7, (pad & 0x7f) * 2);
+	if (0 != fclose(file) || 0 != geoidx_build(sources, staging, false))
+		return false;
+
+#if defined(_WIN32)	// a mapped image cannot be replaced in place; rename it aside.
+	const std::string aside = std::string(database) + "." + std::to_string(g);
+	(void) rename(database, aside.c_str());
+#endif
+	return (0 == rename(staging, database));
+}
+
+
+static void
+cleanup(unsigned generations)
+{
+	(void) remove(source);
+	(void) remove(database);
+#if defined(_WIN32)
+	for (unsigned g = 0; g <= generations; ++g)
+		(void) remove((std::string(database) + "." + std::to_string(g)).c_str());
+#else
+	(void) generations;
+#endif
+}
+
+
+static bool
+marker(geoips &table, unsigned g)
+{
+	const std::string value = "country G" + std::to_string(g);
+
+	table.database(database);
+	return (table.push(value.c_str(), '+') && table.match_default(-1) && table.build());
+}
+
+
+static void
+test_rules()
+{
+	geoips allow, deny, mixed, missing;
+
+	allow.database(database);
+	if (! allow.push("country AU NZ", '+') || ! allow.match_default(-1) || ! allow.build())
+		failed("rules", "allow list rejected");
+	if (! allowed(allow, "1.0.0.1") || ! allowed(allow, "1.0.1.254") ||
+			allowed(allow, "3.1.2.3") || allowed(allow, "200.0.0.1"))
+		failed("rules", "allow list, default deny");
+	if (! allowed(allow, "::ffff:1.0.0.1") || allowed(allow, "::ffff:3.1.2.3"))
+		failed("rules", "v4-mapped source");
+
+	deny.database(database);
+	if (! deny.push("country US GB", '-') || ! deny.match_default(1) || ! deny.build())
+		failed("rules", "deny list rejected");
+	if (allowed(deny, "3.0.0.0") || allowed(deny, "5.0.255.255") ||
+			! allowed(deny, "5.1.0.0") || ! allowed(deny, "1.0.0.1") || ! allowed(deny, "200.0.0.1"))
+		failed("rules", "deny list, default allow");
+
+	mixed.database(database);			// default neither; unmatched allowed.
+	if (! mixed.push("country JP", '+') || ! mixed.push("country AU", '-') || ! mixed.build())
+		failed("rules", "mixed list rejected");
+	if (mixed.push("country AU", '+'))
+		failed("rules", "duplicate rule accepted");
+	if (! allowed(mixed, "2001:db8::1") || allowed(mixed, "1.0.0.1") ||
+			! allowed(mixed, "2001:db9::1") || ! allowed(mixed, "200.0.0.1"))
+		failed("rules", "mixed list");
+
+	missing.database("geoips_test.missing.gidx");	// unavailable; the default applies.
+	if (! missing.push("country AU", '+') || ! missing.match_default(-1) || missing.build())
+		failed("rules", "unavailable database built");
+	if (allowed(missing, "1.0.0.1"))
+		failed("rules", "unavailable database, default ignored");
+}
+
+
+/*
+ *  Readers look up whilst generations are published; each marker result lies within
+ *  [newest observed, newest published], and the fixed ranges always resolve.
+ */
+static void
+test_swap(unsigned generations, unsigned nreaders)
+{
+	std::unique_ptr<geoips[]> markers(new geoips[generations + 1]);
+	std::atomic<unsigned> published(1);
+	std::atomic<unsigned long> lookups(0);
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> readers;
+	geoips fixed;
+
+	for (unsigned g = 1; g <= generations; ++g) {
+		if (! marker(markers[g], g))
+			failed("swap", "marker %u rejected", g);
+	}
+	fixed.database(database);
+	if (! fixed.push("country AU JP", '+') || ! fixed.match_default(-1) || ! fixed.build())
+		failed("swap", "fixed rules rejected");
+	if (! allowed(markers[1], "10.1.2.3"))
+		failed("swap", "generation 1 not loaded");
+
+	for (unsigned t = 0; t < nreaders; ++t) {
+		readers.emplace_back([&, t]() {
+			const struct sockaddr_storage mark = address("10.1.2.3"),
+				au = address("1.0.0.1"), jp = address("2001:db8::1");
+			uint64_t state = 0x2545f4914f6cdd1dULL * (t + 1);
+			unsigned long t_lookups = 0;
+			unsigned seen = 1;
+
+			while (! stop.load(std::memory_order_relaxed)) {
+				const unsigned g = 1 + (random32r(&state) % generations);
+
+				if (markers[g].allowed((const struct sockaddr *)&mark)) {
+					const unsigned hi = published.load();
+
+					if (g < seen || g > hi)
+						failed("swap", "generation %u observed, within [%u, %u]", g, seen, hi);
+					seen = g;
+				}
+				if (! fixed.allowed((const struct sockaddr *)&au) ||
+						! fixed.allowed((const struct sockaddr *)&jp))
+					failed("swap", "fixed ranges unresolved");
+				t_lookups += 3;
+			}
+			lookups += t_lookups;
+		});
+	}
+
+	const double start = now();
+	for (unsigned g = 2; g <= generations && 0 == errors; ++g) {
+		const double timeout = now() + RELOAD;
+
+		published = g;
+		if (! publish(g)) {
+			failed("swap", "unable to build generation %u", g);
+			break;
+		}
+		while (! allowed(markers[g], "10.1.2.3")) {
+			if (now() > timeout) {
+				failed("swap", "generation %u not reloaded", g);
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+	}
+	const double elapsed = now() - start;
+
+	stop = true;
+	for (auto &reader : readers)
+		reader.join();
+
+	for (unsigned g = 1; g <= generations; ++g) {	// quiescent; the last only.
+		if (allowed(markers[g], "10.1.2.3") != (g == generations))
+			failed("swap", "generation %u, quiescent", g);
+	}
+	printf("geoips_test: %u generations, %u readers, %lu lookups, %.1f seconds\n",
+		generations, nreaders, lookups.load(), elapsed);
+}
+
+
+/*
+ *  A referenced source survives purge(), still serving the previous image until reloaded;
+ *  once unreferenced it is released, and the next table loads the replacement at once.
+ *  Each check follows the replacement well within a poll interval, before any reload.
+ */
+static void
+test_release(unsigned g)
+{
+	std::unique_ptr<geoips> held(new geoips), shared(new geoips), fresh(new geoips);
+
+	if (! marker(*held, g))
+		failed("release", "marker %u rejected", g);
+	if (! publish(g + 1)) {
+		failed("release", "unable to build generation %u", g + 1);
+		return;
+	}
+
+	geoips::purge();				// referenced; retained.
+	if (! marker(*shared, g) || ! allowed(*shared, "10.1.2.3"))
+		failed("release", "referenced source released");
+
+	held.reset(), shared.reset();
+	geoips::purge();				// unreferenced; released.
+	if (! marker(*fresh, g + 1) || ! allowed(*fresh, "10.1.2.3"))
+		failed("release", "unreferenced source retained");
+
+	fresh.reset();
+	geoips::purge();
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned generations = (argc > 1 ? (unsigned)atoi(argv[1]) : 4);
+	const unsigned nreaders = (argc > 2 ? (unsigned)atoi(argv[2]) : 4);
+
+	if (generations < 2 || 0 == nreaders || argc > 3) {
+		fprintf(stderr, "usage: geoips_test [generations [readers]]\n");
+		return 1;
+	}
+
+	cleanup(generations + 1);
+	if (! publish(1)) {
+		fprintf(stderr, "geoips_test: unable to build database\n");
+		return 1;
+	}
+
+	test_rules();
+	test_swap(generations, nreaders);
+	geoips::purge();
+	test_release(generations);
+	cleanup(generations + 1);
+
+	if (errors) {
+		fprintf(stderr, "geoips_test: %lu failures\n", errors.load());
+		return 1;
+	}
+	printf("geoips_test: passed\n");
+	return 0;
+}
+
+//end
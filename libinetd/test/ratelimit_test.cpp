@@ -0,0 +1,403 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - rate limit test.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Token bucket behaviour of ratelimits::allowed(), see ratelimit.cpp:
+ *
+ *	o rule parsing; rate, period and burst defaults and rejections.
+ *	o burst; a fresh bucket admits exactly <burst> connections.
+ *	o aggregation; ipv4 /24, ipv6 /64 and /48 sources share a bucket, others do not.
+ *	o isolation; distinct sources never share a bucket, each admitted exactly <burst>.
+ *	o chaining; a refusal returns the tokens taken from the earlier scopes.
+ *	o refill; tokens return at <rate>/<period> and never beyond <burst>.
+ *	o concurrency; the service bucket admits exactly its depth across threads.
+ *
+ *  Rules other than those timing refill use 1/86400s, a token per day, so buckets only
+ *  drain within a run.
+ *
+ *	ratelimit_test [threads]
+ */
+
+#include "../inetd.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../ratelimit.h"
+#include "unittest.h"
+
+#define DAY		86400
+
+static unsigned long errors;
+
+
+static void
+failed(const char *test, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "ratelimit_test: %s, ", test);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	++errors;
+}
+
+
+static struct sockaddr_storage
+inet4(uint32_t addr)
+{
+	struct sockaddr_storage ss = {0};
+	struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(addr);
+	return ss;
+}
+
+
+static struct sockaddr_storage
+inet6(uint16_t net48, uint16_t subnet, uint64_t host)
+{
+	struct sockaddr_storage ss = {0};
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+	unsigned char *addr = sin6->sin6_addr.s6_addr;
+
+	sin6->sin6_family = AF_INET6;
+	addr[0] = 0x20, addr[1] = 0x01, addr[2] = 0x0d, addr[3] = 0xb8;
+	addr[4] = (unsigned char)(net48 >> 8), addr[5] = (unsigned char)net48;
+	addr[6] = (unsigned char)(subnet >> 8), addr[7] = (unsigned char)subnet;
+	for (unsigned i = 0; i < 8; ++i)
+		addr[15 - i] = (unsigned char)(host >> (i * 8));
+	return ss;
+}
+
+
+/*
+ *  Admissions until the first refusal, bounded.
+ */
+static unsigned
+drain(const ratelimits &limits, const struct sockaddr_storage *ss, unsigned limit = 100000)
+{
+	unsigned admitted = 0;
+
+	while (admitted < limit && nullptr == limits.allowed(ss))
+		++admitted;
+	return admitted;
+}
+
+
+static void
+test_rules()
+{
+	struct ratelimits::rule rule;
+
+	if (! ratelimits::to_rule("source", "10/60", "20", rule) || ratelimits::RL_SOURCE != rule.type ||
+			10 != rule.rate || 60 != rule.period || 20 != rule.burst)
+		failed("rules", "source 10/60 20");
+	if (! ratelimits::to_rule("SUBNET", "5", nullptr, rule) || ratelimits::RL_SUBNET != rule.type ||
+			5 != rule.rate || 1 != rule.period || 5 != rule.burst)
+		failed("rules", "subnet 5, burst defaults to rate");
+	if (ratelimits::to_rule("host", "5", nullptr, rule) || ratelimits::to_rule("service", "0", nullptr, rule) ||
+			ratelimits::to_rule("service", "5/0", nullptr, rule) || ratelimits::to_rule("service", "5/x", nullptr, rule) ||
+			ratelimits::to_rule("service", "5", "0", rule) || ratelimits::to_rule("service", "5", "5x", rule))
+		failed("rules", "malformed rule accepted");
+
+	ratelimits limits;				// one rule per scope, the last.
+	limits.push({ratelimits::RL_SOURCE, 1, DAY, 1});
+	limits.push({ratelimits::RL_SOURCE, 2, DAY, 2});
+	if (1 != limits.size() || 2 != limits()[0].burst)
+		failed("rules", "scope replaced, %u rules", (unsigned)limits.size());
+	limits.build();
+	if (limits.push({ratelimits::RL_SERVICE, 1, DAY, 1}))
+		failed("rules", "push once active");
+}
+
+
+static void
+test_burst()
+{
+	static const unsigned depths[] = { 1, 3, 64, 1000 };
+
+	for (unsigned scope = ratelimits::RL_SOURCE; scope < ratelimits::RL_SCOPES; ++scope) {
+		for (unsigned depth : depths) {
+			const struct sockaddr_storage ss = inet4(0xc0000200 | (depth & 0xff));
+			ratelimits limits;
+			unsigned admitted;
+
+			limits.push({(ratelimits::scope)scope, 1, DAY, depth});
+			limits.build();
+			if ((admitted = drain(limits, &ss)) != depth)
+				failed(ratelimits::to_name((ratelimits::scope)scope), "burst, admitted %u of %u", admitted, depth);
+		}
+	}
+
+	ratelimits service;				// unknown source; service scope only.
+	service.push({ratelimits::RL_SOURCE, 1, DAY, 1});
+	service.push({ratelimits::RL_SERVICE, 1, DAY, 5});
+	service.build();
+	unsigned admitted = drain(service, nullptr);
+	if (5 != admitted)
+		failed("service", "unknown source, admitted %u of %u", admitted, 5);
+}
+
+
+static void
+test_aggregation()
+{
+	struct {
+		ratelimits::scope type;
+		struct sockaddr_storage first, shared, distinct;
+	} cases[] = {
+		{ ratelimits::RL_SOURCE,   inet4(0x0a010203), inet4(0x0a010203), inet4(0x0a010204) },
+		{ ratelimits::RL_SUBNET,   inet4(0x0a010203), inet4(0x0a0102fe), inet4(0x0a010303) },
+		{ ratelimits::RL_SUBNET48, inet4(0x0a010203), inet4(0x0a010200), inet4(0x0b010203) },
+		{ ratelimits::RL_SOURCE,   inet6(1, 1, 1), inet6(1, 1, 1), inet6(1, 1, 2) },
+		{ ratelimits::RL_SUBNET,   inet6(1, 1, 1), inet6(1, 1, ~0ULL), inet6(1, 2, 1) },
+		{ ratelimits::RL_SUBNET48, inet6(1, 1, 1), inet6(1, 0xffff, 7), inet6(2, 1, 1) },
+	};
+
+	for (const auto &c : cases) {
+		const char *name = ratelimits::to_name(c.type);
+		ratelimits limits;
+		unsigned admitted;
+
+		limits.push({c.type, 1, DAY, 4});
+		limits.build();
+		if ((admitted = drain(limits, &c.first, 2)) != 2)
+			failed(name, "aggregation, admitted %u of %u", admitted, 2);
+		if ((admitted = drain(limits, &c.shared)) != 2)
+			failed(name, "aggregation, shared admitted %u of %u", admitted, 2);
+		if ((admitted = drain(limits, &c.distinct)) != 4)
+			failed(name, "aggregation, distinct admitted %u of %u", admitted, 4);
+	}
+}
+
+
+/*
+ *  Sources never share a bucket; whilst the population fits the table, every source is
+ *  admitted exactly its burst whatever the order of arrival.
+ */
+static void
+test_isolation()
+{
+	const unsigned population = 256, depth = 3;
+	std::vector<struct sockaddr_storage> sources;
+	std::vector<unsigned> admitted(population);
+
+	for (unsigned i = 0; i < population; ++i)
+		sources.push_back(i & 1 ? inet4(random32()) : inet6((uint16_t)random32(), (uint16_t)random32(), random64()));
+
+	ratelimits limits;
+	limits.push({ratelimits::RL_SOURCE, 1, DAY, depth});
+	limits.build();
+
+	for (unsigned a = 0; a < population * depth * 4; ++a) {
+		const unsigned idx = random32() % population;
+		if (nullptr == limits.allowed(&sources[idx]))
+			++admitted[idx];
+	}
+	for (unsigned idx = 0; idx < population; ++idx)
+		admitted[idx] += drain(limits, &sources[idx]);
+
+	for (unsigned idx = 0; idx < population; ++idx) {
+		if (admitted[idx] != depth)
+			failed("isolation", "source admitted %u of %u", admitted[idx], depth);
+	}
+}
+
+
+/*
+ *  A refusal by a later scope returns the tokens of the earlier; the refusing rule is
+ *  reported.
+ */
+static void
+test_chaining()
+{
+	const struct sockaddr_storage a = inet4(0x0a000001), b = inet4(0x0a000102);
+	const struct ratelimits::rule *refused;
+	ratelimits limits;
+	unsigned admitted;
+
+	limits.push({ratelimits::RL_SOURCE, 1, DAY, 2});
+	limits.push({ratelimits::RL_SERVICE, 1, DAY, 3});
+	limits.build();
+
+	if ((admitted = drain(limits, &a)) != 2)
+		failed("chaining", "source admitted %u of %u", admitted, 2);
+	if (nullptr == (refused = limits.allowed(&a)) || ratelimits::RL_SOURCE != refused->type)
+		failed("chaining", "refused by %u expected %u", refused ? refused->type : ~0U, ratelimits::RL_SOURCE);
+	if ((admitted = drain(limits, &b)) != 1)
+		failed("chaining", "service remainder, admitted %u of %u", admitted, 1);
+	if (nullptr == (refused = limits.allowed(&b)) || ratelimits::RL_SERVICE != refused->type)
+		failed("chaining", "refused by %u expected %u", refused ? refused->type : ~0U, ratelimits::RL_SERVICE);
+
+	ratelimits reverse;				// source refusal, after service taken.
+	reverse.push({ratelimits::RL_SERVICE, 1, DAY, 3});
+	reverse.push({ratelimits::RL_SOURCE, 1, DAY, 1});
+	reverse.build();
+	drain(reverse, &a);
+	drain(reverse, &a);				// refusals must not drain the service.
+	if ((admitted = drain(reverse, &b)) != 1 || (admitted += drain(reverse, nullptr)) != 2)
+		failed("chaining", "service returned, admitted %u of %u", admitted, 2);
+}
+
+
+/*
+ *  Refill at 1000/s; bounded by the elapsed time, plus clock resolution.
+ */
+static void
+test_refill()
+{
+	const unsigned slack = 32;
+	ratelimits refill;
+	unsigned drained, refilled, limit;
+	double mark;
+
+	refill.push({ratelimits::RL_SERVICE, 1000, 1, 1000});
+	refill.build();
+	mark = now();
+	drained = drain(refill, nullptr);
+	limit = 1000 + (unsigned)((now() - mark) * 1000) + slack;
+	if (drained < 1000 || drained > limit)
+		failed("refill", "drained %u, limit %u", drained, limit);
+
+	mark = now();
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	refilled = drain(refill, nullptr);
+	limit = (unsigned)((now() - mark) * 1000) + slack;
+	if (refilled < 100 - slack || refilled > limit)
+		failed("refill", "refilled %u, limit %u", refilled, limit);
+
+	ratelimits capped;				// idle, refill capped at burst.
+	const struct sockaddr_storage ss = inet4(0x0a000001);
+	capped.push({ratelimits::RL_SOURCE, 1000, 1, 5});
+	capped.build();
+	drain(capped, &ss);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	if ((refilled = drain(capped, &ss, 5 + slack)) != 5)
+		failed("refill", "idle, admitted %u of %u", refilled, 5);
+
+	ratelimits slow;				// 1/2s; idle for less than a token.
+	slow.push({ratelimits::RL_SOURCE, 1, 2, 1});
+	slow.build();
+	drain(slow, &ss);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	if ((refilled = drain(slow, &ss)) != 0)
+		failed("refill", "fractional, admitted %u of %u", refilled, 0);
+
+	refill.reset();					// fresh buckets, full.
+	if ((refilled = drain(refill, nullptr, 1000)) != 1000)
+		failed("refill", "reset, admitted %u of %u", refilled, 1000);
+	ratelimits::purge();
+	ratelimits::purge();
+}
+
+
+/*
+ *  Concurrent admission; the service bucket admits exactly its depth, and each source no
+ *  more than its burst.
+ */
+static void
+test_concurrent(unsigned nthreads)
+{
+	const unsigned population = 64, depth = 4, admissions = 20000, service = 5000;
+	std::vector<struct sockaddr_storage> sources;
+	std::vector<std::atomic<unsigned>> admitted(population);
+	std::atomic<unsigned> served(0);
+	std::vector<std::thread> threads;
+	ratelimits concurrent, shared;
+
+	for (unsigned i = 0; i < population; ++i)
+		sources.push_back(inet4(0x0a000000 | (i << 8) | 1));
+	concurrent.push({ratelimits::RL_SOURCE, 1, DAY, depth});
+	concurrent.build();
+	shared.push({ratelimits::RL_SERVICE, 1, DAY, service});
+	shared.build();
+
+	for (unsigned t = 0; t < nthreads; ++t) {
+		threads.emplace_back([&, t]() {
+			uint64_t state = 0x2545f4914f6cdd1dULL * (t + 1);
+			unsigned t_served = 0;
+
+			for (unsigned a = 0; a < admissions; ++a) {
+				const unsigned idx = random32r(&state) % population;
+
+				if (nullptr == concurrent.allowed(&sources[idx]))
+					++admitted[idx];
+				if (nullptr == shared.allowed(&sources[idx]))
+					++t_served;
+			}
+			served += t_served;
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	for (unsigned idx = 0; idx < population; ++idx) {
+		if (admitted[idx] != depth)
+			failed("concurrent", "source admitted %u of %u", admitted[idx].load(), depth);
+	}
+	if (served != service)
+		failed("concurrent", "service admitted %u of %u", served.load(), service);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned nthreads = (argc > 1 ? (unsigned)atoi(argv[1]) : 4);
+
+	if (0 == nthreads || argc > 2) {
+		fprintf(stderr, "usage: ratelimit_test [threads]\n");
+		return 1;
+	}
+
+	test_rules();
+	test_burst();
+	test_aggregation();
+	test_isolation();
+	test_chaining();
+	test_refill();
+	test_concurrent(nthreads);
+
+	if (errors) {
+		fprintf(stderr, "ratelimit_test: %lu failures\n", errors);
+		return 1;
+	}
+	printf("ratelimit_test: passed\n");
+	return 0;
+}
+
+//end
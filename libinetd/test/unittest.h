@@ -0,0 +1,83 @@
+#pragma once
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - unit test support.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Shared by the libinetd, libiptable and mmdblookup tests; C and C++.
+ *
+ *	random32r()	xorshift64 generator, caller state; one per thread.
+ *	random32()	as above, shared state; fixed seed so runs repeat.
+ *	random64()	two random32() draws.
+ *	now()		wall clock, seconds.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__cplusplus)
+#define UNITTEST_INLINE inline
+#elif defined(_MSC_VER) || defined(__WATCOMC__)
+#define UNITTEST_INLINE __inline
+#else
+#define UNITTEST_INLINE inline
+#endif
+
+static uint64_t unittest_rng = 0x9e3779b97f4a7c15ULL;
+
+static UNITTEST_INLINE uint32_t
+random32r(uint64_t *state)
+{
+	*state ^= *state << 13;			/* xorshift64 */
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return (uint32_t)(*state >> 16);
+}
+
+
+static UNITTEST_INLINE uint32_t
+random32(void)
+{
+	return random32r(&unittest_rng);
+}
+
+
+static UNITTEST_INLINE uint64_t
+random64(void)
+{
+	const uint64_t hi = random32();
+	return (hi << 32) | random32();
+}
+
+
+static UNITTEST_INLINE double
+now(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+//end
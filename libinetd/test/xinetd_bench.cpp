@@ -0,0 +1,187 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - xinetd tokenizer benchmark.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Times xinetd configuration tokenization, see xinetd::Collection, reporting the best
+ *  of repeated loads of either a generated or the named configuration.
+ *
+ *	xinetd_bench [-g services] [-o output] [-n loads] [source]
+ *
+ *  The generator emits a defaults section plus 'services' sections (default 10000) of
+ *  13 attributes each, mixing assignment operators, address lists and $(var) references;
+ *  -o writes the generated configuration rather than timing it. Only Collection::load()
+ *  is used, so building against an earlier xinetd.h compares tokenizers on equal input.
+ *
+ *  Built standalone against ../xinetd.h.
+ */
+
+#include "../inetd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "../xinetd.h"
+
+
+static void
+generate(std::string &image, unsigned services)
+{
+	char buffer[1024];
+
+	image.clear();
+	image +=
+		"#\n"
+		"# generated; xinetd_bench\n"
+		"#\n"
+		"\n"
+		"defaults\n"
+		"{\n"
+		"        log_type         =  FILE ./log/servicelog\n"
+		"        log_on_success   =  PID\n"
+		"        log_on_failure   =  HOST RECORD\n"
+		"        instances        =  10\n"
+		"        bogusnet         =  0.0.0.0/8 192.0.2.0/24 224.0.0.0/3 10.0.0.0/8 172.16.0.0/12 192.168.0.0/16\n"
+		"}\n";
+
+	for (unsigned idx = 0; idx < services; ++idx) {
+		snprintf(buffer, sizeof(buffer),
+			"\n"
+			"service svc%05u\n"
+			"{\n"
+			"        id              =  svc%05u-stream\n"
+			"        socket_type     =  stream\n"
+			"        protocol        =  %s\n"
+			"        wait            =  no\n"
+			"        user            =  root\n"
+			"        server          =  /usr/sbin/svc%05ud\n"
+			"        server_args     =  -l -p %u\n"
+			"        port            =  %u\n"
+			"        instances       =  %u\n"
+			"        log_on_success  += DURATION HOST USERID\n"
+			"        only_from       =  10.%u.%u.0/24 192.168.%u.0/24\n"
+			"        no_access       =  $(bogusnet)\n"
+			"        access_times    =  2:00-9:00 12:00-24:00\n"
+			"}\n",
+			idx, idx, (idx & 1 ? "tcp6" : "tcp"), idx,
+			10000 + idx, 10000 + idx, 1 + (idx % 32),
+			(idx >> 8) & 0xff, idx & 0xff, idx % 251);
+		image += buffer;
+	}
+}
+
+
+static bool
+slurp(const char *source, std::string &image)
+{
+	std::ifstream file(source);
+	std::ostringstream content;
+
+	if (! file.is_open())
+		return false;
+	content << file.rdbuf();
+	image = content.str();
+	return true;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	unsigned services = 10000, loads = 20;
+	const char *output = nullptr, *source = nullptr;
+	std::string image;
+
+	for (int arg = 1; arg < argc; ++arg) {
+		if (0 == strcmp(argv[arg], "-g") && arg + 1 < argc) {
+			services = (unsigned)strtoul(argv[++arg], nullptr, 10);
+		} else if (0 == strcmp(argv[arg], "-o") && arg + 1 < argc) {
+			output = argv[++arg];
+		} else if (0 == strcmp(argv[arg], "-n") && arg + 1 < argc) {
+			loads = (unsigned)strtoul(argv[++arg], nullptr, 10);
+		} else if ('-' != argv[arg][0] && nullptr == source) {
+			source = argv[arg];
+		} else {
+			fprintf(stderr, "usage: xinetd_bench [-g services] [-o output] [-n loads] [source]\n");
+			return 1;
+		}
+	}
+
+	if (source) {
+		if (! slurp(source, image)) {
+			fprintf(stderr, "xinetd_bench: %s: cannot open\n", source);
+			return 1;
+		}
+	} else {
+		generate(image, services);
+		source = "generated";
+	}
+
+	if (output) {
+		std::ofstream file(output, std::ios::binary);
+
+		if (! file.write(image.data(), image.size()) || (file.close(), file.fail())) {
+			fprintf(stderr, "xinetd_bench: %s: write error\n", output);
+			return 1;
+		}
+		printf("%s: %u services, %lu bytes\n", output, services, (unsigned long)image.size());
+		return 0;
+	}
+
+	double best = 0, total = 0;
+	size_t sections = 0;
+
+	for (unsigned load = 0; load < (loads ? loads : 1); ++load) {
+		std::istringstream stream(image);
+		const auto start = std::chrono::steady_clock::now();
+		xinetd::Collection collection;
+		const bool success = collection.load(stream, source);
+		const double elapsed = std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - start).count();
+
+		if (! success || ! collection.good()) {
+			int error_code = 0;
+			fprintf(stderr, "xinetd_bench: %s\n", collection.status(error_code).c_str());
+			return 1;
+		}
+		sections = collection.attributes().size();
+		if (0 == load || elapsed < best)
+			best = elapsed;
+		total += elapsed;
+	}
+
+	printf("%s: %lu bytes, %lu sections; loads: %u, best %.1f ms, mean %.1f ms\n",
+		source, (unsigned long)image.size(), (unsigned long)sections,
+		(loads ? loads : 1), best, total / (loads ? loads : 1));
+	return 0;
+}
+
+//end
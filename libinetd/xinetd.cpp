@@ -38,6 +38,7 @@
 
 #include <syslog.h>
 #include "config2.h"
+#include "servdb.h"
 #include "xinetd.h"
 
 #include "../libiptable/isc_util.h"
@@ -87,6 +88,7 @@ class ParserImpl
 
 	bool good() const;
 	std::shared_ptr<const Attributes> defaults() const;
+	const std::vector<std::string> &sources() const;
 	struct servconfig *next(const struct configparams *params);
 	const std::string &status(int &error_code) const;
 
@@ -112,9 +114,11 @@ class ParserImpl
 	static parse_status redirect(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status bind(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status only_from(ParserImpl &parser, const xinetd::Attribute *attr);
-	static bool only_from(ParserImpl &parser, char op, const std::string &value);
 	static parse_status no_access(ParserImpl &parser, const xinetd::Attribute *attr);
-	static bool no_access(ParserImpl &parser, char op, const std::string &value);
+	static parse_status shadow_only_from(ParserImpl &parser, const xinetd::Attribute *attr);
+	static parse_status shadow_no_access(ParserImpl &parser, const xinetd::Attribute *attr);
+	static parse_status netaddress(ParserImpl &parser, const xinetd::Attribute *attr, netaddrs &addresses, char type);
+	static bool netaddress(ParserImpl &parser, const xinetd::Attribute *attr, netaddrs &addresses, char type, char op, const std::string &value);
 	static parse_status sndbuf(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status rcvbuf(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status geoip_database(ParserImpl &parser, const xinetd::Attribute *attr);
@@ -130,6 +134,7 @@ class ParserImpl
 	static parse_status banner_fail(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status per_source(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status cpm(ParserImpl &parser, const xinetd::Attribute *attr);
+	static parse_status rate_limit(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status enabled(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status disable(ParserImpl &parser, const xinetd::Attribute *attr);
 	static parse_status max_load(ParserImpl &parser, const xinetd::Attribute *attr);
@@ -216,9 +221,6 @@ class ParserImpl
 		return false;
 	}
 
-#define WARNING_GEOIP_ALLOW	0x0001
-#define WARNING_GEOIP_DENY	0x0002
-
 	struct servconfig configent_;
 	Collection collection_;
 	Collection::const_iterator iterator_;
@@ -261,9 +263,11 @@ static const ParserImpl::KeyValue service_attributes[] = {
 	{ "redirect",		ParserImpl::redirect,		Optional|Upto(2) },
 	{ "only_from",		ParserImpl::only_from,		Default|Optional|Multiple|Modifier },
 	{ "no_access",		ParserImpl::no_access,		Default|Optional|Multiple|Modifier },
+	{ "shadow_only_from",	ParserImpl::shadow_only_from,	Default|Optional|Multiple|Modifier },
+	{ "shadow_no_access",	ParserImpl::shadow_no_access,	Default|Optional|Multiple|Modifier },
 	{ "sndbuf",		ParserImpl::sndbuf,		Default|Optional },
 	{ "rcvbuf",		ParserImpl::rcvbuf,		Default|Optional },
-	{ "geoip_database",	ParserImpl::geoip_database,	Default|Optional },
+	{ "geoip_database",	ParserImpl::geoip_database,	Default|Optional|Upto(2) },
 	{ "geoip_allow",	ParserImpl::geoip_allow,	Default|Optional|Multiple|Modifier },
 	{ "geoip_deny",		ParserImpl::geoip_deny,		Default|Optional|Multiple|Modifier },
 #if defined(HAVE_AF_UNIX)
@@ -278,6 +282,7 @@ static const ParserImpl::KeyValue service_attributes[] = {
 	{ "banner_success",	ParserImpl::banner_success,	Default|Optional },
 	{ "banner_fail",	ParserImpl::banner_fail,	Default|Optional },
 	{ "cpm",		ParserImpl::cpm,		Default|Optional|Upto(2) },
+	{ "rate_limit",		ParserImpl::rate_limit,		Default|Optional|Multiple },
 	{ "enabled",		ParserImpl::enabled,		Default|Optional|Multiple },
 	{ "disable",		ParserImpl::disable,		Default|Optional },
 	{ "max_load",		ParserImpl::max_load,		Default|Optional },
@@ -383,6 +388,16 @@ xinetd::Parser::defaults(const char *key, char &op, unsigned idx) const
 }
 
 
+const std::vector<std::string> *
+xinetd::Parser::sources() const
+{
+	if (impl_) {
+		return &impl_->sources();
+	}
+	return nullptr;
+}
+
+
 bool
 xinetd::Parser::good() const
 {
@@ -431,6 +446,13 @@ ParserImpl::defaults() const
 }
 
 
+const std::vector<std::string>&
+ParserImpl::sources() const
+{
+	return collection_.sources();
+}
+
+
 struct servconfig *
 ParserImpl::next(const struct configparams *params)
 {
@@ -910,9 +932,7 @@ ParserImpl::group(ParserImpl &parser, const xinetd::Attribute *attr)
 static int
 matchservent(const char *name1, const char *name2, const char *proto)
 {
-	char **alias;
 	const char *p;
-	struct servent *se;
 
 	if (strcmp(proto, "unix") == 0) {
 		if ((p = strrchr(name1, '/')) != NULL)
@@ -922,14 +942,7 @@ matchservent(const char *name1, const char *name2, const char *proto)
 	}
 	if (strcmp(name1, name2) == 0)
 		return(1);
-	if ((se = getservbyname(name1, proto)) != NULL) {
-		if (strcmp(name2, se->s_name) == 0)
-			return(1);
-		for (alias = se->s_aliases; *alias; alias++)
-			if (strcmp(name2, *alias) == 0)
-				return(1);
-	}
-	return(0);
+	return servdbmatch(name1, name2, proto);
 }
 
 
@@ -1032,7 +1045,7 @@ ParserImpl::id(ParserImpl &parser, const xinetd::Attribute *attr)
 
 	assert(1 == attr->values.size());
 	const char *arg = attr->values[0].c_str();
-	sep->se_server_name = arg;
+	sep->se_server_name = servconfig::newname(arg);
 	return Success;
 }
 
@@ -1242,16 +1255,15 @@ ParserImpl::port(ParserImpl &parser, const xinetd::Attribute *attr)
 #if defined(HAVE_AF_UNIX)
 		if (AF_UNIX != sep->se_family) {
 #endif
-			struct servent *sp;
-			sp = getservbyname(sep->se_service, sep->se_proto);
-			if (nullptr == sp) {
+			const int port = servdbport(sep->se_service, sep->se_proto);
+			if (-1 == port) {
 				if (UNLISTED_TYPE != sep->se_type) {
 					parser.serverr("unknown service");
 					return Failure;
 				}
 				sep->se_port = 0;
 			} else {
-				sep->se_port = sp->s_port;
+				sep->se_port = port;
 			}
 #if defined(HAVE_AF_UNIX)
 		}
@@ -1449,91 +1461,56 @@ ParserImpl::parse_status
 ParserImpl::only_from(ParserImpl &parser, const xinetd::Attribute *attr)
 {
 	// only_from = 192.168.1.107 ...
-	struct servconfig *sep = &parser.configent_;
-	if (nullptr == attr)
-		return Success;
+	return netaddress(parser, attr, parser.configent_.se_addresses, '+');
+}
 
-	if (attr->values.size() && (AF_INET == sep->se_family || AF_INET6 == sep->se_family)) {
-		if ('=' == attr->op) {
-			sep->se_addresses.clear('+');
-		}
 
-		if (strcmp(attr->values[0].c_str(), "FILE") == 0) {
-			if (!parse_file(parser, attr,
-					[&](auto &parser, char op, const std::string &value) -> bool {
-						return only_from(parser, op, value);
-					})) {
-				return Failure;
-			}
-		} else {
-			for (unsigned vi = 0; vi < attr->values.size(); ++vi) {
-				if (! only_from(parser, attr->op, attr->values[vi])) {
-					return Failure;
-				}
-			}
-		}
-	}
-	return Success;
+ParserImpl::parse_status
+ParserImpl::no_access(ParserImpl &parser, const xinetd::Attribute *attr)
+{
+	// no_access = 10.0.1.0/24 ...
+	return netaddress(parser, attr, parser.configent_.se_addresses, '-');
 }
 
 
-bool
-ParserImpl::only_from(ParserImpl &parser, char op, const std::string &value)
+ParserImpl::parse_status
+ParserImpl::shadow_only_from(ParserImpl &parser, const xinetd::Attribute *attr)
 {
-	// only_from = 192.168.1.107 ...
-	struct servconfig *sep = &parser.configent_;
-	auto &addresses = sep->se_addresses;
-	struct netaddr addr = {0};
-	char errmsg[512];
-
-	if (_stricmp(value.c_str(), "ALL") == 0) { // wild-card
-		if (! addresses.match_default(1)) {
-			parser.serverr("invalid only_from/no_access=ALL are mutually exclusive");
-			return false;
-		}
-		return true;
-	}
+	// shadow_only_from = 192.168.1.0/24 ...
+	return netaddress(parser, attr, parser.configent_.se_shadow_addresses, '+');
+}
 
-	if (! getnetaddrx(value.c_str(), &addr, sep->se_family, NETADDR_IMPLIEDMASK, errmsg, sizeof(errmsg))) {
-		parser.serverr("invalid only_from address <%s>", value, errmsg);
-		return false;
-	}
 
-	if ('-' != op) {
-		if (! addresses.push(addr, '+')) {
-			parser.serverr("non-unique only_from address <%s>", value.c_str());
-			return false;
-		}
-	} else {
-		addresses.erase(addr, '+');
-	}
-	return true;
+ParserImpl::parse_status
+ParserImpl::shadow_no_access(ParserImpl &parser, const xinetd::Attribute *attr)
+{
+	// shadow_no_access = 10.0.1.0/24 ...
+	return netaddress(parser, attr, parser.configent_.se_shadow_addresses, '-');
 }
 
 
 ParserImpl::parse_status
-ParserImpl::no_access(ParserImpl &parser, const xinetd::Attribute *attr)
+ParserImpl::netaddress(ParserImpl &parser, const xinetd::Attribute *attr, netaddrs &addresses, char type)
 {
-	// no_access = 10.0.1.0/24 ...
 	struct servconfig *sep = &parser.configent_;
 	if (nullptr == attr)
 		return Success;
 
 	if (attr->values.size() && (AF_INET == sep->se_family || AF_INET6 == sep->se_family)) {
 		if ('=' == attr->op) {
-			sep->se_addresses.clear('-');
+			addresses.clear(type);
 		}
 
 		if (strcmp(attr->values[0].c_str(), "FILE") == 0) {
 			if (!parse_file(parser, attr,
 					[&](auto &parser, char op, const std::string &value) -> bool {
-						return no_access(parser, op, value);
+						return netaddress(parser, attr, addresses, type, op, value);
 					})) {
 				return Failure;
 			}
 		} else {
 			for (unsigned vi = 0; vi < attr->values.size(); ++vi) {
-				if (! no_access(parser, attr->op, attr->values[vi])) {
+				if (! netaddress(parser, attr, addresses, type, attr->op, attr->values[vi])) {
 					return Failure;
 				}
 			}
@@ -1544,16 +1521,16 @@ ParserImpl::no_access(ParserImpl &parser, const xinetd::Attribute *attr)
 
 
 bool
-ParserImpl::no_access(ParserImpl &parser, char op, const std::string &value)
+ParserImpl::netaddress(ParserImpl &parser, const xinetd::Attribute *attr, netaddrs &addresses, char type, char op, const std::string &value)
 {
-	// no_access = 10.0.1.0/24 ...
+	// <only_from|no_access> = <address | address range | ALL> ...
 	struct servconfig *sep = &parser.configent_;
-	auto &addresses = sep->se_addresses;
+	const char *name = attr->key.c_str();
 	struct netaddr addr = {0};
 	char errmsg[512];
 
 	if (_stricmp(value.c_str(), "ALL") == 0) { // wild-card
-		if (! addresses.match_default(-1)) {
+		if (! addresses.match_default('+' == type ? 1 : -1)) {
 			parser.serverr("invalid only_from/no_access=ALL are mutually exclusive");
 			return false;
 		}
@@ -1561,17 +1538,17 @@ ParserImpl::no_access(ParserImpl &parser, char op, const std::string &value)
 	}
 
 	if (! getnetaddrx(value.c_str(), &addr, sep->se_family, NETADDR_IMPLIEDMASK, errmsg, sizeof(errmsg))) {
-		parser.serverr("invalid no_access address <%s>", value, errmsg);
+		parser.serverr("invalid %s address <%s>: %s", name, value.c_str(), errmsg);
 		return false;
 	}
 
 	if ('-' != op) {
-		if (! addresses.push(addr, '-')) {
-			parser.serverr("non-unique no_access address <%s>", value.c_str());
+		if (! addresses.push(addr, type)) {
+			parser.serverr("non-unique %s address <%s>", name, value.c_str());
 			return false;
 		}
 	} else {
-		addresses.erase(addr, '-');
+		addresses.erase(addr, type);
 	}
 	return true;
 }
@@ -1625,9 +1602,23 @@ ParserImpl::geoip_database(ParserImpl &parser, const xinetd::Attribute *attr)
 		return Success;
 	}
 
-	assert(1 == attr->values.size());
-	const char *arg = attr->values[0].c_str();
-	sep->se_geoips.database(arg);
+	// geoip_database = <path> [prefault|mlock]
+	const auto& values = attr->values;
+	unsigned options = 0;
+
+	assert(values.size() >= 1 && values.size() <= 2);
+	if (values.size() > 1) {
+		const char *option = values[1].c_str();
+		if (0 == _stricmp(option, "prefault")) {
+			options = geoips::GEOIP_PREFAULT;
+		} else if (0 == _stricmp(option, "mlock")) {
+			options = geoips::GEOIP_PREFAULT|geoips::GEOIP_MLOCK;
+		} else {
+			parser.serverr("invalid geoip_database option <%s>, expected prefault or mlock", option);
+			return Failure;
+		}
+	}
+	sep->se_geoips.database(values[0].c_str(), options);
 	return Success;
 }
 
@@ -1647,7 +1638,6 @@ ParserImpl::geoip_allow(ParserImpl &parser, const xinetd::Attribute *attr)
 		sep->se_geoips.clear('+');
 	}
 
-#if defined(HAVE_LIBMAXMINDDB)
 	if (_stricmp(values[0].c_str(), "ALL") == 0) { // wild-card
 		if (! sep->se_geoips.match_default(1)) {
 			parser.serverr("invalid geoip_allow/deny=ALL are mutually exclusive");
@@ -1658,17 +1648,10 @@ ParserImpl::geoip_allow(ParserImpl &parser, const xinetd::Attribute *attr)
 			return Failure;
 		}
 
-	} else if (! sep->se_geoips.push(values, '+')) {
+	} else if (! sep->se_geoips.push(values.strings(), '+')) {
 		parser.serverr("invalid geoip_allow value <%s>", attr->value.c_str());
 		return Failure;
 	}
-
-#else //HAVE_LIBMAXMINDDB
-	if (0 == (parser.warning_once_ & WARNING_GEOIP_ALLOW)) {
-		parser.servwarn("geoip support not available; geoip_allow option ignored");
-		parser.warning_once_ |= WARNING_GEOIP_ALLOW;
-	}
-#endif
 	return Success;
 }
 
@@ -1688,7 +1671,6 @@ ParserImpl::geoip_deny(ParserImpl &parser, const xinetd::Attribute *attr)
 		sep->se_geoips.clear('-');
 	}
 
-#if defined(HAVE_LIBMAXMINDDB)
 	if (_stricmp(values[0].c_str(), "ALL") == 0) { // wild-card
 		if (! sep->se_geoips.match_default(-1)) {
 			parser.serverr("invalid geoip_allow/deny=ALL are mutually exclusive");
@@ -1699,17 +1681,10 @@ ParserImpl::geoip_deny(ParserImpl &parser, const xinetd::Attribute *attr)
 			return Failure;
 		}
 
-	} else if (! sep->se_geoips.push(values, '-')) {
+	} else if (! sep->se_geoips.push(values.strings(), '-')) {
 		parser.serverr("invalid geoip_deny value <%s>", attr->value.c_str());
 		return Failure;
 	}
-
-#else //HAVE_LIBMAXMINDDB
-	if (0 == (parser.warning_once_ & WARNING_GEOIP_DENY)) {
-		parser.servwarn("geoip support not available; geoip_deny option ignored");
-		parser.warning_once_ |= WARNING_GEOIP_DENY;
-	}
-#endif
 	return Success;
 }
 
@@ -1959,6 +1934,32 @@ ParserImpl::cpm(ParserImpl &parser, const xinetd::Attribute *attr)
 }
 
 
+ParserImpl::parse_status
+ParserImpl::rate_limit(ParserImpl &parser, const xinetd::Attribute *attr)
+{
+	// rate_limit = <source|subnet|subnet48|service> <rate>[/<seconds>] [<burst>]
+	struct servconfig *sep = &parser.configent_;
+	if (nullptr == attr)
+		return Success;
+
+	const size_t count = attr->values.size();
+	if (count < 2 || count > 3) {
+		parser.serverr("rate_limit, expected <scope> <rate>[/<seconds>] [<burst>]");
+		return Failure;
+	}
+
+	ratelimits::rule rule;
+	if (! ratelimits::to_rule(attr->values[0].c_str(), attr->values[1].c_str(),
+			(3 == count ? attr->values[2].c_str() : nullptr), rule)) {
+		parser.serverr("invalid rate_limit <%s %s%s%s>", attr->values[0].c_str(), attr->values[1].c_str(),
+			(3 == count ? " " : ""), (3 == count ? attr->values[2].c_str() : ""));
+		return Failure;
+	}
+	sep->se_ratelimits.push(rule);
+	return Success;
+}
+
+
 ParserImpl::parse_status
 ParserImpl::enabled(ParserImpl &parser, const xinetd::Attribute *attr)
 {
@@ -1971,7 +1972,7 @@ ParserImpl::enabled(ParserImpl &parser, const xinetd::Attribute *attr)
 	for (unsigned vi = 0; vi < attr->values.size(); ++vi) {
 		const auto &arg = attr->values[vi];
 		if (processing_defaults) {
-			if (! Collection::valid_symbol(arg)) {
+			if (! Collection::valid_symbol(arg.c_str())) {
 				parser.bad_attribute("invalid service name <%s>", arg.c_str());
 			}
 		} else {
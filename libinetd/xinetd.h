@@ -27,9 +27,16 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iterator>
 #include <memory>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 #include <iostream>
 #include <fstream>
@@ -56,18 +63,208 @@ struct configparams;
 
 namespace xinetd {
 
-class Attribute {
+/*
+ *  Arena, per-load storage backing the parsed attributes; released as a whole.
+ */
+class Arena {
+    public:
+	enum { BLOCKSIZE = 64 * 1024 };
+
     public:
-	template <typename Split>
-	Attribute(const std::string &key, char op, const std::string &val, Split split)
-		: key(key), value(val), values(split(val)), op(op)
+	Arena() : cursor_(nullptr), available_(0), used_(0), blocksize_(BLOCKSIZE / 32)
+	{
+	}
+
+	void *allocate(size_t size, size_t align = sizeof(void *))
+	{
+		size_t pad = (align - ((uintptr_t)cursor_ & (align - 1))) & (align - 1);
+		if ((size + pad) > available_) {
+			if (size > (BLOCKSIZE / 4)) { // large, dedicated block.
+				blocks_.emplace_back(new char[size]);
+				used_ += size;
+				return blocks_.back().get();
+			}
+			const size_t blocksize = std::max(blocksize_, size);
+			blocks_.emplace_back(new char[blocksize]);
+			cursor_ = blocks_.back().get();
+			available_ = blocksize;
+			pad = 0;
+			if (blocksize_ < BLOCKSIZE) // grow; small sources remain small.
+				blocksize_ *= 2;
+		}
+		void *ret = cursor_ + pad;
+		cursor_ += size + pad;
+		available_ -= size + pad;
+		used_ += size + pad;
+		return ret;
+	}
+
+	template <typename T>
+	T *allocate(size_t count)
+	{
+		return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	char *strndup(const char *str, size_t len)
+	{
+		char *ret = static_cast<char *>(allocate(len + 1, 1));
+		(void) memcpy(ret, str, len);
+		ret[len] = 0;
+		return ret;
+	}
+
+	char *adopt(std::unique_ptr<char[]> &block, size_t size)
+	{
+		blocks_.push_back(std::move(block));
+		used_ += size;
+		return blocks_.back().get();
+	}
+
+	size_t used() const
 	{
+		return used_;
 	}
 
-	const std::string key;
-	const std::vector<std::string> values;
-	const std::string value;
+    private:
+	Arena(const Arena &) = delete;
+	Arena& operator=(const Arena &) = delete;
+
+    private:
+	std::vector<std::unique_ptr<char[]>> blocks_;
+	char *cursor_;
+	size_t available_;
+	size_t used_;
+	size_t blocksize_;
+};
+
+
+/*
+ *  Token, non-owning NUL terminated string referencing arena storage.
+ */
+class Token {
+    public:
+	Token() : data_(""), length_(0)
+	{
+	}
+
+	Token(const char *data, size_t length) : data_(data), length_((unsigned)length)
+	{
+		assert(0 == data[length]);
+	}
+
+	const char *c_str() const
+	{
+		return data_;
+	}
+
+	const char *data() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return length_;
+	}
+
+	size_t length() const
+	{
+		return length_;
+	}
+
+	bool empty() const
+	{
+		return (0 == length_);
+	}
+
+	char operator[](size_t idx) const
+	{
+		return data_[idx];
+	}
+
+	operator std::string() const
+	{
+		return std::string(data_, length_);
+	}
+
+	bool operator==(const char *str) const
+	{
+		return (0 == strcmp(data_, str));
+	}
+
+	bool operator!=(const char *str) const
+	{
+		return (0 != strcmp(data_, str));
+	}
+
+    private:
+	const char *data_;
+	unsigned length_;
+};
+
+
+class Tokens {
+    public:
+	using const_iterator = const Token *;
+
+    public:
+	Tokens() : data_(nullptr), size_(0)
+	{
+	}
+
+	Tokens(const Token *data, size_t size) : data_(data), size_((unsigned)size)
+	{
+	}
+
+	const Token &operator[](size_t idx) const
+	{
+		assert(idx < size_);
+		return data_[idx];
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	bool empty() const
+	{
+		return (0 == size_);
+	}
+
+	const_iterator begin() const
+	{
+		return data_;
+	}
+
+	const_iterator end() const
+	{
+		return data_ + size_;
+	}
+
+	std::vector<std::string> strings() const
+	{
+		return std::vector<std::string>(begin(), end());
+	}
+
+    private:
+	const Token *data_;
+	unsigned size_;
+};
+
+
+class Attribute { // arena allocated; trivially destructible.
+    public:
+	Attribute(const Token &key, char op, const Token &val, const Tokens &values, unsigned line)
+		: key(key), values(values), value(val), op(op), line(line)
+	{
+	}
+
+	const Token key;
+	const Tokens values;
+	const Token value;
 	const char op; // '=', '+' or '-'.
+	const unsigned line; // source line.
 };
 
 
@@ -79,14 +276,9 @@ class Attributes {
 	using const_iterator = Container::const_iterator;
 
     public:
-	Attributes(const std::string &name) : name_(name)
-	{
-	}
-
-	~Attributes()
+	Attributes(const std::string &name, const std::shared_ptr<Arena> &arena)
+		: name_(name), arena_(arena)
 	{
-		for (auto attribute : values_)
-			delete attribute;
 	}
 
 	const std::string &name() const
@@ -152,6 +344,7 @@ class Attributes {
     private:
 	friend class Collection;
 	const std::string name_;
+	std::shared_ptr<Arena> arena_; // attribute storage.
 	Container values_;
 };
 
@@ -209,7 +402,7 @@ class Split {
 	enum { SPLIT_ESCAPES = 1, SPLIT_EXPAND = 2 };
 
     public:
-	Split(class Attributes *defaults = nullptr) : defaults_(defaults)
+	Split(const class Attributes *defaults = nullptr) : defaults_(defaults)
 	{
 	}
 
@@ -217,14 +410,7 @@ class Split {
 	std::vector<std::string>
 	operator()(const std::string &value, unsigned options = SPLIT_ESCAPES|SPLIT_EXPAND)
 	{
-		std::vector<std::string> values;
-		if (! value.empty()) {
-			if (char *t_value = ::_strdup(value.c_str())) {
-				emplace_split(values, t_value, options);
-				::free(t_value);
-			}
-		}
-		return values;
+		return operator()(value.c_str(), options);
 	}
 
 	std::vector<std::string>
@@ -232,16 +418,19 @@ class Split {
 	{
 		std::vector<std::string> values;
 		if (value && *value) {
-			if (char *t_value = ::_strdup(value)) {
-				emplace_split(values, t_value, options);
-				::free(t_value);
+			std::unique_ptr<char, decltype(&::free)> t_value(::_strdup(value), &::free);
+			if (t_value) {
+				std::vector<Token> tokens;
+				emplace_split(tokens, t_value.get(), options);
+				values.assign(tokens.begin(), tokens.end());
 			}
 		}
 		return values;
 	}
 
+	// split 'cmd' in-place; the resulting tokens reference either 'cmd' or the defaults.
 	void
-	emplace_split(std::vector<std::string> &values, char *cmd, unsigned options)
+	emplace_split(std::vector<Token> &values, char *cmd, unsigned options)
 	{
 		const bool escapes = (SPLIT_ESCAPES & options) ? true : false;
 		char *start, *end;
@@ -293,24 +482,33 @@ class Split {
 			}
 
 			// result
+			const bool last = (0 == *cmd);
+			*end = 0;		/* terminate; may overwrite *cmd */
+
 			if (defaults_ && (SPLIT_EXPAND & options)) {
 				expand(start, end, 0, values);
 			} else {
-				values.push_back(std::string(start, end - start));
+				values.emplace_back(start, end - start);
 			}
 
-			if (!*cmd) break;
-			*end = 0;
+			if (last) break;
 			++cmd;
 		}
 	}
 
+	// expand the variable reference 'value' against the defaults.
+	void
+	expand(const Token &value, std::vector<Token> &results)
+	{
+		expand(value.data(), value.data() + value.length(), 0, results);
+	}
+
     private:
 	void
-	expand(const char *value, const char *end, unsigned level, std::vector<std::string> &results)
+	expand(const char *value, const char *end, unsigned level, std::vector<Token> &results)
 	{
 		if ('$' != value[0] || '(' != value[1]) {
-			results.emplace_back(value, end);
+			results.emplace_back(value, end - value);
 			return;
 		}
 
@@ -358,6 +556,7 @@ class Collection {
     public:
 	using Container = std::vector<std::shared_ptr<Attributes>>;
 	using const_iterator = Container::const_iterator;
+	enum { MAXWORKERS = 16 };
 
     public:
 	Collection() : line_number_(0)
@@ -379,6 +578,12 @@ class Collection {
 		return attributes_;
 	}
 
+	// sources consulted, in order; directories have a trailing '/'.
+	const std::vector<std::string> &sources() const
+	{
+		return sources_;
+	}
+
 	const_iterator begin() const
 	{
 		return attributes_.begin();
@@ -453,16 +658,190 @@ class Collection {
 				}) == name.end();
 	}
 
+	static bool valid_symbol(const char *name)
+	{
+		for (char c; 0 != (c = *name); ++name)
+			if (!(std::isalnum(c) || c == '_'))
+				return false;
+		return true;
+	}
+
+	size_t arena_used() const
+	{
+		size_t used = 0;
+		for (const auto &arena : arenas_)
+			used += arena->used();
+		return used;
+	}
+
     private:
+	struct Section {
+		Section(const std::shared_ptr<Attributes> &attributes, const std::string &source, unsigned line, bool unique)
+			: attributes(attributes), source(source), line(line), unique(unique)
+		{
+		}
+		std::shared_ptr<Attributes> attributes; // null until opened.
+		std::string source;		// header origin.
+		unsigned line;
+		bool unique;			// "defaults" header; duplicates rejected.
+	};
+
+	// Parse result of a single source (plus any of its includes), independent of all
+	// others; fragments are merged in source order, applying defaults at that time.
+	struct Fragment {
+		Fragment(const std::string &source, bool parallel)
+			: arena(std::make_shared<Arena>()), source(source), line(0), parallel(parallel)
+		{
+		}
+		std::shared_ptr<Arena> arena;
+		std::vector<std::shared_ptr<Arena>> arenas; // includedir storage.
+		std::vector<Section> sections;
+		std::vector<std::string> sources; // consulted files and directories.
+		std::string source;		// current source and line; error position.
+		unsigned line;
+		bool parallel;			// includedir fragments parsed concurrently.
+		std::exception_ptr error;
+	};
+
 	void reset_state(const char *source)
 	{
 		source_ = (source ? source : "xconf");
 		line_number_ = 0;
 		defaults_.reset();
 		attributes_.clear();
+		arenas_.clear();
+		sources_.clear();
 		clear_status();
 	}
 
+	void parse(std::istream &input)
+	{
+		Fragment fragment(source_, true);
+
+		parse_fragment(fragment, input);
+		merge(fragment);
+	}
+
+	static void parse_fragment(Fragment &fragment)
+	{
+		std::ifstream input(fragment.source);
+		parse_fragment(fragment, input);
+	}
+
+	static void parse_fragment(Fragment &fragment, std::istream &input)
+	{
+		fragment.sources.push_back(fragment.source);
+		try {
+			parse(fragment, input);
+		} catch (...) {
+			fragment.error = std::current_exception();
+		}
+	}
+
+	// Apply fragment sections in order, raising the first error as a serial parse would.
+	void merge(Fragment &fragment)
+	{
+		std::vector<Token> values;
+
+		arenas_.push_back(fragment.arena);
+		arenas_.insert(arenas_.end(), fragment.arenas.begin(), fragment.arenas.end());
+		sources_.insert(sources_.end(), fragment.sources.begin(), fragment.sources.end());
+
+		for (const auto &section : fragment.sections) {
+			source_ = section.source;
+			line_number_ = section.line;
+
+			if (section.unique && defaults_)
+				throw Exception::Section("duplicate defaults section");
+			if (! section.attributes)
+				continue; // incomplete.
+
+			if (section.attributes->name() == "defaults") {
+				defaults_ = section.attributes;
+				continue;
+			}
+
+			if (defaults_) {
+				expand(*section.attributes, values);
+			}
+			attributes_.push_back(section.attributes);
+		}
+
+		if (fragment.error) {
+			source_ = fragment.source;
+			line_number_ = fragment.line;
+			std::rethrow_exception(fragment.error);
+		}
+	}
+
+	// Expand $(var) references against the current defaults.
+	void expand(Attributes &attributes, std::vector<Token> &values)
+	{
+		Arena &arena = *attributes.arena_;
+		Split split(defaults_.get());
+
+		for (auto &attribute : attributes.values_) {
+			const Tokens &t_values = attribute->values;
+			if (std::none_of(t_values.begin(), t_values.end(), [](const Token &value) {
+					return ('$' == value[0] && '(' == value[1]);
+				})) {
+				continue;
+			}
+
+			line_number_ = attribute->line;
+			values.clear();
+			for (const auto &value : t_values) {
+				split.expand(value, values);
+			}
+
+			Token *n_values = arena.allocate<Token>(values.size());
+			std::uninitialized_copy(values.begin(), values.end(), n_values);
+			attribute = new(arena.allocate<Attribute>(1)) Attribute(attribute->key, attribute->op,
+					attribute->value, Tokens(n_values, values.size()), attribute->line);
+		}
+	}
+
+	static void parse(Fragment &fragment, std::istream &input)
+	{
+		if (! input) {
+			throw Exception::File("unable to open source");
+		}
+
+		size_t length = 0;
+		char *buffer = slurp(*fragment.arena, input, length);
+		parse(fragment, buffer, buffer + length);
+	}
+
+	// read the remaining stream content into arena storage, NUL terminated.
+	static char *slurp(Arena &arena, std::istream &input, size_t &length)
+	{
+		std::streambuf *sb = input.rdbuf();
+		const std::streampos pos = sb->pubseekoff(0, std::ios::cur, std::ios::in);
+		const std::streampos end = sb->pubseekoff(0, std::ios::end, std::ios::in);
+		size_t size = 4096, count = 0;
+
+		if (pos != std::streampos(-1) && end != std::streampos(-1)) {
+			if (end > pos) // content, terminator plus eof probe.
+				size = static_cast<size_t>(end - pos) + 2;
+			sb->pubseekpos(pos, std::ios::in);
+		}
+
+		std::unique_ptr<char[]> buffer(new char[size]);
+		for (std::streamsize cnt;
+				(cnt = sb->sgetn(buffer.get() + count, size - count - 1)) > 0;) {
+			count += static_cast<size_t>(cnt);
+			if ((count + 1) == size) { // full, expand.
+				std::unique_ptr<char[]> t_buffer(new char[size * 2]);
+				(void) memcpy(t_buffer.get(), buffer.get(), count);
+				buffer.swap(t_buffer);
+				size *= 2;
+			}
+		}
+		buffer[count] = 0;
+		length = count;
+		return arena.adopt(buffer, size);
+	}
+
 	//
 	//  defaults
 	//  {
@@ -476,24 +855,32 @@ class Collection {
 	//	...
 	//  }
 	//
-	void parse(std::istream &input)
+	//  Lines are tokenised in-place within the arena resident source image;
+	//  only the split values are copied. Variable expansion is deferred until merge.
+	//
+	static void parse(Fragment &fragment, char *cursor, char *const buffer_end)
 	{
+		Arena &arena = *fragment.arena;
 		std::shared_ptr<Attributes> attributes;
-		std::string line, service_name;
-		Attributes *defaults = nullptr;
+		std::vector<Token> values;
+		Token service_name;
 
-		if (! input) {
-			throw Exception::File("unable to open source");
-		}
+		while (cursor < buffer_end) {
+			char *line = cursor, *end;
 
-		while (std::getline(input, line)) {
+			if (nullptr != (end = (char *)memchr(cursor, '\n', buffer_end - cursor))) {
+				*end = 0;
+				cursor = end + 1;
+			} else {
+				end = cursor = buffer_end;
+			}
 
-			++line_number_;
+			++fragment.line;
 
 			// any line whose first non-white-space character is a '#' is considered a comment line.
 			// empty lines are ignored.
-			ltrim(line);
-			if (line.empty() || line[0] == '#') {
+			line = ltrim(line);
+			if (0 == *line || line[0] == '#') {
 				continue;
 			}
 
@@ -501,27 +888,28 @@ class Collection {
 			if (! attributes) {
 				if (service_name.empty()) {
 						if (is_keyword(line, "includedir", 10)) {
-							parse_directory(ltrim(line.erase(0, 11)).c_str());
+							parse_directory(fragment, ltrim(line + 10));
 							continue;
 
 						} else if (is_keyword(line, "include", 7)) {
-							parse_include(ltrim(line.erase(0, 8)).c_str());
+							parse_include(fragment, ltrim(line + 7));
 							continue;
 						}
 
-						service_name = rtrim(line);
+						end = rtrim(line, end);
+						service_name = Token(line, end - line);
 						if (service_name == "defaults") {
-							if (! defaults_)
-								continue;
-							throw Exception::Section("duplicate defaults section");
+							fragment.sections.emplace_back(nullptr, fragment.source, fragment.line, true);
+							continue; // duplicates, see merge()
 
-						} else if (is_keyword(service_name, "service", 7)) {
-							service_name.erase(0, 8);
-							ltrim(service_name);
+						} else if (is_keyword(line, "service", 7)) {
+							line = ltrim(line + 7);
+							service_name = Token(line, end - line);
 							if (service_name.empty())
 								throw Exception::Section("missing service name");
-							if (! valid_symbol(service_name))
+							if (! valid_symbol(line))
 								throw Exception::Section("invalid service name");
+							fragment.sections.emplace_back(nullptr, fragment.source, fragment.line, false);
 							continue;
 						}
 
@@ -529,61 +917,61 @@ class Collection {
 							throw Exception::Section("missing section name");
 						throw Exception::Section("unknown section");
 
-				} else if ("{" == rtrim(line)) {
-						attributes = std::make_shared<Attributes>(service_name);
-						if (service_name == "defaults") {
-							defaults_ = attributes;
-							defaults = nullptr;
-						} else {
-							attributes_.push_back(attributes);
-							defaults = defaults_.get();
-						}
+				} else if (is_bracket(line, end, '{')) {
+						attributes = std::make_shared<Attributes>(service_name, fragment.arena);
+						fragment.sections.back().attributes = attributes;
 						continue;
 				}
 				throw Exception::Section("missing opening bracket");
 
 			} else if (line[0] == '}') {
-				if ("}" == rtrim(line)) {
+				if (is_bracket(line, end, '}')) {
 					attributes.reset();
-					service_name.clear();
+					service_name = Token();
 					continue;
 				}
 				throw Exception::Section("invalid closing");
 			}
 
 			// key = value
-			size_t eqs = line.find_first_of("="), eqe = eqs;
+			const char *eq = strchr(line, '=');
+			const size_t length = end - line;
 			char op = '=';
 
-			if (std::string::npos == eqs) {
-				if (line == "defaults" || is_keyword(line, "service", 7))
+			if (nullptr == eq) {
+				if (0 == strcmp(line, "defaults") || is_keyword(line, "service", 7))
 					throw Exception::Section("missing trailing bracket");
 				throw Exception::Attribute("missing operator");
 			}
 
+			size_t eqs = eq - line, eqe = eqs;
 			if (eqs && (line[eqs-1] == '+' || line[eqs-1] == '-'))
 				op = line[--eqs]; // += or -=
 
-			if ((eqs && !is_white(line[eqs-1])) || (++eqe < line.size() && !is_white(line[eqe++])))
+			if ((eqs && !is_white(line[eqs-1])) || (++eqe < length && !is_white(line[eqe++])))
 				throw Exception::Attribute("invalid operator");
 
-			std::string key(line, 0, eqs);
-			std::string val(line, eqe, line.size() - eqe);
-
-			rtrim(key);
-			if (key.empty())
+			char *key = line, *key_end = rtrim(key, line + eqs);
+			if (key == key_end)
 				throw Exception::Attribute("missing attribute key");
 			if (!valid_symbol(key))
 				throw Exception::Attribute("invalid attribute key");
 
-			trim(val);
-			if (val.empty())
+			char *val = ltrim(line + std::min(eqe, length)), *val_end = rtrim(val, end);
+			if (val == val_end)
 				throw Exception::Attribute("empty attribute value");
 
 			if ('=' == op && attributes->find(key) != attributes->end())
 				throw Exception::Attribute("mixed assignment operators");
 
-			Attribute *attribute = new Attribute(key, op, val, Split(defaults));
+			values.clear();
+			Split().emplace_split(values, arena.strndup(val, val_end - val), Split::SPLIT_ESCAPES);
+
+			Token *t_values = arena.allocate<Token>(values.size());
+			std::uninitialized_copy(values.begin(), values.end(), t_values);
+
+			Attribute *attribute = new(arena.allocate<Attribute>(1)) Attribute(Token(key, key_end - key),
+				op, Token(val, val_end - val), Tokens(t_values, values.size()), fragment.line);
 			attributes->push_back(attribute);
 		}
 
@@ -607,7 +995,7 @@ class Collection {
 		DIR *d;
 	};
 
-	void parse_directory(const char *path)
+	static void parse_directory(Fragment &fragment, const char *path)
 	{
 		if (!path || !*path) {
 			throw Exception::Directory("missing directory");
@@ -620,38 +1008,120 @@ class Collection {
 			throw Exception::Directory("unable to open directory");
 		}
 
+		std::vector<Fragment> fragments;
 		struct dirent *entry;
+
+		fragment.sources.push_back(std::string(path) + '/');
 		while (nullptr != (entry = dir.read())) {
 			const char *name = entry->d_name;
 			if (name[0] == '.' || name[entry->d_namlen-1] == '~') {
 				continue;
 			}
 			snprintf(t_path, sizeof(t_path), "%s/%s", path, name);
-			parse_include(t_path);
+			fragments.emplace_back(t_path, false);
+		}
+
+		parse_fragments(fragments, fragment.parallel);
+
+		for (auto &child : fragments) { // directory order.
+			fragment.arenas.push_back(child.arena);
+			fragment.arenas.insert(fragment.arenas.end(), child.arenas.begin(), child.arenas.end());
+			fragment.sources.insert(fragment.sources.end(), child.sources.begin(), child.sources.end());
+			fragment.sections.insert(fragment.sections.end(),
+				std::make_move_iterator(child.sections.begin()), std::make_move_iterator(child.sections.end()));
+			if (child.error) {
+				fragment.source = child.source;
+				fragment.line = child.line;
+				std::rethrow_exception(child.error);
+			}
 		}
 	}
 
-	void parse_include(const char *path)
+	// Parse the fragments on a transient worker pool; work beyond the first failure is skipped.
+	static void parse_fragments(std::vector<Fragment> &fragments, bool parallel)
+	{
+		const size_t count = fragments.size();
+		unsigned threads = (parallel ? std::thread::hardware_concurrency() : 1);
+
+		if (0 == threads) threads = 1;
+		if (threads > MAXWORKERS) threads = MAXWORKERS;
+		if (threads > count) threads = (unsigned)count;
+
+		std::atomic<size_t> next(0), failed(count);
+		auto worker = [&]() {
+			for (size_t idx; (idx = next++) < count && idx < failed.load();) {
+				Fragment &fragment = fragments[idx];
+				parse_fragment(fragment);
+				if (fragment.error) {
+					size_t t_failed = failed.load();
+					while (idx < t_failed && !failed.compare_exchange_weak(t_failed, idx))
+						;
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		if (threads > 1) {
+			workers.reserve(threads - 1);
+			try {
+				while (workers.size() < (threads - 1))
+					workers.emplace_back(worker);
+			} catch (const std::system_error &) { // resources; continue with those available.
+			}
+		}
+		worker();
+		for (auto &thread : workers)
+			thread.join();
+	}
+
+	static void parse_include(Fragment &fragment, const char *path)
 	{
 		if (!path || !*path) {
 			throw Exception::File("missing include");
 		}
 
-		const std::string t_source = source_;
-		const unsigned t_line_number = line_number_;
+		const std::string t_source = fragment.source;
+		const unsigned t_line_number = fragment.line;
 		std::ifstream input(path);
 
-		source_ = path;
-		line_number_ = 0;
-		parse(input);
-		source_ = t_source;
-		line_number_ = t_line_number;
+		fragment.source = path;
+		fragment.line = 0;
+		fragment.sources.push_back(fragment.source);
+		parse(fragment, input);
+		fragment.source = t_source;
+		fragment.line = t_line_number;
 	}
 
 	static bool
-	is_keyword(const std::string &line, const char *word, unsigned sz)
+	is_keyword(const char *line, const char *word, unsigned sz)
+	{
+		return (0 == strncmp(line, word, sz) && (0 == line[sz] || is_white(line[sz])));
+	}
+
+	// line consists solely of the bracket, ignoring trailing white-space.
+	static bool
+	is_bracket(char *line, char *end, char bracket)
+	{
+		return (line[0] == bracket && rtrim(line, end) == line + 1);
+	}
+
+	// left trim, in-place
+	static char *
+	ltrim(char *s)
+	{
+		while (is_white(*s))
+			++s;
+		return s;
+	}
+
+	// right trim, in-place; returns the new end.
+	static char *
+	rtrim(char *s, char *end)
 	{
-		return (0 == line.compare(0, sz, word) && (sz == line.size() || is_white(line[sz])));
+		while (end > s && is_white(end[-1]))
+			--end;
+		*end = 0;
+		return end;
 	}
 
 	// is_white
@@ -686,8 +1156,10 @@ class Collection {
 	}
 
     private:
+	std::vector<std::shared_ptr<Arena>> arenas_;
 	std::shared_ptr<Attributes> defaults_;
 	Container attributes_;
+	std::vector<std::string> sources_;
 	std::string source_;
 	std::string status_;
 	unsigned line_number_;
@@ -703,6 +1175,7 @@ class  Parser {
 
 	struct servconfig *next(const struct configparams *param);
 	const char *defaults(const char *key, char &op, unsigned idx) const;
+	const std::vector<std::string> *sources() const;
 	const char *status(int &error_code) const;
 	bool good() const;
 
@@ -19,6 +19,7 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 
+#include <string.h>
 #include <assert.h>
 
 #include "isc_radix.h"
@@ -67,8 +68,10 @@ isc_mem_attach(isc_mem_t *mctx, isc_mem_t **child)
 static void
 isc_mem_putanddetach(isc_mem_t **mctx, void *ptr, size_t size)
 {
-	isc_mem_put(*mctx, ptr, size);
-	*mctx = NULL;
+	isc_mem_t *ctx = *mctx;
+
+	*mctx = NULL;				/* note: 'mctx' may reside within 'ptr' */
+	isc_mem_put(ctx, ptr, size);
 }
 
 
@@ -455,6 +458,167 @@ isc_radix_search_best(isc_radix_tree_t *radix, isc_radix_node_t **target, const
 }
 
 
+/*
+ *  Batch best-match search.
+ *
+ *  Up to RADIX_BATCH_LANES searches are advanced in lockstep, one node per lane per pass;
+ *  the next node of each lane is prefetched so that by the time the lane is revisited the
+ *  cache miss has been serviced, overlapping the miss latency of independent searches.
+ *  A lane is refilled from the input as soon as it completes.
+ *
+ *  Prefix verification compares the address as two big-endian 64-bit words, rather than
+ *  by byte, as all candidates of a lane are tested against the same address.
+ */
+
+#define RADIX_BATCH_LANES	8
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RADIX_PREFETCH(p)	__builtin_prefetch((const void *)(p), 0, 3)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define RADIX_PREFETCH(p)	_mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define RADIX_PREFETCH(p)	(void)(p)
+#endif
+
+struct radix_lane {
+	isc_radix_node_t *node;			/* current node */
+	const isc_prefix_t *prefix;
+	unsigned idx;				/* result index */
+	int cnt;
+	isc_radix_node_t *stack[RADIX_MAXBITS + 1];
+	uint64_t key[2];			/* address, big-endian words */
+};
+
+static uint64_t
+_load_be64(const u_char *p)
+{
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+		((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+		((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+		((uint64_t)p[6] << 8)  |  (uint64_t)p[7];
+}
+
+static int
+_comp_with_mask64(const uint64_t key[2], const isc_prefix_t *prefix)
+{
+	const u_char *addr = (const u_char *)&prefix->add.sin6;
+	const u_int mask = prefix->bitlen;
+	uint64_t diff;
+
+	if (mask == 0) {
+		return (1);
+	}
+	diff = key[0] ^ _load_be64(addr);
+	if (mask < 64) {
+		return ((diff >> (64 - mask)) == 0);
+	}
+	if (diff) {
+		return (0);
+	}
+	if (mask == 64) {
+		return (1);
+	}
+	diff = key[1] ^ _load_be64(addr + 8);
+	return ((diff >> (128 - mask)) == 0);
+}
+
+static void
+_lane_start(isc_radix_tree_t *radix, struct radix_lane *lane, const isc_prefix_t *prefix, unsigned idx)
+{
+	const u_char *addr = (const u_char *)&prefix->add.sin6;
+
+	assert(prefix->bitlen <= radix->maxbits);
+	lane->node = radix->head;
+	lane->prefix = prefix;
+	lane->idx = idx;
+	lane->cnt = 0;
+	lane->key[0] = _load_be64(addr);
+	lane->key[1] = (prefix->family == AF_INET6 ? _load_be64(addr + 8) : 0);
+}
+
+static isc_radix_node_t *
+_lane_resolve(struct radix_lane *lane)
+{
+	const isc_prefix_t *prefix = lane->prefix;
+	const int fam = ISC_RADIX_FAMILY(prefix);
+
+	while (lane->cnt-- > 0) {
+		isc_radix_node_t *node = lane->stack[lane->cnt];
+
+		if (prefix->bitlen < node->bit) {
+			continue;
+		}
+		if (_comp_with_mask64(lane->key, node->prefix) && node->node_num[fam] != -1) {
+			return (node);
+		}
+	}
+	return (NULL);
+}
+
+unsigned
+isc_radix_search_batch(isc_radix_tree_t *radix, isc_radix_node_t **targets, const isc_prefix_t *prefixes, unsigned count)
+{
+	struct radix_lane lanes[RADIX_BATCH_LANES];
+	unsigned next = 0, matched = 0, active = 0, l;
+
+	assert(radix != NULL);
+	assert(RADIX_TREE_VALID(radix->magic));
+	assert(targets != NULL && (prefixes != NULL || count == 0));
+
+	if (radix->head == NULL) {
+		memset(targets, 0, sizeof(*targets) * count);
+		return (0);
+	}
+
+	while (active < RADIX_BATCH_LANES && next < count) {
+		_lane_start(radix, lanes + active++, prefixes + next, next);
+		++next;
+	}
+
+	while (active) {
+		for (l = 0; l < active;) {
+			struct radix_lane *lane = lanes + l;
+			isc_radix_node_t *node = lane->node;
+
+			if (node->bit < lane->prefix->bitlen) {
+				const u_char *addr = isc_prefix_touchar(lane->prefix);
+
+				if (node->prefix) {
+					lane->stack[lane->cnt++] = node;
+					RADIX_PREFETCH(node->prefix);
+				}
+				if (BIT_TEST(addr[node->bit >> 3], 0x80 >> (node->bit & 0x07))) {
+					node = node->r;
+				} else {
+					node = node->l;
+				}
+				if (node != NULL) {
+					RADIX_PREFETCH(node);
+					lane->node = node;
+					++l;		/* revisit next pass */
+					continue;
+				}
+			} else if (node->prefix) {
+				lane->stack[lane->cnt++] = node;
+			}
+
+			if ((targets[lane->idx] = _lane_resolve(lane)) != NULL) {
+				++matched;
+			}
+
+			if (next < count) {	/* refill */
+				_lane_start(radix, lane, prefixes + next, next);
+				++next;
+				++l;
+			} else if (l != --active) {
+				*lane = lanes[active];	/* compact; revisit */
+			}
+		}
+	}
+	return (matched);
+}
+
 isc_result_t
 isc_radix_insert(isc_radix_tree_t *radix, isc_radix_node_t **target,
 		 isc_radix_node_t *source, isc_prefix_t *prefix)
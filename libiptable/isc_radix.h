@@ -157,6 +157,22 @@ isc_radix_search_best(isc_radix_tree_t *radix, isc_radix_node_t **target, const
  * \li	ISC_R_SUCCESS
  */
 
+unsigned
+isc_radix_search_batch(isc_radix_tree_t *radix, isc_radix_node_t **targets, const isc_prefix_t *prefixes, unsigned count);
+/*%<
+ * Search 'radix' for the best match of each of the 'count' 'prefixes', as per
+ * isc_radix_search_best(), interleaving the searches to overlap memory latency.
+ * Return the node found for 'prefixes[i]' in 'targets[i]', otherwise NULL.
+ *
+ * Requires:
+ * \li	'radix' to be valid.
+ * \li	'targets' to reference 'count' elements.
+ * \li	'prefixes' to be valid.
+ *
+ * Returns:
+ * \li	the number of prefixes matched.
+ */
+
 isc_result_t
 isc_radix_insert(isc_radix_tree_t *radix, isc_radix_node_t **target, isc_radix_node_t *source, isc_prefix_t *prefix);
 /*%<
@@ -0,0 +1,710 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * libiptable - concurrent radix tree.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#include "rcu_radix.h"
+
+#define BIT_TEST(f, b)	(((f) & (b)) != 0)
+#define ADDR_BIT(a, d)	(BIT_TEST((a)[(d) >> 3], 0x80 >> ((d) & 0x07)) ? 1 : 0)
+
+#define RCU_RADIX_MAGIC	ISC_MAGIC('R', 'c', 'u', 'T')
+
+////////////////////////////////////////////////////////////////////////////////////
+//	atomics
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RCU_LOADP(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define RCU_STOREP(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_SEQ_CST)	/* ordered before the epoch load, see publish() */
+#define RCU_LOADL(p)		__atomic_load_n(&(p), __ATOMIC_SEQ_CST)
+#define RCU_STOREL(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_SEQ_CST)
+#define RCU_RELEASEL(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+static long
+RCU_CASL(volatile long *p, long o, long n)
+{
+	__atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return o;
+}
+
+#else	/*MSVC; volatile accesses have acquire/release semantics (/volatile:ms) */
+#define RCU_LOADP(p)		(p)
+#define RCU_STOREP(p, v)	InterlockedExchangePointer((PVOID volatile *)&(p), (PVOID)(v))
+#define RCU_LOADL(p)		(MemoryBarrier(), (p))
+#define RCU_STOREL(p, v)	InterlockedExchange(&(p), (v))
+#define RCU_RELEASEL(p, v)	((p) = (v))
+#define RCU_CASL(p, o, n)	InterlockedCompareExchange((p), (n), (o))
+#endif
+
+#if defined(_WIN32)
+#define RCU_YIELD()		SwitchToThread()
+#else
+#define RCU_YIELD()		sched_yield()
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////
+//	epochs
+
+/*
+ *  The global epoch is odd and advances by two, so an announced epoch is never zero;
+ *  zero marks an idle reader slot. Storage retired within epoch 'e' is reclaimed once the
+ *  epoch has advanced twice, at which point any reader which could have observed it has
+ *  exited its read section.
+ */
+
+#define RCU_EPOCH_STEP		2
+#define RCU_EPOCH_GRACE		(2 * RCU_EPOCH_STEP)
+
+static volatile long rcu_epoch = 1;
+
+static struct rcu_reader {			/* cache line per reader */
+	volatile long epoch;
+	char pad[64 - sizeof(long)];
+} rcu_readers[RCU_RADIX_MAXREADERS];
+
+
+int
+rcu_read_enter(void)
+{
+	const uintptr_t stack = (uintptr_t)&stack;	/* spread threads across slots */
+	unsigned idx = (unsigned)(((stack >> 12) * 2654435761u) >> 8) & (RCU_RADIX_MAXREADERS - 1);
+
+	for (;;) {
+		unsigned n;
+
+		for (n = 0; n < RCU_RADIX_MAXREADERS; ++n, idx = (idx + 1) & (RCU_RADIX_MAXREADERS - 1)) {
+			struct rcu_reader *reader = rcu_readers + idx;
+			long epoch, current;
+
+			if (RCU_LOADL(reader->epoch))
+				continue;		/* in use */
+
+			epoch = RCU_LOADL(rcu_epoch);
+			if (0 != RCU_CASL(&reader->epoch, 0, epoch))
+				continue;		/* lost race */
+
+			while ((current = RCU_LOADL(rcu_epoch)) != epoch) {
+				RCU_STOREL(reader->epoch, current);
+				epoch = current;	/* advanced during announcement */
+			}
+			return (int)idx;
+		}
+		RCU_YIELD();				/* all slots active */
+	}
+	/*NOTREACHED*/
+}
+
+
+void
+rcu_read_exit(int token)
+{
+	assert(token >= 0 && token < RCU_RADIX_MAXREADERS);
+	assert(rcu_readers[token].epoch != 0);
+	RCU_RELEASEL(rcu_readers[token].epoch, 0);
+}
+
+
+static void
+rcu_advance(void)
+{
+	const long epoch = RCU_LOADL(rcu_epoch);
+	unsigned idx;
+
+	for (idx = 0; idx < RCU_RADIX_MAXREADERS; ++idx) {
+		const long active = RCU_LOADL(rcu_readers[idx].epoch);
+		if (active && active != epoch)
+			return;			/* reader within an earlier epoch */
+	}
+	(void) RCU_CASL(&rcu_epoch, epoch, epoch + RCU_EPOCH_STEP);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//	deferred release
+
+typedef struct rcu_deferred {
+	struct rcu_deferred *next;
+	void *		data;
+	rcu_radix_destroyfunc_t destroy;
+	long		epoch;			/* retirement epoch */
+} rcu_deferred_t;
+
+static volatile long rcu_deferred_lock;
+static rcu_deferred_t *rcu_deferred, *rcu_deferred_tail;	/* in epoch order */
+
+
+static void
+rcu_synchronize(void)
+{
+	const long epoch = RCU_LOADL(rcu_epoch);
+
+	while ((unsigned long)(RCU_LOADL(rcu_epoch) - epoch) < RCU_EPOCH_GRACE) {
+		rcu_advance();
+		RCU_YIELD();
+	}
+}
+
+
+void
+rcu_retire(void *data, rcu_radix_destroyfunc_t destroy)
+{
+	rcu_deferred_t *entry;
+
+	if (NULL == data || NULL == destroy)
+		return;
+
+	if (NULL == (entry = calloc(1, sizeof(rcu_deferred_t)))) {
+		rcu_synchronize();		/* resource error; wait out the readers */
+		destroy(data);
+		return;
+	}
+	entry->data = data;
+	entry->destroy = destroy;
+
+	while (0 != RCU_CASL(&rcu_deferred_lock, 0, 1))
+		RCU_YIELD();
+	entry->epoch = RCU_LOADL(rcu_epoch);	/* readers of 'data' are within <= epoch */
+	if (rcu_deferred_tail) {
+		rcu_deferred_tail->next = entry;
+	} else {
+		rcu_deferred = entry;
+	}
+	rcu_deferred_tail = entry;
+	RCU_STOREL(rcu_deferred_lock, 0);
+
+	rcu_reclaim();
+}
+
+
+void
+rcu_reclaim(void)
+{
+	rcu_deferred_t *expired = NULL, *entry;
+	long epoch;
+
+	rcu_advance();
+	epoch = RCU_LOADL(rcu_epoch);
+
+	while (0 != RCU_CASL(&rcu_deferred_lock, 0, 1))
+		RCU_YIELD();
+	while (NULL != (entry = rcu_deferred)) {
+		if ((unsigned long)(epoch - entry->epoch) < RCU_EPOCH_GRACE)
+			break;			/* may still be referenced */
+		if (NULL == (rcu_deferred = entry->next))
+			rcu_deferred_tail = NULL;
+		entry->next = expired;
+		expired = entry;
+	}
+	RCU_STOREL(rcu_deferred_lock, 0);
+
+	while (NULL != (entry = expired)) {	/* outside the lock; destroy may retire */
+		expired = entry->next;
+		entry->destroy(entry->data);
+		free(entry);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//	tree
+
+/*
+ *  Path-compressed, as isc_radix; a node holds its full prefix and is entered only on
+ *  the bit following it, so chains of single-child nodes are elided and the depth is
+ *  bounded by the prefixes along a path rather than by their length. Nodes are either
+ *  prefixes ('active') or glue, the latter always having two children.
+ */
+typedef struct rcu_radix_node {
+	struct rcu_radix_node *child[2];	/* discriminated by bit 'bit' */
+	void *		data;
+	int		active;			/* data assigned */
+	unsigned	bit;			/* prefix length */
+	u_char		addr[16];		/* prefix, trailing bits clear */
+
+	/* reclamation, writer only */
+	struct rcu_radix_node *retired;
+	long		epoch;			/* retirement epoch */
+	int		destroy;		/* apply destroy to data */
+} rcu_radix_node_t;
+
+struct rcu_radix_tree {
+	unsigned	magic;
+	rcu_radix_node_t * volatile root[RADIX_FAMILIES];
+	rcu_radix_destroyfunc_t destroy;
+	volatile long	lock;			/* writer lock */
+	rcu_radix_node_t *limbo, *limbo_tail;	/* retired nodes, in epoch order */
+	unsigned	prefixes;
+	unsigned	nodes;
+	unsigned	retired;
+	unsigned long	updates;
+};
+
+
+static void
+writer_lock(rcu_radix_tree_t *tree)
+{
+	while (0 != RCU_CASL(&tree->lock, 0, 1))
+		RCU_YIELD();
+}
+
+
+static void
+writer_unlock(rcu_radix_tree_t *tree)
+{
+	RCU_STOREL(tree->lock, 0);
+}
+
+
+static int
+prefix_check(const isc_prefix_t *prefix, int *fam)
+{
+	if (NULL == prefix) {
+		errno = EINVAL;
+		return 0;
+	}
+	if (AF_INET == prefix->family && prefix->bitlen <= 32) {
+		*fam = RADIX_V4;
+	} else if (AF_INET6 == prefix->family && prefix->bitlen <= 128) {
+		*fam = RADIX_V6;
+	} else {
+		errno = EINVAL;
+		return 0;
+	}
+	return 1;
+}
+
+
+static rcu_radix_node_t *
+node_copy(const rcu_radix_node_t *source)
+{
+	rcu_radix_node_t *node = calloc(1, sizeof(rcu_radix_node_t));
+
+	if (node && source) {
+		node->child[0] = source->child[0];
+		node->child[1] = source->child[1];
+		node->data = source->data;
+		node->active = source->active;
+		node->bit = source->bit;
+		memcpy(node->addr, source->addr, sizeof(node->addr));
+	}
+	return node;
+}
+
+
+static rcu_radix_node_t *
+node_new(const u_char *addr, unsigned bit)
+{
+	rcu_radix_node_t *node = calloc(1, sizeof(rcu_radix_node_t));
+
+	if (node) {
+		const unsigned bytes = bit >> 3;
+
+		node->bit = bit;
+		memcpy(node->addr, addr, bytes);
+		if (bit & 0x07)
+			node->addr[bytes] = addr[bytes] & (u_char)(0xff00 >> (bit & 0x07));
+	}
+	return node;
+}
+
+
+/*
+ *  Whether 'addr' lies within the node prefix.
+ */
+static int
+node_covers(const rcu_radix_node_t *node, const u_char *addr)
+{
+	const unsigned bytes = node->bit >> 3, bits = node->bit & 0x07;
+
+	if (bytes && memcmp(node->addr, addr, bytes))
+		return 0;
+	return (0 == bits ||
+		0 == ((node->addr[bytes] ^ addr[bytes]) & (u_char)(0xff00 >> bits)));
+}
+
+
+/*
+ *  First bit at which 'addr' differs from the node prefix, at most 'limit'.
+ */
+static unsigned
+node_differs(const rcu_radix_node_t *node, const u_char *addr, unsigned limit)
+{
+	unsigned bit;
+
+	for (bit = 0; bit < limit; bit += 8) {
+		const u_char diff = node->addr[bit >> 3] ^ addr[bit >> 3];
+
+		if (diff) {
+			u_char mask = 0x80;
+			while (0 == (diff & mask))
+				mask >>= 1, ++bit;
+			break;
+		}
+	}
+	return (bit < limit ? bit : limit);
+}
+
+
+static void
+node_retire(rcu_radix_tree_t *tree, rcu_radix_node_t *node, long epoch, int destroy)
+{
+	node->retired = NULL;
+	node->epoch = epoch;
+	node->destroy = destroy;
+	if (tree->limbo_tail) {
+		tree->limbo_tail->retired = node;
+	} else {
+		tree->limbo = node;
+	}
+	tree->limbo_tail = node;
+	++tree->retired;
+}
+
+
+static void
+node_free(rcu_radix_tree_t *tree, rcu_radix_node_t *node, int destroy)
+{
+	if (destroy && tree->destroy && node->active)
+		tree->destroy(node->data);
+	free(node);
+}
+
+
+static void
+reclaim(rcu_radix_tree_t *tree, int force)
+{
+	rcu_radix_node_t *node;
+	long epoch;
+
+	rcu_advance();
+	epoch = RCU_LOADL(rcu_epoch);
+	while (NULL != (node = tree->limbo)) {
+		if (! force && (unsigned long)(epoch - node->epoch) < RCU_EPOCH_GRACE)
+			break;			/* may still be referenced */
+		if (NULL == (tree->limbo = node->retired))
+			tree->limbo_tail = NULL;
+		--tree->retired;
+		node_free(tree, node, node->destroy);
+	}
+}
+
+
+/*
+ *  Publish the new root, retiring the 'count' replaced nodes; 'destroy' applies to the data
+ *  of the last.
+ */
+static void
+publish(rcu_radix_tree_t *tree, int fam, rcu_radix_node_t *root,
+	rcu_radix_node_t **retire, int count, int destroy)
+{
+	long epoch;
+	int d;
+
+	RCU_STOREP(tree->root[fam], root);
+	epoch = RCU_LOADL(rcu_epoch);		/* readers of the old path are within <= epoch */
+	for (d = 0; d < count; ++d) {
+		node_retire(tree, retire[d], epoch, (d == count - 1 ? destroy : 0));
+	}
+	++tree->updates;
+	reclaim(tree, 0);
+}
+
+
+/*
+ *  Copy the ancestors path[0 .. depth-1] onto 'below', which replaces the node beneath
+ *  path[depth-1], assigning the new root; returns 0 on success, otherwise -1.
+ */
+static int
+path_copy(rcu_radix_node_t **path, int depth, const u_char *addr,
+	rcu_radix_node_t *below, rcu_radix_node_t **root)
+{
+	rcu_radix_node_t *copy[RADIX_MAXBITS + 2];
+	int d;
+
+	for (d = 0; d < depth; ++d) {
+		if (NULL == (copy[d] = node_copy(path[d]))) {
+			while (--d >= 0)
+				free(copy[d]);
+			return -1;
+		}
+	}
+	for (d = depth - 1; d >= 0; --d) {
+		copy[d]->child[ADDR_BIT(addr, copy[d]->bit)] = below;
+		below = copy[d];
+	}
+	*root = below;
+	return 0;
+}
+
+
+rcu_radix_tree_t *
+rcu_radix_create(rcu_radix_destroyfunc_t destroy)
+{
+	rcu_radix_tree_t *tree = calloc(1, sizeof(rcu_radix_tree_t));
+
+	if (NULL == tree) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	tree->magic = RCU_RADIX_MAGIC;
+	tree->destroy = destroy;
+	return tree;
+}
+
+
+static void
+destroy_nodes(rcu_radix_tree_t *tree, rcu_radix_node_t *node)
+{
+	if (node) {
+		destroy_nodes(tree, node->child[0]);
+		destroy_nodes(tree, node->child[1]);
+		node_free(tree, node, 1);
+	}
+}
+
+
+void
+rcu_radix_destroy(rcu_radix_tree_t *tree)
+{
+	int fam;
+
+	if (NULL == tree)
+		return;
+	assert(RCU_RADIX_MAGIC == tree->magic);
+	for (fam = 0; fam < RADIX_FAMILIES; ++fam) {
+		destroy_nodes(tree, tree->root[fam]);
+		tree->root[fam] = NULL;
+	}
+	reclaim(tree, 1);
+	tree->magic = 0;
+	free(tree);
+}
+
+
+int
+rcu_radix_insert(rcu_radix_tree_t *tree, const isc_prefix_t *prefix, void *data)
+{
+	rcu_radix_node_t *path[RADIX_MAXBITS + 2], *node, *leaf, *glue = NULL, *root = NULL;
+	const u_char *addr;
+	unsigned bitlen;
+	int fam, depth = 0, exact, replaced = 0;
+
+	assert(tree && RCU_RADIX_MAGIC == tree->magic);
+	if (! prefix_check(prefix, &fam))
+		return -1;
+
+	addr = (const u_char *)isc_prefix_tochar(prefix);
+	bitlen = prefix->bitlen;
+
+	writer_lock(tree);
+
+	node = tree->root[fam];			/* existing path; covering prefixes */
+	while (node && node->bit < bitlen && node_covers(node, addr)) {
+		path[depth++] = node;
+		node = node->child[ADDR_BIT(addr, node->bit)];
+	}
+
+	exact = (node && node->bit == bitlen && node_covers(node, addr));
+	if (exact) {				/* replace */
+		leaf = node_copy(node);
+		replaced = node->active;
+
+	} else if (NULL != (leaf = node_new(addr, bitlen)) && node) {
+		const unsigned diff = node_differs(node, addr, (bitlen < node->bit ? bitlen : node->bit));
+
+		if (diff == bitlen) {		/* covers the subtree */
+			leaf->child[ADDR_BIT(node->addr, bitlen)] = node;
+		} else if (NULL != (glue = node_new(addr, diff))) {
+			glue->child[ADDR_BIT(addr, diff)] = leaf;
+			glue->child[ADDR_BIT(node->addr, diff)] = node;
+		} else {
+			free(leaf), leaf = NULL;
+		}
+	}
+
+	if (NULL == leaf || path_copy(path, depth, addr, (glue ? glue : leaf), &root) < 0) {
+		free(glue);
+		free(leaf);
+		writer_unlock(tree);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	leaf->data = data;
+	leaf->active = 1;
+	if (! replaced)
+		++tree->prefixes;
+	if (exact) {
+		path[depth++] = node;
+	} else {
+		tree->nodes += (glue ? 2 : 1);
+	}
+
+	publish(tree, fam, root, path, depth,
+		(replaced && node->data != data));
+	writer_unlock(tree);
+	return 0;
+}
+
+
+int
+rcu_radix_remove(rcu_radix_tree_t *tree, const isc_prefix_t *prefix)
+{
+	rcu_radix_node_t *path[RADIX_MAXBITS + 2], *node, *below, *spliced = NULL, *root = NULL;
+	const u_char *addr;
+	unsigned bitlen;
+	int fam, depth = 0, glue;
+
+	assert(tree && RCU_RADIX_MAGIC == tree->magic);
+	if (! prefix_check(prefix, &fam))
+		return -1;
+
+	addr = (const u_char *)isc_prefix_tochar(prefix);
+	bitlen = prefix->bitlen;
+
+	writer_lock(tree);
+
+	node = tree->root[fam];
+	while (node && node->bit < bitlen && node_covers(node, addr)) {
+		path[depth++] = node;
+		node = node->child[ADDR_BIT(addr, node->bit)];
+	}
+
+	if (NULL == node || node->bit != bitlen || ! node->active || ! node_covers(node, addr)) {
+		writer_unlock(tree);
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (0 != (glue = (node->child[0] && node->child[1]))) {
+		if (NULL == (below = node_copy(node))) {
+			writer_unlock(tree);
+			errno = ENOMEM;
+			return -1;
+		}
+		below->data = NULL;
+		below->active = 0;
+
+	} else {				/* elided */
+		below = (node->child[0] ? node->child[0] : node->child[1]);
+		if (NULL == below && depth && ! path[depth - 1]->active) {
+			spliced = path[--depth];	/* glue, left with a single child */
+			below = spliced->child[! ADDR_BIT(addr, spliced->bit)];
+		}
+	}
+
+	if (path_copy(path, depth, addr, below, &root) < 0) {
+		if (glue)
+			free(below);
+		writer_unlock(tree);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (! glue)
+		tree->nodes -= (spliced ? 2 : 1);
+	--tree->prefixes;
+	if (spliced)
+		path[depth++] = spliced;
+	path[depth++] = node;
+
+	publish(tree, fam, root, path, depth, 1);
+	writer_unlock(tree);
+	return 0;
+}
+
+
+int
+rcu_radix_search(rcu_radix_tree_t *tree, const isc_prefix_t *prefix, void **data)
+{
+	const rcu_radix_node_t *node, *best = NULL;
+	const u_char *addr;
+	unsigned bitlen;
+	int fam;
+
+	assert(tree && RCU_RADIX_MAGIC == tree->magic);
+	assert(data != NULL);
+
+	if (! prefix_check(prefix, &fam))
+		return ISC_R_NOTFOUND;
+
+	addr = (const u_char *)isc_prefix_tochar(prefix);
+	bitlen = prefix->bitlen;
+
+	node = RCU_LOADP(tree->root[fam]);
+	while (node && node->bit <= bitlen) {
+		if (node->active) {		/* elided bits verified; none below otherwise */
+			if (! node_covers(node, addr))
+				break;
+			best = node;
+		}
+		if (node->bit == bitlen)
+			break;
+		node = RCU_LOADP(node->child[ADDR_BIT(addr, node->bit)]);
+	}
+
+	if (NULL == best)
+		return ISC_R_NOTFOUND;
+	*data = best->data;
+	return ISC_R_SUCCESS;
+}
+
+
+void
+rcu_radix_reclaim(rcu_radix_tree_t *tree)
+{
+	assert(tree && RCU_RADIX_MAGIC == tree->magic);
+	writer_lock(tree);
+	reclaim(tree, 0);
+	writer_unlock(tree);
+}
+
+
+void
+rcu_radix_stats(rcu_radix_tree_t *tree, struct rcu_radix_stats *stats)
+{
+	assert(tree && RCU_RADIX_MAGIC == tree->magic);
+	writer_lock(tree);
+	stats->prefixes = tree->prefixes;
+	stats->nodes = tree->nodes;
+	stats->retired = tree->retired;
+	stats->updates = tree->updates;
+	stats->epoch = (unsigned long)RCU_LOADL(rcu_epoch);
+	writer_unlock(tree);
+}
+
+//end
@@ -0,0 +1,148 @@
+#pragma once
+#ifndef RCU_RADIX_H_INCLUDED
+#define RCU_RADIX_H_INCLUDED
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * libiptable - concurrent radix tree.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Longest prefix match tree permitting single prefix updates whilst being searched.
+ *
+ *  Readers are lock-free; a search is bracketed by rcu_read_enter() and rcu_read_exit(),
+ *  which announce the reader within the current epoch. Writers are serialised; an update
+ *  copies the path of path-compressed nodes from the root to the affected node, bounded
+ *  by the prefixes along it rather than their length, and publishes the new root with a
+ *  single pointer store, so a reader observes either the old or the new tree, never a
+ *  partial one. The replaced nodes, and any replaced data, are retired against the epoch
+ *  and reclaimed once no reader can still reference them (epoch-based reclamation).
+ *
+ *  Data returned by rcu_radix_search() remains valid only until the matching rcu_read_exit().
+ */
+
+#include <sys/cdefs.h>
+
+#include "isc_radix.h"
+
+__BEGIN_DECLS
+
+#define RCU_RADIX_MAXREADERS	256		/* concurrent read sections */
+
+typedef struct rcu_radix_tree rcu_radix_tree_t;
+typedef void (*rcu_radix_destroyfunc_t)(void *);
+
+struct rcu_radix_stats {
+	unsigned	prefixes;		/* active prefixes */
+	unsigned	nodes;			/* active nodes */
+	unsigned	retired;		/* nodes pending reclamation */
+	unsigned long	updates;		/* published updates */
+	unsigned long	epoch;			/* current epoch */
+};
+
+rcu_radix_tree_t *
+rcu_radix_create(rcu_radix_destroyfunc_t destroy);
+/*%<
+ * Create an empty tree; 'destroy', when not NULL, is applied to data once reclaimed.
+ */
+
+void
+rcu_radix_destroy(rcu_radix_tree_t *tree);
+/*%<
+ * Destroy the tree, all nodes and associated data.
+ *
+ * Requires:
+ * \li	no concurrent readers or writers.
+ */
+
+int
+rcu_radix_insert(rcu_radix_tree_t *tree, const isc_prefix_t *prefix, void *data);
+/*%<
+ * Insert or replace the 'data' associated with 'prefix'; any replaced data is
+ * destroyed once reclaimed.
+ *
+ * Returns:
+ * \li	0 on success, otherwise -1 (errno ENOMEM or EINVAL).
+ */
+
+int
+rcu_radix_remove(rcu_radix_tree_t *tree, const isc_prefix_t *prefix);
+/*%<
+ * Remove the exact 'prefix'.
+ *
+ * Returns:
+ * \li	0 on success, otherwise -1 (errno ENOENT, ENOMEM or EINVAL).
+ */
+
+int
+rcu_radix_search(rcu_radix_tree_t *tree, const isc_prefix_t *prefix, void **data);
+/*%<
+ * Search 'tree' for the longest prefix covering 'prefix'.
+ *
+ * Requires:
+ * \li	caller within a read section.
+ *
+ * Returns:
+ * \li	ISC_R_SUCCESS, with '*data' assigned.
+ * \li	ISC_R_NOTFOUND
+ */
+
+void
+rcu_radix_reclaim(rcu_radix_tree_t *tree);
+/*%<
+ * Advance the epoch if possible and reclaim retired storage; implied by updates.
+ */
+
+void
+rcu_radix_stats(rcu_radix_tree_t *tree, struct rcu_radix_stats *stats);
+
+int
+rcu_read_enter(void);
+/*%<
+ * Enter a read section; returns the section token for rcu_read_exit().
+ */
+
+void
+rcu_read_exit(int token);
+
+void
+rcu_retire(void *data, rcu_radix_destroyfunc_t destroy);
+/*%<
+ * Apply 'destroy' to 'data' once no reader can still reference it; deferred release of
+ * storage outside any tree, which the caller has first unpublished.
+ *
+ * Requires:
+ * \li	caller not within a read section.
+ */
+
+void
+rcu_reclaim(void);
+/*%<
+ * Advance the epoch if possible and release retired data; implied by rcu_retire().
+ */
+
+__END_DECLS
+
+#endif /*RCU_RADIX_H_INCLUDED*/
+
+//end
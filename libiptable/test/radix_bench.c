@@ -0,0 +1,153 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * libiptable - radix search benchmark.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Compares isc_radix_search_best() against isc_radix_search_batch() over a tree of
+ *  random prefixes, verifying both agree.
+ *
+ *	radix_bench [prefixes [addresses [rounds]]]
+ */
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../isc_radix.h"
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t
+random32(void)
+{
+	rng ^= rng << 13;			/* xorshift64 */
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return (uint32_t)(rng >> 16);
+}
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+static void
+random_prefix(isc_prefix_t *pfx, int v6, unsigned bitlen)
+{
+	unsigned char *addr = (unsigned char *)&pfx->add.sin6;
+	unsigned i;
+
+	memset(pfx, 0, sizeof(*pfx));
+	pfx->family = (v6 ? AF_INET6 : AF_INET);
+	pfx->bitlen = bitlen;
+	for (i = 0; i < (v6 ? 16U : 4U); ++i)
+		addr[i] = (unsigned char)random32();
+	for (i = bitlen; i < (v6 ? 128U : 32U); ++i)
+		addr[i >> 3] &= (unsigned char)~(0x80 >> (i & 7));
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned prefixes = (argc > 1 ? (unsigned)atoi(argv[1]) : 100000);
+	const unsigned addresses = (argc > 2 ? (unsigned)atoi(argv[2]) : 1000000);
+	const unsigned rounds = (argc > 3 ? (unsigned)atoi(argv[3]) : 5);
+	isc_radix_tree_t *radix = NULL;
+	isc_radix_node_t **single, **batch;
+	isc_prefix_t *queries;
+	double t_single = 0, t_batch = 0;
+	isc_mem_t mctx = {0};
+	unsigned i, r, matched = 0;
+
+	if (0 == prefixes || 0 == addresses || 0 == rounds) {
+		fprintf(stderr, "usage: radix_bench [prefixes [addresses [rounds]]]\n");
+		return 1;
+	}
+
+	isc_radix_create(&mctx, &radix, RADIX_MAXBITS);
+	for (i = 0; i < prefixes; ++i) {
+		const int v6 = (random32() % 4) == 0;
+		isc_radix_node_t *node = NULL;
+		isc_prefix_t pfx;
+
+		random_prefix(&pfx, v6, (v6 ? 16 + random32() % 49 : 8 + random32() % 25));
+		if (isc_radix_insert(radix, &node, NULL, &pfx) != ISC_R_SUCCESS)
+			break;
+		node->data[ISC_RADIX_FAMILY(&pfx)] = (void *)1;
+	}
+
+	queries = calloc(addresses, sizeof(isc_prefix_t));
+	single = calloc(addresses, sizeof(isc_radix_node_t *));
+	batch = calloc(addresses, sizeof(isc_radix_node_t *));
+	if (NULL == queries || NULL == single || NULL == batch) {
+		fprintf(stderr, "radix_bench: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < addresses; ++i) {
+		const int v6 = (random32() % 4) == 0;
+		random_prefix(queries + i, v6, (v6 ? 128 : 32));
+	}
+
+	for (r = 0; r < rounds; ++r) {
+		double start = now();
+
+		for (i = 0; i < addresses; ++i) {
+			single[i] = NULL;
+			(void) isc_radix_search_best(radix, single + i, queries + i);
+		}
+		t_single += now() - start;
+
+		start = now();
+		matched = isc_radix_search_batch(radix, batch, queries, addresses);
+		t_batch += now() - start;
+
+		if (memcmp(single, batch, addresses * sizeof(isc_radix_node_t *))) {
+			fprintf(stderr, "radix_bench: batch/single mismatch\n");
+			return 1;
+		}
+	}
+
+	printf("prefixes: %u, nodes: %u, addresses: %u, matched: %u, rounds: %u\n",
+		prefixes, mctx.mem_radix, addresses, matched, rounds);
+	printf("single: %8.1f ns/lookup\n", (t_single * 1e9) / ((double)addresses * rounds));
+	printf("batch:  %8.1f ns/lookup (%.2fx)\n", (t_batch * 1e9) / ((double)addresses * rounds),
+		t_single / t_batch);
+
+	isc_radix_destroy(radix, NULL);
+	free(queries), free(single), free(batch);
+	return 0;
+}
+
+//end
@@ -0,0 +1,789 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * libiptable - concurrent radix tree test.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  Concurrent radix tree, see rcu_radix.c:
+ *
+ *	o match; longest prefix match over nested, sibling, host and default prefixes of
+ *	  both families, the families kept apart, and searches by a prefix.
+ *	o compression; node counts across inserts and removes. Nested prefixes add no glue,
+ *	  siblings add one, a removed prefix with two children remains as glue, and glue
+ *	  left with a single child is spliced out; an emptied tree holds no nodes.
+ *	o reclamation; data replaced or removed whilst a read section may reference it is
+ *	  retained until the section exits, then destroyed exactly once.
+ *	o sequential; random inserts and removes against a naive reference, the node count
+ *	  never exceeding 2n-1 per family.
+ *	o concurrency; readers search whilst a writer toggles prefixes. Each result must
+ *	  cover the address, be at least as specific as the best stable match, and its data
+ *	  must not have been reclaimed; reclaimed data is marked dead rather than freed.
+ *
+ *	rcu_radix_test [prefixes [readers [seconds]]]
+ */
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <sthread.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../rcu_radix.h"
+#include "../../libinetd/test/unittest.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOAD(p)			__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)		__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else	/*MSVC; volatile accesses have acquire/release semantics (/volatile:ms) */
+#define LOAD(p)			(p)
+#define STORE(p, v)		((p) = (v))
+#endif
+
+#define ENTRY_LIVE	0x4c495645
+#define ENTRY_DEAD	0xdeaddead
+
+struct entry {
+	volatile unsigned magic;
+	isc_prefix_t prefix;
+	struct entry *next;			/* reclaimed list */
+};
+
+struct reader {
+	pthread_t thread;
+	unsigned index;
+	unsigned long lookups, failures;
+};
+
+static isc_prefix_t *stable, *changing, *queries;
+static int *present;				/* changing[] published */
+static int *best_stable;			/* queries[] -> stable[], otherwise -1 */
+static unsigned nstable, nchanging, nqueries;
+
+static rcu_radix_tree_t *tree;
+static struct entry *reclaimed;
+static unsigned long destroyed;
+static volatile int stop;
+static unsigned long errors;
+
+
+static void
+failed(const char *test, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "rcu_radix_test: %s, ", test);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	++errors;
+}
+
+
+static isc_prefix_t
+to_prefix(const char *text)
+{
+	char address[INET6_ADDRSTRLEN + 1] = {0};
+	const char *slash = strchr(text, '/');
+	const size_t length = (slash ? (size_t)(slash - text) : strlen(text));
+	isc_prefix_t pfx;
+
+	memset(&pfx, 0, sizeof(pfx));
+	memcpy(address, text, (length < INET6_ADDRSTRLEN ? length : INET6_ADDRSTRLEN));
+	if (1 == inet_pton(AF_INET, address, &pfx.add.sin)) {
+		pfx.family = AF_INET;
+		pfx.bitlen = (slash ? (unsigned)atoi(slash + 1) : 32);
+	} else if (1 == inet_pton(AF_INET6, address, &pfx.add.sin6)) {
+		pfx.family = AF_INET6;
+		pfx.bitlen = (slash ? (unsigned)atoi(slash + 1) : 128);
+	}
+	return pfx;
+}
+
+
+static void
+random_prefix(isc_prefix_t *pfx, int v6, unsigned bitlen)
+{
+	unsigned char *addr = (unsigned char *)&pfx->add.sin6;
+	unsigned i;
+
+	memset(pfx, 0, sizeof(*pfx));
+	pfx->family = (v6 ? AF_INET6 : AF_INET);
+	pfx->bitlen = bitlen;
+	for (i = 0; i < (v6 ? 16U : 4U); ++i)
+		addr[i] = (unsigned char)random32();
+	for (i = bitlen; i < (v6 ? 128U : 32U); ++i)
+		addr[i >> 3] &= (unsigned char)~(0x80 >> (i & 7));
+}
+
+
+static void
+random_within(isc_prefix_t *address, const isc_prefix_t *pfx)
+{
+	const int v6 = (AF_INET6 == pfx->family);
+	unsigned char *addr = (unsigned char *)&address->add.sin6;
+	unsigned i;
+
+	random_prefix(address, v6, (v6 ? 128 : 32));
+	for (i = 0; i < pfx->bitlen; ++i) {
+		const unsigned char bit = (unsigned char)(0x80 >> (i & 7));
+		addr[i >> 3] = (unsigned char)((addr[i >> 3] & ~bit) |
+				(((const unsigned char *)&pfx->add.sin6)[i >> 3] & bit));
+	}
+}
+
+
+static int
+covers(const isc_prefix_t *pfx, const isc_prefix_t *address)
+{
+	const unsigned char *a = (const unsigned char *)&pfx->add.sin6,
+		*b = (const unsigned char *)&address->add.sin6;
+	unsigned i;
+
+	if (pfx->family != address->family)
+		return 0;
+	for (i = 0; i < pfx->bitlen; ++i) {
+		const unsigned char bit = (unsigned char)(0x80 >> (i & 7));
+		if ((a[i >> 3] & bit) != (b[i >> 3] & bit))
+			return 0;
+	}
+	return 1;
+}
+
+
+static int
+same(const isc_prefix_t *a, const isc_prefix_t *b)
+{
+	return (a->bitlen == b->bitlen && covers(a, b) && covers(b, a));
+}
+
+
+/*
+ *  Naive longest prefix match; the set 'pfxs', restricted by 'active' when not NULL.
+ */
+static int
+reference(const isc_prefix_t *pfxs, const int *active, unsigned count, const isc_prefix_t *address)
+{
+	int best = -1;
+	unsigned i;
+
+	for (i = 0; i < count; ++i) {
+		if (active && ! active[i])
+			continue;
+		if (covers(pfxs + i, address) &&
+				(best < 0 || pfxs[i].bitlen > pfxs[best].bitlen))
+			best = (int)i;
+	}
+	return best;
+}
+
+
+static void
+entry_destroy(void *data)
+{
+	struct entry *e = data;
+
+	if (ENTRY_LIVE != e->magic)
+		failed("destroy", "data destroyed twice");
+	e->magic = ENTRY_DEAD;			/* retained, see release() */
+	e->next = reclaimed;
+	reclaimed = e;
+	++destroyed;
+}
+
+
+static struct entry *
+entry_new(const isc_prefix_t *pfx)
+{
+	struct entry *e = calloc(1, sizeof(struct entry));
+
+	if (NULL == e) {
+		fprintf(stderr, "rcu_radix_test: out of memory\n");
+		exit(1);
+	}
+	e->magic = ENTRY_LIVE;
+	e->prefix = *pfx;
+	return e;
+}
+
+
+static void
+release(void)
+{
+	while (reclaimed) {
+		struct entry *e = reclaimed;
+		reclaimed = e->next;
+		free(e);
+	}
+}
+
+
+/*
+ *  Search, within a read section; the matching prefix, otherwise NULL.
+ */
+static const isc_prefix_t *
+search(const isc_prefix_t *address)
+{
+	const int token = rcu_read_enter();
+	const isc_prefix_t *result = NULL;
+	void *data = NULL;
+
+	if (ISC_R_SUCCESS == rcu_radix_search(tree, address, &data)) {
+		const struct entry *e = data;
+		if (ENTRY_LIVE == e->magic)
+			result = &e->prefix;
+	}
+	rcu_read_exit(token);
+	return result;				/* live until the next update */
+}
+
+
+static void
+test_match(void)
+{
+	static const char *prefixes[] = {
+		"0.0.0.0/0", "10.0.0.0/8", "10.1.0.0/16", "10.1.2.0/24", "10.1.2.3/32", "192.168.0.0/16",
+		"2001:db8::/32", "2001:db8::1/128", "2001:db8:8000::/33",
+		};
+	static const struct {
+		const char *address, *expected;
+	} probes[] = {
+		{"10.1.2.3", "10.1.2.3/32"}, {"10.1.2.4", "10.1.2.0/24"}, {"10.1.3.1", "10.1.0.0/16"},
+		{"10.2.0.0", "10.0.0.0/8"}, {"10.255.255.255", "10.0.0.0/8"}, {"9.255.255.255", "0.0.0.0/0"},
+		{"11.0.0.0", "0.0.0.0/0"}, {"192.168.255.255", "192.168.0.0/16"}, {"192.169.0.0", "0.0.0.0/0"},
+		{"10.1.0.0/16", "10.1.0.0/16"}, {"10.1.2.0/23", "10.1.0.0/16"}, {"10.0.0.0/7", "0.0.0.0/0"},
+		{"2001:db8::1", "2001:db8::1/128"}, {"2001:db8::2", "2001:db8::/32"},
+		{"2001:db8:7fff::1", "2001:db8::/32"}, {"2001:db8:8000::1", "2001:db8:8000::/33"},
+		{"2001:db9::", NULL}, {"::ffff:10.1.2.3", NULL}, {"::", NULL},
+		};
+	unsigned i;
+
+	if (NULL == (tree = rcu_radix_create(entry_destroy))) {
+		failed("match", "create failed");
+		return;
+	}
+	for (i = 0; i < (sizeof(prefixes) / sizeof(prefixes[0])); ++i) {
+		const isc_prefix_t pfx = to_prefix(prefixes[i]);
+
+		if (rcu_radix_insert(tree, &pfx, entry_new(&pfx)) < 0)
+			failed("match", "%s, insert failed", prefixes[i]);
+	}
+
+	for (i = 0; i < (sizeof(probes) / sizeof(probes[0])); ++i) {
+		const isc_prefix_t address = to_prefix(probes[i].address);
+		const isc_prefix_t *result = search(&address);
+
+		if (NULL == probes[i].expected) {
+			if (result)
+				failed("match", "%s, unexpected match", probes[i].address);
+		} else {
+			const isc_prefix_t expected = to_prefix(probes[i].expected);
+
+			if (NULL == result || ! same(result, &expected))
+				failed("match", "%s, expected %s", probes[i].address, probes[i].expected);
+		}
+	}
+
+	rcu_radix_destroy(tree);
+	tree = NULL;
+	release();
+}
+
+
+/*
+ *  Each step either inserts (+), removes (-), or removes expecting ENOENT (!), followed by
+ *  the expected prefix and node counts; 'glue' steps then probe beneath retained glue.
+ */
+static void
+test_compression(void)
+{
+	static const struct {
+		char op;
+		const char *prefix;
+		unsigned prefixes, nodes;
+		int glue;
+	} steps[] = {
+		{'+', "10.0.0.0/8",	1, 1, 0},
+		{'+', "10.1.0.0/16",	2, 2, 0},	/* nested */
+		{'+', "10.2.0.0/16",	3, 4, 0},	/* sibling; glue at /14 */
+		{'+', "10.2.0.0/16",	3, 4, 0},	/* replaced */
+		{'-', "10.1.0.0/16",	2, 2, 0},	/* glue spliced */
+		{'-', "10.0.0.0/8",	1, 1, 0},	/* single child, elided */
+		{'+', "10.0.0.0/8",	2, 2, 0},	/* covers the subtree */
+		{'+', "10.2.3.0/24",	3, 3, 0},
+		{'+', "10.2.128.0/24",	4, 4, 0},	/* the other child */
+		{'-', "10.2.0.0/16",	3, 4, 0},	/* two children, retained as glue */
+		{'!', "10.2.0.0/16",	3, 4, 0},	/* glue, not a prefix */
+		{'+', "10.128.0.0/16",	4, 5, 0},
+		{'-', "10.0.0.0/8",	3, 5, 1},	/* two children, retained as glue */
+		{'!', "10.0.0.0/8",	3, 5, 1},
+		{'-', "10.128.0.0/16",	2, 3, 0},	/* glue spliced */
+		{'+', "2001:db8::/32",	3, 4, 0},
+		{'-', "10.2.3.0/24",	2, 2, 0},	/* glue spliced */
+		{'-', "10.2.128.0/24",	1, 1, 0},
+		{'!', "2001:db8::/31",	1, 1, 0},
+		{'-', "2001:db8::/32",	0, 0, 0},
+		};
+	static const char *probes[][2] = {		/* beneath the 10.0.0.0/8 glue */
+		{"10.5.0.0", NULL}, {"10.2.3.1", "10.2.3.0/24"}, {"10.128.0.1", "10.128.0.0/16"},
+		};
+	struct rcu_radix_stats stats;
+	isc_prefix_t invalid;
+	unsigned i, p;
+
+	if (NULL == (tree = rcu_radix_create(entry_destroy))) {
+		failed("compression", "create failed");
+		return;
+	}
+
+	for (i = 0; i < (sizeof(steps) / sizeof(steps[0])); ++i) {
+		const isc_prefix_t pfx = to_prefix(steps[i].prefix);
+		int ret;
+
+		errno = 0;
+		switch (steps[i].op) {
+		case '+':
+			ret = rcu_radix_insert(tree, &pfx, entry_new(&pfx));
+			break;
+		case '-':
+			ret = rcu_radix_remove(tree, &pfx);
+			break;
+		default:
+			ret = (rcu_radix_remove(tree, &pfx) < 0 && ENOENT == errno ? 0 : -1);
+			break;
+		}
+		rcu_radix_stats(tree, &stats);
+		if (ret < 0 || stats.prefixes != steps[i].prefixes || stats.nodes != steps[i].nodes)
+			failed("compression", "step %u, %c%s, result %d, prefixes %u/%u, nodes %u/%u",
+				i + 1, steps[i].op, steps[i].prefix, ret,
+				stats.prefixes, steps[i].prefixes, stats.nodes, steps[i].nodes);
+
+		if (steps[i].glue) {
+			for (p = 0; p < (sizeof(probes) / sizeof(probes[0])); ++p) {
+				const isc_prefix_t address = to_prefix(probes[p][0]);
+				const isc_prefix_t *result = search(&address);
+				const isc_prefix_t expected = (probes[p][1] ? to_prefix(probes[p][1]) : address);
+
+				if ((NULL == result) != (NULL == probes[p][1]) || (result && ! same(result, &expected)))
+					failed("compression", "%s, glue matched", probes[p][0]);
+			}
+		}
+	}
+
+	invalid = to_prefix("10.0.0.0/8");		/* rejected */
+	invalid.bitlen = 33;
+	if (rcu_radix_insert(tree, &invalid, NULL) >= 0 || EINVAL != errno ||
+			rcu_radix_remove(tree, &invalid) >= 0 || EINVAL != errno)
+		failed("compression", "invalid prefix accepted");
+
+	rcu_radix_destroy(tree);
+	tree = NULL;
+	release();
+}
+
+
+/*
+ *  Data replaced, then removed, whilst this thread holds a read section referencing it;
+ *  writers never wait on readers, so the section may span the updates.
+ */
+static void
+test_reclamation(void)
+{
+	const isc_prefix_t pfx = to_prefix("172.16.0.0/12");
+	struct entry *first, *second;
+	struct rcu_radix_stats stats;
+	unsigned long t_destroyed;
+	void *data = NULL;
+	int token, round;
+
+	if (NULL == (tree = rcu_radix_create(entry_destroy))) {
+		failed("reclamation", "create failed");
+		return;
+	}
+	first = entry_new(&pfx), second = entry_new(&pfx);
+	(void) rcu_radix_insert(tree, &pfx, first);
+	t_destroyed = destroyed;
+
+	token = rcu_read_enter();
+	if (ISC_R_SUCCESS != rcu_radix_search(tree, &pfx, &data) || data != first)
+		failed("reclamation", "initial search");
+	if (rcu_radix_insert(tree, &pfx, second) < 0 || rcu_radix_remove(tree, &pfx) < 0)
+		failed("reclamation", "update failed");
+	for (round = 0; round < 4; ++round)
+		rcu_radix_reclaim(tree);
+	rcu_radix_stats(tree, &stats);
+	if (ENTRY_LIVE != first->magic || ENTRY_LIVE != second->magic ||
+			destroyed != t_destroyed || 0 == stats.retired)
+		failed("reclamation", "reclaimed within the read section");
+	rcu_read_exit(token);
+
+	for (round = 0; round < 4; ++round)
+		rcu_radix_reclaim(tree);
+	rcu_radix_stats(tree, &stats);
+	if (ENTRY_DEAD != first->magic || ENTRY_DEAD != second->magic ||
+			destroyed != t_destroyed + 2 || 0 != stats.retired || 0 != stats.nodes)
+		failed("reclamation", "not reclaimed after the read section, retired %u", stats.retired);
+
+	rcu_radix_destroy(tree);
+	tree = NULL;
+	release();
+}
+
+
+static int
+duplicate(const isc_prefix_t *pfx)
+{
+	unsigned i;
+
+	for (i = 0; i < nstable; ++i)
+		if (same(stable + i, pfx))
+			return 1;
+	for (i = 0; i < nchanging; ++i)
+		if (same(changing + i, pfx))
+			return 1;
+	return 0;
+}
+
+
+/*
+ *  Unique prefixes; changing prefixes are frequently nested within stable ones.
+ */
+static int
+generate(unsigned prefixes)
+{
+	unsigned i;
+
+	nqueries = prefixes * 8;
+	stable = calloc(prefixes, sizeof(isc_prefix_t));
+	changing = calloc(prefixes, sizeof(isc_prefix_t));
+	present = calloc(prefixes, sizeof(int));
+	queries = calloc(nqueries, sizeof(isc_prefix_t));
+	best_stable = calloc(nqueries, sizeof(int));
+	if (NULL == stable || NULL == changing || NULL == present ||
+			NULL == queries || NULL == best_stable)
+		return -1;
+
+	while (nstable < prefixes) {
+		const int v6 = (random32() % 4) == 0;
+		isc_prefix_t pfx;
+
+		random_prefix(&pfx, v6, (v6 ? 16 + random32() % 33 : 8 + random32() % 17));
+		if (! duplicate(&pfx))
+			stable[nstable++] = pfx;
+	}
+	while (nchanging < prefixes) {
+		isc_prefix_t pfx;
+
+		if (random32() % 2) {
+			const isc_prefix_t *outer = stable + (random32() % nstable);
+			const unsigned maxbits = (AF_INET6 == outer->family ? 128 : 32);
+			unsigned bitlen = outer->bitlen + 1 + random32() % 16;
+			unsigned b;
+
+			random_within(&pfx, outer);
+			if (bitlen > maxbits)
+				bitlen = maxbits;
+			pfx.bitlen = bitlen;
+			for (b = bitlen; b < maxbits; ++b)
+				((unsigned char *)&pfx.add.sin6)[b >> 3] &= (unsigned char)~(0x80 >> (b & 7));
+		} else {
+			const int v6 = (random32() % 4) == 0;
+			random_prefix(&pfx, v6, (v6 ? 16 + random32() % 113 : 8 + random32() % 25));
+		}
+		if (! duplicate(&pfx))
+			changing[nchanging++] = pfx;
+	}
+
+	for (i = 0; i < nqueries; ++i) {
+		switch (i % 3) {
+		case 0: random_within(queries + i, stable + (random32() % nstable)); break;
+		case 1: random_within(queries + i, changing + (random32() % nchanging)); break;
+		default: {
+				const int v6 = (random32() % 4) == 0;
+				random_prefix(queries + i, v6, (v6 ? 128 : 32));
+			}
+			break;
+		}
+		best_stable[i] = reference(stable, NULL, nstable, queries + i);
+	}
+	return 0;
+}
+
+
+/*
+ *  Toggle a random changing prefix; inserted when absent, otherwise replaced or removed.
+ *  Returns the entries created, otherwise -1.
+ */
+static int
+toggle(void)
+{
+	const unsigned c = random32() % nchanging;
+
+	if (! present[c] || (random32() % 2)) {
+		if (rcu_radix_insert(tree, changing + c, entry_new(changing + c)) < 0)
+			return -1;
+		present[c] = 1;
+		return 1;
+	}
+	if (rcu_radix_remove(tree, changing + c) < 0)
+		return -1;
+	present[c] = 0;
+	return 0;
+}
+
+
+/*
+ *  Quiescent; every query agrees exactly with the reference.
+ */
+static void
+verify(const char *test)
+{
+	unsigned i, mismatches = 0;
+
+	for (i = 0; i < nqueries; ++i) {
+		const int s = best_stable[i], c = reference(changing, present, nchanging, queries + i);
+		const isc_prefix_t *expected = (c >= 0 && (s < 0 || changing[c].bitlen > stable[s].bitlen) ?
+							changing + c : (s >= 0 ? stable + s : NULL));
+		const isc_prefix_t *result = search(queries + i);
+
+		if ((NULL == result) != (NULL == expected) || (result && ! same(result, expected)))
+			++mismatches;
+	}
+	if (mismatches)
+		failed(test, "%u of %u queries mismatched", mismatches, nqueries);
+}
+
+
+static void
+populate(const char *test)
+{
+	unsigned i;
+
+	if (NULL == (tree = rcu_radix_create(entry_destroy))) {
+		failed(test, "create failed");
+		return;
+	}
+	memset(present, 0, nchanging * sizeof(int));
+	for (i = 0; i < nstable; ++i) {
+		if (rcu_radix_insert(tree, stable + i, entry_new(stable + i)) < 0)
+			failed(test, "insert failed");
+	}
+}
+
+
+/*
+ *  Drain retired storage, then check accounting; every entry not still published has been
+ *  destroyed, and the tree is destroyed in turn.
+ */
+static void
+drain(const char *test, unsigned long created)
+{
+	struct rcu_radix_stats stats;
+	unsigned i, count = 0;
+
+	for (i = 0; i < nchanging; ++i)
+		count += (present[i] ? 1 : 0);
+	for (i = 0; i < 4; ++i)
+		rcu_radix_reclaim(tree);	/* no readers; epoch advances */
+	rcu_radix_stats(tree, &stats);
+	if (stats.prefixes != nstable + count || stats.retired != 0 ||
+			destroyed != created - stats.prefixes)
+		failed(test, "accounting, prefixes %u/%u, retired %u, destroyed %lu/%lu",
+			stats.prefixes, nstable + count, stats.retired, destroyed, created - stats.prefixes);
+
+	rcu_radix_destroy(tree);
+	tree = NULL;
+	if (destroyed != created)
+		failed(test, "destroyed %lu of %lu", destroyed, created);
+	release();
+}
+
+
+static void
+test_sequential(unsigned updates)
+{
+	unsigned long created = nstable;
+	unsigned i, c, bound;
+
+	destroyed = 0;
+	populate("sequential");
+	if (NULL == tree)
+		return;
+
+	for (i = 0; i < updates; ++i) {
+		struct rcu_radix_stats stats;
+		unsigned v4 = 0, v6 = 0;
+		const int ret = toggle();
+
+		if (ret < 0) {
+			failed("sequential", "update failed");
+			break;
+		}
+		created += (unsigned)ret;
+		for (c = 0; c < nstable + nchanging; ++c) {
+			const isc_prefix_t *pfx = (c < nstable ? stable + c : changing + (c - nstable));
+
+			if (c < nstable || present[c - nstable])
+				++*(AF_INET6 == pfx->family ? &v6 : &v4);
+		}
+		bound = (v4 ? (2 * v4) - 1 : 0) + (v6 ? (2 * v6) - 1 : 0);
+		rcu_radix_stats(tree, &stats);
+		if (stats.nodes > bound || stats.nodes < stats.prefixes) {
+			failed("sequential", "update %u, %u nodes for %u+%u prefixes", i, stats.nodes, v4, v6);
+			break;
+		}
+	}
+	verify("sequential");
+	drain("sequential", created);
+}
+
+
+static void *
+reader(void *arg)
+{
+	struct reader *self = arg;
+	uint64_t state = 0x2545f4914f6cdd1dULL * (self->index + 1);
+
+	while (! LOAD(stop)) {
+		const unsigned q = random32r(&state) % nqueries;
+		const isc_prefix_t *address = queries + q;
+		const int token = rcu_read_enter();
+		void *data = NULL;
+
+		if (ISC_R_SUCCESS == rcu_radix_search(tree, address, &data)) {
+			const struct entry *e = data;
+
+			if (ENTRY_LIVE != e->magic) {
+				++self->failures;	/* reclaimed whilst referenced */
+			} else if (! covers(&e->prefix, address)) {
+				++self->failures;
+			} else if (best_stable[q] >= 0 && e->prefix.bitlen < stable[best_stable[q]].bitlen) {
+				++self->failures;	/* less specific than a stable prefix */
+			} else if (ENTRY_LIVE != e->magic) {
+				++self->failures;
+			}
+		} else if (best_stable[q] >= 0) {
+			++self->failures;		/* stable prefix missed */
+		}
+		rcu_read_exit(token);
+		++self->lookups;
+	}
+	return NULL;
+}
+
+
+static void
+test_concurrent(unsigned nreaders, unsigned seconds)
+{
+	struct reader *readers = calloc(nreaders, sizeof(struct reader));
+	unsigned long lookups = 0, failures = 0, updates = 0, created = nstable;
+	unsigned i, count, started = 0;
+	double start;
+
+	destroyed = 0;
+	if (NULL == readers) {
+		failed("concurrent", "out of memory");
+		return;
+	}
+	populate("concurrent");
+	if (NULL == tree) {
+		free(readers);
+		return;
+	}
+
+	STORE(stop, 0);
+	for (i = 0; i < nreaders; ++i, ++started) {
+		readers[i].index = i;
+		if (pthread_create(&readers[i].thread, NULL, reader, readers + i)) {
+			failed("concurrent", "pthread_create failed");
+			break;
+		}
+	}
+
+	start = now();
+	while ((now() - start) < seconds) {
+		for (count = 0; count < 256; ++count, ++updates) {
+			const int ret = toggle();
+
+			if (ret < 0) {
+				failed("concurrent", "update failed");
+				goto done;
+			}
+			created += (unsigned)ret;
+		}
+	}
+
+done:;	STORE(stop, 1);
+	for (i = 0; i < started; ++i) {
+		pthread_join(readers[i].thread, NULL);
+		lookups += readers[i].lookups;
+		failures += readers[i].failures;
+	}
+	if (failures)
+		failed("concurrent", "%lu mismatches whilst updating", failures);
+
+	verify("concurrent");
+	printf("rcu_radix_test: %u+%u prefixes, %u readers, %lu lookups, %lu updates\n",
+		nstable, nchanging, started, lookups, updates);
+	drain("concurrent", created);
+	free(readers);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned prefixes = (argc > 1 ? (unsigned)atoi(argv[1]) : 2000);
+	const unsigned nreaders = (argc > 2 ? (unsigned)atoi(argv[2]) : 4);
+	const unsigned seconds = (argc > 3 ? (unsigned)atoi(argv[3]) : 2);
+
+	if (0 == prefixes || 0 == nreaders || 0 == seconds || argc > 4) {
+		fprintf(stderr, "usage: rcu_radix_test [prefixes [readers [seconds]]]\n");
+		return 1;
+	}
+
+	test_match();
+	test_compression();
+	test_reclamation();
+	if (generate(prefixes) < 0) {
+		fprintf(stderr, "rcu_radix_test: out of memory\n");
+		return 1;
+	}
+	test_sequential(prefixes * 2);
+	test_concurrent(nreaders, seconds);
+
+	if (errors) {
+		fprintf(stderr, "rcu_radix_test: %lu failures\n", errors);
+		return 1;
+	}
+	printf("rcu_radix_test: passed\n");
+	free(stable), free(changing), free(present), free(queries), free(best_stable);
+	return 0;
+}
+
+//end
@@ -0,0 +1,313 @@
+
+//
+//  Batch lookup; parallel resolution of an address list.
+//
+//  The list is loaded (read or mapped) whole and split into records, which are
+//  sharded as contiguous ranges across worker threads. Each worker formats into
+//  its own buffer and records per lookup latency; buffers are emitted in shard
+//  order, so output follows input order.
+//
+
+#if !defined(_CRT_SECURE_NO_WARNINGS)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "batch.h"
+
+namespace {
+
+// Address list image, either mapped or read.
+class Source {
+	Source(const Source &) = delete;
+	Source& operator=(const Source &) = delete;
+
+public:
+	Source() : data_(nullptr), size_(0), mapped_(false)
+#if defined(_WIN32)
+		, file_(INVALID_HANDLE_VALUE), mapping_(NULL)
+#endif
+	{
+	}
+
+	~Source()
+	{
+		close();
+	}
+
+	bool open(const char *filename, bool map)
+	{
+		if (map && open_mapped(filename))
+			return true;
+
+		FILE *file = fopen(filename, "rb");
+		if (nullptr == file)
+			return false;
+
+		char buffer[64 * 1024];
+		size_t count;
+		while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			buffer_.insert(buffer_.end(), buffer, buffer + count);
+		fclose(file);
+		data_ = buffer_.data(), size_ = buffer_.size();
+		return true;
+	}
+
+	const char *data() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	bool mapped() const
+	{
+		return mapped_;
+	}
+
+private:
+	bool open_mapped(const char *filename)
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER size;
+
+		file_ = ::CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (INVALID_HANDLE_VALUE == file_ || !::GetFileSizeEx(file_, &size) || 0 == size.QuadPart) {
+			close();
+			return false;
+		}
+		if (NULL == (mapping_ = ::CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL)) ||
+				NULL == (data_ = (const char *)::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0))) {
+			close();
+			return false;
+		}
+		size_ = (size_t)size.QuadPart;
+#else
+		struct stat sb;
+		int fd;
+
+		if ((fd = ::open(filename, O_RDONLY)) < 0)
+			return false;
+		if (-1 == fstat(fd, &sb) || 0 == sb.st_size) {
+			::close(fd);
+			return false;
+		}
+		void *base = ::mmap(nullptr, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (MAP_FAILED == base)
+			return false;
+		data_ = (const char *)base, size_ = (size_t)sb.st_size;
+#endif
+		mapped_ = true;
+		return true;
+	}
+
+	void close()
+	{
+#if defined(_WIN32)
+		if (mapped_ && data_) ::UnmapViewOfFile(data_);
+		if (mapping_) ::CloseHandle(mapping_);
+		if (INVALID_HANDLE_VALUE != file_) ::CloseHandle(file_);
+		mapping_ = NULL, file_ = INVALID_HANDLE_VALUE;
+#else
+		if (mapped_ && data_) ::munmap((void *)data_, size_);
+#endif
+		data_ = nullptr, size_ = 0, mapped_ = false;
+	}
+
+private:
+	std::vector<char> buffer_;
+	const char *data_;
+	size_t size_;
+	bool mapped_;
+#if defined(_WIN32)
+	HANDLE file_, mapping_;
+#endif
+};
+
+
+struct Record {
+	size_t offset;
+	unsigned length;
+};
+
+
+// Split into address records; first field of each line, '#' comments ignored.
+static void
+split(const char *data, size_t size, std::vector<Record> &records)
+{
+	const char *cursor = data, *end = data + size;
+
+	while (cursor < end) {
+		const char *eol = (const char *)memchr(cursor, '\n', end - cursor);
+		if (nullptr == eol) eol = end;
+
+		const char *start = cursor, *last;
+		while (start < eol && (' ' == *start || '\t' == *start))
+			++start;
+		for (last = start; last < eol && ',' != *last && '#' != *last && '\r' != *last; ++last)
+			;
+		while (last > start && (' ' == last[-1] || '\t' == last[-1]))
+			--last;
+		if (last > start)
+			records.push_back({(size_t)(start - data), (unsigned)(last - start)});
+		cursor = eol + 1;
+	}
+}
+
+
+struct Shard {
+	size_t first, last;			// record range [first, last).
+	std::string output;
+	std::vector<uint32_t> latency;		// nanoseconds, per lookup.
+	unsigned resolved;
+};
+
+
+static void
+worker(const char *data, const std::vector<Record> &records, Shard &shard,
+	batch_resolver resolver, void *context, bool quiet)
+{
+	typedef std::chrono::steady_clock clock;
+	std::string result;
+	char address[128];
+
+	shard.latency.reserve(shard.last - shard.first);
+	shard.resolved = 0;
+	for (size_t idx = shard.first; idx < shard.last; ++idx) {
+		const Record &record = records[idx];
+		const unsigned length = std::min<unsigned>(record.length, sizeof(address) - 1);
+
+		memcpy(address, data + record.offset, length);
+		address[length] = 0;
+		result.clear();
+
+		const clock::time_point start = clock::now();
+		const bool found = resolver(context, address, result);
+		const clock::duration elapsed = clock::now() - start;
+
+		shard.latency.push_back((uint32_t)std::min<long long>(UINT32_MAX,
+			std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+		if (found)
+			++shard.resolved;
+		if (! quiet) {
+			shard.output.append(address, length);
+			shard.output.push_back(',');
+			shard.output.append(found ? result : std::string("--"));
+			shard.output.push_back('\n');
+		}
+	}
+}
+
+
+static double
+percentile(const std::vector<uint32_t> &sorted, double pct)
+{
+	if (sorted.empty())
+		return 0;
+	const size_t idx = (size_t)((pct / 100.0) * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(idx, sorted.size() - 1)] / 1000.0;
+}
+
+}; // anon namespace
+
+
+int
+batch_lookup(const struct batch_options &options, batch_resolver resolver, void *context)
+{
+	typedef std::chrono::steady_clock clock;
+	Source source;
+
+	if (! source.open(options.filename, options.mmap)) {
+		fprintf(stderr, "%s: unable to open batch source\n", options.filename);
+		return 3;
+	}
+
+	const clock::time_point load_start = clock::now();
+	std::vector<Record> records;
+	split(source.data(), source.size(), records);
+	const double load_seconds = std::chrono::duration<double>(clock::now() - load_start).count();
+
+	unsigned threads = options.threads;
+	if (0 == threads && 0 == (threads = std::thread::hardware_concurrency()))
+		threads = 1;
+	if (threads > records.size())
+		threads = records.size() ? (unsigned)records.size() : 1;
+
+	std::vector<Shard> shards(threads);
+	const size_t count = records.size(), chunk = count / threads, remainder = count % threads;
+	size_t cursor = 0;
+
+	for (unsigned t = 0; t < threads; ++t) {
+		shards[t].first = cursor;
+		cursor += chunk + (t < remainder ? 1 : 0);
+		shards[t].last = cursor;
+	}
+
+	const clock::time_point start = clock::now();
+	if (1 == threads) {
+		worker(source.data(), records, shards[0], resolver, context, options.quiet);
+	} else {
+		std::vector<std::thread> workers;
+		workers.reserve(threads);
+		for (unsigned t = 0; t < threads; ++t) {
+			workers.emplace_back(worker, source.data(), std::cref(records), std::ref(shards[t]),
+				resolver, context, options.quiet);
+		}
+		for (auto &w : workers)
+			w.join();
+	}
+	const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	std::vector<uint32_t> latency;
+	unsigned resolved = 0;
+
+	latency.reserve(count);
+	for (auto &shard : shards) {		// input order
+		if (! options.quiet)
+			fwrite(shard.output.data(), 1, shard.output.size(), stdout);
+		latency.insert(latency.end(), shard.latency.begin(), shard.latency.end());
+		resolved += shard.resolved;
+	}
+	fflush(stdout);
+	std::sort(latency.begin(), latency.end());
+
+	fprintf(stderr,
+		"\n  Batch:\n"
+		"    Source:        %s (%s, %.3f seconds to split)\n"
+		"    Addresses:     %u (%u resolved)\n"
+		"    Threads:       %u\n"
+		"    Elapsed:       %.3f seconds\n"
+		"    Throughput:    %.0f lookups per second\n"
+		"    Latency (us):  p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n\n",
+		options.filename, source.mapped() ? "mapped" : "read", load_seconds,
+		(unsigned)count, resolved, threads, seconds,
+		(seconds > 0 ? count / seconds : 0.0),
+		percentile(latency, 50), percentile(latency, 90), percentile(latency, 99),
+		percentile(latency, 99.9), (latency.empty() ? 0 : latency.back() / 1000.0));
+	return 0;
+}
+
+//end
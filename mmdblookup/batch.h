@@ -0,0 +1,19 @@
+#pragma once
+//
+//  Batch lookup; parallel resolution of an address list.
+//
+
+#include <string>
+
+typedef bool (*batch_resolver)(void *context, const char *address, std::string &result);
+
+struct batch_options {
+	const char *filename;		// address list.
+	unsigned threads;		// worker count; 0 = hardware concurrency.
+	bool mmap;			// map rather than read the list.
+	bool quiet;			// statistics only.
+};
+
+int	batch_lookup(const struct batch_options &options, batch_resolver resolver, void *context);
+
+//end
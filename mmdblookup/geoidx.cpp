@@ -0,0 +1,387 @@
+
+//
+//  Native geoip range index (.gidx), builder and lookup.
+//
+//  Compiles start,end,country CSV range files, for example geoips.txt and geoips6.txt,
+//  into the memory mappable image described by libinetd/geoidx.h.
+//
+
+#if !defined(_CRT_SECURE_NO_WARNINGS)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../libinetd/geoidx.h"
+#include "geoidx.h"
+#include "batch.h"
+
+namespace {
+
+struct Range4 {
+	uint32_t start, end;
+	char code[4];
+};
+
+struct Range6 {
+	inetd::GeoIndex::key6 start, end;
+	char code[4];
+};
+
+static inline bool
+operator<(const inetd::GeoIndex::key6 &a, const inetd::GeoIndex::key6 &b)
+{
+	return (a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo));
+}
+
+static std::string&
+trim(std::string &s, const char *c = " \t\n\r")
+{
+	s.erase(s.find_last_not_of(c) + 1);
+	s.erase(0, s.find_first_not_of(c));
+	return s;
+}
+
+static bool
+to_code(std::string &value, char code[4])
+{
+	trim(value);
+	if (value.empty() || value.size() > 3)
+		return false;
+	memset(code, 0, 4);
+	for (unsigned i = 0; i < value.size(); ++i) {
+		if (! isalnum((unsigned char)value[i]))
+			return false;
+		code[i] = (char)toupper((unsigned char)value[i]);
+	}
+	return true;
+}
+
+
+// Parse a source; "start,end,country" with '#' comments.
+static bool
+parse(const char *filename, std::vector<Range4> &v4, std::vector<Range6> &v6)
+{
+	std::ifstream stream(filename);
+	if (stream.fail()) {
+		fprintf(stderr, "%s: unable to open source\n", filename);
+		return false;
+	}
+
+	std::string line;
+	unsigned lineno = 0;
+
+	line.reserve(1024);
+	while (std::getline(stream, line)) {
+		++lineno;
+
+		const size_t bang = line.find_first_of('#');
+		if (bang != std::string::npos)
+			line.erase(bang);
+		if (trim(line).empty())
+			continue;
+
+		const size_t c1 = line.find(','), c2 = (c1 == std::string::npos ? c1 : line.find(',', c1 + 1));
+		if (c2 == std::string::npos) {
+			fprintf(stderr, "%s(%u): expected start,end,country\n", filename, lineno);
+			return false;
+		}
+
+		std::string start(line, 0, c1), end(line, c1 + 1, c2 - (c1 + 1)), code(line, c2 + 1);
+		trim(start), trim(end);
+
+		if (start.find(':') == std::string::npos) {
+			unsigned char s[4], e[4];
+			Range4 range;
+
+			if (1 != inet_pton(AF_INET, start.c_str(), s) || 1 != inet_pton(AF_INET, end.c_str(), e) ||
+					! to_code(code, range.code)) {
+				fprintf(stderr, "%s(%u): invalid range <%s>\n", filename, lineno, line.c_str());
+				return false;
+			}
+			range.start = inetd::GeoIndex::to_key4(s);
+			range.end = inetd::GeoIndex::to_key4(e);
+			if (range.end < range.start) {
+				fprintf(stderr, "%s(%u): inverted range <%s>\n", filename, lineno, line.c_str());
+				return false;
+			}
+			v4.push_back(range);
+
+		} else {
+			unsigned char s[16], e[16];
+			Range6 range;
+
+			if (1 != inet_pton(AF_INET6, start.c_str(), s) || 1 != inet_pton(AF_INET6, end.c_str(), e) ||
+					! to_code(code, range.code)) {
+				fprintf(stderr, "%s(%u): invalid range <%s>\n", filename, lineno, line.c_str());
+				return false;
+			}
+			range.start = inetd::GeoIndex::to_key6(s);
+			range.end = inetd::GeoIndex::to_key6(e);
+			if (range.end < range.start) {
+				fprintf(stderr, "%s(%u): inverted range <%s>\n", filename, lineno, line.c_str());
+				return false;
+			}
+			v6.push_back(range);
+		}
+	}
+	return true;
+}
+
+
+// Sort and verify ranges are disjoint.
+template<typename Range>
+static bool
+order(std::vector<Range> &ranges, const char *family)
+{
+	std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) {
+			return a.start < b.start;
+		});
+	for (size_t idx = 1; idx < ranges.size(); ++idx) {
+		if (! (ranges[idx - 1].end < ranges[idx].start)) {
+			fprintf(stderr, "%s: overlapping ranges, entries %u and %u (%.4s/%.4s)\n", family,
+				(unsigned)idx - 1, (unsigned)idx, ranges[idx - 1].code, ranges[idx].code);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// In-order walk of the implicit tree, assigning sorted elements to Eytzinger slots.
+template<typename Key, typename Range>
+static void
+eytzinger(const std::vector<Range> &ranges, Key *keys, uint32_t *ranks, size_t k, size_t &idx)
+{
+	if (k <= ranges.size()) {
+		eytzinger(ranges, keys, ranks, 2 * k, idx);
+		keys[k] = ranges[idx].start;
+		ranks[k] = (uint32_t)idx++;
+		eytzinger(ranges, keys, ranks, (2 * k) + 1, idx);
+	}
+}
+
+
+template<typename Key, typename Range>
+static void
+layout(std::vector<char> &image, const std::vector<Range> &ranges,
+	uint64_t &keys, uint64_t &ranks, uint64_t &ends, uint64_t &codes)
+{
+	const size_t n = ranges.size();
+	size_t offset = image.size();
+
+	keys = offset = inetd::GeoIndex::align(offset);
+	ranks = offset = inetd::GeoIndex::align(offset + ((n + 1) * sizeof(Key)));
+	ends = offset = inetd::GeoIndex::align(offset + ((n + 1) * sizeof(uint32_t)));
+	codes = offset = inetd::GeoIndex::align(offset + (n * sizeof(Key)));
+	image.resize(inetd::GeoIndex::align(offset + (n * 4)));
+
+	Key *t_keys = (Key *)(image.data() + keys);
+	uint32_t *t_ranks = (uint32_t *)(image.data() + ranks);
+	Key *t_ends = (Key *)(image.data() + ends);
+	char *t_codes = image.data() + codes;
+	size_t idx = 0;
+
+	memset(t_keys, 0, sizeof(Key)), t_ranks[0] = 0;
+	eytzinger(ranges, t_keys, t_ranks, 1, idx);
+	for (idx = 0; idx < n; ++idx) {
+		t_ends[idx] = ranges[idx].end;
+		memcpy(t_codes + (idx * 4), ranges[idx].code, 4);
+	}
+}
+
+
+static bool
+load(const char *filename, std::vector<char> &image)
+{
+	FILE *file = fopen(filename, "rb");
+	if (nullptr == file) {
+		fprintf(stderr, "%s: unable to open database\n", filename);
+		return false;
+	}
+
+	char buffer[64 * 1024];
+	size_t count;
+
+	image.clear();
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		image.insert(image.end(), buffer, buffer + count);
+	fclose(file);
+	return true;
+}
+
+
+static const char *
+lookup(const inetd::GeoIndex &index, const char *address)
+{
+	unsigned char addr[16];
+
+	if (1 == inet_pton(AF_INET, address, addr))
+		return index.lookup4(inetd::GeoIndex::to_key4(addr));
+	if (1 == inet_pton(AF_INET6, address, addr)) {
+		static const unsigned char mapped[12] = {0,0,0,0,0,0,0,0,0,0,0xff,0xff};
+		if (0 == memcmp(addr, mapped, sizeof(mapped))) {
+			if (const char *code = index.lookup4(inetd::GeoIndex::to_key4(addr + 12)))
+				return code;
+		}
+		return index.lookup6(inetd::GeoIndex::to_key6(addr));
+	}
+	return nullptr;
+}
+
+
+static bool
+resolve(void *context, const char *address, std::string &result)
+{
+	if (const char *code = lookup(*(const inetd::GeoIndex *)context, address)) {
+		result.assign(code, strnlen(code, 4));
+		return true;
+	}
+	return false;
+}
+
+}; // anon namespace
+
+
+int
+geoidx_build(const std::vector<const char *> &sources, const char *output, bool verbose)
+{
+	std::vector<Range4> v4;
+	std::vector<Range6> v6;
+
+	for (const char *source : sources) {
+		if (! parse(source, v4, v6))
+			return 3;
+	}
+
+	if (! order(v4, "ipv4") || ! order(v6, "ipv6"))
+		return 3;
+
+	std::vector<char> image(sizeof(inetd::GeoIndex::header));
+	inetd::GeoIndex::header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, inetd::GeoIndex::magic(), sizeof(hdr.magic));
+	hdr.version = inetd::GeoIndex::VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.v4count = (uint32_t)v4.size();
+	hdr.v6count = (uint32_t)v6.size();
+	layout<uint32_t>(image, v4, hdr.v4keys, hdr.v4ranks, hdr.v4ends, hdr.v4codes);
+	layout<inetd::GeoIndex::key6>(image, v6, hdr.v6keys, hdr.v6ranks, hdr.v6ends, hdr.v6codes);
+	hdr.size = image.size();
+	memcpy(image.data(), &hdr, sizeof(hdr));
+
+	inetd::GeoIndex index;
+	if (! index.attach(image.data(), image.size())) {
+		fprintf(stderr, "%s: internal error, image verification\n", output);
+		return 3;
+	}
+
+	FILE *file = fopen(output, "wb");
+	if (nullptr == file ||
+		    image.size() != fwrite(image.data(), 1, image.size(), file) || 0 != fclose(file)) {
+		fprintf(stderr, "%s: unable to write database\n", output);
+		if (file) fclose(file);
+		remove(output);
+		return 3;
+	}
+
+	if (verbose) {
+		fprintf(stdout, "%s: %u ipv4 and %u ipv6 ranges, %u bytes\n",
+			output, hdr.v4count, hdr.v6count, (unsigned)hdr.size);
+	}
+	return 0;
+}
+
+
+int
+geoidx_lookup(const char *database, const std::vector<const char *> &ips,
+		const std::vector<const char *> &files, bool quiet, bool verbose)
+{
+	std::vector<char> image;
+	inetd::GeoIndex index;
+
+	if (! load(database, image))
+		return 3;
+	if (! index.attach(image.data(), image.size())) {
+		fprintf(stderr, "%s: not a valid geoip index\n", database);
+		return 3;
+	}
+
+	if (verbose) {
+		fprintf(stdout, "\n  Index:\n    IPv4 ranges:   %u\n    IPv6 ranges:   %u\n\n",
+			index.v4count(), index.v6count());
+	}
+
+	for (const char *ip : ips) {
+		const char *code = lookup(index, ip);
+		printf("IP: %s\n  country: %.4s\n\n", ip, code ? code : "--");
+	}
+
+	for (const char *filename : files) {
+		std::ifstream stream(filename);
+		if (stream.fail()) {
+			fprintf(stderr, "%s: unable to open source\n", filename);
+			return 3;
+		}
+
+		clock_t const clock_start = clock();
+		std::string line;
+		unsigned count = 0;
+
+		while (std::getline(stream, line)) {
+			const size_t bang = line.find_first_of('#');
+			if (bang != std::string::npos)
+				line.erase(bang);
+			if (trim(line).empty())
+				continue;
+
+			const size_t comma = line.find_first_of(',');
+			if (comma != std::string::npos)	// first element
+				line.erase(comma);
+			const char *code = lookup(index, trim(line).c_str());
+			if (! quiet)
+				printf("IP: %s\n  country: %.4s\n\n", line.c_str(), code ? code : "--");
+			++count;
+		}
+
+		if (verbose) {
+			clock_t const clock_diff = clock() - clock_start;
+			double const seconds = (double)clock_diff / CLOCKS_PER_SEC;
+			fprintf(stdout, "%u addresses in %.2f seconds. %.2Lf lookups per second.\n",
+					count, seconds, (long double)count / seconds);
+		}
+	}
+	return 0;
+}
+
+
+
+int
+geoidx_batch(const char *database, const struct batch_options &options)
+{
+	std::vector<char> image;
+	inetd::GeoIndex index;
+
+	if (! load(database, image))
+		return 3;
+	if (! index.attach(image.data(), image.size())) {
+		fprintf(stderr, "%s: not a valid geoip index\n", database);
+		return 3;
+	}
+	return batch_lookup(options, resolve, &index);
+}
+
+//end
@@ -0,0 +1,15 @@
+#pragma once
+//
+//  Native geoip range index (.gidx), builder and lookup.
+//
+
+#include <vector>
+
+struct batch_options;
+
+int	geoidx_build(const std::vector<const char *> &sources, const char *output, bool verbose);
+int	geoidx_lookup(const char *database, const std::vector<const char *> &ips,
+		const std::vector<const char *> &files, bool quiet, bool verbose);
+int	geoidx_batch(const char *database, const struct batch_options &options);
+
+//end
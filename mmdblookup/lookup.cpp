@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
 
 #include <fstream>
@@ -29,6 +30,8 @@
 #endif
 
 #include "../libinetd/ServiceGetOpt.h"
+#include "geoidx.h"
+#include "batch.h"
 
 #include <netdb.h>
 
@@ -60,14 +63,20 @@ namespace std {
 static bool	mmdbopen(const char *filename, MMDB_s *mmdb);
 static void	mmdbmeta(MMDB_s *mmdb);
 static int	mmdblookup(MMDB_s *mmdb, const char *ip_address, bool quiet);
+static bool	mmdbresolve(void *context, const char *ip_address, std::string &result);
 #endif
 static void	usage(const inetd::Getopt &options, const char *fmt, ...); /*no-return*/
 
-static const char *short_options = "f:i:q:v";
+static const char *short_options = "b:f:i:o:q:t:v";
 static struct inetd::Getopt::Option long_options[] = {
 	{ "db",         inetd::Getopt::argument_required, NULL,   'd'  },
 	{ "ip",         inetd::Getopt::argument_required, NULL,   'i'  },
 	{ "file",       inetd::Getopt::argument_required, NULL,   'f'  },
+	{ "build",      inetd::Getopt::argument_required, NULL,   'b'  },
+	{ "output",     inetd::Getopt::argument_required, NULL,   'o'  },
+	{ "batch",      inetd::Getopt::argument_required, NULL,   1101 },
+	{ "threads",    inetd::Getopt::argument_required, NULL,   't'  },
+	{ "mmap",       inetd::Getopt::argument_none,     NULL,   1102 },
 	{ "quiet",      inetd::Getopt::argument_none,     NULL,   'q'  },
 	{ "verbose",    inetd::Getopt::argument_none,     NULL,   'v'  },
 	{ "usage",      inetd::Getopt::argument_none,     NULL,   1100 },
@@ -153,9 +162,10 @@ int
 main(int argc, const char **argv)
 {
 	inetd::Getopt options(short_options, long_options);
-	Vector ips, files;
+	Vector ips, files, sources;
 	std::string errmsg;
-	const char *database = NULL;
+	const char *database = NULL, *output = NULL;
+	struct batch_options batch = {0};
 
 	while (-1 != options.shift(argc, argv, errmsg)) {
 		switch (options.optret()) {
@@ -169,6 +179,30 @@ main(int argc, const char **argv)
 				database = t_database;
 			}
 			break;
+		case 'b':
+			sources.push_back(options.optarg());
+			break;
+		case 'o':
+			output = options.optarg();
+			break;
+		case 1101:	// batch
+			if (batch.filename) {
+				usage(options, "multiple batch sources specified");
+			}
+			batch.filename = options.optarg();
+			break;
+		case 't': {
+				char *end = NULL;
+				const unsigned long threads = strtoul(options.optarg(), &end, 10);
+				if (*end || threads > 256) {
+					usage(options, "invalid thread count <%s>", options.optarg());
+				}
+				batch.threads = (unsigned)threads;
+			}
+			break;
+		case 1102:	// mmap
+			batch.mmap = true;
+			break;
 		case 'f':
 			files.push_back(options.optarg());
 			break;
@@ -190,13 +224,28 @@ main(int argc, const char **argv)
 		}
 	}
 
+	argv += options.optind();
+	if (0 != (argc -= options.optind())) {
+		usage(options, "unexpected arguments %s ...", argv[0]);
+	}
+
+	if (! sources.empty()) {		// native index builder
+		if (NULL == output || !*output) {
+			usage(options, "BUILD option, output missing");
+		}
+		return geoidx_build(sources, output, verbose);
+	}
+
 	if (NULL == database) {
 		usage(options, "database missing");
 	}
 
-	argv += options.optind();
-	if (0 != (argc -= options.optind())) {
-		usage(options, "unexpected arguments %s ...", argv[0]);
+	const char *ext = strrchr(database, '.');
+	batch.quiet = quiet;
+	if (ext && 0 == strcmp(ext, ".gidx")) {	// native index
+		if (batch.filename)
+			return geoidx_batch(database, batch);
+		return geoidx_lookup(database, ips, files, quiet, verbose);
 	}
 
 #if defined(HAVE_LIBMAXMINDDB)
@@ -206,6 +255,12 @@ main(int argc, const char **argv)
 	if (verbose)
 		mmdbmeta(&mmdb);
 
+	if (batch.filename) {
+		const int ret = batch_lookup(batch, mmdbresolve, &mmdb);
+		MMDB_close(&mmdb);
+		return ret;
+	}
+
 	for (Vector::const_iterator it(ips.begin()), end(ips.end()); it != end; ++it)
 		mmdblookup(&mmdb, *it, false);
 
@@ -241,16 +296,23 @@ usage(const inetd::Getopt &options, const char *fmt, ...)
 	}
 
 	fprintf(stderr,
-	    "Usage: %s [options] --db <mmdb> --file <file> | --ip <addr> ..\n\n", options.progname());
+	    "Usage: %s [options] --db <mmdb|gidx> --file <file> | --ip <addr> ..\n"
+	    "       %s [options] --build <csv> .. --output <gidx>\n\n", options.progname(), options.progname());
 	fprintf(stderr,
 	    "options:\n"
 	    " -v,--verbose         Database meta and performance stats.\n"
 	    " -q,--quiet           Quiet file mode; lookup only, wont dump associated data-set.\n"
 	    "\n"
 	    "arguments:\n"
-	    " -d,--db <database>   MMDB file path, required.\n"
+	    " -d,--db <database>   MMDB or native index (.gidx) file path, required.\n"
 	    " -i,--ip <path>       Address to resolve, none or more.\n"
 	    " -f,--file <file>     Address list, none or more.\n"
+	    " -b,--build <csv>     Native index source; start,end,country ranges, one or more.\n"
+	    " -o,--output <gidx>   Native index image to be generated.\n"
+	    "    --batch <file>    Batch mode; resolve the address list in parallel, output in input order\n"
+	    "                      as <address>,<country>, with throughput and latency statistics.\n"
+	    " -t,--threads <n>     Batch worker threads; default hardware concurrency.\n"
+	    "    --mmap            Batch source is memory mapped, rather than read.\n"
 	    );
 	exit(3);
 }
@@ -363,6 +425,31 @@ end:
 	MMDB_free_entry_data_list(entry_data_list);
 	return rtn;
 }
+
+
+// batch resolver; country iso code.
+static bool
+mmdbresolve(void *context, const char *ip_address, std::string &result)
+{
+	MMDB_s *mmdb = (MMDB_s *)context;
+	int gai_error, mmdb_error;
+	MMDB_lookup_result_s lookup =
+		MMDB_lookup_string(mmdb, ip_address, &gai_error, &mmdb_error);
+
+	if (0 != gai_error || MMDB_SUCCESS != mmdb_error || !lookup.found_entry)
+		return false;
+
+	MMDB_entry_data_s entry_data = {};
+	int status = MMDB_get_value(&lookup.entry, &entry_data, "country", "iso_code", NULL);
+	if (MMDB_SUCCESS != status)
+		status = MMDB_get_value(&lookup.entry, &entry_data, "registered_country", "iso_code", NULL);
+	if (MMDB_SUCCESS == status && entry_data.has_data && MMDB_DATA_TYPE_UTF8_STRING == entry_data.type) {
+		result.assign(entry_data.utf8_string, entry_data.data_size);
+	} else {
+		result.assign("?");
+	}
+	return true;
+}
 #endif //HAVE_LIBMAXMINDDB
 
 //end
@@ -0,0 +1,532 @@
+/* -*- mode: c; indent-width: 8; -*- */
+/*
+ * windows inetd service - geoip range index test.
+ *
+ * Copyright (c) 2022, Adam Young.
+ * All rights reserved.
+ *
+ * The applications are free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 3.
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, and must be distributed with the license document above.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, and must include the license document above in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * This project is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * license for more details.
+ * ==
+ */
+
+/*
+ *  The .gidx builder and index, see geoidx.cpp and ../libinetd/geoidx.h:
+ *
+ *	o edges; range boundaries, adjacent and single address ranges, the extremes of each
+ *	  family, plus comments, blank lines, spacing and case within the sources. Families
+ *	  are kept apart; a v4-mapped address resolves only within the ipv6 table.
+ *	o sources; overlapping, inverted and malformed ranges are rejected, including an
+ *	  overlap between sources, and no image is written.
+ *	o reference; random disjoint ranges, counts either side of each Eytzinger level
+ *	  boundary, against a linear scan. Every range edge, start-1, start, end and end+1,
+ *	  is probed together with random addresses.
+ *	o attach; damaged images are rejected, including out of range ranks and counts whose
+ *	  table lengths would wrap in 32-bit arithmetic, and a rejected image detaches.
+ *
+ *	geoidx_test [ranges [lookups]]
+ */
+
+#if !defined(_CRT_SECURE_NO_WARNINGS)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../../libinetd/geoidx.h"
+#include "../../libinetd/test/unittest.h"
+#include "../geoidx.h"
+
+typedef inetd::GeoIndex::key6 key6;
+typedef inetd::GeoIndex::header header;
+
+static const char *source4 = "geoidx_test4.txt";
+static const char *source6 = "geoidx_test6.txt";
+static const char *database = "geoidx_test.gidx";
+
+static unsigned long errors;
+
+struct Range4 {
+	uint32_t start, end;
+	char code[4];
+};
+
+struct Range6 {
+	key6 start, end;
+	char code[4];
+};
+
+
+static void
+failed(const char *test, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "geoidx_test: %s, ", test);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	++errors;
+}
+
+
+static bool
+operator<=(const key6 &a, const key6 &b)
+{
+	return (a.hi < b.hi || (a.hi == b.hi && a.lo <= b.lo));
+}
+
+
+static key6
+next6(key6 key, int delta)
+{
+	if (delta > 0) {
+		if (0 == ++key.lo) ++key.hi;
+	} else {
+		if (0 == key.lo--) --key.hi;
+	}
+	return key;
+}
+
+
+static bool
+same(const char *code, const char *expected)
+{
+	if (nullptr == code || nullptr == expected)
+		return (code == expected);
+	return (0 == strncmp(code, expected, 4));
+}
+
+
+static bool
+save(const char *filename, const char *text)
+{
+	FILE *file = fopen(filename, "w");
+
+	if (nullptr == file)
+		return false;
+	fputs(text, file);
+	return (0 == fclose(file));
+}
+
+
+/*
+ *  Build the database from the two sources; returns the builder status.
+ */
+static int
+compile(const char *text4, const char *text6)
+{
+	const std::vector<const char *> sources = {source4, source6};
+
+	(void) remove(database);
+	if (! save(source4, text4) || ! save(source6, text6))
+		return -1;
+	return geoidx_build(sources, database, false);
+}
+
+
+static bool
+load(std::vector<uint64_t> &image, size_t &size)
+{
+	FILE *file;
+
+	if (nullptr == (file = fopen(database, "rb")))
+		return false;
+	fseek(file, 0, SEEK_END);
+	size = (size_t)ftell(file);
+	fseek(file, 0, SEEK_SET);
+	image.assign((size / sizeof(uint64_t)) + 1, 0);	// 8 byte aligned copy.
+	const bool success = (size == fread(image.data(), 1, size, file));
+	fclose(file);
+	return success;
+}
+
+
+/*
+ *  Lookup by address text; no v4-mapped fallback, unlike geoips::allowed().
+ */
+static const char *
+find(const inetd::GeoIndex &index, const char *text)
+{
+	unsigned char addr[16];
+
+	if (1 == inet_pton(AF_INET, text, addr))
+		return index.lookup4(inetd::GeoIndex::to_key4(addr));
+	if (1 == inet_pton(AF_INET6, text, addr))
+		return index.lookup6(inetd::GeoIndex::to_key6(addr));
+	return nullptr;
+}
+
+
+static const char edges4[] =
+	"# start,end,country\n"
+	"\n"
+	"0.0.0.0, 0.255.255.255, zz\t# lower extreme\n"
+	"1.0.0.0,1.0.0.255,AU\n"
+	"1.0.1.0,1.0.1.255,nz\t\t# adjacent\n"
+	"  1.0.2.7 , 1.0.2.7 , Sg \n"
+	"8.8.8.0,8.8.8.255,US1\n"
+	"# 9.0.0.0,9.255.255.255,CA\n"
+	"255.255.255.255,255.255.255.255,XX\n";
+
+static const char edges6[] =
+	"::,::ffff,ZZ\n"
+	"::ffff:0.0.0.0,::ffff:255.255.255.255,MP\n"
+	"2001:db8::,2001:db8::ffff:ffff:ffff:ffff,JP\n"
+	"2001:db8:0:1::,2001:db8:0:1::,sg\t# single\n"
+	"\n"
+	"ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff,ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff,XX\n";
+
+
+static void
+test_edges()
+{
+	static const struct {
+		const char *address, *expected;
+	} probes[] = {
+		{"0.0.0.0", "ZZ"}, {"0.255.255.255", "ZZ"},
+		{"1.0.0.0", "AU"}, {"1.0.0.255", "AU"}, {"1.0.1.0", "NZ"}, {"1.0.1.255", "NZ"},
+		{"1.0.2.0", nullptr}, {"1.0.2.6", nullptr}, {"1.0.2.7", "SG"}, {"1.0.2.8", nullptr},
+		{"8.8.7.255", nullptr}, {"8.8.8.8", "US1"}, {"8.8.9.0", nullptr},
+		{"9.1.2.3", nullptr}, {"255.255.255.254", nullptr}, {"255.255.255.255", "XX"},
+		{"::", "ZZ"}, {"::ffff", "ZZ"}, {"::1:0", nullptr},
+		{"::ffff:1.0.0.1", "MP"}, {"::fffe:ffff:ffff", nullptr},
+		{"2001:db7:ffff:ffff:ffff:ffff:ffff:ffff", nullptr}, {"2001:db8::", "JP"},
+		{"2001:db8::ffff:ffff:ffff:ffff", "JP"}, {"2001:db8:0:1::", "SG"}, {"2001:db8:0:1::1", nullptr},
+		{"ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffe", nullptr},
+		{"ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", "XX"},
+		};
+	std::vector<uint64_t> image;
+	inetd::GeoIndex index;
+	size_t size = 0;
+
+	if (0 != compile(edges4, edges6) || ! load(image, size) || ! index.attach(image.data(), size)) {
+		failed("edges", "build failed");
+		return;
+	}
+	if (6 != index.v4count() || 5 != index.v6count())
+		failed("edges", "%u/%u ranges, expected 6/5", index.v4count(), index.v6count());
+
+	for (const auto &probe : probes) {
+		const char *code = find(index, probe.address);
+
+		if (! same(code, probe.expected))
+			failed("edges", "%s, %.4s expected %s", probe.address,
+				(code ? code : "none"), (probe.expected ? probe.expected : "none"));
+	}
+}
+
+
+static void
+test_sources()
+{
+	static const struct {
+		const char *text4, *text6, *reason;
+	} sources[] = {
+		{"1.0.0.0,1.0.0.255,AU\n1.0.0.255,1.0.1.0,NZ\n", "", "overlap, single address"},
+		{"1.0.0.0,1.0.255.255,AU\n1.0.3.0,1.0.3.255,NZ\n", "", "overlap, nested"},
+		{"", "2001:db8::,2001:db8::ff,JP\n2001:db8::80,2001:db8::100,SG\n", "overlap, ipv6"},
+		{"1.0.0.0,1.0.0.255,AU\n", "1.0.0.128,1.0.0.128,NZ\n", "overlap, between sources"},
+		{"1.0.0.9,1.0.0.1,AU\n", "", "inverted"},
+		{"", "2001:db8::1,2001:db8::,JP\n", "inverted, ipv6"},
+		{"1.0.0.256,1.0.1.0,AU\n", "", "invalid address"},
+		{"1.0.0.0,::1,AU\n", "", "mixed families"},
+		{"1.0.0.0,1.0.0.255\n", "", "missing country"},
+		{"1.0.0.0,1.0.0.255,\n", "", "empty country"},
+		{"1.0.0.0,1.0.0.255,ABCD\n", "", "long country"},
+		{"1.0.0.0,1.0.0.255,A-\n", "", "invalid country"},
+		};
+
+	for (const auto &source : sources) {
+		FILE *file;
+
+		if (0 == compile(source.text4, source.text6))
+			failed("sources", "%s accepted", source.reason);
+		if (nullptr != (file = fopen(database, "rb"))) {
+			failed("sources", "%s, image written", source.reason);
+			fclose(file);
+		}
+	}
+
+	if (0 != compile("1.0.0.0,1.0.0.255,AU\n", "1.0.1.0,1.0.1.0,NZ\n"))
+		failed("sources", "adjacent between sources rejected");
+}
+
+
+/*
+ *  Sorted disjoint ranges, one per slot of the address space; slots are either filled
+ *  (adjacent to their neighbours) or hold a random sub-range.
+ */
+static void
+random_ranges(unsigned n, std::vector<Range4> &v4, std::vector<Range6> &v6)
+{
+	v4.resize(n), v6.resize(n);
+	if (0 == n)
+		return;
+
+	const uint64_t width4 = ((uint64_t)1 << 32) / n;
+	const uint64_t width6 = (~(uint64_t)0 / n);
+
+	for (unsigned i = 0; i < n; ++i) {
+		const uint64_t base4 = i * width4, last4 = (i + 1 == n ? 0xffffffffULL : base4 + width4 - 1);
+		const uint64_t base6 = i * width6, last6 = (i + 1 == n ? ~(uint64_t)0 : base6 + width6 - 1);
+		Range4 &r4 = v4[i];
+		Range6 &r6 = v6[i];
+
+		if (0 == (random32() % 3)) {		// filled
+			r4.start = (uint32_t)base4, r4.end = (uint32_t)last4;
+			r6.start.hi = base6, r6.start.lo = 0;
+			r6.end.hi = last6, r6.end.lo = ~(uint64_t)0;
+
+		} else {
+			const uint64_t span4 = last4 - base4, span6 = last6 - base6;
+			const uint64_t s4 = random32() % (span4 + 1), e4 = s4 + (random32() % (span4 - s4 + 1));
+
+			r4.start = (uint32_t)(base4 + s4), r4.end = (uint32_t)(base4 + e4);
+			r6.start.hi = base6 + (span6 ? random64() % span6 : 0);
+			r6.start.lo = random64();
+			r6.end.hi = r6.start.hi + (r6.start.hi < last6 ? random32() % 2 : 0);
+			r6.end.lo = random64();
+			if (r6.end.hi == r6.start.hi)		// within the remainder of the block.
+				r6.end.lo = r6.start.lo + (~r6.start.lo ? r6.end.lo % ~r6.start.lo : 0);
+		}
+
+		for (char *code : {r4.code, r6.code}) {
+			memset(code, 0, 4);
+			code[0] = (char)('A' + (random32() % 26));
+			code[1] = (char)('A' + (random32() % 26));
+		}
+	}
+}
+
+
+/*
+ *  Sources, shuffled, as text.
+ */
+static void
+format_sources(const std::vector<Range4> &v4, const std::vector<Range6> &v6,
+		std::string &text4, std::string &text6)
+{
+	std::vector<std::string> lines;
+	char start[INET6_ADDRSTRLEN], end[INET6_ADDRSTRLEN];
+
+	for (unsigned family = 0; family < 2; ++family) {
+		const size_t n = (family ? v6.size() : v4.size());
+		std::string &text = (family ? text6 : text4);
+
+		lines.clear();
+		for (size_t i = 0; i < n; ++i) {
+			unsigned char s[16], e[16];
+
+			if (family) {
+				for (unsigned b = 0; b < 8; ++b) {
+					s[b] = (unsigned char)(v6[i].start.hi >> (56 - (b * 8)));
+					s[8 + b] = (unsigned char)(v6[i].start.lo >> (56 - (b * 8)));
+					e[b] = (unsigned char)(v6[i].end.hi >> (56 - (b * 8)));
+					e[8 + b] = (unsigned char)(v6[i].end.lo >> (56 - (b * 8)));
+				}
+				inet_ntop(AF_INET6, s, start, sizeof(start));
+				inet_ntop(AF_INET6, e, end, sizeof(end));
+			} else {
+				for (unsigned b = 0; b < 4; ++b) {
+					s[b] = (unsigned char)(v4[i].start >> (24 - (b * 8)));
+					e[b] = (unsigned char)(v4[i].end >> (24 - (b * 8)));
+				}
+				inet_ntop(AF_INET, s, start, sizeof(start));
+				inet_ntop(AF_INET, e, end, sizeof(end));
+			}
+			lines.push_back(std::string(start) + "," + end + "," +
+				std::string(family ? v6[i].code : v4[i].code, 2) + "\n");
+		}
+
+		for (size_t i = lines.size(); i > 1; --i)
+			std::swap(lines[i - 1], lines[random32() % i]);
+		text.clear();
+		for (const std::string &line : lines)
+			text += line;
+	}
+}
+
+
+static const char *
+reference4(const std::vector<Range4> &v4, uint32_t addr)
+{
+	for (const Range4 &range : v4)
+		if (range.start <= addr && addr <= range.end)
+			return range.code;
+	return nullptr;
+}
+
+
+static const char *
+reference6(const std::vector<Range6> &v6, const key6 &addr)
+{
+	for (const Range6 &range : v6)
+		if (range.start <= addr && addr <= range.end)
+			return range.code;
+	return nullptr;
+}
+
+
+static void
+test_reference(unsigned nranges, unsigned lookups)
+{
+	std::vector<unsigned> counts = {0, 1, 2, 3, 4, 6, 7, 8, 9, 15, 16, 17, 31, 63, 64, 65, 255, 256, 1023};
+	std::vector<uint64_t> image;
+	std::vector<Range4> v4;
+	std::vector<Range6> v6;
+	std::string text4, text6;
+	size_t size = 0;
+
+	counts.push_back(nranges);
+	for (unsigned n : counts) {
+		std::vector<uint32_t> probes4 = {0, 1, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff};
+		std::vector<key6> probes6 = {{0, 0}, {0, 1}, {0, ~(uint64_t)0}, {1, 0},
+				{~(uint64_t)0, ~(uint64_t)0 - 1}, {~(uint64_t)0, ~(uint64_t)0}};
+		inetd::GeoIndex index;
+
+		random_ranges(n, v4, v6);
+		format_sources(v4, v6, text4, text6);
+		if (0 != compile(text4.c_str(), text6.c_str()) || ! load(image, size) ||
+				! index.attach(image.data(), size)) {
+			failed("reference", "%u ranges, build failed", n);
+			continue;
+		}
+		if (index.v4count() != n || index.v6count() != n)
+			failed("reference", "%u ranges, %u/%u indexed", n, index.v4count(), index.v6count());
+
+		for (const Range4 &range : v4) {
+			probes4.push_back(range.start - 1), probes4.push_back(range.start);
+			probes4.push_back(range.end), probes4.push_back(range.end + 1);
+		}
+		for (const Range6 &range : v6) {
+			probes6.push_back(next6(range.start, -1)), probes6.push_back(range.start);
+			probes6.push_back(range.end), probes6.push_back(next6(range.end, 1));
+		}
+		for (unsigned i = 0, count = (n == nranges ? lookups : 64); i < count; ++i) {
+			probes4.push_back(random32());
+			probes6.push_back(key6{random64(), random64()});
+		}
+
+		for (uint32_t addr : probes4) {
+			if (! same(index.lookup4(addr), reference4(v4, addr)))
+				failed("reference", "%u ranges, ipv4 0x%08x", n, addr);
+		}
+		for (const key6 &addr : probes6) {
+			if (! same(index.lookup6(addr), reference6(v6, addr)))
+				failed("reference", "%u ranges, ipv6 0x%016llx%016llx", n,
+					(unsigned long long)addr.hi, (unsigned long long)addr.lo);
+		}
+	}
+}
+
+
+/*
+ *  Each variant damages a copy of the edges image; attach() must refuse it and leave
+ *  the index detached.
+ */
+static void
+test_attach()
+{
+	static const char *variants[] = {
+		"magic", "version", "header size", "truncated", "short header", "misaligned table",
+		"table beyond image", "table offset beyond image", "v4 rank", "v6 rank",
+		"v4 count wraps", "v6 count wraps", "v4 count", "v6 keys wrap",
+		};
+	std::vector<uint64_t> image, copy;
+	inetd::GeoIndex index;
+	size_t size = 0;
+
+	if (0 != compile(edges4, edges6) || ! load(image, size) || ! index.attach(image.data(), size)) {
+		failed("attach", "build failed");
+		return;
+	}
+
+	for (unsigned variant = 0; variant < (sizeof(variants) / sizeof(variants[0])); ++variant) {
+		copy = image;
+		header *hdr = (header *)copy.data();
+		char *base = (char *)copy.data();
+		size_t length = size;
+
+		switch (variant) {
+		case 0: hdr->magic[0] ^= 1; break;
+		case 1: ++hdr->version; break;
+		case 2: hdr->header_size -= 8; break;
+		case 3: --length; break;
+		case 4: length = sizeof(header) - 1, hdr->size = length; break;
+		case 5: hdr->v4ends += 4; break;
+		case 6: hdr->v6codes = size - inetd::GeoIndex::ALIGNMENT; hdr->v6count += 4; break;
+		case 7: hdr->v4codes = size + inetd::GeoIndex::ALIGNMENT; break;
+		case 8: ((uint32_t *)(base + hdr->v4ranks))[hdr->v4count] = hdr->v4count; break;
+		case 9: ((uint32_t *)(base + hdr->v6ranks))[1] = 0x80000000; break;
+		case 10: hdr->v4count = 0xffffffff; break;	// (count + 1) * 4 wraps to 0.
+		case 11: hdr->v6count = 0xffffffff; break;
+		case 12: hdr->v4count = 0x7fffffff; break;
+		case 13: hdr->v6keys = ~(uint64_t)0 & ~(uint64_t)(inetd::GeoIndex::ALIGNMENT - 1); break;
+		}
+
+		if (! index.attach(image.data(), size))
+			failed("attach", "%s, original rejected", variants[variant]);
+		if (index.attach(copy.data(), length) || index.attached())
+			failed("attach", "%s, accepted", variants[variant]);
+	}
+
+	if (index.attach(nullptr, size) || ! index.attach(image.data(), size))
+		failed("attach", "null image");
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const unsigned nranges = (argc > 1 ? (unsigned)atoi(argv[1]) : 5000);
+	const unsigned lookups = (argc > 2 ? (unsigned)atoi(argv[2]) : 20000);
+
+	if (0 == nranges || 0 == lookups || argc > 3) {
+		fprintf(stderr, "usage: geoidx_test [ranges [lookups]]\n");
+		return 1;
+	}
+
+	test_edges();
+	test_sources();
+	test_reference(nranges, lookups);
+	test_attach();
+
+	(void) remove(source4);
+	(void) remove(source6);
+	(void) remove(database);
+
+	if (errors) {
+		fprintf(stderr, "geoidx_test: %lu failures\n", errors);
+		return 1;
+	}
+	printf("geoidx_test: passed\n");
+	return 0;
+}
+
+//end